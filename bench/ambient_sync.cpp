@@ -0,0 +1,117 @@
+/**
+ * Screen sync cost per frame: reduceFrame alone on a 4K BGRX frame of random pixels, at each
+ * row step, then the whole -ambient frame (reduce, match, diff and send to the loopback
+ * backend) on the test source, whose colors change every frame: the worst case for sending.
+ *
+ * Usage: bench/ambient_sync [frames] [width]x[height]
+ *
+ * Prints ms per frame and the frame rate one core could sustain; 60 fps needs under 16.7ms.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../ledcontrol.h"
+
+static volatile unsigned char sink;
+
+static double
+nowNanos() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+report(const char* name, double nanos, int frames) {
+
+	double ms = nanos / frames / 1e6;
+	printf("%-28s %8.3f ms/frame  %8.1f fps\n", name, ms, 1e3 / ms);
+}
+
+int
+main(int argc, char* argv[]) {
+
+	int frames = argc > 1 ? atoi(argv[1]) : 120;
+	int width = DEFAULT_AMBIENT_WIDTH, height = DEFAULT_AMBIENT_HEIGHT;
+	unsigned char rgb[9];
+	char name[64];
+
+	if (argc > 2 && sscanf(argv[2], "%dx%d", &width, &height) != 2) {
+		printf("Usage: bench/ambient_sync [frames] [width]x[height]\n");
+		return 1;
+	}
+	if (frames < 1) {
+		frames = 1;
+	}
+
+	size_t stride = (size_t) width * 4;
+	unsigned char* frame = (unsigned char*) malloc(stride * height);
+	if (!frame) {
+		printf("Not enough memory for a %dx%d frame.\n", width, height);
+		return 1;
+	}
+	srand(1);
+	for (size_t i = 0; i < stride * height; i++) {
+		frame[i] = rand();
+	}
+
+	printf("%dx%d BGRX frames, %d frames per case\n", width, height, frames);
+
+	for (int step = 1; step <= 4; step *= 2) {
+		double start = nowNanos();
+		for (int i = 0; i < frames; i++) {
+			reduceFrame(frame, width, height, stride, step, rgb);
+			sink = rgb[i % 9];
+		}
+		snprintf(name, sizeof(name), "reduceFrame step %d", step);
+		report(name, nowNanos() - start, frames);
+	}
+	free(frame);
+
+	// The test source of -ambient moves its colors every frame, so every frame is sent
+	ambient amb;
+	keyboardState state;
+	char sizeParam[32];
+	snprintf(sizeParam, sizeof(sizeParam), "%dx%d", width, height);
+	char* params[] = { (char*) "msiledenabler", (char*) "-ambient", (char*) "test", (char*) "-size", sizeParam,
+		(char*) "-step", (char*) "1", (char*) "-fps", (char*) "240", NULL };
+
+	const char* error = parseAmbient(9, params, &amb);
+	hid_device* device = hid_open(MSI_VENDOR_ID, MSI_PRODUCT_ID, NULL);
+	if (error || !device) {
+		printf("%s", error ? error : "Unable to open the loopback device.\n");
+		return 1;
+	}
+
+	// What runAmbient does for each frame, without the sleeps between frames
+	resetState(&state);
+	unsigned long long sent = 0;
+	double start = nowNanos();
+	for (int i = 0; i < frames; i++) {
+		unsigned char colors[3], levels[3];
+		reportBatch batch, changes;
+
+		reduceFrame(amb.frames + i % amb.frameCount * amb.frameOffset, amb.width, amb.height, amb.stride, amb.rowStep, rgb);
+		quantizeColors(rgb, 3, colors, levels);
+		batch.count = 0;
+		for (int area = 0; area < 3; area++) {
+			batchActivateArea(&batch, 0x42, AREA_LEFT + area, colors[area], levels[area], 0x00);
+		}
+		batchCommit(&batch, MODE_NORMAL);
+		if (diffBatch(&state, &batch, &changes) > 0 && submitBatch(device, &changes) == 0) {
+			updateState(&state, &changes);
+			sent++;
+		}
+	}
+	report("-ambient test frame", nowNanos() - start, frames);
+	printf("%-28s %llu of %d frames sent\n", "", sent, frames);
+
+	closeAmbient(&amb);
+	hid_close(device);
+	hid_exit();
+
+	return 0;
+}
@@ -0,0 +1,142 @@
+/**
+ * End-to-end time to program the breathing, wave and dualcolor modes (9 areas + commit),
+ * before (one report built and sent per sendActivateArea call, ramp speeds computed on the
+ * way) and after (the whole state encoded by buildBatch into one reportBatch, then sent
+ * back to back by submitBatch).
+ *
+ * Usage: bench/batch_programming [iterations]
+ *
+ * With the keyboard plugged the reports go to the device; without it they go to a sink,
+ * which leaves only the encoding cost.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../ledcontrol.h"
+
+static hid_device *device = NULL;
+static volatile unsigned char sink;
+
+static double
+nowNanos() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+sendReport(const unsigned char* report, size_t length) {
+
+	if (device) {
+		hid_send_feature_report(device, report, length);
+	} else {
+		sink = report[length - 1] ^ report[2];
+	}
+}
+
+// The per-report path as main() used to do it: a fresh buffer per report
+static void
+legacyActivateArea(unsigned char modeValue, unsigned char area, unsigned char color, unsigned char level, unsigned char blue) {
+
+	unsigned char data[REPORT_LENGTH];
+	memset(&data, 0x00, REPORT_LENGTH);
+	data[0] = 0x01;
+	data[1] = 0x02;
+	data[2] = modeValue;
+	data[3] = area;
+	data[4] = color;
+	data[5] = level;
+	data[6] = blue;
+	data[7] = 0xec;
+	sendReport(data, REPORT_LENGTH);
+}
+
+static void
+legacyCommit(unsigned char mode) {
+
+	unsigned char data[REPORT_LENGTH];
+	memset(&data, 0x00, REPORT_LENGTH);
+	data[0] = 0x01;
+	data[1] = 0x02;
+	data[2] = 0x41;
+	data[3] = mode;
+	data[7] = 0xec;
+	sendReport(data, REPORT_LENGTH);
+}
+
+static void
+legacyApply(const unsigned char arguments[kSize]) {
+
+	colors allowedColors;
+	bool dual = arguments[kMode] == MODE_DUAL_COLOR;
+	double period = dual ? PERIOD_DUAL_COLOR : (arguments[kMode] == MODE_WAVE_STD ? PERIOD_WAVE_STD : PERIOD_BREATHING_STD);
+	unsigned char colorIndex[3] = { arguments[kColor1], arguments[kColor2], arguments[kColor3] };
+
+	for (int i = 0; i < 3; i++) {
+		rgb left = identifyRGBcolor(allowedColors, dual ? colorIndex[0] : colorIndex[i]);
+		rgb right = dual ? identifyRGBcolor(allowedColors, colorIndex[1]) : rgb();
+		unsigned char r = computeRampSpeed(left.r, right.r, period);
+		unsigned char g = computeRampSpeed(left.g, right.g, period);
+		unsigned char b = computeRampSpeed(left.b, right.b, period);
+
+		legacyActivateArea(0x43, AREA_LEFT + i * 3, dual ? colorIndex[0] : colorIndex[i], LEVEL_2, 0x00);
+		legacyActivateArea(0x43, AREA_MIDDLE + i * 3, dual ? colorIndex[1] : 0x00, LEVEL_2, 0x00);
+		legacyActivateArea(0x43, AREA_RIGHT + i * 3, r, g, b);
+	}
+	legacyCommit(arguments[kMode]);
+}
+
+static void
+batchApply(const unsigned char arguments[kSize], reportBatch* batch) {
+
+	buildBatch(arguments, batch);
+	for (unsigned char i = 0; i < batch->count; i++) {
+		sendReport(batch->data[i], REPORT_LENGTH);
+	}
+}
+
+int
+main(int argc, char* argv[]) {
+
+	int iterations;
+	const char* names[] = { "breathing", "wave", "dualcolor" };
+	const unsigned char modes[] = { MODE_BREATHING_STD, MODE_WAVE_STD, MODE_DUAL_COLOR };
+	static reportBatch batch;
+
+	device = hid_open(MSI_VENDOR_ID, MSI_PRODUCT_ID, NULL);
+	iterations = argc > 1 ? atoi(argv[1]) : (device ? 100 : 1000000);
+	printf("target: %s, %d iterations\n", device ? "MSI Led device" : "sink (no device, encoding only)", iterations);
+
+	for (int m = 0; m < 3; m++) {
+		unsigned char arguments[kSize];
+		memset(arguments, UCHAR_MAX, kSize);
+		arguments[kMode] = modes[m];
+		arguments[kColor1] = COLOR_RED;
+		arguments[kColor2] = COLOR_GREEN;
+		arguments[kColor3] = COLOR_BLUE;
+
+		double start = nowNanos();
+		for (int i = 0; i < iterations; i++) {
+			legacyApply(arguments);
+		}
+		double legacy = (nowNanos() - start) / iterations;
+
+		start = nowNanos();
+		for (int i = 0; i < iterations; i++) {
+			batchApply(arguments, &batch);
+		}
+		double batched = (nowNanos() - start) / iterations;
+
+		printf("%-10s before=%.1fns after=%.1fns (%.2fx)\n", names[m], legacy, batched, legacy / batched);
+	}
+
+	if (device) {
+		hid_close(device);
+	}
+	hid_exit();
+
+	return 0;
+}
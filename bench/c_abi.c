@@ -0,0 +1,117 @@
+/**
+ * A C program driving the keyboard through libmsiled, here the loopback build of it
+ * (libmsiled-mock.so): what a status bar or a compositor does on each event instead of
+ * running msiledenabler, fork + exec + enumerate + open included.
+ *
+ * Usage: bench/c_abi [changes]
+ *
+ * Prints us per change (p50 / p99) for msiled_apply_batch, msiled_set_area + msiled_commit
+ * of the color already shown (nothing sent) and msiled_apply with command line params.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../msiled.h"
+
+static double
+nowMicros(void) {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int
+compareDoubles(const void* a, const void* b) {
+
+	double x = *(const double*) a, y = *(const double*) b;
+	return x < y ? -1 : x > y;
+}
+
+static void
+report(const char* name, double* micros, int count) {
+
+	int p99 = (int) (count * 0.99);
+
+	qsort(micros, count, sizeof(double), compareDoubles);
+	printf("%-28s p50=%8.2fus p99=%8.2fus\n", name, micros[count / 2], micros[p99 < count ? p99 : count - 1]);
+}
+
+int
+main(int argc, char* argv[]) {
+
+	int changes = argc > 1 ? atoi(argv[1]) : 2000;
+	const char* params[] = {
+		"-mode normal -color1 red -color2 green -color3 blue -level 0",
+		"-mode normal -color1 ff8000 -color2 sky -color3 purple -level 1",
+	};
+	double* micros;
+	msiled* keyboard;
+	int error;
+
+	if (changes < 1) {
+		changes = 1;
+	}
+	micros = malloc(changes * sizeof(double));
+
+	printf("libmsiled ABI %d\n", msiled_abi_version());
+	keyboard = msiled_open(NULL, MSILED_OPEN_FORCE, &error);
+	if (!keyboard) {
+		printf("%s\n", msiled_strerror(error));
+		return 1;
+	}
+
+	for (int i = 0; i < changes; i++) {
+		msiled_area areas[3] = {
+			{ MSILED_AREA_LEFT, MSILED_COLOR_RED + i % 8, MSILED_LEVEL_4 },
+			{ MSILED_AREA_MIDDLE, MSILED_COLOR_RED + (i + 1) % 8, MSILED_LEVEL_4 },
+			{ MSILED_AREA_RIGHT, MSILED_COLOR_RED + (i + 2) % 8, MSILED_LEVEL_4 },
+		};
+		double before = nowMicros();
+		error = msiled_apply_batch(keyboard, MSILED_MODE_NORMAL, areas, 3);
+		micros[i] = nowMicros() - before;
+		if (error != MSILED_OK) {
+			printf("%s\n", msiled_last_error(keyboard));
+			return 1;
+		}
+	}
+	report("msiled_apply_batch", micros, changes);
+
+	for (int i = 0; i < changes; i++) {
+		double before = nowMicros();
+		msiled_set_area(keyboard, MSILED_AREA_LEFT, MSILED_COLOR_BLUE, MSILED_LEVEL_4);
+		error = msiled_commit(keyboard);
+		micros[i] = nowMicros() - before;
+		if (error != MSILED_OK) {
+			printf("%s\n", msiled_last_error(keyboard));
+			return 1;
+		}
+	}
+	report("msiled_commit, same color", micros, changes);
+
+	for (int i = 0; i < changes; i++) {
+		double before = nowMicros();
+		error = msiled_apply(keyboard, params[i % 2]);
+		micros[i] = nowMicros() - before;
+		if (error != MSILED_OK) {
+			printf("%s\n", msiled_last_error(keyboard));
+			return 1;
+		}
+	}
+	report("msiled_apply", micros, changes);
+
+	if (msiled_apply(keyboard, "-mode normal -color1 nocolor -level 0") != MSILED_ERR_INVALID) {
+		printf("Invalid params were taken.\n");
+		return 1;
+	}
+	printf("invalid params: %s\n", msiled_last_error(keyboard));
+
+	msiled_close(keyboard);
+	msiled_exit();
+	free(micros);
+
+	return 0;
+}
@@ -0,0 +1,145 @@
+/**
+ * Latency of a color change through a cold command line run (fork + exec + enumerate +
+ * open + reports + close) against a warm daemon (one line on an already connected socket).
+ *
+ * Usage: bench/daemon_latency [iterations] [path_to_msiledenabler]
+ *
+ * Without the keyboard (or the mock backend) both paths stop at "Unable to open", which
+ * still measures the process and enumeration overhead the daemon removes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <vector>
+
+#define BENCH_SOCKET_PATH					"/tmp/msiledenabler-bench.sock"
+#define BENCH_COMMAND						"-mode normal -color1 red -color2 green -color3 blue -level 0\n"
+
+static double
+nowMicros() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static pid_t
+spawn(const char* binary, char* const argv[]) {
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		int devnull = open("/dev/null", O_WRONLY);
+		dup2(devnull, STDOUT_FILENO);
+		dup2(devnull, STDERR_FILENO);
+		execv(binary, argv);
+		_exit(127);
+	}
+	return pid;
+}
+
+static void
+report(const char* name, std::vector<double>& samples) {
+
+	double total = 0;
+	for (size_t i = 0; i < samples.size(); i++) {
+		total += samples[i];
+	}
+	std::sort(samples.begin(), samples.end());
+
+	printf("%-6s n=%zu min=%.1fus p50=%.1fus p99=%.1fus mean=%.1fus\n", name, samples.size(),
+		samples.front(), samples[samples.size() / 2], samples[(samples.size() * 99) / 100],
+		total / samples.size());
+}
+
+static int
+connectDaemon() {
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, BENCH_SOCKET_PATH);
+
+	// Give the daemon a second to come up
+	for (int attempt = 0; attempt < 100; attempt++) {
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (connect(fd, (struct sockaddr*) &address, sizeof(address)) == 0) {
+			return fd;
+		}
+		close(fd);
+		usleep(10000);
+	}
+	return -1;
+}
+
+int
+main(int argc, char* argv[]) {
+
+	int iterations = argc > 1 ? atoi(argv[1]) : 200;
+	const char* binary = argc > 2 ? argv[2] : "./msiledenabler";
+	std::vector<double> cold, warm;
+	char reply[256];
+
+	if (iterations <= 0) {
+		printf("Usage: %s [iterations] [path_to_msiledenabler]\n", argv[0]);
+		return 1;
+	}
+
+	// Cold: a full process per change, as the session scripts do today
+	char* coldArgv[] = { (char*) binary, (char*) "-mode", (char*) "normal", (char*) "-color1", (char*) "red",
+		(char*) "-color2", (char*) "green", (char*) "-color3", (char*) "blue", (char*) "-level", (char*) "0", NULL };
+	for (int i = 0; i < iterations; i++) {
+		double start = nowMicros();
+		pid_t pid = spawn(binary, coldArgv);
+		waitpid(pid, NULL, 0);
+		cold.push_back(nowMicros() - start);
+	}
+
+	// Warm: one daemon, one connection, one line per change
+	char* daemonArgv[] = { (char*) binary, (char*) "-daemon", (char*) BENCH_SOCKET_PATH, NULL };
+	pid_t daemon = spawn(binary, daemonArgv);
+	int fd = connectDaemon();
+	if (fd < 0) {
+		printf("Unable to connect to the daemon on %s\n", BENCH_SOCKET_PATH);
+		kill(daemon, SIGTERM);
+		waitpid(daemon, NULL, 0);
+		return 1;
+	}
+
+	for (int i = 0; i < iterations; i++) {
+		double start = nowMicros();
+		send(fd, BENCH_COMMAND, strlen(BENCH_COMMAND), 0);
+		ssize_t received = 0;
+		while (received <= 0 || reply[received - 1] != '\n') {
+			ssize_t res = recv(fd, reply + received, sizeof(reply) - received, 0);
+			if (res <= 0) {
+				break;
+			}
+			received += res;
+		}
+		warm.push_back(nowMicros() - start);
+		if (i == 0) {
+			reply[received > 0 ? received - 1 : 0] = '\0';
+			printf("daemon replied: %s\n", reply);
+		}
+	}
+
+	close(fd);
+	kill(daemon, SIGTERM);
+	waitpid(daemon, NULL, 0);
+
+	report("cold", cold);
+	report("warm", warm);
+	printf("speedup (p50): %.1fx\n", cold[cold.size() / 2] / warm[warm.size() / 2]);
+
+	return 0;
+}
@@ -0,0 +1,322 @@
+/**
+ * Cost of each stage between the command line params and the device, one case per stage:
+ * params parsing, name lookup, palette lookup, RGB quantization, ramp speed computation, report encoding, whole batch
+ * encoding and submission to the loopback backend (hid_mock.c, no keyboard needed).
+ *
+ * Usage: bench/encode_path [-json] [iterations]
+ *
+ * Every case reports ns/op, the p50 / p99 of samples of SAMPLE_OPS operations and the heap
+ * allocations per operation. -json prints one object per line, for tracking across releases.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+#include "../ledcontrol.h"
+#include "../hid_mock.h"
+
+/** Operations timed together as one sample, so the clock reads stay out of the result */
+#define SAMPLE_OPS							64
+
+static unsigned long long allocations = 0;
+static volatile unsigned char sink;
+
+/** The allocator behind the counting one, found at the first allocation */
+static void* (*nextMalloc)(size_t) = NULL;
+static void* (*nextCalloc)(size_t, size_t) = NULL;
+static void* (*nextRealloc)(void*, size_t) = NULL;
+static void (*nextFree)(void*) = NULL;
+
+/** What dlsym allocates while it looks them up, never freed */
+static unsigned char bootstrap[4096];
+static size_t bootstrapUsed = 0;
+static bool resolving = false;
+
+static void*
+bootstrapAlloc(size_t size) {
+
+	size = (size + 15) & ~(size_t) 15;
+	if (bootstrapUsed + size > sizeof(bootstrap)) {
+		abort();
+	}
+	void* ptr = bootstrap + bootstrapUsed;
+	bootstrapUsed += size;
+	return ptr;
+}
+
+static bool
+resolveNext() {
+
+	if (resolving) {
+		return false;
+	}
+	resolving = true;
+	nextMalloc = (void* (*)(size_t)) dlsym(RTLD_NEXT, "malloc");
+	nextCalloc = (void* (*)(size_t, size_t)) dlsym(RTLD_NEXT, "calloc");
+	nextRealloc = (void* (*)(void*, size_t)) dlsym(RTLD_NEXT, "realloc");
+	nextFree = (void (*)(void*)) dlsym(RTLD_NEXT, "free");
+	resolving = false;
+	return true;
+}
+
+static bool
+fromBootstrap(void* ptr) {
+
+	return ptr >= (void*) bootstrap && ptr < (void*) (bootstrap + sizeof(bootstrap));
+}
+
+// Counts every heap allocation of the process. Through dlsym(RTLD_NEXT) rather than the glibc
+// only __libc_* entry points, so it also builds on macOS
+extern "C" void*
+malloc(size_t size) {
+
+	if (!nextMalloc && !resolveNext()) {
+		return bootstrapAlloc(size);
+	}
+	allocations++;
+	return nextMalloc(size);
+}
+
+extern "C" void*
+calloc(size_t count, size_t size) {
+
+	// The bootstrap buffer is static, so already zeroed
+	if (!nextCalloc && !resolveNext()) {
+		return bootstrapAlloc(count * size);
+	}
+	allocations++;
+	return nextCalloc(count, size);
+}
+
+extern "C" void*
+realloc(void* ptr, size_t size) {
+
+	if (fromBootstrap(ptr)) {
+		void* moved = malloc(size);
+		memcpy(moved, ptr, std::min(size, (size_t) (bootstrap + sizeof(bootstrap) - (unsigned char*) ptr)));
+		return moved;
+	}
+	if (!nextRealloc && !resolveNext()) {
+		return bootstrapAlloc(size);
+	}
+	allocations++;
+	return nextRealloc(ptr, size);
+}
+
+extern "C" void
+free(void* ptr) {
+
+	if (!ptr || fromBootstrap(ptr)) {
+		return;
+	}
+	if (!nextFree) {
+		resolveNext();
+	}
+	nextFree(ptr);
+}
+
+// The C++ runtime of macOS allocates from its own image, not through the malloc above
+void*
+operator new(size_t size) {
+
+	void* ptr = malloc(size ? size : 1);
+	if (!ptr) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void*
+operator new[](size_t size) {
+
+	return operator new(size);
+}
+
+void
+operator delete(void* ptr) noexcept {
+
+	free(ptr);
+}
+
+void
+operator delete[](void* ptr) noexcept {
+
+	free(ptr);
+}
+
+static double
+nowNanos() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// struct for what is shared by every case
+struct context {
+	hid_device *device;
+	unsigned char arguments[kSize];
+	reportBatch batch;
+	colors allowedColors;
+	int argc;
+	char* argv[16];
+};
+
+typedef void (*benchCase)(context* ctx, int i);
+
+static void
+caseParseArguments(context* ctx, int i) {
+
+	const char* error = parseArguments(ctx->argc, ctx->argv, ctx->arguments);
+	sink = error ? 1 : ctx->arguments[kMode];
+}
+
+// First and last entries of the former strcmp chains, and a miss: all should cost the same
+static const char* lookupWords[] = { "-mode", "white", "-duration", "dualcolor", "scan", "magenta" };
+
+static void
+caseLookupToken(context* ctx, int i) {
+
+	const token* t = lookupToken(lookupWords[i % (sizeof(lookupWords) / sizeof(lookupWords[0]))]);
+	sink = t ? t->value : 0;
+}
+
+static void
+caseIdentifyRGBcolor(context* ctx, int i) {
+
+	rgb color = identifyRGBcolor(ctx->allowedColors, i % 9);
+	sink = color.r ^ color.g ^ color.b;
+}
+
+static void
+caseNearestColor(context* ctx, int i) {
+
+	unsigned char color, level;
+	nearestColor(i * 37, i * 101 >> 2, i * 13, &color, &level);
+	sink = color ^ level;
+}
+
+static void
+caseComputeRampSpeed(context* ctx, int i) {
+
+	sink = computeRampSpeed(i & 0xff, 0x00, PERIOD_BREATHING_STD);
+}
+
+static void
+caseEncodeActivateArea(context* ctx, int i) {
+
+	unsigned char report[REPORT_LENGTH];
+	encodeActivateArea(report, 0x42, AREA_LEFT + i % 3, i % 9, LEVEL_4, 0x00);
+	sink = report[4];
+}
+
+static void
+caseBuildBatch(context* ctx, int i) {
+
+	buildBatch(ctx->arguments, &ctx->batch);
+	sink = ctx->batch.count;
+}
+
+static void
+caseSubmitBatch(context* ctx, int i) {
+
+	sink = submitBatch(ctx->device, &ctx->batch);
+}
+
+static void
+caseSendActivateArea(context* ctx, int i) {
+
+	sink = sendActivateArea(ctx->device, 0x42, AREA_LEFT + i % 3, i % 9, LEVEL_4, 0x00);
+}
+
+static void
+runCase(const char* name, benchCase fn, context* ctx, int iterations, bool json) {
+
+	int samples = (iterations + SAMPLE_OPS - 1) / SAMPLE_OPS;
+	std::vector<double> perOp(samples);
+
+	// Warm up caches and branch predictors
+	for (int i = 0; i < SAMPLE_OPS; i++) {
+		fn(ctx, i);
+	}
+
+	unsigned long long allocationsBefore = allocations;
+	double start = nowNanos();
+	for (int s = 0; s < samples; s++) {
+		double sampleStart = nowNanos();
+		for (int i = 0; i < SAMPLE_OPS; i++) {
+			fn(ctx, s * SAMPLE_OPS + i);
+		}
+		perOp[s] = (nowNanos() - sampleStart) / SAMPLE_OPS;
+	}
+	double total = nowNanos() - start;
+	unsigned long long ops = (unsigned long long) samples * SAMPLE_OPS;
+	double allocationsPerOp = (double) (allocations - allocationsBefore) / ops;
+
+	std::sort(perOp.begin(), perOp.end());
+	double p50 = perOp[samples / 2];
+	double p99 = perOp[std::min(samples - 1, (int) (samples * 0.99))];
+
+	if (json) {
+		printf("{\"case\":\"%s\",\"ops\":%llu,\"ns_per_op\":%.2f,\"p50_ns\":%.2f,\"p99_ns\":%.2f,\"allocs_per_op\":%.3f}\n",
+			name, ops, total / ops, p50, p99, allocationsPerOp);
+	} else {
+		printf("%-20s %10.1f ns/op  p50=%9.1fns  p99=%9.1fns  %.3f allocs/op\n", name, total / ops, p50, p99, allocationsPerOp);
+	}
+}
+
+int
+main(int argc, char* argv[]) {
+
+	static char* params[] = { (char*) "msiledenabler", (char*) "-mode", (char*) "breathing", (char*) "-color1", (char*) "red",
+		(char*) "-color2", (char*) "green", (char*) "-color3", (char*) "blue", (char*) "-idle", (char*) "1" };
+	static context ctx;
+	bool json = false;
+	int iterations = 1000000;
+
+	for (int x = 1; x < argc; x++) {
+		if (strcmp(argv[x], "-json") == 0) {
+			json = true;
+		} else {
+			iterations = atoi(argv[x]);
+		}
+	}
+	if (iterations < SAMPLE_OPS) {
+		iterations = SAMPLE_OPS;
+	}
+
+	ctx.argc = sizeof(params) / sizeof(params[0]);
+	memcpy(ctx.argv, params, sizeof(params));
+	ctx.argv[ctx.argc] = NULL;
+	parseArguments(ctx.argc, ctx.argv, ctx.arguments);
+	buildBatch(ctx.arguments, &ctx.batch);
+
+	ctx.device = hid_open(MSI_VENDOR_ID, MSI_PRODUCT_ID, NULL);
+	if (!ctx.device) {
+		printf("Unable to open the loopback device.\n");
+		return 1;
+	}
+
+	if (!json) {
+		printf("%d iterations per case, samples of %d ops, loopback backend\n", iterations, SAMPLE_OPS);
+	}
+	runCase("parseArguments", caseParseArguments, &ctx, iterations, json);
+	runCase("lookupToken", caseLookupToken, &ctx, iterations, json);
+	runCase("identifyRGBcolor", caseIdentifyRGBcolor, &ctx, iterations, json);
+	runCase("nearestColor", caseNearestColor, &ctx, iterations, json);
+	runCase("computeRampSpeed", caseComputeRampSpeed, &ctx, iterations, json);
+	runCase("encodeActivateArea", caseEncodeActivateArea, &ctx, iterations, json);
+	runCase("buildBatch", caseBuildBatch, &ctx, iterations, json);
+	runCase("sendActivateArea", caseSendActivateArea, &ctx, iterations, json);
+	runCase("submitBatch", caseSubmitBatch, &ctx, iterations / 10, json);
+
+	hid_close(ctx.device);
+	hid_exit();
+
+	return 0;
+}
@@ -0,0 +1,212 @@
+/**
+ * Input reports of many devices read by one thread per device (a blocking hid_read each, what
+ * a program without the reactor does) and by a single thread running the epoll reactor of
+ * hid_reactor.h. The devices are FIFOs opened through hid_open_path of the hidraw backend:
+ * reports of HID_REACTOR_MAX_REPORT bytes come one per read, like from a hidraw node, and a
+ * writer thread sends them round robin with the time they were sent.
+ *
+ * Usage: bench/input_reactor [devices] [reports_per_device]
+ *
+ * Prints the reader threads, the time from send to read (p50 / p99) and the total time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <vector>
+#include "../hidapi.h"
+#include "../hid_reactor.h"
+
+// struct for the FIFOs standing for the devices, and what their readers measured
+struct bench {
+	int devices, reports;
+	std::vector<hid_device*> handles;
+	std::vector<int> writers;
+	std::vector<double> latencies; // ns, one slice of reports per device
+	std::vector<int> received;
+	int total;
+};
+
+static double
+nowNanos() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void*
+writeReports(void* param) {
+
+	bench* b = (bench*) param;
+	unsigned char report[HID_REACTOR_MAX_REPORT];
+
+	memset(report, 0, sizeof(report));
+	for (int i = 0; i < b->reports; i++) {
+		for (int d = 0; d < b->devices; d++) {
+			double sent = nowNanos();
+			memcpy(report, &sent, sizeof(sent));
+			if (write(b->writers[d], report, sizeof(report)) != (ssize_t) sizeof(report)) {
+				perror("write");
+				exit(1);
+			}
+		}
+		// Reports come in rounds, like keys and sensors, not as one burst
+		struct timespec pause = { 0, 20000 };
+		nanosleep(&pause, NULL);
+	}
+
+	return NULL;
+}
+
+static void
+record(bench* b, int device, const unsigned char* data) {
+
+	double sent;
+
+	memcpy(&sent, data, sizeof(sent));
+	b->latencies[(size_t) device * b->reports + b->received[device]++] = nowNanos() - sent;
+	b->total++;
+}
+
+// struct for a reader thread of one device
+struct reader {
+	bench* b;
+	int device;
+};
+
+static void*
+readDevice(void* param) {
+
+	reader* r = (reader*) param;
+	unsigned char data[HID_REACTOR_MAX_REPORT];
+
+	while (r->b->received[r->device] < r->b->reports) {
+		if (hid_read(r->b->handles[r->device], data, sizeof(data)) != (int) sizeof(data)) {
+			fprintf(stderr, "hid_read failed\n");
+			exit(1);
+		}
+		// Each thread writes its own slice and counter, total is only read after the joins
+		double sent;
+		memcpy(&sent, data, sizeof(sent));
+		r->b->latencies[(size_t) r->device * r->b->reports + r->b->received[r->device]++] = nowNanos() - sent;
+	}
+
+	return NULL;
+}
+
+static void
+onReport(hid_device* dev, const unsigned char* data, int length, void* context) {
+
+	bench* b = (bench*) context;
+
+	if (length < 0) {
+		fprintf(stderr, "device gone\n");
+		exit(1);
+	}
+	for (int d = 0; d < b->devices; d++) {
+		if (b->handles[d] == dev) {
+			record(b, d, data);
+			return;
+		}
+	}
+}
+
+static void
+report(const char* name, int threads, bench* b, double elapsed) {
+
+	std::sort(b->latencies.begin(), b->latencies.end());
+	size_t count = b->latencies.size();
+	printf("%-22s threads=%3d p50=%8.2fus p99=%8.2fus total=%8.2fms\n", name, threads,
+		b->latencies[count / 2] / 1e3, b->latencies[std::min(count - 1, (size_t) (count * 0.99))] / 1e3, elapsed / 1e6);
+}
+
+static void
+reset(bench* b) {
+
+	b->latencies.assign((size_t) b->devices * b->reports, 0);
+	b->received.assign(b->devices, 0);
+	b->total = 0;
+}
+
+int
+main(int argc, char* argv[]) {
+
+	bench b;
+	char dir[] = "/tmp/msiled-reactor-XXXXXX";
+	pthread_t writer;
+
+	b.devices = argc > 1 ? atoi(argv[1]) : 16;
+	b.reports = argc > 2 ? atoi(argv[2]) : 2000;
+	if (b.devices < 1 || b.reports < 1 || !mkdtemp(dir)) {
+		printf("Usage: bench/input_reactor [devices] [reports_per_device]\n");
+		return 1;
+	}
+
+	for (int d = 0; d < b.devices; d++) {
+		char path[64];
+		snprintf(path, sizeof(path), "%s/%d", dir, d);
+		hid_device* handle = mkfifo(path, 0600) == 0 ? hid_open_path(path) : NULL;
+		int fd = handle ? open(path, O_WRONLY | O_CLOEXEC) : -1;
+		unlink(path);
+		if (fd < 0) {
+			printf("Unable to make the FIFO devices.\n");
+			return 1;
+		}
+		b.handles.push_back(handle);
+		b.writers.push_back(fd);
+	}
+	rmdir(dir);
+
+	printf("%d devices, %d reports each\n", b.devices, b.reports);
+
+	reset(&b);
+	std::vector<pthread_t> threads(b.devices);
+	std::vector<reader> readers(b.devices);
+	double start = nowNanos();
+	for (int d = 0; d < b.devices; d++) {
+		readers[d].b = &b;
+		readers[d].device = d;
+		pthread_create(&threads[d], NULL, readDevice, &readers[d]);
+	}
+	pthread_create(&writer, NULL, writeReports, &b);
+	for (int d = 0; d < b.devices; d++) {
+		pthread_join(threads[d], NULL);
+	}
+	pthread_join(writer, NULL);
+	report("hid_read per device", b.devices, &b, nowNanos() - start);
+
+	reset(&b);
+	struct hid_reactor* reactor = hid_reactor_new();
+	for (int d = 0; d < b.devices; d++) {
+		if (!reactor || hid_reactor_add(reactor, b.handles[d], onReport, &b) < 0) {
+			printf("Unable to add the devices to the reactor.\n");
+			return 1;
+		}
+	}
+	start = nowNanos();
+	pthread_create(&writer, NULL, writeReports, &b);
+	while (b.total < b.devices * b.reports) {
+		if (hid_reactor_run(reactor, -1) < 0) {
+			perror("hid_reactor_run");
+			return 1;
+		}
+	}
+	pthread_join(writer, NULL);
+	report("reactor", 1, &b, nowNanos() - start);
+
+	hid_reactor_free(reactor);
+	for (int d = 0; d < b.devices; d++) {
+		hid_close(b.handles[d]);
+		close(b.writers[d]);
+	}
+	hid_exit();
+
+	return 0;
+}
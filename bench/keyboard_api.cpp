@@ -0,0 +1,105 @@
+/**
+ * Cost of a color change from a program that links liblededit, against running the tool for
+ * it (fork + exec + enumerate + open + reports + close). Both are on the loopback backend
+ * (hid_mock.c): the in process one in this process, the tool as msiledenabler-mock.
+ *
+ * Usage: bench/keyboard_api [changes] [path_to_msiledenabler-mock]
+ *
+ * Prints us per change (p50 / p99) for Keyboard::commit of a new color, of the color already
+ * shown (nothing sent), and for a run of the tool.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <vector>
+#include "../lededit.h"
+
+static double
+nowMicros() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void
+report(const char* name, std::vector<double>& micros) {
+
+	std::sort(micros.begin(), micros.end());
+	printf("%-24s p50=%9.1fus p99=%9.1fus\n", name, micros[micros.size() / 2],
+		micros[std::min(micros.size() - 1, (size_t) (micros.size() * 0.99))]);
+}
+
+int
+main(int argc, char* argv[]) {
+
+	int changes = argc > 1 ? atoi(argv[1]) : 2000;
+	const char* binary = argc > 2 ? argv[2] : "./msiledenabler-mock";
+	Keyboard keyboard;
+
+	if (changes < 1) {
+		changes = 1;
+	}
+	std::vector<double> micros(changes);
+
+	if (keyboard.open(NULL, true) < 0) {
+		printf("Unable to open the loopback device.\n");
+		return 1;
+	}
+
+	for (int i = 0; i < changes; i++) {
+		double before = nowMicros();
+		keyboard.setMode(MODE_NORMAL);
+		keyboard.setArea(AREA_LEFT, COLOR_RED + i % 8, LEVEL_4);
+		keyboard.setArea(AREA_MIDDLE, COLOR_RED + (i + 1) % 8, LEVEL_4);
+		keyboard.setArea(AREA_RIGHT, COLOR_RED + (i + 2) % 8, LEVEL_4);
+		if (keyboard.commit() != 0) {
+			printf("Unable to commit.\n");
+			return 1;
+		}
+		micros[i] = nowMicros() - before;
+	}
+	report("Keyboard::commit", micros);
+
+	for (int i = 0; i < changes; i++) {
+		double before = nowMicros();
+		keyboard.setArea(AREA_LEFT, COLOR_BLUE, LEVEL_4);
+		keyboard.commit();
+		micros[i] = nowMicros() - before;
+	}
+	report("Keyboard::commit, same", micros);
+	keyboard.close();
+
+	// Each run is a new process, so the changes are fewer
+	int runs = std::max(1, std::min(changes, 200));
+	micros.resize(runs);
+	for (int i = 0; i < runs; i++) {
+		const char* colors[] = { "red", "green", "blue" };
+		double before = nowMicros();
+		pid_t pid = fork();
+		if (pid == 0) {
+			int devNull = open("/dev/null", O_WRONLY);
+			dup2(devNull, STDOUT_FILENO);
+			execl(binary, binary, "-mode", "normal", "-color1", colors[i % 3], "-level", "0", (char*) NULL);
+			_exit(127);
+		}
+		int status;
+		waitpid(pid, &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			printf("%s failed, build it with make mock.\n", binary);
+			return 1;
+		}
+		micros[i] = nowMicros() - before;
+	}
+	report("msiledenabler-mock run", micros);
+
+	tracedExit();
+
+	return 0;
+}
@@ -0,0 +1,209 @@
+/**
+ * Profile switching cost against a library of many profiles: the library is compiled from a
+ * generated source, then random profiles are applied to the loopback backend (hid_mock.c)
+ * from the mapped library, and the same states from their command line params (parse, encode,
+ * send) for comparison. The shadow state is reset before each apply, so every report is sent.
+ *
+ * Usage: bench/profile_switch [profiles] [switches]
+ *
+ * Prints the compile and open times, then ns per switch (p50 / p99) for both paths: getting the
+ * reports alone (lookup, or parse and encode), then with sending them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "../ledcontrol.h"
+
+static const char* colorNames[] = { "red", "orange", "yellow", "green", "sky", "blue", "purple", "white" };
+
+static double
+nowNanos() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * The params of profile i, alternating between the modes.
+ */
+static void
+profileParams(int i, char* line, size_t length) {
+
+	const char* c1 = colorNames[i % 8];
+	const char* c2 = colorNames[(i / 8) % 8];
+	const char* c3 = colorNames[(i / 64) % 8];
+
+	switch (i % 4) {
+	case 0:
+		snprintf(line, length, "-mode normal -color1 %s -color2 %s -color3 %s -level %d", c1, c2, c3, i % 4);
+		break;
+	case 1:
+		snprintf(line, length, "-mode normal -color1 %02x%02x%02x -color2 %d,%d,%d -color3 %02x%02x%02x", i * 7 % 256, i * 13 % 256, i * 29 % 256,
+			i * 3 % 256, i * 5 % 256, i * 11 % 256, i * 17 % 256, i * 19 % 256, i * 23 % 256);
+		break;
+	case 2:
+		snprintf(line, length, "-mode breathing -color1 %s -color2 %s -color3 %s -period %.1f", c1, c2, c3, 0.5 + i % 20 * 0.5);
+		break;
+	default:
+		snprintf(line, length, "-mode dualcolor -color1 %s -color2 %s", c1, c2);
+		break;
+	}
+}
+
+/**
+ * The params of profile i as argv, split in line. Returns argc.
+ */
+static int
+splitParams(int i, char* line, size_t length, char* params[]) {
+
+	char* saveptr = NULL;
+	int count = 0;
+
+	profileParams(i, line, length);
+	params[count++] = (char*) "msiledenabler";
+	for (char* word = strtok_r(line, " ", &saveptr); word; word = strtok_r(NULL, " ", &saveptr)) {
+		params[count++] = word;
+	}
+	params[count] = NULL;
+
+	return count;
+}
+
+static void
+report(const char* name, std::vector<double>& nanos) {
+
+	std::sort(nanos.begin(), nanos.end());
+	printf("%-28s p50=%9.0fns p99=%9.0fns\n", name, nanos[nanos.size() / 2],
+		nanos[std::min(nanos.size() - 1, (size_t) (nanos.size() * 0.99))]);
+}
+
+int
+main(int argc, char* argv[]) {
+
+	int profiles = argc > 1 ? atoi(argv[1]) : 5000;
+	int switches = argc > 2 ? atoi(argv[2]) : 20000;
+	char sourcePath[64], libraryPath[64], line[256], name[32];
+	keyboardState state;
+	profileLibrary lib;
+	int count;
+
+	if (profiles < 1) {
+		profiles = 1;
+	}
+	if (switches < 1) {
+		switches = 1;
+	}
+	std::vector<double> nanos(switches);
+
+	snprintf(sourcePath, sizeof(sourcePath), "/tmp/profile_switch.%d.txt", (int) getpid());
+	snprintf(libraryPath, sizeof(libraryPath), "/tmp/profile_switch.%d.profiles", (int) getpid());
+	FILE* source = fopen(sourcePath, "w");
+	if (!source) {
+		printf("Unable to write %s.\n", sourcePath);
+		return 1;
+	}
+	for (int i = 0; i < profiles; i++) {
+		profileParams(i, line, sizeof(line));
+		fprintf(source, "[profile%d]\n%s\n", i, line);
+	}
+	fclose(source);
+
+	double start = nowNanos();
+	const char* error = compileProfiles(sourcePath, libraryPath, &count);
+	unlink(sourcePath);
+	if (error) {
+		printf("%s", error);
+		return 1;
+	}
+	printf("%d profiles compiled in %.1fms\n", count, (nowNanos() - start) / 1e6);
+
+	memset(&lib, 0, sizeof(lib));
+	start = nowNanos();
+	if (openLibrary(&lib, libraryPath) < 0) {
+		printf("Unable to open %s.\n", libraryPath);
+		return 1;
+	}
+	printf("library of %zu bytes mapped in %.1fus\n", lib.length, (nowNanos() - start) / 1e3);
+
+	hid_device* device = hid_open(MSI_VENDOR_ID, MSI_PRODUCT_ID, NULL);
+	if (!device) {
+		printf("Unable to open the loopback device.\n");
+		return 1;
+	}
+
+	srand(1);
+	std::vector<int> picks(switches);
+	for (int i = 0; i < switches; i++) {
+		picks[i] = rand() % profiles;
+	}
+
+	for (int i = 0; i < switches; i++) {
+		snprintf(name, sizeof(name), "profile%d", picks[i]);
+		double before = nowNanos();
+		const profileEntry* profile = findProfile(&lib, name);
+		nanos[i] = nowNanos() - before;
+		if (!profile) {
+			printf("Unable to find %s.\n", name);
+			return 1;
+		}
+	}
+	report("findProfile", nanos);
+
+	for (int i = 0; i < switches; i++) {
+		char* params[MAX_BATCH_REPORTS * 2];
+		int paramCount = splitParams(picks[i], line, sizeof(line), params);
+		unsigned char arguments[kSize];
+		reportBatch batch;
+
+		double before = nowNanos();
+		if (parseArguments(paramCount, params, arguments)) {
+			printf("Unable to parse %s.\n", line);
+			return 1;
+		}
+		buildBatch(arguments, &batch);
+		nanos[i] = nowNanos() - before;
+	}
+	report("parseArguments + buildBatch", nanos);
+
+	for (int i = 0; i < switches; i++) {
+		snprintf(name, sizeof(name), "profile%d", picks[i]);
+		resetState(&state);
+		double before = nowNanos();
+		const profileEntry* profile = findProfile(&lib, name);
+		if (!profile || applyProfile(device, &lib, profile, &state) != 0) {
+			printf("Unable to apply %s.\n", name);
+			return 1;
+		}
+		nanos[i] = nowNanos() - before;
+	}
+	report("-profile, sent", nanos);
+
+	// What a run with the params does once it has its argv
+	for (int i = 0; i < switches; i++) {
+		char* params[MAX_BATCH_REPORTS * 2];
+		int paramCount = splitParams(picks[i], line, sizeof(line), params);
+		unsigned char arguments[kSize];
+
+		resetState(&state);
+		double before = nowNanos();
+		if (parseArguments(paramCount, params, arguments) || applyArguments(device, arguments, &state) != 0) {
+			printf("Unable to apply %s.\n", line);
+			return 1;
+		}
+		nanos[i] = nowNanos() - before;
+	}
+	report("params, sent", nanos);
+
+	closeLibrary(&lib);
+	unlink(libraryPath);
+	hid_close(device);
+	hid_exit();
+
+	return 0;
+}
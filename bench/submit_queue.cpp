@@ -0,0 +1,125 @@
+/**
+ * A bursty producer against a slow keyboard: frames of 3 random colors in normal mode, sent
+ * with submitBatch from the producer (every frame waits for its reports) and queued with
+ * queueBatch (the writer thread coalesces what it had no time for). The loopback backend
+ * (hid_mock.c) stands for the keyboard, each report taking the given latency.
+ *
+ * Usage: bench/submit_queue [frames] [report_latency_us]
+ *
+ * Prints the time the producer was held per frame (p50 / p99), the reports that reached the
+ * keyboard and whether it ended on the last frame.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+#include "../ledcontrol.h"
+#include "../hid_mock.h"
+
+static double
+nowNanos() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+buildFrame(int i, reportBatch* batch) {
+
+	batch->count = 0;
+	for (int area = 0; area < 3; area++) {
+		batchActivateArea(batch, 0x42, AREA_LEFT + area, (i * 7 + area * 3) % 9, LEVEL_4, 0x00);
+	}
+	batchCommit(batch, MODE_NORMAL);
+}
+
+static bool
+showsFrame(hid_device *device, const reportBatch* expected) {
+
+	struct hid_mock_controller controller;
+
+	if (hid_mock_controller_state(0, &controller) < 0) {
+		return false;
+	}
+	for (int area = 0; area < 3; area++) {
+		if (controller.areas[area].color != expected->data[area][4]) {
+			return false;
+		}
+	}
+
+	return controller.mode == MODE_NORMAL;
+}
+
+static void
+report(const char* name, std::vector<double>& held, double total, hid_device *device, const reportBatch* last) {
+
+	std::sort(held.begin(), held.end());
+	printf("%-12s held p50=%9.1fus p99=%9.1fus  total %8.1fms  %6llu reports  %s\n", name,
+		held[held.size() / 2] / 1e3, held[std::min(held.size() - 1, (size_t) (held.size() * 0.99))] / 1e3,
+		total / 1e6, hid_mock_report_count(), showsFrame(device, last) ? "latest state shown" : "LAGGING");
+}
+
+int
+main(int argc, char* argv[]) {
+
+	int frames = argc > 1 ? atoi(argv[1]) : 500;
+	unsigned int latency = argc > 2 ? atoi(argv[2]) : 1000;
+	std::vector<double> held(frames > 0 ? frames : 1);
+	reportBatch batch;
+	keyboardState state;
+	reportQueue q;
+
+	if (frames < 1) {
+		frames = 1;
+	}
+
+	hid_device *device = hid_open(MSI_VENDOR_ID, MSI_PRODUCT_ID, NULL);
+	if (!device) {
+		printf("Unable to open the loopback device.\n");
+		return 1;
+	}
+	printf("%d frames, %uus per report\n", frames, latency);
+
+	// Frames come as fast as the producer can make them
+	hid_mock_set_latency(latency);
+	resetState(&state);
+	double start = nowNanos();
+	for (int i = 0; i < frames; i++) {
+		buildFrame(i, &batch);
+		double before = nowNanos();
+		reportBatch changes;
+		if (diffBatch(&state, &batch, &changes) > 0 && submitBatch(device, &changes) == 0) {
+			updateState(&state, &changes);
+		}
+		held[i] = nowNanos() - before;
+	}
+	report("submitBatch", held, nowNanos() - start, device, &batch);
+
+	hid_mock_reset();
+	hid_mock_set_latency(latency);
+	resetState(&state);
+	if (openQueue(&q, device, &state) < 0) {
+		printf("Unable to start the writer thread.\n");
+		return 1;
+	}
+	start = nowNanos();
+	for (int i = 0; i < frames; i++) {
+		buildFrame(i, &batch);
+		double before = nowNanos();
+		queueBatch(&q, &batch);
+		held[i] = nowNanos() - before;
+	}
+	flushQueue(&q);
+	report("queueBatch", held, nowNanos() - start, device, &batch);
+	printf("%-12s %llu queued, %llu superseded before the wire\n", "", q.queued.load(), q.superseded.load());
+	closeQueue(&q);
+
+	hid_close(device);
+	hid_exit();
+
+	return 0;
+}
@@ -0,0 +1,101 @@
+/**
+ * Drift of a long show: keyframes every few ms with a different color each, played on the
+ * loopback backend (hid_mock.c) with a latency per report. First chained, a sleep of the step
+ * length then the send, as a loop calling the binary does without even the process start; then
+ * with runTimeline, every cue on its absolute deadline from the start.
+ *
+ * Usage: bench/timeline_drift [keyframes] [step_ms] [report_latency_us]
+ *
+ * Prints for both how late the show ended against its planned length.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../ledcontrol.h"
+#include "../hid_mock.h"
+
+static const char* colorNames[] = { "red", "orange", "yellow", "green", "sky", "blue", "purple", "white" };
+
+static double
+nowNanos() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int
+main(int argc, char* argv[]) {
+
+	int keyframes = argc > 1 ? atoi(argv[1]) : 200;
+	int stepMs = argc > 2 ? atoi(argv[2]) : 20;
+	unsigned int latency = argc > 3 ? atoi(argv[3]) : 500;
+	char path[64], fpsParam[16];
+	keyboardState state;
+	timeline tl;
+	timelineStats stats;
+
+	if (keyframes < 2) {
+		keyframes = 2;
+	}
+	if (stepMs < 1) {
+		stepMs = 1;
+	}
+
+	snprintf(path, sizeof(path), "/tmp/timeline_drift.%d.txt", (int) getpid());
+	FILE* f = fopen(path, "w");
+	if (!f) {
+		printf("Unable to write %s.\n", path);
+		return 1;
+	}
+	for (int i = 0; i < keyframes; i++) {
+		fprintf(f, "%.3f -mode normal -color1 %s -color2 %s -color3 %s -level %d\n", i * stepMs / 1e3,
+			colorNames[i % 8], colorNames[(i + 3) % 8], colorNames[(i + 5) % 8], i % 4);
+	}
+	fclose(f);
+
+	snprintf(fpsParam, sizeof(fpsParam), "%d", MAX_ANIMATION_FPS);
+	char* params[] = { (char*) "msiledenabler", (char*) "-timeline", path, (char*) "-fps", fpsParam, NULL };
+	const char* error = parseTimeline(5, params, &tl);
+	unlink(path);
+	if (error) {
+		printf("%s", error);
+		return 1;
+	}
+
+	hid_device* device = hid_open(MSI_VENDOR_ID, MSI_PRODUCT_ID, NULL);
+	if (!device) {
+		printf("Unable to open the loopback device.\n");
+		return 1;
+	}
+	hid_mock_set_latency(latency);
+	printf("%zu cues %dms apart, %uus per report, planned %.3fs\n", tl.count, stepMs, latency, tl.duration);
+
+	// Each step waits its length after the previous send: the send time adds up
+	resetState(&state);
+	double start = nowNanos();
+	for (size_t i = 0; i < tl.count; i++) {
+		if (i > 0) {
+			struct timespec pause = { 0, stepMs * 1000000L };
+			nanosleep(&pause, NULL);
+		}
+		applyBatch(device, &tl.cues[i].batch, &state);
+	}
+	double chained = (nowNanos() - start) / 1e9;
+	printf("%-10s ended %.3fs, %8.1fms late\n", "chained", chained, (chained - tl.duration) * 1e3);
+
+	resetState(&state);
+	runTimeline(device, &tl, &state, &stats);
+	printf("%-10s ended %.3fs, %8.1fms late, worst cue %.1fus late\n", "timeline", stats.elapsed,
+		(stats.elapsed - tl.duration) * 1e3, stats.maxLatenessUs);
+	printf("%-10s %llu missed, %llu skipped, lateness mean %.1fus\n", "", stats.missed, stats.skipped, stats.meanLatenessUs);
+
+	closeTimeline(&tl);
+	hid_close(device);
+	hid_exit();
+
+	return 0;
+}
@@ -27,11 +27,15 @@
 #include <CoreFoundation/CoreFoundation.h>
 #include <wchar.h>
 #include <locale.h>
+#include <errno.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
 #include <sys/time.h>
 #include <unistd.h>
 
 #include "hidapi.h"
+#include "input_ring.h"
 
 /* Barrier implementation because Mac OSX doesn't have pthread_barrier.
    It also doesn't have clock_gettime(). So much for POSIX and SUSv2.
@@ -93,15 +97,9 @@ static int pthread_barrier_wait(pthread_barrier_t *barrier)
 
 static int return_data(hid_device *dev, unsigned char *data, size_t length);
 
-/* Linked List of input reports received from the device. */
-struct input_report {
-	uint8_t *data;
-	size_t len;
-	struct input_report *next;
-};
-
 struct hid_device_ {
 	IOHIDDeviceRef device_handle;
+	int write_only; /* No read thread, run loop or input ring */
 	int blocking;
 	int uses_numbered_reports;
 	int disconnected;
@@ -110,10 +108,10 @@ struct hid_device_ {
 	CFRunLoopSourceRef source;
 	uint8_t *input_report_buf;
 	CFIndex max_input_report_len;
-	struct input_report *input_reports;
+	struct input_ring *input_ring;
 
 	pthread_t thread;
-	pthread_mutex_t mutex; /* Protects input_reports */
+	pthread_mutex_t mutex; /* Only for sleeping readers, the ring itself is lock-free */
 	pthread_cond_t condition;
 	pthread_barrier_t barrier; /* Ensures correct startup sequence */
 	pthread_barrier_t shutdown_barrier; /* Ensures correct shutdown sequence */
@@ -128,6 +126,13 @@ struct hid_device_ {
 static hid_device *device_list = NULL;
 static pthread_mutex_t device_list_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/* Every hid_enumerate() asks the HID Manager again, nothing is cached. */
+static unsigned long full_scans = 0;
+
+/* Whether devices opened from now on get a read thread, see hid_set_input_reports().
+   Set and read from any thread, so atomic. */
+static atomic_int input_reports_enabled = 1;
+
 static hid_device *new_hid_device(void)
 {
 	hid_device *dev = calloc(1, sizeof(hid_device));
@@ -139,7 +144,7 @@ static hid_device *new_hid_device(void)
 	dev->run_loop = NULL;
 	dev->source = NULL;
 	dev->input_report_buf = NULL;
-	dev->input_reports = NULL;
+	dev->input_ring = NULL;
 	dev->shutdown_thread = 0;
 	dev->next = NULL;
 
@@ -173,14 +178,8 @@ static void free_hid_device(hid_device *dev)
 	if (!dev)
 		return;
 	
-	/* Delete any input reports still left over. */
-	struct input_report *rpt = dev->input_reports;
-	while (rpt) {
-		struct input_report *next = rpt->next;
-		free(rpt->data);
-		free(rpt);
-		rpt = next;
-	}
+	/* Delete the ring and any input reports still left in it. */
+	free_input_ring(dev->input_ring);
 
 	/* Free the string and the report buffer. The check for NULL
 	   is necessary here as CFRelease() doesn't handle NULL like
@@ -415,6 +414,7 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 
 	/* Set up the HID Manager if it hasn't been done */
 	hid_init();
+	full_scans++;
 	
 	/* Get a list of the Devices */
 	CFSetRef device_set = IOHIDManagerCopyDevices(hid_mgr);
@@ -553,7 +553,8 @@ static void hid_device_removal_callback(void *context, IOReturn result,
 	while (d) {
 		if (d->device_handle == dev_ref) {
 			d->disconnected = 1;
-			CFRunLoopStop(d->run_loop);
+			if (d->run_loop)
+				CFRunLoopStop(d->run_loop);
 		}
 		
 		d = d->next;
@@ -568,48 +569,22 @@ static void hid_report_callback(void *context, IOReturn result, void *sender,
                          IOHIDReportType report_type, uint32_t report_id,
                          uint8_t *report, CFIndex report_length)
 {
-	struct input_report *rpt;
 	hid_device *dev = context;
+	struct input_ring *ring = dev->input_ring;
 
-	/* Make a new Input Report object */
-	rpt = calloc(1, sizeof(struct input_report));
-	rpt->data = calloc(1, report_length);
-	memcpy(rpt->data, report, report_length);
-	rpt->len = report_length;
-	rpt->next = NULL;
-
-	/* Lock this section */
-	pthread_mutex_lock(&dev->mutex);
-	
-	/* Attach the new report object to the end of the list. */
-	if (dev->input_reports == NULL) {
-		/* The list is empty. Put it at the root. */
-		dev->input_reports = rpt;
-	}
-	else {
-		/* Find the end of the list and attach. */
-		struct input_report *cur = dev->input_reports;
-		int num_queued = 0;
-		while (cur->next != NULL) {
-			cur = cur->next;
-			num_queued++;
-		}
-		cur->next = rpt;
+	/* Full: drop this report rather than grow or block the run loop. */
+	if (input_ring_push(ring, report, report_length) < 0)
+		return;
 
-		/* Pop one off if we've reached 30 in the queue. This
-		   way we don't grow forever if the user never reads
-		   anything from the device. */
-		if (num_queued > 30) {
-			return_data(dev, NULL, 0);
-		}
+	/* Only take the mutex when a reader is (about to be) asleep. The
+	   seq_cst store in input_ring_push() and the load here pair with the
+	   ones in hid_read_timeout(), so either the reader sees the report or
+	   we see the reader. */
+	if (atomic_load(&ring->reader_waiting)) {
+		pthread_mutex_lock(&dev->mutex);
+		pthread_cond_signal(&dev->condition);
+		pthread_mutex_unlock(&dev->mutex);
 	}
-
-	/* Signal a waiting thread that there is data. */
-	pthread_cond_signal(&dev->condition);
-
-	/* Unlock */
-	pthread_mutex_unlock(&dev->mutex);
-
 }
 
 /* This gets called when the read_thred's run loop gets signaled by
@@ -722,10 +697,25 @@ hid_device * HID_API_EXPORT hid_open_path(const char *path)
 				free(device_array);
 				CFRelease(device_set);
 				dev->device_handle = os_dev;
+
+				/* Feature reports only: no buffers, run loop or
+				   thread, so there is nothing to start or join. */
+				if (!atomic_load(&input_reports_enabled)) {
+					dev->write_only = 1;
+					IOHIDManagerRegisterDeviceRemovalCallback(hid_mgr, hid_device_removal_callback, NULL);
+					return dev;
+				}
 				
 				/* Create the buffers for receiving data */
 				dev->max_input_report_len = (CFIndex) get_max_report_length(os_dev);
 				dev->input_report_buf = calloc(dev->max_input_report_len, sizeof(uint8_t));
+				dev->input_ring = new_input_ring(dev->max_input_report_len);
+				if (!dev->input_ring) {
+					IOHIDDeviceClose(os_dev, kIOHIDOptionsTypeNone);
+					dev->device_handle = NULL;
+					free_hid_device(dev);
+					return NULL;
+				}
 				
 				/* Create the Run Loop Mode for this device.
 				   printing the reference seems to work. */
@@ -767,8 +757,10 @@ static int set_report(hid_device *dev, IOHIDReportType type, const unsigned char
 	IOReturn res;
 
 	/* Return if the device has been disconnected. */
-   	if (dev->disconnected)
+   	if (dev->disconnected) {
+		errno = ENODEV;
    		return -1;
+	}
 
 	if (data[0] == 0x0) {
 		/* Not using numbered Reports.
@@ -792,10 +784,12 @@ static int set_report(hid_device *dev, IOHIDReportType type, const unsigned char
 		if (res == kIOReturnSuccess) {
 			return length;
 		}
-		else
-			return -1;
+		/* Like hidraw: ENODEV once unplugged, EPIPE for a refused report. */
+		errno = (res == kIOReturnNotAttached || res == kIOReturnNoDevice)? ENODEV: EPIPE;
+		return -1;
 	}
 	
+	errno = ENODEV;
 	return -1;
 }
 
@@ -807,20 +801,14 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
 /* Helper function, so that this isn't duplicated in hid_read(). */
 static int return_data(hid_device *dev, unsigned char *data, size_t length)
 {
-	/* Copy the data out of the linked list item (rpt) into the
-	   return buffer (data), and delete the liked list item. */
-	struct input_report *rpt = dev->input_reports;
-	size_t len = (length < rpt->len)? length: rpt->len;
-	memcpy(data, rpt->data, len);
-	dev->input_reports = rpt->next;
-	free(rpt->data);
-	free(rpt);
-	return len;
+	/* Copy the oldest report out of the ring into the return buffer
+	   (data), then hand its slot back to the producer. */
+	return input_ring_pop(dev->input_ring, data, length);
 }
 
 static int cond_wait(const hid_device *dev, pthread_cond_t *cond, pthread_mutex_t *mutex)
 {
-	while (!dev->input_reports) {
+	while (input_ring_empty(dev->input_ring)) {
 		int res = pthread_cond_wait(cond, mutex);
 		if (res != 0)
 			return res;
@@ -840,7 +828,7 @@ static int cond_wait(const hid_device *dev, pthread_cond_t *cond, pthread_mutex_
 
 static int cond_timedwait(const hid_device *dev, pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime)
 {
-	while (!dev->input_reports) {
+	while (input_ring_empty(dev->input_ring)) {
 		int res = pthread_cond_timedwait(cond, mutex, abstime);
 		if (res != 0)
 			return res;
@@ -863,12 +851,21 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 {
 	int bytes_read = -1;
 
-	/* Lock the access to the report list. */
+	/* Opened without input reports, there is nothing to wait for. */
+	if (dev->write_only)
+		return -1;
+
+	/* There's an input report queued up. Return it without locking. */
+	if (!input_ring_empty(dev->input_ring))
+		return return_data(dev, data, length);
+
+	/* Announce the reader before checking again under the mutex, so the
+	   run loop thread signals the condition for any report published from
+	   now on. */
 	pthread_mutex_lock(&dev->mutex);
-	
-	/* There's an input report queued up. Return it. */
-	if (dev->input_reports) {
-		/* Return the first one */
+	atomic_store(&dev->input_ring->reader_waiting, 1);
+
+	if (!input_ring_empty(dev->input_ring)) {
 		bytes_read = return_data(dev, data, length);
 		goto ret;
 	}
@@ -928,6 +925,7 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 	}
 
 ret:
+	atomic_store(&dev->input_ring->reader_waiting, 0);
 	/* Unlock */
 	pthread_mutex_unlock(&dev->mutex);
 	return bytes_read;
@@ -976,6 +974,14 @@ void HID_API_EXPORT hid_close(hid_device *dev)
 	if (!dev)
 		return;
 
+	/* Without a read thread there is only the OS handle to close. */
+	if (dev->write_only) {
+		if (!dev->disconnected)
+			IOHIDDeviceClose(dev->device_handle, kIOHIDOptionsTypeNone);
+		free_hid_device(dev);
+		return;
+	}
+
 	/* Disconnect the report callback before close. */
 	if (!dev->disconnected) {
 		IOHIDDeviceRegisterInputReportCallback(
@@ -1006,13 +1012,7 @@ void HID_API_EXPORT hid_close(hid_device *dev)
 		IOHIDDeviceClose(dev->device_handle, kIOHIDOptionsTypeNone);
 	}
 	
-	/* Clear out the queue of received reports. */
-	pthread_mutex_lock(&dev->mutex);
-	while (dev->input_reports) {
-		return_data(dev, NULL, 0);
-	}
-	pthread_mutex_unlock(&dev->mutex);
-
+	/* The read thread is gone, the reports left in the ring are freed with it. */
 	free_hid_device(dev);
 }
 
@@ -1046,6 +1046,24 @@ HID_API_EXPORT const wchar_t * HID_API_CALL  hid_error(hid_device *dev)
 	return NULL;
 }
 
+unsigned long HID_API_EXPORT_CALL hid_get_input_overflows(hid_device *dev)
+{
+	if (!dev->input_ring)
+		return 0;
+	return input_ring_overflows(dev->input_ring);
+}
+
+void HID_API_EXPORT_CALL hid_set_input_reports(int enabled)
+{
+	atomic_store(&input_reports_enabled, enabled);
+}
+
+void HID_API_EXPORT_CALL hid_get_enumeration_stats(unsigned long *hits, unsigned long *scans)
+{
+	*hits = 0;
+	*scans = full_scans;
+}
+
 
 
 
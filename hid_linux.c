@@ -0,0 +1,966 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Linux hidraw backend for the MSI Led enabler.
+
+ This backend talks to /dev/hidraw* directly. Device
+ discovery reads the uevent files the kernel exports in
+ sysfs, so there is no dependency on libudev, and no
+ thread or event loop is created per opened device: a
+ feature report is a single ioctl() on the device node.
+
+ Enumerations are cached per VID/PID and dropped when the
+ kernel announces a hidraw node coming or going on its
+ uevent netlink socket (the one udev itself listens to),
+ so repeated opens don't walk sysfs again.
+
+ Input reports can be waited on for many devices from one
+ thread with the epoll reactor declared in hid_reactor.h.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        http://github.com/signal11/hidapi .
+********************************************************/
+
+#define _GNU_SOURCE /* realpath(), O_CLOEXEC */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <locale.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <linux/hidraw.h>
+#include <linux/netlink.h>
+
+#include "hidapi.h"
+#include "hid_reactor.h"
+
+/* Bus type reported in the HID_ID uevent key for USB devices. */
+#define BUS_USB 0x03
+
+#define SYSFS_HIDRAW_CLASS "/sys/class/hidraw"
+#define DEV_DIR "/dev"
+#define BUF_LEN 256
+/* VID/PID pairs whose enumeration is kept. */
+#define ENUM_CACHE_SIZE 8
+
+struct hid_device_ {
+	int device_handle;
+	int write_only;
+	int blocking;
+	int disconnected;
+	/* Message of the last failed call, returned by hid_error(). */
+	wchar_t *last_error_str;
+	/* Set while registered in a reactor. */
+	hid_input_callback callback;
+	void *callback_context;
+};
+
+struct hid_reactor {
+	int epoll_fd;
+};
+
+/* Information about a hidraw node, gathered from sysfs. */
+struct hidraw_info {
+	int bus_type;
+	unsigned short vendor_id;
+	unsigned short product_id;
+	unsigned short release_number;
+	int interface_number;
+	char serial_number[BUF_LEN];
+	char manufacturer_string[BUF_LEN];
+	char product_string[BUF_LEN];
+};
+
+/* One cached enumeration. devs may be NULL: nothing matched. */
+struct enum_cache_entry {
+	int valid;
+	unsigned short vendor_id;
+	unsigned short product_id;
+	struct hid_device_info *devs;
+};
+
+static int locale_set = 0;
+
+static pthread_mutex_t enum_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct enum_cache_entry enum_cache[ENUM_CACHE_SIZE];
+static unsigned int enum_cache_next = 0;
+/* Kernel uevent socket, -1 when hotplug can't be watched, in which
+   case nothing is cached. */
+static int hotplug_fd = -1;
+static unsigned long cache_hits = 0;
+static unsigned long full_scans = 0;
+/* Whether devices opened from now on can read input reports. Set and
+   read from any thread, so atomic. */
+static atomic_int input_reports_enabled = 1;
+
+static void open_hotplug_monitor(void);
+static void invalidate_enum_cache(void);
+
+static hid_device *new_hid_device(void)
+{
+	hid_device *dev = calloc(1, sizeof(hid_device));
+	dev->device_handle = -1;
+	dev->blocking = 1;
+	dev->disconnected = 0;
+
+	return dev;
+}
+
+/* Convert a UTF-8 (or locale encoded) string into a newly allocated
+   wide string. Never returns NULL for a non-NULL input. */
+static wchar_t *utf8_to_wchar_t(const char *utf8)
+{
+	wchar_t *ret = NULL;
+	size_t wlen;
+
+	if (!utf8)
+		utf8 = "";
+
+	wlen = mbstowcs(NULL, utf8, 0);
+	if (wlen == (size_t) -1) {
+		/* Invalid sequence for the current locale. */
+		ret = calloc(1, sizeof(wchar_t));
+		return ret;
+	}
+
+	ret = calloc(wlen + 1, sizeof(wchar_t));
+	mbstowcs(ret, utf8, wlen + 1);
+	ret[wlen] = 0x0000;
+
+	return ret;
+}
+
+/* Keep "<what>: <reason>" as the last error of dev, the reason being
+   strerror(err) when err is not 0. Marks dev disconnected on ENODEV.
+   errno is left as the failed call set it. */
+static void register_device_error(hid_device *dev, const char *what, int err)
+{
+	char message[256];
+
+	if (err == ENODEV)
+		dev->disconnected = 1;
+
+	snprintf(message, sizeof(message), "%s: %s", what, err? strerror(err): "not supported by hidraw");
+	free(dev->last_error_str);
+	dev->last_error_str = utf8_to_wchar_t(message);
+	errno = err? err: ENOSYS;
+}
+
+/* Read a whole (small) sysfs attribute into buf, stripping the
+   trailing newline. Returns the length read or -1. */
+static int read_sysfs_attr(const char *dir, const char *attr, char *buf, size_t len)
+{
+	char path[PATH_MAX];
+	ssize_t res;
+	int fd;
+
+	buf[0] = '\0';
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	res = read(fd, buf, len - 1);
+	close(fd);
+	if (res < 0) {
+		buf[0] = '\0';
+		return -1;
+	}
+
+	buf[res] = '\0';
+	while (res > 0 && (buf[res-1] == '\n' || buf[res-1] == '\r'))
+		buf[--res] = '\0';
+
+	return (int) res;
+}
+
+/* Parse the HID_ID, HID_NAME and HID_UNIQ keys out of the uevent
+   file of a hid device. Returns 1 if HID_ID was found, 0 otherwise. */
+static int parse_uevent_info(const char *uevent, struct hidraw_info *info)
+{
+	char tmp[1024];
+	char *saveptr = NULL;
+	char *line;
+	int found_id = 0;
+
+	strncpy(tmp, uevent, sizeof(tmp) - 1);
+	tmp[sizeof(tmp) - 1] = '\0';
+
+	for (line = strtok_r(tmp, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+		char *value = strchr(line, '=');
+		if (!value)
+			continue;
+		*value++ = '\0';
+
+		if (strcmp(line, "HID_ID") == 0) {
+			/* HID_ID=0003:00001770:0000FF00 */
+			unsigned int bus, vid, pid;
+			if (sscanf(value, "%x:%x:%x", &bus, &vid, &pid) == 3) {
+				info->bus_type = bus;
+				info->vendor_id = vid;
+				info->product_id = pid;
+				found_id = 1;
+			}
+		}
+		else if (strcmp(line, "HID_NAME") == 0) {
+			strncpy(info->product_string, value, BUF_LEN - 1);
+			info->product_string[BUF_LEN - 1] = '\0';
+		}
+		else if (strcmp(line, "HID_UNIQ") == 0) {
+			strncpy(info->serial_number, value, BUF_LEN - 1);
+			info->serial_number[BUF_LEN - 1] = '\0';
+		}
+	}
+
+	return found_id;
+}
+
+/* Fill info from the sysfs directory of a hidraw node, e.g.
+   /sys/class/hidraw/hidraw0. Returns 0 on success, -1 on failure. */
+static int get_hidraw_info(const char *sysfs_dir, struct hidraw_info *info)
+{
+	char path[PATH_MAX];
+	char hid_dir[PATH_MAX];
+	char uevent[1024];
+	char buf[BUF_LEN];
+
+	memset(info, 0, sizeof(*info));
+	info->interface_number = -1;
+
+	snprintf(path, sizeof(path), "%s/device", sysfs_dir);
+	if (!realpath(path, hid_dir))
+		return -1;
+
+	if (read_sysfs_attr(hid_dir, "uevent", uevent, sizeof(uevent)) < 0)
+		return -1;
+	if (!parse_uevent_info(uevent, info))
+		return -1;
+
+	if (info->bus_type == BUS_USB) {
+		/* The hid device sits below the USB interface, which sits
+		   below the USB device. Prefer the USB descriptor strings
+		   over HID_NAME, which glues both of them together. */
+		char intf_dir[PATH_MAX];
+		char usb_dir[PATH_MAX];
+		char *slash;
+
+		strcpy(intf_dir, hid_dir);
+		slash = strrchr(intf_dir, '/');
+		if (slash)
+			*slash = '\0';
+		strcpy(usb_dir, intf_dir);
+		slash = strrchr(usb_dir, '/');
+		if (slash)
+			*slash = '\0';
+
+		if (read_sysfs_attr(intf_dir, "bInterfaceNumber", buf, sizeof(buf)) > 0)
+			info->interface_number = (int) strtol(buf, NULL, 16);
+		if (read_sysfs_attr(usb_dir, "bcdDevice", buf, sizeof(buf)) > 0)
+			info->release_number = (unsigned short) strtol(buf, NULL, 16);
+		if (read_sysfs_attr(usb_dir, "manufacturer", buf, sizeof(buf)) > 0)
+			strcpy(info->manufacturer_string, buf);
+		if (read_sysfs_attr(usb_dir, "product", buf, sizeof(buf)) > 0)
+			strcpy(info->product_string, buf);
+	}
+
+	return 0;
+}
+
+/* Same as get_hidraw_info(), starting from an open hidraw descriptor. */
+static int get_hidraw_info_from_fd(int fd, struct hidraw_info *info)
+{
+	char sysfs_dir[PATH_MAX];
+	struct stat s;
+
+	if (fstat(fd, &s) < 0 || !S_ISCHR(s.st_mode))
+		return -1;
+
+	snprintf(sysfs_dir, sizeof(sysfs_dir), "/sys/dev/char/%u:%u",
+	         major(s.st_rdev), minor(s.st_rdev));
+
+	return get_hidraw_info(sysfs_dir, info);
+}
+
+int HID_API_EXPORT hid_init(void)
+{
+	/* Set the locale if it's not set, so mbstowcs() converts
+	   the UTF-8 strings from sysfs. */
+	if (!locale_set) {
+		const char *locale = setlocale(LC_CTYPE, NULL);
+		if (!locale || strcmp(locale, "C") == 0)
+			setlocale(LC_CTYPE, "");
+		locale_set = 1;
+	}
+
+	pthread_mutex_lock(&enum_mutex);
+	if (hotplug_fd < 0)
+		open_hotplug_monitor();
+	pthread_mutex_unlock(&enum_mutex);
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_exit(void)
+{
+	/* Only the enumeration cache and its hotplug socket outlive a call. */
+	pthread_mutex_lock(&enum_mutex);
+	invalidate_enum_cache();
+	if (hotplug_fd >= 0)
+		close(hotplug_fd);
+	hotplug_fd = -1;
+	pthread_mutex_unlock(&enum_mutex);
+
+	return 0;
+}
+
+/* Walk every hidraw node in sysfs and list the ones matching VID/PID. */
+static struct hid_device_info *scan_hidraw(unsigned short vendor_id, unsigned short product_id)
+{
+	struct hid_device_info *root = NULL; /* return object */
+	struct hid_device_info *cur_dev = NULL;
+	struct dirent *entry;
+	DIR *dir;
+
+	full_scans++;
+
+	dir = opendir(SYSFS_HIDRAW_CLASS);
+	if (!dir)
+		return NULL;
+
+	while ((entry = readdir(dir)) != NULL) {
+		char sysfs_dir[PATH_MAX];
+		char dev_path[PATH_MAX];
+		struct hidraw_info info;
+		struct hid_device_info *tmp;
+
+		if (strncmp(entry->d_name, "hidraw", 6) != 0)
+			continue;
+
+		snprintf(sysfs_dir, sizeof(sysfs_dir), "%s/%s", SYSFS_HIDRAW_CLASS, entry->d_name);
+		if (get_hidraw_info(sysfs_dir, &info) < 0)
+			continue;
+
+		/* Check the VID/PID against the arguments */
+		if (!((vendor_id == 0x0 && product_id == 0x0) ||
+		      (vendor_id == info.vendor_id && product_id == info.product_id)))
+			continue;
+
+		/* VID/PID match. Create the record. */
+		tmp = calloc(1, sizeof(struct hid_device_info));
+		if (cur_dev) {
+			cur_dev->next = tmp;
+		}
+		else {
+			root = tmp;
+		}
+		cur_dev = tmp;
+
+		snprintf(dev_path, sizeof(dev_path), "%s/%s", DEV_DIR, entry->d_name);
+		cur_dev->path = strdup(dev_path);
+		cur_dev->vendor_id = info.vendor_id;
+		cur_dev->product_id = info.product_id;
+		cur_dev->serial_number = utf8_to_wchar_t(info.serial_number);
+		cur_dev->release_number = info.release_number;
+		cur_dev->manufacturer_string = utf8_to_wchar_t(info.manufacturer_string);
+		cur_dev->product_string = utf8_to_wchar_t(info.product_string);
+
+		/* Usage Page and Usage are not available from sysfs
+		   without parsing the report descriptor. */
+		cur_dev->usage_page = 0;
+		cur_dev->usage = 0;
+		cur_dev->interface_number = info.interface_number;
+		cur_dev->next = NULL;
+	}
+
+	closedir(dir);
+
+	return root;
+}
+
+static wchar_t *dup_wcs(const wchar_t *s)
+{
+	size_t len = wcslen(s);
+	wchar_t *ret = malloc((len + 1) * sizeof(wchar_t));
+	wcscpy(ret, s);
+
+	return ret;
+}
+
+/* Deep copy of an enumeration, so callers can free what they get. */
+static struct hid_device_info *copy_enumeration(const struct hid_device_info *devs)
+{
+	struct hid_device_info *root = NULL;
+	struct hid_device_info *cur_dev = NULL;
+
+	for (; devs; devs = devs->next) {
+		struct hid_device_info *tmp = malloc(sizeof(struct hid_device_info));
+		*tmp = *devs;
+		tmp->path = strdup(devs->path);
+		tmp->serial_number = dup_wcs(devs->serial_number);
+		tmp->manufacturer_string = dup_wcs(devs->manufacturer_string);
+		tmp->product_string = dup_wcs(devs->product_string);
+		tmp->next = NULL;
+
+		if (cur_dev)
+			cur_dev->next = tmp;
+		else
+			root = tmp;
+		cur_dev = tmp;
+	}
+
+	return root;
+}
+
+/* Open the kernel uevent socket. Done once, from hid_init(). */
+static void open_hotplug_monitor(void)
+{
+	struct sockaddr_nl addr;
+
+	hotplug_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+	if (hotplug_fd < 0)
+		return;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1; /* Kernel events, not the ones udev rebroadcasts. */
+	if (bind(hotplug_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		close(hotplug_fd);
+		hotplug_fd = -1;
+	}
+}
+
+static void invalidate_enum_cache(void)
+{
+	int i;
+
+	for (i = 0; i < ENUM_CACHE_SIZE; i++) {
+		if (enum_cache[i].valid)
+			hid_free_enumeration(enum_cache[i].devs);
+		enum_cache[i].valid = 0;
+		enum_cache[i].devs = NULL;
+	}
+}
+
+/* Drop the cache if a hidraw node was added or removed since the last
+   call. With nothing pending this is one failed recv(). Called with
+   enum_mutex held. */
+static void check_hotplug(void)
+{
+	char buf[4096];
+	ssize_t len;
+
+	while ((len = recv(hotplug_fd, buf, sizeof(buf) - 1, 0)) != -1) {
+		/* "ACTION@DEVPATH\0KEY=VALUE\0..." */
+		char *p = buf;
+		buf[len] = '\0';
+		for (; p < buf + len; p += strlen(p) + 1) {
+			if (strcmp(p, "SUBSYSTEM=hidraw") == 0) {
+				invalidate_enum_cache();
+				break;
+			}
+		}
+	}
+
+	/* The kernel dropped events for us, anything may have changed. */
+	if (errno == ENOBUFS)
+		invalidate_enum_cache();
+}
+
+/* The cached enumeration of VID/PID, scanning sysfs first if needed.
+   Called with enum_mutex held. Returns NULL if hotplug can't be
+   watched, the caller then owns a fresh scan in *uncached. */
+static struct enum_cache_entry *lookup_enumeration(unsigned short vendor_id, unsigned short product_id, struct hid_device_info **uncached)
+{
+	struct enum_cache_entry *entry;
+	int i;
+
+	*uncached = NULL;
+	if (hotplug_fd < 0) {
+		*uncached = scan_hidraw(vendor_id, product_id);
+		return NULL;
+	}
+
+	check_hotplug();
+	for (i = 0; i < ENUM_CACHE_SIZE; i++) {
+		entry = &enum_cache[i];
+		if (entry->valid && entry->vendor_id == vendor_id && entry->product_id == product_id) {
+			cache_hits++;
+			return entry;
+		}
+	}
+
+	/* Miss. Replace the oldest entry. */
+	entry = &enum_cache[enum_cache_next];
+	enum_cache_next = (enum_cache_next + 1) % ENUM_CACHE_SIZE;
+	if (entry->valid)
+		hid_free_enumeration(entry->devs);
+	entry->vendor_id = vendor_id;
+	entry->product_id = product_id;
+	entry->devs = scan_hidraw(vendor_id, product_id);
+	entry->valid = 1;
+
+	return entry;
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+	struct enum_cache_entry *entry;
+	struct hid_device_info *devs;
+
+	hid_init();
+
+	pthread_mutex_lock(&enum_mutex);
+	entry = lookup_enumeration(vendor_id, product_id, &devs);
+	if (entry)
+		devs = copy_enumeration(entry->devs);
+	pthread_mutex_unlock(&enum_mutex);
+
+	return devs;
+}
+
+void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
+{
+	/* This function is identical to the Mac version. Platform independent. */
+	struct hid_device_info *d = devs;
+	while (d) {
+		struct hid_device_info *next = d->next;
+		free(d->path);
+		free(d->serial_number);
+		free(d->manufacturer_string);
+		free(d->product_string);
+		free(d);
+		d = next;
+	}
+}
+
+void HID_API_EXPORT_CALL hid_get_enumeration_stats(unsigned long *hits, unsigned long *scans)
+{
+	pthread_mutex_lock(&enum_mutex);
+	*hits = cache_hits;
+	*scans = full_scans;
+	pthread_mutex_unlock(&enum_mutex);
+}
+
+/* Copy into path the first device of devs matching the arguments of
+   hid_open(). Returns 0 if there is one. */
+static int find_path(const struct hid_device_info *devs, unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number, char *path, size_t len)
+{
+	for (; devs; devs = devs->next) {
+		if (devs->vendor_id == vendor_id &&
+		    devs->product_id == product_id &&
+		    (!serial_number || wcscmp(serial_number, devs->serial_number) == 0)) {
+			snprintf(path, len, "%s", devs->path);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+hid_device * HID_API_EXPORT hid_open(unsigned short vendor_id, unsigned short product_id, wchar_t *serial_number)
+{
+	struct enum_cache_entry *entry;
+	struct hid_device_info *uncached;
+	char path[PATH_MAX];
+	int found;
+	hid_device *handle;
+
+	hid_init();
+
+	/* Look the path up in the cached enumeration, no copy needed. */
+	pthread_mutex_lock(&enum_mutex);
+	entry = lookup_enumeration(vendor_id, product_id, &uncached);
+	found = find_path(entry? entry->devs: uncached, vendor_id, product_id, serial_number, path, sizeof(path)) == 0;
+	hid_free_enumeration(uncached);
+	pthread_mutex_unlock(&enum_mutex);
+
+	if (!found)
+		return NULL;
+	handle = hid_open_path(path);
+	if (handle || !entry)
+		return handle;
+
+	/* The cached node may be gone with its uevent not read yet: scan
+	   again once before giving up. */
+	pthread_mutex_lock(&enum_mutex);
+	invalidate_enum_cache();
+	entry = lookup_enumeration(vendor_id, product_id, &uncached);
+	found = find_path(entry? entry->devs: uncached, vendor_id, product_id, serial_number, path, sizeof(path)) == 0;
+	hid_free_enumeration(uncached);
+	pthread_mutex_unlock(&enum_mutex);
+
+	return found? hid_open_path(path): NULL;
+}
+
+hid_device * HID_API_EXPORT hid_open_path(const char *path)
+{
+	hid_device *dev;
+
+	hid_init();
+
+	dev = new_hid_device();
+	dev->write_only = !atomic_load(&input_reports_enabled);
+	dev->device_handle = open(path, (dev->write_only? O_WRONLY: O_RDWR) | O_CLOEXEC);
+	if (dev->device_handle < 0) {
+		free(dev);
+		return NULL;
+	}
+
+	return dev;
+}
+
+int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t length)
+{
+	ssize_t bytes_written;
+
+	if (dev->disconnected) {
+		register_device_error(dev, "hid_write", ENODEV);
+		return -1;
+	}
+
+	bytes_written = write(dev->device_handle, data, length);
+	if (bytes_written < 0)
+		register_device_error(dev, "hid_write", errno);
+
+	return (int) bytes_written;
+}
+
+int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+	ssize_t bytes_read;
+
+	if (dev->disconnected) {
+		register_device_error(dev, "hid_read", ENODEV);
+		return -1;
+	}
+	if (dev->write_only) {
+		/* Opened after hid_set_input_reports(0). */
+		register_device_error(dev, "hid_read on a write-only device", 0);
+		return -1;
+	}
+
+	if (milliseconds >= 0) {
+		/* Milliseconds is either 0 (non-blocking) or > 0 (contains
+		   a valid timeout). In both cases we want to call poll()
+		   and wait for data to arrive. */
+		struct pollfd fds;
+		int ret;
+
+		fds.fd = dev->device_handle;
+		fds.events = POLLIN;
+		fds.revents = 0;
+		ret = poll(&fds, 1, milliseconds);
+		if (ret == 0) {
+			/* Timeout */
+			return 0;
+		}
+		if (ret < 0) {
+			/* Error */
+			register_device_error(dev, "hid_read", errno);
+			return -1;
+		}
+		if (fds.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			/* The device was unplugged. */
+			register_device_error(dev, "hid_read", ENODEV);
+			return -1;
+		}
+	}
+
+	bytes_read = read(dev->device_handle, data, length);
+	if (bytes_read < 0) {
+		if (errno == EAGAIN || errno == EINPROGRESS)
+			return 0;
+		register_device_error(dev, "hid_read", errno);
+		return -1;
+	}
+
+	return (int) bytes_read;
+}
+
+int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
+{
+	return hid_read_timeout(dev, data, length, (dev->blocking)? -1: 0);
+}
+
+int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
+{
+	/* Blocking reads are done with a plain read(), non-blocking
+	   ones through poll() with a zero timeout. */
+	dev->blocking = !nonblock;
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length)
+{
+	int res;
+
+	if (dev->disconnected) {
+		register_device_error(dev, "hid_send_feature_report", ENODEV);
+		return -1;
+	}
+
+	res = ioctl(dev->device_handle, HIDIOCSFEATURE(length), data);
+	if (res < 0)
+		register_device_error(dev, "hid_send_feature_report", errno);
+
+	return res;
+}
+
+int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data, size_t length)
+{
+	int res;
+
+	if (dev->disconnected) {
+		register_device_error(dev, "hid_get_feature_report", ENODEV);
+		return -1;
+	}
+
+	res = ioctl(dev->device_handle, HIDIOCGFEATURE(length), data);
+	if (res < 0)
+		register_device_error(dev, "hid_get_feature_report", errno);
+
+	return res;
+}
+
+void HID_API_EXPORT hid_close(hid_device *dev)
+{
+	if (!dev)
+		return;
+
+	close(dev->device_handle);
+	free(dev->last_error_str);
+	free(dev);
+}
+
+/* Copy one of the strings of an open device into a caller buffer. */
+static int get_device_string(hid_device *dev, int which, wchar_t *string, size_t maxlen)
+{
+	struct hidraw_info info;
+	const char *str;
+	size_t res;
+
+	if (!maxlen) {
+		register_device_error(dev, "hid_get_string", EINVAL);
+		return -1;
+	}
+
+	if (get_hidraw_info_from_fd(dev->device_handle, &info) < 0) {
+		register_device_error(dev, "hid_get_string", EIO);
+		string[0] = 0x0000;
+		return -1;
+	}
+
+	switch (which) {
+	case 0:
+		str = info.manufacturer_string;
+		break;
+	case 1:
+		str = info.product_string;
+		break;
+	default:
+		str = info.serial_number;
+		break;
+	}
+
+	res = mbstowcs(string, str, maxlen);
+	if (res == (size_t) -1) {
+		register_device_error(dev, "hid_get_string", EILSEQ);
+		string[0] = 0x0000;
+		return -1;
+	}
+	string[maxlen-1] = 0x0000;
+
+	return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_manufacturer_string(hid_device *dev, wchar_t *string, size_t maxlen)
+{
+	return get_device_string(dev, 0, string, maxlen);
+}
+
+int HID_API_EXPORT_CALL hid_get_product_string(hid_device *dev, wchar_t *string, size_t maxlen)
+{
+	return get_device_string(dev, 1, string, maxlen);
+}
+
+int HID_API_EXPORT_CALL hid_get_serial_number_string(hid_device *dev, wchar_t *string, size_t maxlen)
+{
+	return get_device_string(dev, 2, string, maxlen);
+}
+
+int HID_API_EXPORT_CALL hid_get_indexed_string(hid_device *dev, int string_index, wchar_t *string, size_t maxlen)
+{
+	/* Not reachable through hidraw. */
+	register_device_error(dev, "hid_get_indexed_string", 0);
+	return -1;
+}
+
+
+HID_API_EXPORT const wchar_t * HID_API_CALL  hid_error(hid_device *dev)
+{
+	/* Errors without a device (enumeration, open) are left in errno. */
+	if (!dev)
+		return NULL;
+
+	return dev->last_error_str;
+}
+
+unsigned long HID_API_EXPORT_CALL hid_get_input_overflows(hid_device *dev)
+{
+	/* The kernel queues input reports per open file and drops the
+	   oldest silently when full; there is no count to report. */
+	return 0;
+}
+
+void HID_API_EXPORT_CALL hid_set_input_reports(int enabled)
+{
+	atomic_store(&input_reports_enabled, enabled);
+}
+
+struct hid_reactor *hid_reactor_new(void)
+{
+	struct hid_reactor *reactor = calloc(1, sizeof(struct hid_reactor));
+
+	if (!reactor)
+		return NULL;
+	reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (reactor->epoll_fd < 0) {
+		free(reactor);
+		return NULL;
+	}
+
+	return reactor;
+}
+
+void hid_reactor_free(struct hid_reactor *reactor)
+{
+	if (!reactor)
+		return;
+
+	close(reactor->epoll_fd);
+	free(reactor);
+}
+
+int hid_reactor_fd(struct hid_reactor *reactor)
+{
+	return reactor->epoll_fd;
+}
+
+int hid_reactor_add(struct hid_reactor *reactor, hid_device *dev, hid_input_callback callback, void *context)
+{
+	struct epoll_event event;
+
+	if (dev->write_only || dev->disconnected || !callback)
+		return -1;
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.ptr = dev;
+	if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, dev->device_handle, &event) < 0)
+		return -1;
+
+	dev->callback = callback;
+	dev->callback_context = context;
+
+	return 0;
+}
+
+int hid_reactor_remove(struct hid_reactor *reactor, hid_device *dev)
+{
+	dev->callback = NULL;
+	dev->callback_context = NULL;
+
+	return epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, dev->device_handle, NULL);
+}
+
+/* Whether dev has a report to read right now, -1 if it is gone. */
+static int report_pending(hid_device *dev)
+{
+	struct pollfd fds;
+
+	fds.fd = dev->device_handle;
+	fds.events = POLLIN;
+	fds.revents = 0;
+	if (poll(&fds, 1, 0) < 0)
+		return (errno == EINTR)? 0: -1;
+	if (fds.revents & POLLIN)
+		return 1;
+
+	return (fds.revents & (POLLERR | POLLHUP | POLLNVAL))? -1: 0;
+}
+
+int hid_reactor_run(struct hid_reactor *reactor, int milliseconds)
+{
+	struct epoll_event events[HID_REACTOR_MAX_EVENTS];
+	unsigned char data[HID_REACTOR_MAX_REPORT];
+	int dispatched = 0;
+	int count, i;
+
+	count = epoll_wait(reactor->epoll_fd, events, HID_REACTOR_MAX_EVENTS, milliseconds);
+	if (count < 0)
+		return (errno == EINTR)? 0: -1;
+
+	for (i = 0; i < count; i++) {
+		hid_device *dev = events[i].data.ptr;
+		int pending = (events[i].events & EPOLLIN)? 1: -1;
+
+		/* Removed by a callback of this round. */
+		if (!dev->callback)
+			continue;
+
+		/* The device stays blocking, the way hid_read() expects it: a
+		   hidraw read() returns one report, so read only while the
+		   kernel says one is queued. */
+		while (pending > 0) {
+			ssize_t bytes_read = read(dev->device_handle, data, sizeof(data));
+			if (bytes_read < 0 && errno == EINTR)
+				continue;
+			if (bytes_read <= 0) {
+				pending = -1;
+				break;
+			}
+			dev->callback(dev, data, (int) bytes_read, dev->callback_context);
+			dispatched++;
+			if (!dev->callback)
+				break;
+			pending = report_pending(dev);
+		}
+
+		if (dev->callback && (pending < 0 || (events[i].events & (EPOLLERR | EPOLLHUP)))) {
+			/* Unplugged. Tell the owner once and stop watching it. */
+			hid_input_callback callback = dev->callback;
+			void *context = dev->callback_context;
+
+			dev->disconnected = 1;
+			hid_reactor_remove(reactor, dev);
+			callback(dev, NULL, -1, context);
+			dispatched++;
+		}
+	}
+
+	return dispatched;
+}
@@ -0,0 +1,508 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Loopback backend for the MSI Led enabler.
+
+ No hardware is touched: hid_enumerate() lists fake
+ 0x1770:0xff00 keyboards, and every feature report sent to
+ one is timestamped into a log and decoded into the state
+ the controller would show. A latency per report and
+ refused reports can be injected, so the mode logic and
+ the throughput of the send path can be exercised on
+ machines without the keyboard.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        http://github.com/signal11/hidapi .
+********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <wchar.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "hid_mock.h"
+
+#define MOCK_VENDOR_ID 0x1770
+#define MOCK_PRODUCT_ID 0xff00
+#define MOCK_PATH_PREFIX "mock:"
+
+struct hid_device_ {
+	int index;
+	int write_only;
+	int blocking;
+	unsigned long long opened; /* CLOCK_MONOTONIC, ns */
+};
+
+static pthread_mutex_t mock_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int initialized = 0;
+static int device_count = 1;
+static unsigned int latency_usec = 0;
+static unsigned int fail_every = 0;
+static unsigned int stall_usec = 0;
+static int readback = 1;
+static int readback_id = 1;
+static atomic_int input_reports_enabled = 1;
+
+static struct hid_mock_controller controllers[HID_MOCK_MAX_DEVICES];
+/* Registers written since the last commit, applied by the next one. */
+static struct hid_mock_area pending[HID_MOCK_MAX_DEVICES][HID_MOCK_AREAS];
+static unsigned short pending_mask[HID_MOCK_MAX_DEVICES];
+static unsigned char last_report[HID_MOCK_MAX_DEVICES][HID_MOCK_REPORT_MAX];
+static size_t last_length[HID_MOCK_MAX_DEVICES];
+
+static unsigned long enumerations = 0;
+
+static struct hid_mock_report log_reports[HID_MOCK_LOG_SIZE];
+static unsigned long long log_total = 0;
+
+static unsigned long long now_nanos(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned int env_uint(const char *name, unsigned int fallback)
+{
+	const char *value = getenv(name);
+	return (value && *value)? (unsigned int) strtoul(value, NULL, 10): fallback;
+}
+
+static wchar_t *dup_wcs(const wchar_t *s)
+{
+	size_t len = wcslen(s);
+	wchar_t *ret = malloc((len + 1) * sizeof(wchar_t));
+	wcscpy(ret, s);
+
+	return ret;
+}
+
+/* Applies one report to the controller of device. Called with the mutex held. */
+static void decode_report(int device, const unsigned char *data, size_t length)
+{
+	struct hid_mock_controller *c = &controllers[device];
+	unsigned char opcode, area;
+
+	/* 0x01 0x02 <opcode> <area|mode> <color> <level> <blue> 0xec */
+	if (length < 8 || data[0] != 0x01 || data[1] != 0x02 || data[7] != 0xec)
+		return;
+
+	opcode = data[2];
+	area = data[3];
+	if (opcode == 0x41) {
+		memcpy(c->areas, pending[device], sizeof(c->areas));
+		c->area_mask = pending_mask[device];
+		c->mode = area;
+		c->committed = 1;
+		c->commits++;
+	}
+	else if ((opcode == 0x42 || opcode == 0x43) && area >= 1 && area <= HID_MOCK_AREAS) {
+		struct hid_mock_area *a = &pending[device][area - 1];
+		a->opcode = opcode;
+		a->color = data[4];
+		a->level = data[5];
+		a->blue = data[6];
+		pending_mask[device] |= 1 << (area - 1);
+	}
+}
+
+int HID_API_EXPORT hid_init(void)
+{
+	pthread_mutex_lock(&mock_mutex);
+	if (!initialized) {
+		device_count = env_uint("MSILED_MOCK_DEVICES", device_count);
+		if (device_count > HID_MOCK_MAX_DEVICES)
+			device_count = HID_MOCK_MAX_DEVICES;
+		latency_usec = env_uint("MSILED_MOCK_LATENCY_US", latency_usec);
+		fail_every = env_uint("MSILED_MOCK_FAIL_EVERY", fail_every);
+		stall_usec = env_uint("MSILED_MOCK_STALL_US", stall_usec);
+		readback = !env_uint("MSILED_MOCK_NO_READBACK", !readback);
+		initialized = 1;
+	}
+	pthread_mutex_unlock(&mock_mutex);
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_exit(void)
+{
+	if (getenv("MSILED_MOCK_DUMP"))
+		hid_mock_dump(stderr);
+
+	return 0;
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+	struct hid_device_info *root = NULL;
+	struct hid_device_info *cur_dev = NULL;
+	int i;
+
+	hid_init();
+	enumerations++;
+
+	if (!((vendor_id == 0x0 && product_id == 0x0) ||
+	      (vendor_id == MOCK_VENDOR_ID && product_id == MOCK_PRODUCT_ID)))
+		return NULL;
+
+	for (i = 0; i < device_count; i++) {
+		char path[32];
+		wchar_t serial[32];
+		struct hid_device_info *tmp = calloc(1, sizeof(struct hid_device_info));
+
+		if (cur_dev)
+			cur_dev->next = tmp;
+		else
+			root = tmp;
+		cur_dev = tmp;
+
+		snprintf(path, sizeof(path), MOCK_PATH_PREFIX "%d", i);
+		swprintf(serial, sizeof(serial) / sizeof(serial[0]), L"MOCK%04d", i);
+		cur_dev->path = strdup(path);
+		cur_dev->vendor_id = MOCK_VENDOR_ID;
+		cur_dev->product_id = MOCK_PRODUCT_ID;
+		cur_dev->serial_number = dup_wcs(serial);
+		cur_dev->release_number = 0x0100;
+		cur_dev->manufacturer_string = dup_wcs(L"MSI EPF USB");
+		cur_dev->product_string = dup_wcs(L"MSI EPF USB (loopback)");
+		cur_dev->interface_number = 0;
+		cur_dev->next = NULL;
+	}
+
+	return root;
+}
+
+void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
+{
+	struct hid_device_info *d = devs;
+	while (d) {
+		struct hid_device_info *next = d->next;
+		free(d->path);
+		free(d->serial_number);
+		free(d->manufacturer_string);
+		free(d->product_string);
+		free(d);
+		d = next;
+	}
+}
+
+hid_device * HID_API_EXPORT hid_open(unsigned short vendor_id, unsigned short product_id, wchar_t *serial_number)
+{
+	struct hid_device_info *devs, *cur_dev;
+	hid_device *handle = NULL;
+
+	devs = hid_enumerate(vendor_id, product_id);
+	for (cur_dev = devs; cur_dev; cur_dev = cur_dev->next) {
+		if (!serial_number || wcscmp(serial_number, cur_dev->serial_number) == 0) {
+			handle = hid_open_path(cur_dev->path);
+			break;
+		}
+	}
+	hid_free_enumeration(devs);
+
+	return handle;
+}
+
+hid_device * HID_API_EXPORT hid_open_path(const char *path)
+{
+	hid_device *dev;
+	char *end;
+	long index;
+
+	hid_init();
+
+	if (strncmp(path, MOCK_PATH_PREFIX, strlen(MOCK_PATH_PREFIX)) != 0)
+		return NULL;
+	index = strtol(path + strlen(MOCK_PATH_PREFIX), &end, 10);
+	if (*end || index < 0 || index >= device_count)
+		return NULL;
+
+	dev = calloc(1, sizeof(hid_device));
+	dev->index = (int) index;
+	dev->opened = now_nanos();
+	dev->write_only = !atomic_load(&input_reports_enabled);
+	dev->blocking = 1;
+
+	return dev;
+}
+
+int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t length)
+{
+	/* Output reports are accepted and dropped, the keyboard only uses feature reports. */
+	return (int) length;
+}
+
+int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+	if (dev->write_only)
+		return -1;
+
+	/* The fake keyboards never send input reports. */
+	if (milliseconds > 0) {
+		struct timespec ts = { milliseconds / 1000, (milliseconds % 1000) * 1000000L };
+		nanosleep(&ts, NULL);
+	}
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
+{
+	return hid_read_timeout(dev, data, length, (dev->blocking)? -1: 0);
+}
+
+int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
+{
+	dev->blocking = !nonblock;
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length)
+{
+	struct hid_mock_report *entry;
+	int refused;
+
+	if (length == 0 || length > HID_MOCK_REPORT_MAX)
+		return -1;
+
+	/* The time a control transfer would take, outside the lock so
+	   several devices can be driven in parallel. */
+	if (latency_usec) {
+		struct timespec ts = { latency_usec / 1000000, (latency_usec % 1000000) * 1000L };
+		nanosleep(&ts, NULL);
+	}
+
+	pthread_mutex_lock(&mock_mutex);
+
+	entry = &log_reports[log_total % HID_MOCK_LOG_SIZE];
+	entry->timestamp = now_nanos();
+	entry->device = dev->index;
+	entry->length = length;
+	memcpy(entry->data, data, length);
+	log_total++;
+
+	controllers[dev->index].reports++;
+	refused = (fail_every && controllers[dev->index].reports % fail_every == 0)
+		|| (stall_usec && entry->timestamp - dev->opened < stall_usec * 1000ULL);
+	if (refused) {
+		controllers[dev->index].failed++;
+	}
+	else {
+		decode_report(dev->index, data, length);
+		memcpy(last_report[dev->index], data, length);
+		last_length[dev->index] = length;
+	}
+
+	pthread_mutex_unlock(&mock_mutex);
+
+	/* What hidraw answers for a stalled control transfer. */
+	if (refused)
+		errno = EPIPE;
+
+	return refused? -1: (int) length;
+}
+
+int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data, size_t length)
+{
+	size_t copied;
+
+	/* Firmware that stalls reads, like most of these controllers. */
+	if (!readback)
+		return -1;
+
+	if (latency_usec) {
+		struct timespec ts = { latency_usec / 1000000, (latency_usec % 1000000) * 1000L };
+		nanosleep(&ts, NULL);
+	}
+
+	/* Loopback: the last feature report that was accepted, nothing
+	   until the first one, like a controller just powered. */
+	pthread_mutex_lock(&mock_mutex);
+	copied = last_length[dev->index] < length? last_length[dev->index]: length;
+	memcpy(data, last_report[dev->index], copied);
+	pthread_mutex_unlock(&mock_mutex);
+
+	/* Backends that strip the report id hand the rest one byte lower. */
+	if (!readback_id && copied > 0)
+		memmove(data, data + 1, --copied);
+
+	return (int) copied;
+}
+
+void HID_API_EXPORT hid_close(hid_device *dev)
+{
+	free(dev);
+}
+
+static int copy_string(const wchar_t *str, wchar_t *string, size_t maxlen)
+{
+	if (!maxlen)
+		return -1;
+
+	wcsncpy(string, str, maxlen);
+	string[maxlen-1] = 0x0000;
+
+	return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_manufacturer_string(hid_device *dev, wchar_t *string, size_t maxlen)
+{
+	return copy_string(L"MSI EPF USB", string, maxlen);
+}
+
+int HID_API_EXPORT_CALL hid_get_product_string(hid_device *dev, wchar_t *string, size_t maxlen)
+{
+	return copy_string(L"MSI EPF USB (loopback)", string, maxlen);
+}
+
+int HID_API_EXPORT_CALL hid_get_serial_number_string(hid_device *dev, wchar_t *string, size_t maxlen)
+{
+	wchar_t serial[32];
+
+	swprintf(serial, sizeof(serial) / sizeof(serial[0]), L"MOCK%04d", dev->index);
+	return copy_string(serial, string, maxlen);
+}
+
+int HID_API_EXPORT_CALL hid_get_indexed_string(hid_device *dev, int string_index, wchar_t *string, size_t maxlen)
+{
+	return -1;
+}
+
+HID_API_EXPORT const wchar_t * HID_API_CALL  hid_error(hid_device *dev)
+{
+	return NULL;
+}
+
+unsigned long HID_API_EXPORT_CALL hid_get_input_overflows(hid_device *dev)
+{
+	/* Nothing is ever queued. */
+	return 0;
+}
+
+void HID_API_EXPORT_CALL hid_set_input_reports(int enabled)
+{
+	atomic_store(&input_reports_enabled, enabled);
+}
+
+void HID_API_EXPORT_CALL hid_get_enumeration_stats(unsigned long *hits, unsigned long *scans)
+{
+	/* Listing the fake keyboards is free, nothing is cached. */
+	*hits = 0;
+	*scans = enumerations;
+}
+
+void hid_mock_reset(void)
+{
+	pthread_mutex_lock(&mock_mutex);
+	memset(controllers, 0, sizeof(controllers));
+	memset(pending, 0, sizeof(pending));
+	memset(pending_mask, 0, sizeof(pending_mask));
+	memset(last_length, 0, sizeof(last_length));
+	log_total = 0;
+	pthread_mutex_unlock(&mock_mutex);
+}
+
+void hid_mock_set_devices(int count)
+{
+	hid_init();
+	device_count = count < 0? 0: (count > HID_MOCK_MAX_DEVICES? HID_MOCK_MAX_DEVICES: count);
+}
+
+void hid_mock_set_latency(unsigned int usec)
+{
+	hid_init();
+	latency_usec = usec;
+}
+
+void hid_mock_set_fail_every(unsigned int n)
+{
+	hid_init();
+	fail_every = n;
+}
+
+void hid_mock_set_stall(unsigned int usec)
+{
+	hid_init();
+	stall_usec = usec;
+}
+
+void hid_mock_set_readback(int enabled)
+{
+	hid_init();
+	readback = enabled;
+}
+
+void hid_mock_set_readback_id(int enabled)
+{
+	hid_init();
+	readback_id = enabled;
+}
+
+unsigned long long hid_mock_report_count(void)
+{
+	return log_total;
+}
+
+int hid_mock_report_at(size_t index, struct hid_mock_report *report)
+{
+	unsigned long long first;
+	int res = -1;
+
+	pthread_mutex_lock(&mock_mutex);
+	first = log_total > HID_MOCK_LOG_SIZE? log_total - HID_MOCK_LOG_SIZE: 0;
+	if (first + index < log_total) {
+		*report = log_reports[(first + index) % HID_MOCK_LOG_SIZE];
+		res = 0;
+	}
+	pthread_mutex_unlock(&mock_mutex);
+
+	return res;
+}
+
+int hid_mock_controller_state(int device, struct hid_mock_controller *state)
+{
+	if (device < 0 || device >= HID_MOCK_MAX_DEVICES)
+		return -1;
+
+	pthread_mutex_lock(&mock_mutex);
+	*state = controllers[device];
+	pthread_mutex_unlock(&mock_mutex);
+
+	return 0;
+}
+
+void hid_mock_dump(FILE *out)
+{
+	int i, a;
+
+	for (i = 0; i < device_count; i++) {
+		struct hid_mock_controller c;
+		if (hid_mock_controller_state(i, &c) < 0)
+			break;
+
+		fprintf(out, "mock:%d reports=%llu commits=%llu failed=%llu", i, c.reports, c.commits, c.failed);
+		if (!c.committed) {
+			fprintf(out, " (never committed)\n");
+			continue;
+		}
+		fprintf(out, " mode=0x%02x\n", c.mode);
+		for (a = 0; a < HID_MOCK_AREAS; a++) {
+			if (c.area_mask & (1 << a))
+				fprintf(out, "  area %d: opcode=0x%02x color=0x%02x level=0x%02x blue=0x%02x\n",
+					a + 1, c.areas[a].opcode, c.areas[a].color, c.areas[a].level, c.areas[a].blue);
+		}
+	}
+}
@@ -0,0 +1,101 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Loopback backend for the MSI Led enabler: extra calls
+ to configure the fake keyboards and look at what they
+ received. See hid_mock.c.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        http://github.com/signal11/hidapi .
+********************************************************/
+
+#ifndef HID_MOCK_H__
+#define HID_MOCK_H__
+
+#include <stdio.h>
+#include "hidapi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Fake keyboards that can be enumerated (MSILED_MOCK_DEVICES). */
+#define HID_MOCK_MAX_DEVICES 16
+/* Reports kept in the log, the oldest ones are overwritten. */
+#define HID_MOCK_LOG_SIZE 4096
+#define HID_MOCK_REPORT_MAX 64
+/* Area registers of the controller: 3 areas x 3 for the special modes. */
+#define HID_MOCK_AREAS 9
+
+/* One feature report as it reached a fake keyboard. */
+struct hid_mock_report {
+	unsigned long long timestamp; /* CLOCK_MONOTONIC, ns */
+	int device;
+	size_t length;
+	unsigned char data[HID_MOCK_REPORT_MAX];
+};
+
+/* One area register: the bytes after the opcode and area of the last
+   0x42 / 0x43 report written to it. */
+struct hid_mock_area {
+	unsigned char opcode;
+	unsigned char color;
+	unsigned char level;
+	unsigned char blue;
+};
+
+/* What a fake keyboard shows: the registers as of its last commit. */
+struct hid_mock_controller {
+	int committed; /* 0 until the first commit */
+	unsigned char mode;
+	unsigned short area_mask; /* registers written before a commit */
+	struct hid_mock_area areas[HID_MOCK_AREAS];
+	unsigned long long reports;
+	unsigned long long commits;
+	unsigned long long failed;
+};
+
+/* Forget every report and controller state. Keeps the configuration. */
+void hid_mock_reset(void);
+
+/* Configuration, also read from the environment by hid_init():
+   MSILED_MOCK_DEVICES, MSILED_MOCK_LATENCY_US, MSILED_MOCK_FAIL_EVERY,
+   MSILED_MOCK_STALL_US and MSILED_MOCK_NO_READBACK. */
+void hid_mock_set_devices(int count);
+void hid_mock_set_latency(unsigned int usec);
+/* Every nth feature report is refused (0 never refuses). */
+void hid_mock_set_fail_every(unsigned int n);
+/* Every report is refused for usec after the device was opened, like a
+   stalled bus or a keyboard still resuming (0 never stalls). */
+void hid_mock_set_stall(unsigned int usec);
+/* hid_get_feature_report() returns the last accepted report (the default),
+   or fails like a firmware that does not answer reads (0). */
+void hid_mock_set_readback(int enabled);
+/* Reads start with the report id (the default), or without it like the
+   backends that leave it out (0). */
+void hid_mock_set_readback_id(int enabled);
+
+/* Total feature reports received, failed ones included. The log keeps the
+   last HID_MOCK_LOG_SIZE of them: index 0 is the oldest one still kept. */
+unsigned long long hid_mock_report_count(void);
+int hid_mock_report_at(size_t index, struct hid_mock_report *report);
+
+/* Returns -1 if there is no such device. */
+int hid_mock_controller_state(int device, struct hid_mock_controller *state);
+
+/* Prints the controller states, done by hid_exit() when MSILED_MOCK_DUMP is set. */
+void hid_mock_dump(FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,67 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Single-threaded input report reactor for the Linux
+ hidraw backend (hid_linux.c). One epoll set waits on any
+ number of opened devices, instead of a thread or a
+ blocking hid_read() per device.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        http://github.com/signal11/hidapi .
+********************************************************/
+
+#ifndef HID_REACTOR_H__
+#define HID_REACTOR_H__
+
+#include "hidapi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Events handled per epoll_wait() and largest report read. */
+#define HID_REACTOR_MAX_EVENTS 16
+#define HID_REACTOR_MAX_REPORT 64
+
+struct hid_reactor;
+
+/* Called from hid_reactor_run() for every input report of dev. A length
+   of -1 (data NULL) means dev was unplugged and is no longer watched.
+   The callback may remove devices from the reactor, but not close them. */
+typedef void (*hid_input_callback)(hid_device *dev, const unsigned char *data, int length, void *context);
+
+/* Returns NULL on failure. */
+struct hid_reactor *hid_reactor_new(void);
+void hid_reactor_free(struct hid_reactor *reactor);
+
+/* The epoll descriptor, readable when hid_reactor_run() has work, so
+   the reactor can be nested in another poll loop. */
+int hid_reactor_fd(struct hid_reactor *reactor);
+
+/* Devices opened without input reports (hid_set_input_reports(0))
+   can't be added. The device keeps its blocking mode: hid_read() and
+   hid_set_nonblocking() work as before, from the thread running the
+   reactor. Another thread must not read it while it is added. Both
+   return -1 on failure. */
+int hid_reactor_add(struct hid_reactor *reactor, hid_device *dev, hid_input_callback callback, void *context);
+int hid_reactor_remove(struct hid_reactor *reactor, hid_device *dev);
+
+/* Waits up to milliseconds (-1 forever, 0 not at all) and dispatches
+   every pending report. Each read is of a report the kernel already
+   holds, so it never blocks. Returns the callbacks made, or -1 on
+   error. */
+int hid_reactor_run(struct hid_reactor *reactor, int milliseconds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -375,6 +375,51 @@ extern "C" {
 		*/
 		HID_API_EXPORT const wchar_t* HID_API_CALL hid_error(hid_device *device);
 
+		/** @brief Get the number of input reports dropped because
+			they were not read in time.
+
+			Reports are queued in a fixed-size buffer between the
+			device and hid_read(). When it is full, the report that
+			just arrived is dropped and counted here: the reports
+			already queued are kept. Before the lock-free ring of
+			the Mac backend, the oldest queued report was dropped
+			instead, so a slow reader now gets the first reports of
+			a burst, not the last ones.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+
+			@returns
+				The number of dropped input reports since the
+				device was opened, 0 if the backend can't tell.
+		*/
+		unsigned long HID_API_EXPORT_CALL hid_get_input_overflows(hid_device *device);
+
+		/** @brief Get how hid_enumerate() and hid_open() found devices.
+
+			Backends that cache enumerations answer repeated
+			lookups from the cache until a device is plugged or
+			unplugged.
+
+			@ingroup API
+			@param hits Set to the lookups answered from the cache.
+			@param scans Set to the full scans of the devices.
+		*/
+		void HID_API_EXPORT_CALL hid_get_enumeration_stats(unsigned long *hits, unsigned long *scans);
+
+		/** @brief Choose whether devices opened from now on can
+			receive input reports.
+
+			Input reports are enabled by default. Devices opened
+			with them disabled only take feature and output
+			reports: no read thread or run loop is set up for
+			them and hid_read() returns -1.
+
+			@ingroup API
+			@param enabled 0 to open devices for writing only.
+		*/
+		void HID_API_EXPORT_CALL hid_set_input_reports(int enabled);
+
 #ifdef __cplusplus
 }
 #endif
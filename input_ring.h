@@ -0,0 +1,136 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Lock-free ring of input reports between the thread
+ receiving them and hid_read(), used by the Mac backend
+ (hid.c). Plain C11, so it is built and tested on every
+ platform (test/input_ring.c).
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        http://github.com/signal11/hidapi .
+********************************************************/
+
+#ifndef INPUT_RING_H__
+#define INPUT_RING_H__
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Input reports kept until hid_read() picks them up. Power of two. Same
+   bound as the old linked list, which dropped reports past 30. */
+#define INPUT_RING_SLOTS 32
+#define CACHE_LINE_SIZE 64
+
+/* Single producer (the thread receiving reports), single consumer (the
+   hid_read() caller) ring of input reports. Slots are slot_size bytes,
+   all allocated up front, so receiving a report never allocates.
+   head and tail live on their own cache lines so the two threads don't
+   bounce each other's line on every report. When the ring is full the
+   new report is dropped and counted in overflows: the oldest one can't
+   be popped by the producer, the tail belongs to the consumer. */
+struct input_ring {
+	_Alignas(CACHE_LINE_SIZE) atomic_size_t head; /* Next slot to fill, written by the producer */
+	_Alignas(CACHE_LINE_SIZE) atomic_size_t tail; /* Next slot to read, written by the consumer */
+	_Alignas(CACHE_LINE_SIZE) atomic_ulong overflows;
+	atomic_int reader_waiting; /* A reader sleeps, see input_ring_push() */
+	size_t slot_size;
+	size_t lens[INPUT_RING_SLOTS];
+	uint8_t *slots;
+};
+
+static inline struct input_ring *new_input_ring(size_t slot_size)
+{
+	struct input_ring *ring;
+
+	if (posix_memalign((void **) &ring, CACHE_LINE_SIZE, sizeof(struct input_ring)) != 0)
+		return NULL;
+	memset(ring, 0, sizeof(struct input_ring));
+
+	ring->slot_size = slot_size;
+	ring->slots = calloc(INPUT_RING_SLOTS, slot_size);
+	if (!ring->slots) {
+		free(ring);
+		return NULL;
+	}
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	atomic_init(&ring->overflows, 0);
+	atomic_init(&ring->reader_waiting, 0);
+
+	return ring;
+}
+
+/* Deletes the ring and any input reports still left in it. */
+static inline void free_input_ring(struct input_ring *ring)
+{
+	if (!ring)
+		return;
+	free(ring->slots);
+	free(ring);
+}
+
+static inline int input_ring_empty(struct input_ring *ring)
+{
+	return atomic_load_explicit(&ring->tail, memory_order_relaxed) ==
+	       atomic_load_explicit(&ring->head, memory_order_acquire);
+}
+
+/* Producer side: copies the report, cut to slot_size, into the next slot.
+   Returns -1 if the ring is full, the report is then dropped rather than
+   growing the ring or blocking the producer.
+
+   The head is published with a seq_cst store. Once this returns, the
+   producer checks reader_waiting (also seq_cst) and wakes the reader if it
+   is set. The reader sets the flag before it checks the ring again, so
+   either the reader sees the report or the producer sees the reader. */
+static inline int input_ring_push(struct input_ring *ring, const uint8_t *report, size_t length)
+{
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	size_t len;
+
+	if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == INPUT_RING_SLOTS) {
+		atomic_fetch_add_explicit(&ring->overflows, 1, memory_order_relaxed);
+		return -1;
+	}
+
+	/* Copy into the slot, then publish it by moving the head. */
+	len = (length < ring->slot_size)? length: ring->slot_size;
+	memcpy(ring->slots + (head % INPUT_RING_SLOTS) * ring->slot_size, report, len);
+	ring->lens[head % INPUT_RING_SLOTS] = len;
+	atomic_store(&ring->head, head + 1);
+
+	return 0;
+}
+
+/* Consumer side, the ring must not be empty: copies the oldest report,
+   cut to length, into data, then hands its slot back to the producer.
+   Returns the bytes copied. */
+static inline int input_ring_pop(struct input_ring *ring, unsigned char *data, size_t length)
+{
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	size_t slot = tail % INPUT_RING_SLOTS;
+	size_t len = (length < ring->lens[slot])? length: ring->lens[slot];
+
+	if (len)
+		memcpy(data, ring->slots + slot * ring->slot_size, len);
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+	return len;
+}
+
+static inline unsigned long input_ring_overflows(struct input_ring *ring)
+{
+	return atomic_load_explicit(&ring->overflows, memory_order_relaxed);
+}
+
+#endif
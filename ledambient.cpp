@@ -0,0 +1,269 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * Screen sync (-ambient): every frame a captured screen is reduced to the average color of its
+ * left, middle and right thirds, matched to the controller colors and sent like an animation
+ * frame, so only the areas that changed reach the device.
+ *
+ * Frames are 32 bit BGRX pixels, as X11 / DRM captures give them. The source is either a file
+ * of whole frames back to back, played in a loop (a single frame file in /dev/shm that a
+ * capturer keeps rewriting is followed live), or "test", generated colors for trying the
+ * pipeline with the mock backend.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "ledcontrol.h"
+
+/** Allowed params */
+const char* PARAM_AMBIENT =						TEXT_PARAM_AMBIENT;
+const char* PARAM_SIZE =						TEXT_PARAM_SIZE;
+const char* PARAM_STEP =						TEXT_PARAM_STEP;
+
+/** Colors of the test source, each frame moves them one area */
+static const unsigned char testColors[3][3] = { { 255, 0, 0 }, { 0, 255, 0 }, { 0, 0, 255 } };
+
+/**
+ * Adds the b, g and r of count BGRX pixels to sums.
+ */
+static void
+sumPixels(const unsigned char* pixels, int count, unsigned long long sums[3]) {
+
+	int i = 0;
+
+#ifdef __SSE2__
+	// 4 pixels at a time: each channel is masked down to the low byte of its pixel, then
+	// psadbw adds the bytes of each half, so the 64 bit sums can't overflow
+	const __m128i mask = _mm_set1_epi32(0xff);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i b = zero, g = zero, r = zero;
+	unsigned long long lanes[2];
+
+	for (; i + 4 <= count; i += 4) {
+		__m128i p = _mm_loadu_si128((const __m128i*) (pixels + i * 4));
+		b = _mm_add_epi64(b, _mm_sad_epu8(_mm_and_si128(p, mask), zero));
+		g = _mm_add_epi64(g, _mm_sad_epu8(_mm_and_si128(_mm_srli_epi32(p, 8), mask), zero));
+		r = _mm_add_epi64(r, _mm_sad_epu8(_mm_and_si128(_mm_srli_epi32(p, 16), mask), zero));
+	}
+
+	_mm_storeu_si128((__m128i*) lanes, b);
+	sums[0] += lanes[0] + lanes[1];
+	_mm_storeu_si128((__m128i*) lanes, g);
+	sums[1] += lanes[0] + lanes[1];
+	_mm_storeu_si128((__m128i*) lanes, r);
+	sums[2] += lanes[0] + lanes[1];
+#endif
+
+	for (; i < count; i++) {
+		sums[0] += pixels[i * 4];
+		sums[1] += pixels[i * 4 + 1];
+		sums[2] += pixels[i * 4 + 2];
+	}
+}
+
+void
+reduceFrame(const unsigned char* frame, int width, int height, size_t stride, int rowStep, unsigned char rgb[9]) {
+
+	unsigned long long sums[3][3] = {};
+	int bounds[4] = { 0, width / 3, width * 2 / 3, width };
+	unsigned long long rows = 0;
+
+	for (int y = 0; y < height; y += rowStep, rows++) {
+		const unsigned char* row = frame + y * stride;
+		for (int area = 0; area < 3; area++) {
+			sumPixels(row + bounds[area] * 4, bounds[area + 1] - bounds[area], sums[area]);
+		}
+	}
+
+	for (int area = 0; area < 3; area++) {
+		unsigned long long pixels = rows * (bounds[area + 1] - bounds[area]);
+		for (int c = 0; c < 3; c++) {
+			// BGRX sums to r, g, b
+			rgb[area * 3 + c] = pixels ? sums[area][2 - c] / pixels : 0;
+		}
+	}
+}
+
+/**
+ * Test frames: one buffer 2 / 3 wider than a frame, with the test colors repeating every
+ * width pixels. Frame n starts n thirds in, so the colors move one area per frame.
+ */
+static int
+generateFrames(ambient* amb) {
+
+	int third = amb->width / 3;
+	int bufferWidth = amb->width + 2 * third;
+
+	amb->stride = (size_t) bufferWidth * 4;
+	amb->frames = (unsigned char*) malloc(amb->stride * amb->height);
+	if (!amb->frames) {
+		return -1;
+	}
+
+	for (int x = 0; x < bufferWidth; x++) {
+		int area = (x % amb->width) / (third ? third : 1) % 3;
+		unsigned char* pixel = amb->frames + x * 4;
+		pixel[0] = testColors[area][2];
+		pixel[1] = testColors[area][1];
+		pixel[2] = testColors[area][0];
+		pixel[3] = 0;
+	}
+	for (int y = 1; y < amb->height; y++) {
+		memcpy(amb->frames + y * amb->stride, amb->frames, amb->stride);
+	}
+
+	amb->frameCount = 3;
+	amb->frameOffset = (size_t) third * 4;
+	amb->mappedLength = 0;
+
+	return 0;
+}
+
+/**
+ * Maps the frames file at path. Its length must be a whole number of frames.
+ */
+static const char*
+mapFrames(ambient* amb, const char* path) {
+
+	struct stat st;
+	size_t frameBytes = (size_t) amb->width * amb->height * 4;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return "Unable to open the frames file. (-ambient)\n\n";
+	}
+	if (fstat(fd, &st) < 0 || st.st_size == 0 || (size_t) st.st_size % frameBytes != 0) {
+		close(fd);
+		return "The frames file is not a whole number of BGRX frames of -size. (-ambient)\n\n";
+	}
+
+	// Shared, so a capturer rewriting the file in place is seen without reopening it
+	void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED) {
+		return "Unable to map the frames file. (-ambient)\n\n";
+	}
+
+	amb->frames = (unsigned char*) mapped;
+	amb->mappedLength = st.st_size;
+	amb->frameCount = st.st_size / frameBytes;
+	amb->frameOffset = frameBytes;
+	amb->stride = (size_t) amb->width * 4;
+
+	return NULL;
+}
+
+const char*
+parseAmbient(int argc, char* argv[], ambient* amb) {
+
+	const char* source = NULL;
+
+	memset(amb, 0, sizeof(*amb));
+	amb->width = DEFAULT_AMBIENT_WIDTH;
+	amb->height = DEFAULT_AMBIENT_HEIGHT;
+	amb->rowStep = DEFAULT_AMBIENT_ROW_STEP;
+	amb->fps = DEFAULT_ANIMATION_FPS;
+
+	for (int x = 1; x < argc; x++) {
+
+		if (argv[x][0] != '-') {
+			continue;
+		} else if (!argv[x + 1]) {
+			return "Invalid parameter(s). Use --help for more information\n\n";
+		}
+
+		const token* param = lookupToken(argv[x]);
+		if (!param || param->kind != TOKEN_PARAM) {
+			continue;
+		}
+
+		switch (param->value) {
+
+		case kParamAmbient:
+
+			source = argv[x + 1];
+			break;
+
+		case kParamSize:
+
+			if (sscanf(argv[x + 1], "%dx%d", &amb->width, &amb->height) != 2) {
+				amb->width = 0;
+			}
+			break;
+
+		case kParamStep:
+
+			amb->rowStep = atoi(argv[x + 1]);
+			break;
+
+		case kParamFps:
+
+			amb->fps = atoi(argv[x + 1]);
+			break;
+
+		case kParamDuration:
+
+			amb->duration = atof(argv[x + 1]);
+			break;
+		}
+	}
+
+	if (!source) {
+		return "No frames source specified. (-ambient). Use --help for more information\n\n";
+	}
+	if (amb->width < 3 || amb->height < 1 || amb->width > 16384 || amb->height > 16384) {
+		return "Invalid frame size. (-size). Use --help for more information\n\n";
+	}
+	if (amb->rowStep < 1) {
+		return "Invalid row step. (-step). Use --help for more information\n\n";
+	}
+	if (amb->fps < MIN_ANIMATION_FPS || amb->fps > MAX_ANIMATION_FPS) {
+		return "Invalid frame rate. (-fps). Use --help for more information\n\n";
+	}
+	if (amb->duration < 0) {
+		return "Invalid duration. Use --help for more information\n\n";
+	}
+
+	if (strcmp(source, "test") == 0) {
+		return generateFrames(amb) < 0 ? "Not enough memory for the test frames.\n\n" : NULL;
+	}
+
+	return mapFrames(amb, source);
+}
+
+void
+closeAmbient(ambient* amb) {
+
+	if (amb->mappedLength) {
+		munmap(amb->frames, amb->mappedLength);
+	} else {
+		free(amb->frames);
+	}
+	amb->frames = NULL;
+}
+
+static void
+renderAmbient(void* context, double elapsed, unsigned char colors[3], unsigned char levels[3]) {
+
+	ambient* amb = (ambient*) context;
+	const unsigned char* frame = amb->frames + amb->next++ % amb->frameCount * amb->frameOffset;
+	unsigned char rgb[9];
+
+	reduceFrame(frame, amb->width, amb->height, amb->stride, amb->rowStep, rgb);
+	quantizeColors(rgb, 3, colors, levels);
+}
+
+int
+runAmbient(hid_device *handle, ambient* amb, keyboardState* state, frameStats* stats) {
+
+	amb->next = 0;
+
+	return runFrames(handle, amb->fps, amb->duration, renderAmbient, amb, state, stats);
+}
@@ -0,0 +1,283 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * Host side animations: the firmware modes only know the PERIOD_* constants, so these effects
+ * are rendered here frame by frame in normal mode, at a fixed rate kept by a monotonic clock.
+ * Each frame only sends the areas that changed since the previous one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include "ledcontrol.h"
+#include "ledprotocol.h"
+
+/** Allowed params */
+const char* PARAM_ANIMATE =						TEXT_PARAM_ANIMATE;
+const char* PARAM_FPS =							TEXT_PARAM_FPS;
+const char* PARAM_PERIOD =						TEXT_PARAM_PERIOD;
+const char* PARAM_DURATION =						TEXT_PARAM_DURATION;
+
+/** Allowed effects values */
+const char* VALUE_EFFECT_PULSE =					TEXT_VALUE_EFFECT_PULSE;
+const char* VALUE_EFFECT_CYCLE =					TEXT_VALUE_EFFECT_CYCLE;
+const char* VALUE_EFFECT_SCAN =						TEXT_VALUE_EFFECT_SCAN;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static double
+nowNanos() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void
+sleepUntil(double deadline, const volatile sig_atomic_t* stop) {
+
+	struct timespec ts;
+
+#if defined(__APPLE__)
+	// No clock_nanosleep there: a relative sleep on what is left, measured again after a signal
+	for (double left = deadline - nowNanos(); left > 0 && !(stop && *stop); left = deadline - nowNanos()) {
+		ts.tv_sec = (time_t) (left / 1e9);
+		ts.tv_nsec = (long) (left - ts.tv_sec * 1e9);
+		if (nanosleep(&ts, NULL) == 0) {
+			break;
+		}
+	}
+#else
+	ts.tv_sec = (time_t) (deadline / 1e9);
+	ts.tv_nsec = (long) (deadline - ts.tv_sec * 1e9);
+
+	// Absolute deadlines, so the time spent rendering and sending does not add up
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0 && !(stop && *stop)) {
+	}
+#endif
+}
+
+/**
+ * Position inside the effect period, in [0, 1).
+ */
+static double
+phase(const animation* anim, double elapsed) {
+
+	double p = fmod(elapsed / anim->period, 1.0);
+	return p < 0 ? p + 1.0 : p;
+}
+
+void
+renderFrame(const animation* anim, double elapsed, unsigned char colors[3], unsigned char levels[3]) {
+
+	double p = phase(anim, elapsed);
+
+	if (anim->effect == EFFECT_PULSE) {
+
+		// Every area goes up to LEVEL_4 and back down to LEVEL_1 once per period
+		double triangle = p < 0.5 ? p * 2 : (1 - p) * 2;
+		unsigned char level = (unsigned char) (triangle * LEVEL_4 + 0.5);
+		for (int i = 0; i < 3; i++) {
+			colors[i] = anim->colors[i];
+			levels[i] = filterLevel(colors[i], level);
+		}
+
+	} else if (anim->effect == EFFECT_CYCLE) {
+
+		// The three colors move one area to the right every third of the period
+		int shift = (int) (p * 3);
+		for (int i = 0; i < 3; i++) {
+			colors[i] = anim->colors[(i + 3 - shift) % 3];
+			levels[i] = filterLevel(colors[i], anim->level);
+		}
+
+	} else {
+
+		// Scan: a bright area sweeps left to right and back, the other two stay dim
+		int lit = p < 0.5 ? (int) (p * 6) : 2 - (int) ((p - 0.5) * 6);
+		for (int i = 0; i < 3; i++) {
+			colors[i] = anim->colors[i];
+			levels[i] = filterLevel(colors[i], i == lit ? LEVEL_4 : LEVEL_1);
+		}
+	}
+}
+
+void
+stopAnimation() {
+
+	stopRequested = 1;
+}
+
+static void
+renderAnimation(void* context, double elapsed, unsigned char colors[3], unsigned char levels[3]) {
+
+	renderFrame((const animation*) context, elapsed, colors, levels);
+}
+
+int
+runAnimation(hid_device *handle, const animation* anim, keyboardState* state, frameStats* stats) {
+
+	return runFrames(handle, anim->fps, anim->duration, renderAnimation, (void*) anim, state, stats);
+}
+
+int
+runFrames(hid_device *handle, int fps, double duration, frameRenderer render, void* context, keyboardState* state, frameStats* stats) {
+
+	double framePeriod = 1e9 / fps;
+	double jitterSum = 0;
+	unsigned long long frame = 0;
+	unsigned char colors[3], levels[3];
+	reportBatch batch, changes;
+
+	memset(stats, 0, sizeof(*stats));
+	stopRequested = 0;
+
+	double start = nowNanos();
+	double end = duration > 0 ? start + duration * 1e9 : 0;
+
+	while (!stopRequested) {
+
+		double deadline = start + frame * framePeriod;
+		if (end && deadline >= end) {
+			break;
+		}
+
+		sleepUntil(deadline, &stopRequested);
+		double woke = nowNanos();
+		double jitter = (woke - deadline) / 1e3;
+		jitterSum += jitter;
+		if (jitter > stats->maxJitterUs) {
+			stats->maxJitterUs = jitter;
+		}
+
+		// Render at the time the frame is due, not when we woke up
+		render(context, (deadline - start) / 1e9, colors, levels);
+
+		batch.count = 0;
+		for (int i = 0; i < 3; i++) {
+			batchActivateArea(&batch, OPCODE_SET_COLOR, AREA_LEFT + i, colors[i], levels[i], 0x00);
+		}
+		batchCommit(&batch, MODE_NORMAL);
+
+		if (diffBatch(state, &batch, &changes) > 0) {
+			if (submitBatch(handle, &changes) != 0) {
+				resetState(state);
+				stats->failed++;
+			} else {
+				updateState(state, &changes);
+				stats->sent++;
+			}
+		}
+		stats->frames++;
+
+		// Frames whose deadline already passed are dropped instead of sent late
+		double next = (nowNanos() - start) / framePeriod;
+		unsigned long long due = (unsigned long long) next;
+		if (due > frame + 1) {
+			stats->dropped += due - frame - 1;
+			frame = due;
+		} else {
+			frame++;
+		}
+	}
+
+	stats->elapsed = (nowNanos() - start) / 1e9;
+	stats->meanJitterUs = stats->frames ? jitterSum / stats->frames : 0;
+
+	return stats->failed ? -1 : 0;
+}
+
+const char*
+parseAnimation(int argc, char* argv[], animation* anim) {
+
+	unsigned char arguments[kSize];
+
+	memset(arguments, UCHAR_MAX, kSize);
+	anim->effect = UCHAR_MAX;
+	anim->fps = DEFAULT_ANIMATION_FPS;
+	anim->period = DEFAULT_ANIMATION_PERIOD;
+	anim->duration = 0;
+
+	for (int x = 1; x < argc; x++) {
+
+		if (argv[x][0] != '-') {
+			continue;
+		} else if (!argv[x + 1]) {
+			return "Invalid parameter(s). Use --help for more information\n\n";
+		}
+
+		const token* param = lookupToken(argv[x]);
+		if (!param || param->kind != TOKEN_PARAM) {
+			continue;
+		}
+
+		switch (param->value) {
+
+		case kParamAnimate: {
+
+			const token* effect = lookupToken(argv[x + 1]);
+			if (effect && effect->kind == TOKEN_EFFECT) {
+				anim->effect = effect->value;
+			}
+			break;
+		}
+		case kParamFps:
+
+			anim->fps = atoi(argv[x + 1]);
+			break;
+
+		case kParamPeriod:
+
+			anim->period = atof(argv[x + 1]);
+			break;
+
+		case kParamDuration:
+
+			anim->duration = atof(argv[x + 1]);
+			break;
+
+		case kParamColor1:
+
+			arguments[kColor1] = parseColor(argv[x + 1]);
+			break;
+
+		case kParamColor2:
+
+			arguments[kColor2] = parseColor(argv[x + 1]);
+			break;
+
+		case kParamColor3:
+
+			arguments[kColor3] = parseColor(argv[x + 1]);
+			break;
+
+		case kParamLevel:
+
+			arguments[kLevel] = convertLevel(argv[x + 1]);
+			break;
+		}
+	}
+
+	if (anim->effect == UCHAR_MAX) {
+		return "No effect specified. (-animate). Use --help for more information\n\n";
+	}
+	if (arguments[kColor1] == UCHAR_MAX) {
+		return "No color specified. (-color1). Use --help for more information\n\n";
+	}
+	if (anim->fps < MIN_ANIMATION_FPS || anim->fps > MAX_ANIMATION_FPS) {
+		return "Invalid frame rate. (-fps). Use --help for more information\n\n";
+	}
+	if (!(anim->period > 0) || anim->duration < 0) {
+		return "Invalid period or duration. Use --help for more information\n\n";
+	}
+
+	// Missing colors repeat the previous one, like normal mode with a single color
+	anim->colors[0] = arguments[kColor1];
+	anim->colors[1] = arguments[kColor2] == UCHAR_MAX ? anim->colors[0] : arguments[kColor2];
+	anim->colors[2] = arguments[kColor3] == UCHAR_MAX ? anim->colors[1] : arguments[kColor3];
+	anim->level = arguments[kLevel] == UCHAR_MAX ? LEVEL_4 : arguments[kLevel];
+
+	return NULL;
+}
@@ -0,0 +1,498 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * Audio reactive mode (-audio): the firmware lists MODE_AUDIO but does nothing with it, so the
+ * host does it in normal mode. An analysis thread runs a sliding FFT over the PCM and splits it
+ * in low, mid and high bands, each lighting one area brighter the louder it is; the calling
+ * thread sends the areas as soon as an analysis is ready.
+ *
+ * The analysis hands its results over through a triple buffer: neither thread ever waits for
+ * the other, the sender always gets the newest analysis and older ones it had no time for are
+ * counted as skipped. The latency from reading the last sample of a window to its reports
+ * being sent is measured on every update.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <atomic>
+#include "ledcontrol.h"
+
+/** Allowed params */
+const char* PARAM_AUDIO =						TEXT_PARAM_AUDIO;
+
+/** Bands under AUDIO_SILENCE_DB are off. A band lights from AUDIO_RANGE_DB under its recent peak */
+#define AUDIO_SILENCE_DB						-10.0
+#define AUDIO_RANGE_DB							30.0
+#define AUDIO_PEAK_DECAY_DB						10.0 // per second
+#define AUDIO_MAX_CHANNELS						8
+#define AUDIO_POLL_NS							1000000 // sender check for a new analysis
+
+/** Set in the triple buffer index when the middle slot holds an analysis not taken yet */
+#define FRESH								4
+
+static std::atomic<int> stopRequested(0);
+
+// struct for one analysis, as handed to the sender
+struct bandFrame {
+	unsigned char colors[3], levels[3];
+	double captured; // ns, CLOCK_MONOTONIC
+	unsigned long long sequence;
+};
+
+// struct for the analysis thread and what it shares with the sender
+struct analyzer {
+	const audio* a;
+
+	float window[AUDIO_FFT_SIZE];
+	float cosines[AUDIO_FFT_SIZE / 2], sines[AUDIO_FFT_SIZE / 2];
+	unsigned short reversed[AUDIO_FFT_SIZE];
+	float history[AUDIO_FFT_SIZE]; // last samples, mono, history[position] is the oldest
+	int position;
+	unsigned long long samples;
+	double peakDb[3];
+	double analysisNanos;
+
+	bandFrame frames[3];
+	int back; // slot the analysis thread writes, only touched by it
+	std::atomic<int> middle; // slot between the two threads, plus FRESH
+	std::atomic<bool> finished;
+	std::atomic<unsigned long long> analyses;
+};
+
+static double
+nowNanos() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Hann window, twiddle factors and bit reversed indexes of the FFT.
+ */
+static void
+prepareAnalyzer(analyzer* an) {
+
+	int bits = 0;
+	while ((1 << bits) < AUDIO_FFT_SIZE) {
+		bits++;
+	}
+
+	for (int i = 0; i < AUDIO_FFT_SIZE; i++) {
+		an->window[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / (AUDIO_FFT_SIZE - 1));
+
+		int r = 0;
+		for (int b = 0; b < bits; b++) {
+			r |= ((i >> b) & 1) << (bits - 1 - b);
+		}
+		an->reversed[i] = r;
+	}
+	for (int i = 0; i < AUDIO_FFT_SIZE / 2; i++) {
+		an->cosines[i] = cosf(2 * M_PI * i / AUDIO_FFT_SIZE);
+		an->sines[i] = -sinf(2 * M_PI * i / AUDIO_FFT_SIZE);
+	}
+	for (int band = 0; band < 3; band++) {
+		an->peakDb[band] = AUDIO_SILENCE_DB;
+	}
+}
+
+static_assert((AUDIO_FFT_SIZE & (AUDIO_FFT_SIZE - 1)) == 0, "AUDIO_FFT_SIZE must be a power of 2");
+static_assert(AUDIO_FFT_SIZE % AUDIO_HOP_SIZE == 0, "windows must start on whole hops");
+
+/**
+ * In place radix 2 FFT of AUDIO_FFT_SIZE points.
+ */
+static void
+fft(const analyzer* an, float* re, float* im) {
+
+	for (int i = 0; i < AUDIO_FFT_SIZE; i++) {
+		int j = an->reversed[i];
+		if (j > i) {
+			float t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+
+	for (int length = 2; length <= AUDIO_FFT_SIZE; length <<= 1) {
+		int half = length / 2;
+		int stride = AUDIO_FFT_SIZE / length;
+		for (int start = 0; start < AUDIO_FFT_SIZE; start += length) {
+			for (int k = 0; k < half; k++) {
+				float wr = an->cosines[k * stride], wi = an->sines[k * stride];
+				int even = start + k, odd = even + half;
+				float tr = re[odd] * wr - im[odd] * wi;
+				float ti = re[odd] * wi + im[odd] * wr;
+				re[odd] = re[even] - tr;
+				im[odd] = im[even] - ti;
+				re[even] += tr;
+				im[even] += ti;
+			}
+		}
+	}
+}
+
+/**
+ * Analyzes the window ending with the last sample read, at captured, and publishes it.
+ */
+static void
+analyze(analyzer* an, double captured) {
+
+	float re[AUDIO_FFT_SIZE], im[AUDIO_FFT_SIZE];
+	double power[3] = { 0, 0, 0 };
+	double decay = AUDIO_PEAK_DECAY_DB * AUDIO_HOP_SIZE / an->a->sampleRate;
+
+	for (int i = 0; i < AUDIO_FFT_SIZE; i++) {
+		re[i] = an->history[(an->position + i) % AUDIO_FFT_SIZE] * an->window[i];
+		im[i] = 0;
+	}
+	fft(an, re, im);
+
+	// Bin 0 is the DC offset, leave it out
+	for (int k = 1; k < AUDIO_FFT_SIZE / 2; k++) {
+		double hz = (double) k * an->a->sampleRate / AUDIO_FFT_SIZE;
+		int band = hz < AUDIO_LOW_HZ ? 0 : hz < AUDIO_MID_HZ ? 1 : 2;
+		power[band] += re[k] * re[k] + im[k] * im[k];
+	}
+
+	bandFrame* frame = &an->frames[an->back];
+	for (int band = 0; band < 3; band++) {
+		double db = 10 * log10(power[band] + 1e-12);
+
+		// The brightest level follows the recent peak, so quiet tracks still move
+		an->peakDb[band] = db > an->peakDb[band] - decay ? db : an->peakDb[band] - decay;
+
+		double loudness = (db - (an->peakDb[band] - AUDIO_RANGE_DB)) / AUDIO_RANGE_DB;
+		if (db < AUDIO_SILENCE_DB || loudness < 0.25) {
+			frame->colors[band] = COLOR_BLACK;
+			frame->levels[band] = LEVEL_1;
+		} else {
+			int level = LEVEL_1 + (int) ((loudness - 0.25) / 0.75 * 4);
+			frame->colors[band] = an->a->colors[band];
+			frame->levels[band] = level > LEVEL_4 ? LEVEL_4 : level;
+		}
+	}
+	frame->captured = captured;
+	frame->sequence = an->analyses.load(std::memory_order_relaxed) + 1;
+
+	// Hand the written slot over and take the one the sender gave back (or never took)
+	an->back = an->middle.exchange(an->back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+	an->analyses.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void*
+analysisThread(void* param) {
+
+	analyzer* an = (analyzer*) param;
+	const audio* a = an->a;
+	size_t frameBytes = 2 * a->channels;
+	unsigned char raw[AUDIO_HOP_SIZE * 2 * AUDIO_MAX_CHANNELS];
+	size_t used = 0;
+	double start = nowNanos();
+
+	while (!stopRequested) {
+
+		// Wake up now and then, so a silent pipe does not keep us from stopping
+		struct pollfd pfd = { a->fd, POLLIN, 0 };
+		if (poll(&pfd, 1, 100) == 0) {
+			continue;
+		}
+
+		ssize_t n = read(a->fd, raw + used, AUDIO_HOP_SIZE * frameBytes - used);
+		if (n <= 0) {
+			break;
+		}
+		used += n;
+		double captured = nowNanos();
+
+		size_t count = used / frameBytes;
+		for (size_t f = 0; f < count; f++) {
+			const unsigned char* sample = raw + f * frameBytes;
+			int sum = 0;
+			for (int c = 0; c < a->channels; c++) {
+				sum += (short) (sample[2 * c] | sample[2 * c + 1] << 8);
+			}
+			an->history[an->position] = sum / (32768.0f * a->channels);
+			an->position = (an->position + 1) % AUDIO_FFT_SIZE;
+			an->samples++;
+
+			if (an->samples % AUDIO_HOP_SIZE == 0 && an->samples >= AUDIO_FFT_SIZE) {
+				double analysisStart = nowNanos();
+				analyze(an, captured);
+				an->analysisNanos += nowNanos() - analysisStart;
+			}
+		}
+		used -= count * frameBytes;
+		memmove(raw, raw + count * frameBytes, used);
+
+		// A file is read as fast as it would play. One hop at most, the loop checks stopRequested
+		if (a->paced) {
+			sleepUntil(start + an->samples * 1e9 / a->sampleRate, NULL);
+		}
+	}
+
+	an->finished.store(true, std::memory_order_release);
+
+	return NULL;
+}
+
+static void
+sendBands(hid_device *handle, const bandFrame* frame, keyboardState* state, audioStats* stats) {
+
+	reportBatch batch, changes;
+
+	batch.count = 0;
+	for (int i = 0; i < 3; i++) {
+		batchActivateArea(&batch, 0x42, AREA_LEFT + i, frame->colors[i], frame->levels[i], 0x00);
+	}
+	batchCommit(&batch, MODE_NORMAL);
+
+	if (diffBatch(state, &batch, &changes) > 0) {
+		if (submitBatch(handle, &changes) != 0) {
+			resetState(state);
+			stats->failed++;
+		} else {
+			updateState(state, &changes);
+			stats->sent++;
+		}
+	}
+}
+
+int
+runAudio(hid_device *handle, const audio* a, keyboardState* state, audioStats* stats) {
+
+	analyzer* an = new analyzer();
+	pthread_t thread;
+	unsigned long long lastSequence = 0, updates = 0;
+	double latencySum = 0;
+	int front = 0;
+
+	memset(stats, 0, sizeof(*stats));
+	stopRequested = 0;
+
+	an->a = a;
+	an->back = 1;
+	an->middle = 2;
+	prepareAnalyzer(an);
+
+	double start = nowNanos();
+	double end = a->duration > 0 ? start + a->duration * 1e9 : 0;
+
+	if (pthread_create(&thread, NULL, analysisThread, an) != 0) {
+		delete an;
+		return -1;
+	}
+
+	while (!stopRequested && !(end && nowNanos() >= end)) {
+
+		if (!(an->middle.load(std::memory_order_acquire) & FRESH)) {
+			if (an->finished.load(std::memory_order_acquire) && !(an->middle.load(std::memory_order_acquire) & FRESH)) {
+				break;
+			}
+			struct timespec pause = { 0, AUDIO_POLL_NS };
+			nanosleep(&pause, NULL);
+			continue;
+		}
+
+		front = an->middle.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+		const bandFrame* frame = &an->frames[front];
+
+		stats->skipped += frame->sequence - lastSequence - 1;
+		lastSequence = frame->sequence;
+
+		sendBands(handle, frame, state, stats);
+
+		double latency = (nowNanos() - frame->captured) / 1e6;
+		latencySum += latency;
+		updates++;
+		if (latency > stats->maxLatencyMs) {
+			stats->maxLatencyMs = latency;
+		}
+	}
+
+	stopRequested = 1;
+	pthread_join(thread, NULL);
+
+	stats->elapsed = (nowNanos() - start) / 1e9;
+	stats->analyses = an->analyses.load();
+	stats->meanAnalysisUs = stats->analyses ? an->analysisNanos / stats->analyses / 1e3 : 0;
+	stats->meanLatencyMs = updates ? latencySum / updates : 0;
+	delete an;
+
+	return stats->failed ? -1 : 0;
+}
+
+void
+stopAudio() {
+
+	stopRequested = 1;
+}
+
+/**
+ * Reads exactly length bytes, from a pipe as well.
+ */
+static int
+readFully(int fd, void* buffer, size_t length) {
+
+	unsigned char* p = (unsigned char*) buffer;
+	while (length > 0) {
+		ssize_t n = read(fd, p, length);
+		if (n <= 0) {
+			return -1;
+		}
+		p += n;
+		length -= n;
+	}
+
+	return 0;
+}
+
+static unsigned int
+littleEndian(const unsigned char* bytes, int length) {
+
+	unsigned int value = 0;
+	for (int i = length - 1; i >= 0; i--) {
+		value = value << 8 | bytes[i];
+	}
+
+	return value;
+}
+
+/**
+ * Reads the WAV header up to the samples. Chunks before them are read through, pipes can't seek.
+ */
+static const char*
+readWavHeader(audio* a) {
+
+	unsigned char header[12], chunk[8], format[16];
+	bool hasFormat = false;
+
+	if (readFully(a->fd, header, sizeof(header)) < 0 || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+		return "The audio input is not a WAV file. (-audio)\n\n";
+	}
+
+	for (;;) {
+		if (readFully(a->fd, chunk, sizeof(chunk)) < 0) {
+			return "The WAV file has no samples. (-audio)\n\n";
+		}
+		unsigned int size = littleEndian(chunk + 4, 4);
+
+		if (memcmp(chunk, "data", 4) == 0) {
+			break;
+		} else if (memcmp(chunk, "fmt ", 4) == 0 && size >= sizeof(format)) {
+			if (readFully(a->fd, format, sizeof(format)) < 0) {
+				return "The WAV file is truncated. (-audio)\n\n";
+			}
+			size -= sizeof(format);
+			hasFormat = true;
+		}
+
+		// Skip the rest of the chunk, padded to an even length
+		unsigned char skip[256];
+		for (size += size & 1; size > 0; ) {
+			size_t n = size < sizeof(skip) ? size : sizeof(skip);
+			if (readFully(a->fd, skip, n) < 0) {
+				return "The WAV file is truncated. (-audio)\n\n";
+			}
+			size -= n;
+		}
+	}
+
+	if (!hasFormat) {
+		return "The WAV file has no format chunk. (-audio)\n\n";
+	}
+
+	// PCM (1) or extensible (0xfffe) holding PCM, 16 bits per sample
+	unsigned int tag = littleEndian(format, 2);
+	a->channels = littleEndian(format + 2, 2);
+	a->sampleRate = littleEndian(format + 4, 4);
+	if ((tag != 1 && tag != 0xfffe) || littleEndian(format + 14, 2) != 16) {
+		return "Only 16 bit PCM WAV is supported. (-audio)\n\n";
+	}
+	if (a->channels < 1 || a->channels > AUDIO_MAX_CHANNELS || a->sampleRate < 2 * AUDIO_MID_HZ) {
+		return "Unsupported channel count or sample rate. (-audio)\n\n";
+	}
+
+	return NULL;
+}
+
+const char*
+parseAudio(int argc, char* argv[], audio* a) {
+
+	const char* source = NULL;
+	struct stat st;
+
+	memset(a, 0, sizeof(*a));
+	a->fd = -1;
+	a->colors[0] = COLOR_RED;
+	a->colors[1] = COLOR_GREEN;
+	a->colors[2] = COLOR_BLUE;
+
+	for (int x = 1; x < argc; x++) {
+
+		if (argv[x][0] != '-' || strcmp(argv[x], "-") == 0) {
+			continue;
+		} else if (!argv[x + 1]) {
+			return "Invalid parameter(s). Use --help for more information\n\n";
+		}
+
+		const token* param = lookupToken(argv[x]);
+		if (!param || param->kind != TOKEN_PARAM) {
+			continue;
+		}
+
+		switch (param->value) {
+
+		case kParamAudio:
+
+			source = argv[x + 1];
+			break;
+
+		case kParamColor1:
+		case kParamColor2:
+		case kParamColor3: {
+
+			unsigned char color = parseColor(argv[x + 1]);
+			if (color == UCHAR_MAX) {
+				return "No color specified. (-color1). Use --help for more information\n\n";
+			}
+			a->colors[param->value - kParamColor1] = color;
+			break;
+		}
+		case kParamDuration:
+
+			a->duration = atof(argv[x + 1]);
+			break;
+		}
+	}
+
+	if (!source) {
+		return "No audio input specified. (-audio). Use --help for more information\n\n";
+	}
+	if (a->duration < 0) {
+		return "Invalid duration. Use --help for more information\n\n";
+	}
+
+	a->fd = strcmp(source, "-") == 0 ? STDIN_FILENO : open(source, O_RDONLY | O_CLOEXEC);
+	if (a->fd < 0) {
+		return "Unable to open the audio input. (-audio)\n\n";
+	}
+	a->paced = fstat(a->fd, &st) == 0 && S_ISREG(st.st_mode);
+
+	return readWavHeader(a);
+}
+
+void
+closeAudio(audio* a) {
+
+	if (a->fd > STDIN_FILENO) {
+		close(a->fd);
+	}
+	a->fd = -1;
+}
@@ -0,0 +1,183 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * Arbitrary RGB colors: the controller only knows 9 colors at 4 levels, so an RGB color is
+ * mapped to the nearest of those pairs. The pairs are kept as separate r, g and b arrays of
+ * fixed length, so the distance loop is vectorized by the compiler (-O2) and the search is
+ * branch free, cheap enough for screen sampling or theme sync at thousands of colors a second.
+ */
+
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include "ledcontrol.h"
+
+/**
+ * Value of a palette channel at level. The palette is what LEVEL_2 shows (see colors) and the
+ * levels are taken as an even split, the firmware does not tell: LEVEL_1 lights half of LEVEL_2,
+ * LEVEL_4 twice as much. No RGB color is brighter than 255, the brighter levels stop there.
+ */
+static constexpr int
+levelValue(int value, int level) {
+
+	return (value * (level + 1) + (LEVEL_2 + 1) / 2) / (LEVEL_2 + 1) < 255
+		? (value * (level + 1) + (LEVEL_2 + 1) / 2) / (LEVEL_2 + 1) : 255;
+}
+
+/** Distance weights of red, green and blue: the eye tells greens apart best */
+#define WEIGHT_R							2
+#define WEIGHT_G							4
+#define WEIGHT_B							3
+
+// struct for the colors x levels the controller can show, one array per channel
+struct quantizeTable {
+	int r[QUANTIZE_ENTRIES], g[QUANTIZE_ENTRIES], b[QUANTIZE_ENTRIES];
+	unsigned char color[QUANTIZE_ENTRIES], level[QUANTIZE_ENTRIES];
+};
+
+static constexpr quantizeTable
+buildQuantizeTable() {
+
+	constexpr colors palette;
+	const rgb entries[] = { palette.red, palette.orange, palette.yellow, palette.green, palette.sky,
+		palette.blue, palette.purple, palette.white };
+	quantizeTable table {};
+	int n = 0;
+
+	// Black at any level is off. It also fills the padding, a repeated entry never wins
+	for (int i = 0; i < QUANTIZE_ENTRIES; i++) {
+		table.color[i] = COLOR_BLACK;
+		table.level[i] = LEVEL_1;
+	}
+	n++;
+
+	// Brightest level first: when the brighter levels of a color stop at the same values, the
+	// first entry wins and a color as bright as it gets is set to LEVEL_4
+	for (const rgb& entry : entries) {
+		for (int level = LEVEL_4; level >= LEVEL_1; level--) {
+			table.r[n] = levelValue(entry.r, level);
+			table.g[n] = levelValue(entry.g, level);
+			table.b[n] = levelValue(entry.b, level);
+			table.color[n] = entry.color;
+			table.level[n] = level;
+			n++;
+		}
+	}
+
+	return table;
+}
+
+static_assert(1 + 8 * 4 <= QUANTIZE_ENTRIES, "QUANTIZE_ENTRIES must hold black and 8 colors at 4 levels");
+static_assert(QUANTIZE_ENTRIES % 8 == 0, "QUANTIZE_ENTRIES must be whole vectors");
+
+static constexpr quantizeTable table = buildQuantizeTable();
+
+static_assert(table.color[1 + (COLOR_SKY - COLOR_RED) * 4 + LEVEL_4 - LEVEL_3] == COLOR_SKY
+	&& table.level[1 + (COLOR_SKY - COLOR_RED) * 4 + LEVEL_4 - LEVEL_3] == LEVEL_3,
+	"levelRGB finds the entry of a color and level by position");
+static_assert(table.r[1 + (COLOR_ORANGE - COLOR_RED) * 4 + LEVEL_4 - LEVEL_2] == colors().orange.r,
+	"the palette is the LEVEL_2 entries");
+
+/**
+ * Index of the entry nearest to r, g, b.
+ */
+static inline int
+nearestEntry(int r, int g, int b) {
+
+	int keys[QUANTIZE_ENTRIES];
+
+	// The entry index goes in the low bits of each key, so the smallest key is the nearest
+	// entry and the search is a plain min reduction. 9 * 255^2 << 6 still fits an int
+	for (int i = 0; i < QUANTIZE_ENTRIES; i++) {
+		int dr = table.r[i] - r;
+		int dg = table.g[i] - g;
+		int db = table.b[i] - b;
+		keys[i] = ((WEIGHT_R * dr * dr + WEIGHT_G * dg * dg + WEIGHT_B * db * db) << 6) | i;
+	}
+
+	int best = INT_MAX;
+	for (int i = 0; i < QUANTIZE_ENTRIES; i++) {
+		best = keys[i] < best ? keys[i] : best;
+	}
+
+	return best & 0x3f;
+}
+
+static_assert(QUANTIZE_ENTRIES <= 0x40, "entry indexes must fit the 6 low bits of a key");
+
+void
+nearestColor(unsigned char r, unsigned char g, unsigned char b, unsigned char* color, unsigned char* level) {
+
+	int entry = nearestEntry(r, g, b);
+	*color = table.color[entry];
+	*level = table.level[entry];
+}
+
+void
+quantizeColors(const unsigned char* rgb, size_t count, unsigned char* colors, unsigned char* levels) {
+
+	for (size_t i = 0; i < count; i++, rgb += 3) {
+		int entry = nearestEntry(rgb[0], rgb[1], rgb[2]);
+		colors[i] = table.color[entry];
+		levels[i] = table.level[entry];
+	}
+}
+
+void
+levelRGB(unsigned char color, unsigned char level, unsigned char rgb[3]) {
+
+	// Entries go black, then each palette color at LEVEL_4 .. LEVEL_1
+	int entry = color >= COLOR_RED && color <= COLOR_WHITE && level <= LEVEL_4 ? 1 + (color - COLOR_RED) * 4 + LEVEL_4 - level : 0;
+	rgb[0] = table.r[entry];
+	rgb[1] = table.g[entry];
+	rgb[2] = table.b[entry];
+}
+
+static int
+hexDigit(char c) {
+
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	} else if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	} else if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+
+	return -1;
+}
+
+int
+parseRGB(const char* word, unsigned char rgb[3]) {
+
+	// "r,g,b" with decimal components
+	if (strchr(word, ',')) {
+		char* end;
+		for (int i = 0; i < 3; i++) {
+			long value = strtol(word, &end, 10);
+			if (end == word || value < 0 || value > 255 || *end != (i < 2 ? ',' : '\0')) {
+				return -1;
+			}
+			rgb[i] = value;
+			word = end + 1;
+		}
+		return 0;
+	}
+
+	// "rrggbb", the # is optional as it starts a comment in the shells
+	if (*word == '#') {
+		word++;
+	}
+	if (strlen(word) != 6) {
+		return -1;
+	}
+	for (int i = 0; i < 3; i++) {
+		int high = hexDigit(word[2 * i]);
+		int low = hexDigit(word[2 * i + 1]);
+		if (high < 0 || low < 0) {
+			return -1;
+		}
+		rgb[i] = high << 4 | low;
+	}
+
+	return 0;
+}
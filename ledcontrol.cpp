@@ -0,0 +1,700 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * Report encoding and params parsing, shared by the command line tool and the daemon.
+ *
+ * Christian Panadero Martinez - 2012 - Bakingcode.com - @PaNaVTEC on twitter
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "ledcontrol.h"
+#include "ledprotocol.h"
+
+/** Allowed params */
+const char* PARAM_HELP =						TEXT_PARAM_HELP;
+const char* PARAM_HELP_SHORT=						TEXT_PARAM_HELP_SHORT;
+const char* PARAM_VERS =						TEXT_PARAM_VERS;
+const char* PARAM_VERS_SHORT=						TEXT_PARAM_VERS_SHORT;
+const char* PARAM_MODE =						TEXT_PARAM_MODE;
+const char* PARAM_COLOR1 =						TEXT_PARAM_COLOR1;
+const char* PARAM_COLOR2 =						TEXT_PARAM_COLOR2;
+const char* PARAM_COLOR3 =						TEXT_PARAM_COLOR3;
+const char* PARAM_LEVEL	=						TEXT_PARAM_LEVEL;
+const char* PARAM_IDLE	=						TEXT_PARAM_IDLE;
+const char* PARAM_DAEMON =						TEXT_PARAM_DAEMON;
+const char* PARAM_FORCE =						TEXT_PARAM_FORCE;
+const char* PARAM_ALL =							TEXT_PARAM_ALL;
+const char* PARAM_PRESET =						TEXT_PARAM_PRESET;
+
+/** Allowed modes values */
+const char* VALUE_MODE_DISABLE = 					TEXT_VALUE_MODE_DISABLE;
+const char* VALUE_MODE_NORMAL = 					TEXT_VALUE_MODE_NORMAL;
+const char* VALUE_MODE_GAMING = 					TEXT_VALUE_MODE_GAMING;
+const char* VALUE_MODE_BREATHING = 					TEXT_VALUE_MODE_BREATHING;
+const char* VALUE_MODE_WAVE = 						TEXT_VALUE_MODE_WAVE;
+const char* VALUE_MODE_DUALCOLOR =					TEXT_VALUE_MODE_DUALCOLOR;
+
+/** Allowed colors values */
+const char* VALUE_COLOR_BLACK =						TEXT_VALUE_COLOR_BLACK;
+const char* VALUE_COLOR_RED	=					TEXT_VALUE_COLOR_RED;
+const char* VALUE_COLOR_ORANGE =					TEXT_VALUE_COLOR_ORANGE;
+const char* VALUE_COLOR_YELLOW =					TEXT_VALUE_COLOR_YELLOW;
+const char* VALUE_COLOR_GREEN =						TEXT_VALUE_COLOR_GREEN;
+const char* VALUE_COLOR_SKY =						TEXT_VALUE_COLOR_SKY;
+const char* VALUE_COLOR_BLUE =						TEXT_VALUE_COLOR_BLUE;
+const char* VALUE_COLOR_PURPLE =					TEXT_VALUE_COLOR_PURPLE;
+const char* VALUE_COLOR_WHITE =						TEXT_VALUE_COLOR_WHITE;
+
+/** Presets, every report encoded by the compiler */
+static constexpr preset presets[] = {
+	{ "off",	MODE_DISABLE,	disableBatch() },
+	{ "red",	MODE_NORMAL,	normalBatch(COLOR_RED, COLOR_RED, COLOR_RED, LEVEL_4) },
+	{ "orange",	MODE_NORMAL,	normalBatch(COLOR_ORANGE, COLOR_ORANGE, COLOR_ORANGE, LEVEL_4) },
+	{ "yellow",	MODE_NORMAL,	normalBatch(COLOR_YELLOW, COLOR_YELLOW, COLOR_YELLOW, LEVEL_4) },
+	{ "green",	MODE_NORMAL,	normalBatch(COLOR_GREEN, COLOR_GREEN, COLOR_GREEN, LEVEL_4) },
+	{ "sky",	MODE_NORMAL,	normalBatch(COLOR_SKY, COLOR_SKY, COLOR_SKY, LEVEL_4) },
+	{ "blue",	MODE_NORMAL,	normalBatch(COLOR_BLUE, COLOR_BLUE, COLOR_BLUE, LEVEL_4) },
+	{ "purple",	MODE_NORMAL,	normalBatch(COLOR_PURPLE, COLOR_PURPLE, COLOR_PURPLE, LEVEL_4) },
+	{ "white",	MODE_NORMAL,	normalBatch(COLOR_WHITE, COLOR_WHITE, COLOR_WHITE, LEVEL_4) },
+	{ "rgb",	MODE_NORMAL,	normalBatch(COLOR_RED, COLOR_GREEN, COLOR_BLUE, LEVEL_4) },
+	{ "dim",	MODE_NORMAL,	normalBatch(COLOR_WHITE, COLOR_WHITE, COLOR_WHITE, LEVEL_1) },
+};
+
+/** Normal and gaming mode frames with the color and level bytes left to fill */
+static constexpr reportBatch normalTemplate = normalBatch(0x00, 0x00, 0x00, 0x00);
+static constexpr reportBatch gamingTemplate = gamingBatch(0x00, 0x00);
+
+static_assert(sizeof(presets) / sizeof(presets[0]) < UCHAR_MAX, "preset indexes must fit a param value");
+static_assert(presets[0].batch.data[0][2] == OPCODE_COMMIT && presets[1].batch.count == 4, "presets are encoded at compile time");
+
+const preset*
+findPreset(const char* name) {
+
+	for (size_t i = 0; i < sizeof(presets) / sizeof(presets[0]); i++) {
+		if (strcmp(name, presets[i].name) == 0) {
+			return &presets[i];
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Writes into report the area / color and level selected.
+ */
+void
+encodeActivateArea(unsigned char* report, unsigned char modeValue, unsigned char area, unsigned char color, unsigned char level, unsigned char blue) {
+
+	// Byte stores straight into report: building a reportBytes first and copying it makes
+	// the copy wait on the narrow stores (store forwarding stall), about 3x slower
+	report[0] = REPORT_ID; // Fixed report value
+	report[1] = REPORT_PREFIX; // Fixed report value
+
+	report[2] = modeValue; // 43 = set special modes color input / 42 = set color input / 41 = confirm
+	report[3] = area; // 1 = left / 2 = middle / 3 = right
+	report[4] = color; // see color constants
+	report[5] = level; // see level constants
+	report[6] = blue; // blue component gain speed for special modes
+	report[7] = REPORT_EOR; // EOR
+	report[8] = 0x00; // padding up to REPORT_LENGTH
+}
+
+/**
+ * Writes into report the commit of the given mode.
+ */
+void
+encodeCommit(unsigned char* report, unsigned char mode) {
+
+	//CONFIRMATION. This needs to be sent for confirmate all the led operations
+	report[0] = REPORT_ID;
+	report[1] = REPORT_PREFIX;
+
+	report[2] = OPCODE_COMMIT; // commit byte
+	report[3] = mode; // current mode
+	report[4] = 0x00;
+	report[5] = 0x00;
+	report[6] = 0x00;
+	report[7] = REPORT_EOR;
+	report[8] = 0x00;
+}
+
+/**
+ * Sends to the handler the area / color and level selected. NOTE you need to commit for this applies
+ */
+int
+sendActivateArea(hid_device *handle, unsigned char modeValue, unsigned char area, unsigned char color, unsigned char level, unsigned char blue) {
+
+	unsigned char data[REPORT_LENGTH];
+	encodeActivateArea(data, modeValue, area, color, level, blue);
+
+	if (sendTransaction(handle, &data, 1) != 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Commits the lights with the modes
+ */
+int
+commit(hid_device *handle, unsigned char mode) {
+
+	unsigned char data[REPORT_LENGTH];
+	encodeCommit(data, mode);
+
+	if (sendTransaction(handle, &data, 1) != 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+batchActivateArea(reportBatch* batch, unsigned char modeValue, unsigned char area, unsigned char color, unsigned char level, unsigned char blue) {
+
+	encodeActivateArea(batch->data[batch->count++], modeValue, area, color, level, blue);
+}
+
+void
+batchCommit(reportBatch* batch, unsigned char mode) {
+
+	encodeCommit(batch->data[batch->count++], mode);
+}
+
+int
+submitBatch(hid_device *handle, const reportBatch* batch) {
+
+	return sendTransaction(handle, batch->data, batch->count);
+}
+
+/**
+ * Every word of the command line, placed by hashToken in a table with one word per slot:
+ * a lookup is one hash of at most MAX_TOKEN_LENGTH chars and one strcmp, whatever the count.
+ */
+static constexpr token tokens[] = {
+	{ TEXT_PARAM_HELP,		TOKEN_PARAM,	kParamHelp },
+	{ TEXT_PARAM_HELP_SHORT,	TOKEN_PARAM,	kParamHelp },
+	{ TEXT_PARAM_VERS,		TOKEN_PARAM,	kParamVersion },
+	{ TEXT_PARAM_VERS_SHORT,	TOKEN_PARAM,	kParamVersion },
+	{ TEXT_PARAM_MODE,		TOKEN_PARAM,	kParamMode },
+	{ TEXT_PARAM_COLOR1,		TOKEN_PARAM,	kParamColor1 },
+	{ TEXT_PARAM_COLOR2,		TOKEN_PARAM,	kParamColor2 },
+	{ TEXT_PARAM_COLOR3,		TOKEN_PARAM,	kParamColor3 },
+	{ TEXT_PARAM_LEVEL,		TOKEN_PARAM,	kParamLevel },
+	{ TEXT_PARAM_IDLE,		TOKEN_PARAM,	kParamIdle },
+	{ TEXT_PARAM_DAEMON,		TOKEN_PARAM,	kParamDaemon },
+	{ TEXT_PARAM_FORCE,		TOKEN_PARAM,	kParamForce },
+	{ TEXT_PARAM_ALL,		TOKEN_PARAM,	kParamAll },
+	{ TEXT_PARAM_PRESET,		TOKEN_PARAM,	kParamPreset },
+	{ TEXT_PARAM_ANIMATE,		TOKEN_PARAM,	kParamAnimate },
+	{ TEXT_PARAM_FPS,		TOKEN_PARAM,	kParamFps },
+	{ TEXT_PARAM_PERIOD,		TOKEN_PARAM,	kParamPeriod },
+	{ TEXT_PARAM_DURATION,		TOKEN_PARAM,	kParamDuration },
+	{ TEXT_PARAM_AMBIENT,		TOKEN_PARAM,	kParamAmbient },
+	{ TEXT_PARAM_SIZE,		TOKEN_PARAM,	kParamSize },
+	{ TEXT_PARAM_STEP,		TOKEN_PARAM,	kParamStep },
+	{ TEXT_PARAM_AUDIO,		TOKEN_PARAM,	kParamAudio },
+	{ TEXT_PARAM_COMPILE,		TOKEN_PARAM,	kParamCompile },
+	{ TEXT_PARAM_PROFILE,		TOKEN_PARAM,	kParamProfile },
+	{ TEXT_PARAM_LIBRARY,		TOKEN_PARAM,	kParamLibrary },
+	{ TEXT_PARAM_HOLD,		TOKEN_PARAM,	kParamHold },
+	{ TEXT_PARAM_TIMELINE,		TOKEN_PARAM,	kParamTimeline },
+	{ TEXT_PARAM_EASE,		TOKEN_PARAM,	kParamEase },
+	{ TEXT_PARAM_STATS,		TOKEN_PARAM,	kParamStats },
+	{ TEXT_PARAM_RETRIES,		TOKEN_PARAM,	kParamRetries },
+	{ TEXT_PARAM_TIMEOUT,		TOKEN_PARAM,	kParamTimeout },
+	{ TEXT_PARAM_QUERY,		TOKEN_PARAM,	kParamQuery },
+	{ TEXT_VALUE_MODE_DISABLE,	TOKEN_MODE,	MODE_DISABLE },
+	{ TEXT_VALUE_MODE_NORMAL,	TOKEN_MODE,	MODE_NORMAL },
+	{ TEXT_VALUE_MODE_GAMING,	TOKEN_MODE,	MODE_GAMING },
+	{ TEXT_VALUE_MODE_BREATHING,	TOKEN_MODE,	MODE_BREATHING_STD },
+	{ TEXT_VALUE_MODE_WAVE,		TOKEN_MODE,	MODE_WAVE_STD },
+	{ TEXT_VALUE_MODE_DUALCOLOR,	TOKEN_MODE,	MODE_DUAL_COLOR },
+	{ TEXT_VALUE_COLOR_BLACK,	TOKEN_COLOR,	COLOR_BLACK },
+	{ TEXT_VALUE_COLOR_RED,		TOKEN_COLOR,	COLOR_RED },
+	{ TEXT_VALUE_COLOR_ORANGE,	TOKEN_COLOR,	COLOR_ORANGE },
+	{ TEXT_VALUE_COLOR_YELLOW,	TOKEN_COLOR,	COLOR_YELLOW },
+	{ TEXT_VALUE_COLOR_GREEN,	TOKEN_COLOR,	COLOR_GREEN },
+	{ TEXT_VALUE_COLOR_SKY,		TOKEN_COLOR,	COLOR_SKY },
+	{ TEXT_VALUE_COLOR_BLUE,	TOKEN_COLOR,	COLOR_BLUE },
+	{ TEXT_VALUE_COLOR_PURPLE,	TOKEN_COLOR,	COLOR_PURPLE },
+	{ TEXT_VALUE_COLOR_WHITE,	TOKEN_COLOR,	COLOR_WHITE },
+	{ TEXT_VALUE_EFFECT_PULSE,	TOKEN_EFFECT,	EFFECT_PULSE },
+	{ TEXT_VALUE_EFFECT_CYCLE,	TOKEN_EFFECT,	EFFECT_CYCLE },
+	{ TEXT_VALUE_EFFECT_SCAN,	TOKEN_EFFECT,	EFFECT_SCAN },
+};
+
+static constexpr size_t TOKEN_COUNT = sizeof(tokens) / sizeof(tokens[0]);
+
+/**
+ * FNV-1a from TOKEN_SEED, folded down to a slot.
+ */
+static constexpr unsigned int
+hashToken(const char* word) {
+
+	unsigned int hash = TOKEN_SEED;
+	for (; *word; word++) {
+		hash = (hash ^ (unsigned char) *word) * 16777619u;
+	}
+
+	return (hash ^ (hash >> 16)) & (TOKEN_SLOTS - 1);
+}
+
+static constexpr bool
+tokensCollide() {
+
+	for (size_t i = 0; i < TOKEN_COUNT; i++) {
+		for (size_t j = 0; j < i; j++) {
+			if (hashToken(tokens[i].name) == hashToken(tokens[j].name)) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+static constexpr size_t
+longestToken() {
+
+	size_t longest = 0;
+	for (size_t i = 0; i < TOKEN_COUNT; i++) {
+		size_t length = 0;
+		while (tokens[i].name[length]) {
+			length++;
+		}
+		longest = length > longest ? length : longest;
+	}
+
+	return longest;
+}
+
+// struct for the hash table itself, so the compiler can fill it
+struct tokenTable {
+	token slots[TOKEN_SLOTS];
+};
+
+static constexpr tokenTable
+buildTokenTable() {
+
+	tokenTable table {};
+	for (size_t i = 0; i < TOKEN_COUNT; i++) {
+		table.slots[hashToken(tokens[i].name)] = tokens[i];
+	}
+
+	return table;
+}
+
+static_assert(!tokensCollide(), "two tokens share a slot, pick another TOKEN_SEED");
+static_assert(longestToken() <= MAX_TOKEN_LENGTH, "a token is longer than MAX_TOKEN_LENGTH");
+
+static constexpr tokenTable tokenSlots = buildTokenTable();
+
+const token*
+lookupToken(const char* word) {
+
+	unsigned int hash = TOKEN_SEED;
+	size_t length = 0;
+
+	// Longer words can't be tokens, stop hashing there
+	for (; word[length]; length++) {
+		if (length == MAX_TOKEN_LENGTH) {
+			return NULL;
+		}
+		hash = (hash ^ (unsigned char) word[length]) * 16777619u;
+	}
+
+	const token* slot = &tokenSlots.slots[(hash ^ (hash >> 16)) & (TOKEN_SLOTS - 1)];
+	if (!slot->name || strcmp(slot->name, word) != 0) {
+		return NULL;
+	}
+
+	return slot;
+}
+
+unsigned char
+parseColorLevel(const char* color, unsigned char* level) {
+
+	unsigned char value[3], quantized;
+
+	*level = UCHAR_MAX;
+
+	const token* t = lookupToken(color);
+	if (t && t->kind == TOKEN_COLOR) {
+		return t->value;
+	}
+
+	if (parseRGB(color, value) < 0) {
+		return UCHAR_MAX;
+	}
+	nearestColor(value[0], value[1], value[2], &quantized, level);
+
+	return quantized;
+}
+
+unsigned char
+parseColor(char* color) {
+
+	unsigned char level;
+
+	return parseColorLevel(color, &level);
+}
+
+unsigned char
+filterLevel(unsigned char color, unsigned char level)
+{
+	if (color == COLOR_BLACK || color == COLOR_WHITE) {
+		return 0;
+	}
+
+	return level;
+}
+
+unsigned char
+convertLevel(char* level) {
+
+    if (strlen(level) == 1) {
+		char clevel = *level-'0';
+		if (clevel == LEVEL_1) {
+			return LEVEL_4;
+		} else if (clevel == LEVEL_2) {
+			return LEVEL_3;
+		} else if (clevel == LEVEL_3) {
+			return LEVEL_2;
+		} else if (clevel == LEVEL_4) {
+			return LEVEL_1;
+		}
+	}
+
+	return UCHAR_MAX;
+}
+
+unsigned char
+convertIdle(char* idle) {
+
+    if (strlen(idle) == 1) {
+		char cidle = *idle-'0';
+		if (cidle == 1) {			
+			return 1; // idle
+		}
+	}
+
+	return 0; // std
+}
+
+rgb
+identifyRGBcolor(colors allowedColors, unsigned char colorN) {
+
+	if (colorN == allowedColors.red.color) {
+		return allowedColors.red;
+	} else if (colorN == allowedColors.orange.color) {
+		return allowedColors.orange;
+	} else if (colorN == allowedColors.yellow.color) {
+		return allowedColors.yellow;
+	} else if (colorN == allowedColors.green.color) {
+		return allowedColors.green;
+	} else if (colorN == allowedColors.sky.color) {
+		return allowedColors.sky;
+	} else if (colorN == allowedColors.blue.color) {
+		return allowedColors.blue;
+	} else if (colorN == allowedColors.purple.color) {
+		return allowedColors.purple;
+	} else if (colorN == allowedColors.white.color) {
+		return allowedColors.white;
+	}
+
+	return allowedColors.black;
+}
+
+
+const char*
+commandLineParam(int argc, char* argv[]) {
+
+	for (int x = 1; x < argc; x++) {
+		const token* param = argv[x][0] == '-' ? lookupToken(argv[x]) : NULL;
+		if (!param || param->kind != TOKEN_PARAM) {
+			continue;
+		}
+
+		switch (param->value) {
+		case kParamDaemon:
+		case kParamAll:
+		case kParamAnimate:
+		case kParamFps:
+		case kParamDuration:
+		case kParamAmbient:
+		case kParamSize:
+		case kParamStep:
+		case kParamAudio:
+		case kParamCompile:
+		case kParamTimeline:
+		case kParamStats:
+		case kParamRetries:
+		case kParamTimeout:
+		case kParamQuery:
+			return argv[x];
+		}
+	}
+
+	return NULL;
+}
+
+const char*
+parseArguments(int argc, char* argv[], unsigned char arguments[kSize]) {
+
+	memset(arguments, UCHAR_MAX, kSize);
+
+	// Get arguments for program
+	for (int x = 1; x < argc; x++) {
+
+		// The params needs to start with "-"
+		if (argv[x][0] == '-') {
+
+			const token* param = lookupToken(argv[x]);
+			unsigned char id = param && param->kind == TOKEN_PARAM ? param->value : UCHAR_MAX;
+
+			if (id == kParamForce) {
+
+				// Params without value
+				arguments[kForce] = 1;
+				continue;
+
+			} else if (id == kParamAll) {
+
+				arguments[kAll] = 1;
+				continue;
+
+			} else if (!argv[x + 1]) {
+
+				return "Invalid parameter(s). Use --help for more information\n\n";
+			}
+
+			switch (id) {
+
+			case kParamPreset: {
+
+				const preset* p = findPreset(argv[x + 1]);
+				if (!p) {
+					return "Unknown preset. (-preset). Use --help for more information\n\n";
+				}
+				arguments[kPreset] = p - presets;
+				arguments[kMode] = p->mode;
+				break;
+			}
+			case kParamMode: {
+
+				const token* value = lookupToken(argv[x + 1]);
+				if (value && value->kind == TOKEN_MODE) {
+					arguments[kMode] = value->value;
+				}
+				break;
+			}
+			case kParamColor1:
+
+				arguments[kColor1] = parseColorLevel(argv[x + 1], &arguments[kLevel1]);
+				break;
+
+			case kParamColor2:
+
+				arguments[kColor2] = parseColorLevel(argv[x + 1], &arguments[kLevel2]);
+				break;
+
+			case kParamColor3:
+
+				arguments[kColor3] = parseColorLevel(argv[x + 1], &arguments[kLevel3]);
+				break;
+
+			case kParamLevel:
+
+				arguments[kLevel] = convertLevel(argv[x + 1]);
+				break;
+
+			case kParamIdle:
+
+				arguments[kIdle] = convertIdle(argv[x + 1]);
+				break;
+
+			case kParamPeriod: {
+
+				double period = atof(argv[x + 1]);
+				if (!(period >= MIN_RAMP_PERIOD && period <= MAX_RAMP_PERIOD)) {
+					return "Invalid period. (-period). Use --help for more information\n\n";
+				}
+				// Whole ms, up to 60000: two bytes, as any byte could read as UCHAR_MAX
+				unsigned int periodMs = (unsigned int) (period * 1000 + 0.5);
+				arguments[kPeriod] = 1;
+				arguments[kPeriodHigh] = periodMs >> 8;
+				arguments[kPeriodLow] = periodMs & 0xff;
+				break;
+			}
+			}
+		}
+	}
+
+	// Presets carry everything
+	if (arguments[kPreset] != UCHAR_MAX) {
+		return NULL;
+	}
+
+	// Check required params
+	if (arguments[kMode] == UCHAR_MAX) {
+		return "No mode specified. (-mode). Use --help for more information\n\n";
+	}
+
+	if ((arguments[kColor1] == UCHAR_MAX && arguments[kMode] != MODE_DISABLE)
+		|| (arguments[kColor2] == UCHAR_MAX && arguments[kMode] == MODE_DUAL_COLOR)
+		|| ((arguments[kColor2] == UCHAR_MAX || arguments[kColor3] == UCHAR_MAX) && (arguments[kMode] == MODE_WAVE_STD || arguments[kMode] == MODE_BREATHING_STD))) {
+		return "No color specified. (-color1). Use --help for more information\n\n";
+	}
+
+	// RGB colors bring their own level, only the colors given by name need -level
+	bool namedColor = arguments[kLevel1] == UCHAR_MAX
+		|| (arguments[kColor2] != UCHAR_MAX && arguments[kLevel2] == UCHAR_MAX && arguments[kMode] == MODE_NORMAL)
+		|| (arguments[kColor3] != UCHAR_MAX && arguments[kLevel3] == UCHAR_MAX && arguments[kMode] == MODE_NORMAL);
+	if (arguments[kLevel] == UCHAR_MAX && namedColor && (arguments[kMode] == MODE_NORMAL || arguments[kMode] == MODE_GAMING)) {
+		return "No intensity level specified. (-level). Use --help for more information\n\n";
+	}
+
+	return NULL;
+}
+
+/**
+ * Ramp period of the -period in arguments, in ms.
+ */
+static unsigned int
+periodMs(const unsigned char arguments[kSize]) {
+
+	return arguments[kPeriodHigh] << 8 | arguments[kPeriodLow];
+}
+
+/**
+ * Level of the area whose color is at arguments[colorLevel]: -level if given, else the level
+ * its RGB color was matched to.
+ */
+static unsigned char
+areaLevel(const unsigned char arguments[kSize], int colorLevel) {
+
+	return arguments[kLevel] != UCHAR_MAX ? arguments[kLevel] : arguments[colorLevel];
+}
+
+void
+buildBatch(const unsigned char arguments[kSize], reportBatch* batch) {
+
+	batch->count = 0;
+
+	// Presets were encoded by the compiler, only copy them
+	if (arguments[kPreset] != UCHAR_MAX) {
+		*batch = presets[arguments[kPreset]].batch;
+		return;
+	}
+
+	// Check Modes
+	if (arguments[kMode] == MODE_DISABLE) {
+
+		// Disable mode = turn off keyboard led
+		*batch = disableBatch();
+
+	} else if (arguments[kMode] == MODE_NORMAL) {
+
+		*batch = normalTemplate;
+		batch->data[0][4] = arguments[kColor1];
+		batch->data[0][5] = areaLevel(arguments, kLevel1);
+
+		//Gaming mode = full keyboard illumination 
+		if (arguments[kColor3] == UCHAR_MAX && arguments[kColor2] == UCHAR_MAX) {
+
+			batch->data[1][4] = batch->data[2][4] = arguments[kColor1];
+			batch->data[1][5] = batch->data[2][5] = batch->data[0][5];
+
+		} else {
+
+			//Normal mode = full keyboard illumination, 3 colors
+			batch->data[1][4] = arguments[kColor2];
+			batch->data[2][4] = arguments[kColor3];
+			batch->data[1][5] = areaLevel(arguments, kLevel2);
+			batch->data[2][5] = areaLevel(arguments, kLevel3);
+		}
+
+	} else if (arguments[kMode] == MODE_GAMING) {
+
+		//Gaming mode = only left area on 1 color with a intensity level
+		*batch = gamingTemplate;
+		batch->data[0][4] = arguments[kColor1];
+		batch->data[0][5] = areaLevel(arguments, kLevel1);
+
+	} else if (arguments[kMode] == MODE_BREATHING_STD || arguments[kMode] == MODE_WAVE_STD) {
+
+		bool breathing = arguments[kMode] == MODE_BREATHING_STD;
+		bool idle = arguments[kIdle] == 1;
+		unsigned char mode = breathing ? (idle ? MODE_BREATHING_IDLE : MODE_BREATHING_STD) : (idle ? MODE_WAVE_IDLE : MODE_WAVE_STD);
+		unsigned int period = (unsigned int) ((breathing ? (idle ? PERIOD_BREATHING_IDLE : PERIOD_BREATHING_STD) : (idle ? PERIOD_WAVE_IDLE : PERIOD_WAVE_STD)) * 1000);
+		if (arguments[kPeriod] == 1) {
+			period = periodMs(arguments);
+		}
+
+		//Breathing and wave modes = 3 areas colors blink with a intensity level of 2, each from its color to black
+		for (int i = 0; i < 3; i++) {
+			unsigned char color = arguments[kColor1 + i];
+			unsigned char ramp[3];
+			rampBytes(period, color, COLOR_BLACK, ramp);
+			batchActivateArea(batch, OPCODE_SET_SPECIAL, AREA_LEFT + 3 * i, color, LEVEL_2, 0x00);
+			batchActivateArea(batch, OPCODE_SET_SPECIAL, AREA_MIDDLE + 3 * i, COLOR_BLACK, LEVEL_2, 0x00);
+			batchActivateArea(batch, OPCODE_SET_SPECIAL, AREA_RIGHT + 3 * i, ramp[0], ramp[1], ramp[2]);
+		}
+		batchCommit(batch, mode);
+
+	} else if (arguments[kMode] == MODE_DUAL_COLOR) {
+
+		unsigned int period = arguments[kPeriod] == 1 ? periodMs(arguments) : (unsigned int) (PERIOD_DUAL_COLOR * 1000);
+		unsigned char ramp[3];
+		rampBytes(period, arguments[kColor1], arguments[kColor2], ramp);
+
+		//Dual color mode = 2 areas colors blink with a intensity level of 2
+		for (int i = 0; i < 3; i++) {
+			batchActivateArea(batch, OPCODE_SET_SPECIAL, AREA_LEFT + 3 * i, arguments[kColor1], filterLevel(arguments[kColor1], LEVEL_2), 0x00);
+			batchActivateArea(batch, OPCODE_SET_SPECIAL, AREA_MIDDLE + 3 * i, arguments[kColor2], filterLevel(arguments[kColor2], LEVEL_2), 0x00);
+			batchActivateArea(batch, OPCODE_SET_SPECIAL, AREA_RIGHT + 3 * i, ramp[0], ramp[1], ramp[2]);
+		}
+		batchCommit(batch, MODE_DUAL_COLOR);
+	}
+}
+
+int
+applyArguments(hid_device *handle, const unsigned char arguments[kSize], keyboardState* state) {
+
+	reportBatch batch;
+
+	buildBatch(arguments, &batch);
+	if (state && arguments[kForce] == 1) {
+		resetState(state);
+	}
+
+	return applyBatch(handle, &batch, state);
+}
+
+int
+applyBatch(hid_device *handle, const reportBatch* batch, keyboardState* state) {
+
+	reportBatch changes;
+	int failed;
+
+	if (!state) {
+		return submitBatch(handle, batch);
+	}
+	if (diffBatch(state, batch, &changes) == 0) {
+		return 0;
+	}
+
+	failed = submitBatch(handle, &changes);
+	if (failed) {
+		// Unknown what the controller kept, program everything next time
+		resetState(state);
+	} else {
+		updateState(state, &changes);
+	}
+
+	return failed;
+}
@@ -0,0 +1,891 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * Protocol constants and helpers shared by the command line tool and the daemon.
+ *
+ * Christian Panadero Martinez - 2012 - Bakingcode.com - @PaNaVTEC on twitter
+ */
+
+#ifndef LEDCONTROL_H__
+#define LEDCONTROL_H__
+
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <atomic>
+#include "hidapi.h"
+
+// UCHAR_MAX marks an unset param below, not the limits.h value.
+#undef UCHAR_MAX
+
+/** Max char params */
+#define UCHAR_MAX							0x10
+
+/** Device ids */
+#define MSI_VENDOR_ID							0x1770
+#define MSI_PRODUCT_ID							0xff00
+
+/** Device paths kept, also the key of the shadow state file of a keyboard */
+#define MAX_DEVICE_PATH							256
+
+/** Keyboards driven at once by -all, and threads sending to them */
+#define MAX_KEYBOARDS							16
+#define MAX_FANOUT_WORKERS						8
+
+/** Unix socket of the daemon, in XDG_RUNTIME_DIR or else SYSTEM_RUNTIME_DIR, where no other user can create it first */
+#define SOCKET_NAME							"msiledenabler.sock"
+#define SYSTEM_RUNTIME_DIR						"/run"
+#define MAX_SOCKET_PATH							108
+
+/** Report constants. REPORT_LENGTH includes the report id */
+#define REPORT_LENGTH							9
+#define MAX_BATCH_REPORTS						10 // 9 areas + commit
+
+/** Area constants */
+#define AREA_LEFT							0x01
+#define AREA_MIDDLE							0x02
+#define AREA_RIGHT							0x03
+
+/** Color constants */
+#define COLOR_BLACK							0x00
+#define COLOR_RED							0x01
+#define COLOR_ORANGE							0x02
+#define COLOR_YELLOW							0x03
+#define COLOR_GREEN							0x04
+#define COLOR_SKY							0x05
+#define COLOR_BLUE							0x06
+#define COLOR_PURPLE							0x07
+#define COLOR_WHITE							0x08
+
+/** Level constants. High is more intense light */
+#define LEVEL_1								0x00
+#define LEVEL_2								0x01
+#define LEVEL_3								0x02
+#define LEVEL_4								0x03
+
+/** Lights modes */
+#define MODE_DISABLE							0x00
+#define MODE_NORMAL							0x01
+#define MODE_GAMING							0x02
+#define MODE_BREATHING_STD						0x03
+#define MODE_AUDIO							0x04 // not implemented by the firmware, -audio renders it on the host
+#define MODE_WAVE_STD  							0x05
+#define MODE_DUAL_COLOR							0x06
+#define MODE_OFF							0x07 // not implemented, same as MODE_DISABLE ?
+#define MODE_BREATHING_IDLE						0x08
+#define MODE_WAVE_IDLE							0x09
+
+/** Mode color change period constants */
+#define PERIOD_WAVE_STD	   						1.5
+#define PERIOD_BREATHING_STD						1
+#define PERIOD_DUAL_COLOR  						2
+#define PERIOD_WAVE_IDLE						6
+#define PERIOD_BREATHING_IDLE						5.5
+
+/** Controller colors x levels searched for the nearest match of an RGB color, padded to whole vectors */
+#define QUANTIZE_ENTRIES						40
+
+/** Ramp periods, see rampBytes. -period takes MIN..MAX_RAMP_PERIOD seconds */
+#define MIN_RAMP_PERIOD							0.1
+#define MAX_RAMP_PERIOD							60
+
+/** Host side animation effects, rendered frame by frame in normal mode */
+#define EFFECT_PULSE							0x00
+#define EFFECT_CYCLE							0x01
+#define EFFECT_SCAN							0x02
+
+/** Screen sync defaults: a 4K frame, and the frames of the generated test source */
+#define DEFAULT_AMBIENT_WIDTH						3840
+#define DEFAULT_AMBIENT_HEIGHT						2160
+#define DEFAULT_AMBIENT_ROW_STEP					2
+#define AMBIENT_TEST_FRAMES						6
+
+/** Audio analysis: FFT window and hop in samples, and the upper edges of the low and mid bands in Hz */
+#define AUDIO_FFT_SIZE							1024
+#define AUDIO_HOP_SIZE							256
+#define AUDIO_LOW_HZ							250
+#define AUDIO_MID_HZ							2000
+
+/** Compiled profile libraries, see compileProfiles. The file is little endian, like the hosts */
+#define PROFILE_MAGIC							0x3150534d // "MSP1"
+#define PROFILE_VERSION							1
+#define PROFILE_LIBRARY_NAME						"msiledenabler.profiles"
+#define MAX_PROFILE_NAME						64 // terminator included
+#define MAX_PROFILE_STEPS						0xffff
+#define MAX_PROFILE_HOLD						3600 // seconds
+
+/** Stages timed by the traced* HID wrappers. Histogram buckets are powers of 2 clock ticks */
+#define STAGE_ENUMERATE							0
+#define STAGE_OPEN							1
+#define STAGE_REPORT							2
+#define STAGE_CLOSE							3
+#define STAGE_EXIT							4
+#define STAGE_TRANSACTION						5 // a whole batch, retries included
+#define STAGE_READ							6
+#define TRACE_STAGES							7
+#define TRACE_BUCKETS							40
+#define TRACE_RING_SIZE							1024
+
+/** Write policy defaults, see sendTransaction. -retries and -timeout (ms) change them */
+#define DEFAULT_WRITE_ATTEMPTS						4
+#define DEFAULT_WRITE_BACKOFF_US					2000
+#define MAX_WRITE_BACKOFF_US						100000
+#define DEFAULT_WRITE_TIMEOUT_US					500000
+
+/** What syncState found out about the controller */
+#define SYNC_UNSUPPORTED						-1 // the firmware does not answer reads, the shadow state is trusted
+#define SYNC_KEPT							0 // it shows the mode of the shadow state, whose areas are kept
+#define SYNC_RESET							1 // it does not, the shadow state only keeps the mode read back
+
+/** Timeline keyframe transitions, see parseTimeline */
+#define EASE_STEP							0x00
+#define EASE_LINEAR							0x01
+#define EASE_SMOOTH							0x02
+
+/** Animation defaults and limits. fps in frames per second, period in seconds */
+#define DEFAULT_ANIMATION_FPS						60
+#define MIN_ANIMATION_FPS						1
+#define MAX_ANIMATION_FPS						240
+#define DEFAULT_ANIMATION_PERIOD					2
+
+/** Spelling of the words lookupToken knows, shared by the PARAM_* / VALUE_* strings and its table */
+#define TEXT_PARAM_HELP							"--help"
+#define TEXT_PARAM_HELP_SHORT						"-h"
+#define TEXT_PARAM_VERS							"--version"
+#define TEXT_PARAM_VERS_SHORT						"-v"
+#define TEXT_PARAM_MODE							"-mode"
+#define TEXT_PARAM_COLOR1						"-color1"
+#define TEXT_PARAM_COLOR2						"-color2"
+#define TEXT_PARAM_COLOR3						"-color3"
+#define TEXT_PARAM_LEVEL						"-level"
+#define TEXT_PARAM_IDLE							"-idle"
+#define TEXT_PARAM_DAEMON						"-daemon"
+#define TEXT_PARAM_FORCE						"-force"
+#define TEXT_PARAM_ALL							"-all"
+#define TEXT_PARAM_PRESET						"-preset"
+#define TEXT_PARAM_ANIMATE						"-animate"
+#define TEXT_PARAM_FPS							"-fps"
+#define TEXT_PARAM_PERIOD						"-period"
+#define TEXT_PARAM_DURATION						"-duration"
+#define TEXT_PARAM_AMBIENT						"-ambient"
+#define TEXT_PARAM_SIZE							"-size"
+#define TEXT_PARAM_STEP							"-step"
+#define TEXT_PARAM_AUDIO						"-audio"
+#define TEXT_PARAM_COMPILE						"-compile"
+#define TEXT_PARAM_PROFILE						"-profile"
+#define TEXT_PARAM_LIBRARY						"-library"
+#define TEXT_PARAM_HOLD							"-hold"
+#define TEXT_PARAM_TIMELINE						"-timeline"
+#define TEXT_PARAM_EASE							"-ease"
+#define TEXT_PARAM_STATS						"--stats"
+#define TEXT_PARAM_RETRIES						"-retries"
+#define TEXT_PARAM_TIMEOUT						"-timeout"
+#define TEXT_PARAM_QUERY						"-query"
+#define TEXT_VALUE_MODE_DISABLE						"disable"
+#define TEXT_VALUE_MODE_NORMAL						"normal"
+#define TEXT_VALUE_MODE_GAMING						"gaming"
+#define TEXT_VALUE_MODE_BREATHING					"breathing"
+#define TEXT_VALUE_MODE_WAVE						"wave"
+#define TEXT_VALUE_MODE_DUALCOLOR					"dualcolor"
+#define TEXT_VALUE_COLOR_BLACK						"black"
+#define TEXT_VALUE_COLOR_RED						"red"
+#define TEXT_VALUE_COLOR_ORANGE						"orange"
+#define TEXT_VALUE_COLOR_YELLOW						"yellow"
+#define TEXT_VALUE_COLOR_GREEN						"green"
+#define TEXT_VALUE_COLOR_SKY						"sky"
+#define TEXT_VALUE_COLOR_BLUE						"blue"
+#define TEXT_VALUE_COLOR_PURPLE						"purple"
+#define TEXT_VALUE_COLOR_WHITE						"white"
+#define TEXT_VALUE_EFFECT_PULSE						"pulse"
+#define TEXT_VALUE_EFFECT_CYCLE						"cycle"
+#define TEXT_VALUE_EFFECT_SCAN						"scan"
+
+/** Allowed params */
+extern const char* PARAM_HELP;
+extern const char* PARAM_HELP_SHORT;
+extern const char* PARAM_VERS;
+extern const char* PARAM_VERS_SHORT;
+extern const char* PARAM_MODE;
+extern const char* PARAM_COLOR1;
+extern const char* PARAM_COLOR2;
+extern const char* PARAM_COLOR3;
+extern const char* PARAM_LEVEL;
+extern const char* PARAM_IDLE;
+extern const char* PARAM_DAEMON;
+extern const char* PARAM_FORCE;
+extern const char* PARAM_ALL;
+extern const char* PARAM_PRESET;
+extern const char* PARAM_ANIMATE;
+extern const char* PARAM_FPS;
+extern const char* PARAM_PERIOD;
+extern const char* PARAM_DURATION;
+extern const char* PARAM_AMBIENT;
+extern const char* PARAM_SIZE;
+extern const char* PARAM_STEP;
+extern const char* PARAM_AUDIO;
+extern const char* PARAM_COMPILE;
+extern const char* PARAM_PROFILE;
+extern const char* PARAM_LIBRARY;
+extern const char* PARAM_HOLD;
+extern const char* PARAM_TIMELINE;
+extern const char* PARAM_EASE;
+extern const char* PARAM_STATS;
+extern const char* PARAM_RETRIES;
+extern const char* PARAM_TIMEOUT;
+extern const char* PARAM_QUERY;
+extern const char* PARAM_GROUP;
+
+/** Allowed modes values */
+extern const char* VALUE_MODE_DISABLE;
+extern const char* VALUE_MODE_NORMAL;
+extern const char* VALUE_MODE_GAMING;
+extern const char* VALUE_MODE_BREATHING;
+extern const char* VALUE_MODE_WAVE;
+extern const char* VALUE_MODE_DUALCOLOR;
+
+/** Allowed effects values */
+extern const char* VALUE_EFFECT_PULSE;
+extern const char* VALUE_EFFECT_CYCLE;
+extern const char* VALUE_EFFECT_SCAN;
+
+/** Allowed colors values */
+extern const char* VALUE_COLOR_BLACK;
+extern const char* VALUE_COLOR_RED;
+extern const char* VALUE_COLOR_ORANGE;
+extern const char* VALUE_COLOR_YELLOW;
+extern const char* VALUE_COLOR_GREEN;
+extern const char* VALUE_COLOR_SKY;
+extern const char* VALUE_COLOR_BLUE;
+extern const char* VALUE_COLOR_PURPLE;
+extern const char* VALUE_COLOR_WHITE;
+
+
+/** Token kinds, see lookupToken */
+#define TOKEN_PARAM							0x01
+#define TOKEN_MODE							0x02
+#define TOKEN_COLOR							0x03
+#define TOKEN_EFFECT							0x04
+
+/** Token hash table. TOKEN_SEED was searched so that no two tokens share a slot */
+#define TOKEN_SLOTS							128
+#define TOKEN_SEED							77823
+#define MAX_TOKEN_LENGTH						16
+
+// enum for the params known by lookupToken
+enum paramIds {
+	kParamHelp,
+	kParamVersion,
+	kParamMode,
+	kParamColor1,
+	kParamColor2,
+	kParamColor3,
+	kParamLevel,
+	kParamIdle,
+	kParamDaemon,
+	kParamForce,
+	kParamAll,
+	kParamPreset,
+	kParamAnimate,
+	kParamFps,
+	kParamPeriod,
+	kParamDuration,
+	kParamAmbient,
+	kParamSize,
+	kParamStep,
+	kParamAudio,
+	kParamCompile,
+	kParamProfile,
+	kParamLibrary,
+	kParamHold,
+	kParamTimeline,
+	kParamEase,
+	kParamStats,
+	kParamRetries,
+	kParamTimeout,
+	kParamQuery,
+};
+
+// struct for a known command line word: its kind and the param id, mode, color or effect it stands for
+struct token {
+	const char* name;
+	unsigned char kind;
+	unsigned char value;
+};
+
+// enum for array param values positions
+enum values {
+	kMode,
+	kColor1,
+	kColor2,
+	kColor3,
+	kLevel,
+	kIdle,
+	kForce,
+	kAll,
+	kPreset,
+	kLevel1, // levels matched to -color1..3 given as RGB, used when there is no -level
+	kLevel2,
+	kLevel3,
+	kPeriod, // 1 when -period was given, its ms in kPeriodHigh / kPeriodLow
+	kPeriodHigh,
+	kPeriodLow,
+	kSize,
+};
+
+// struct for RedGreenBlue color model
+struct rgb {
+	constexpr rgb() : color(COLOR_BLACK), r(0), g(0), b(0) {}
+	constexpr rgb(unsigned char color, unsigned char r, unsigned char g, unsigned char b) : color(color), r(r), g(g), b(b) {}
+	unsigned char color, r, g, b;
+	void setRGBvalues(rgb rgbColor) {
+		color = rgbColor.color;
+		r = rgbColor.r;
+		g = rgbColor.g;
+		b = rgbColor.b;
+	}
+};
+
+// struct for colors defined with RGB values at intensity LEVEL_2
+struct colors {
+	constexpr colors() : black(COLOR_BLACK, 0, 0, 0), red(COLOR_RED, 255, 0, 0),
+				orange(COLOR_ORANGE, 187, 112, 0), yellow(COLOR_YELLOW, 238, 238, 0),
+				green(COLOR_GREEN, 176, 255, 0), sky(COLOR_SKY, 0, 255, 255),
+				blue(COLOR_BLUE, 0, 0, 255), purple(COLOR_PURPLE, 48, 0, 255),
+				white(COLOR_WHITE, 176, 255, 176) {}
+	const rgb black, red, orange, yellow, green, sky, blue, purple, white;
+};
+
+// struct for a whole keyboard state encoded as contiguous feature reports
+struct reportBatch {
+	unsigned char count;
+	unsigned char data[MAX_BATCH_REPORTS][REPORT_LENGTH];
+};
+
+/** Area registers tracked by the shadow state (3 areas x 3 for the special modes) */
+#define STATE_AREAS							(MAX_BATCH_REPORTS - 1)
+
+// struct for the last committed state of the controller: the last report sent per area
+struct keyboardState {
+	unsigned int magic;
+	unsigned char valid;
+	unsigned char mode;
+	unsigned short areaMask;
+	unsigned char areas[STATE_AREAS][REPORT_LENGTH];
+};
+
+// struct for a host side animation, as filled by parseAnimation
+struct animation {
+	unsigned char effect;
+	unsigned char colors[3];
+	unsigned char level;
+	int fps;
+	double period;
+	double duration; // seconds, 0 runs until stopAnimation
+};
+
+// struct for what the frame scheduler measured. Jitter is how late each frame woke up
+struct frameStats {
+	unsigned long long frames, dropped, sent, failed;
+	double elapsed, meanJitterUs, maxJitterUs;
+};
+
+// Renders one frame of a host side effect, elapsed seconds after its start
+typedef void (*frameRenderer)(void* context, double elapsed, unsigned char colors[3], unsigned char levels[3]);
+
+// struct for the screen frames followed by -ambient: 32 bit BGRX pixels, rows stride bytes apart
+struct ambient {
+	int width, height;
+	size_t stride;
+	int rowStep; // only every rowStep rows are sampled
+	int fps;
+	double duration;
+
+	unsigned char* frames; // frame n starts at frames + n % frameCount * frameOffset
+	size_t frameCount, frameOffset;
+	size_t mappedLength; // 0 when the frames were generated (test source)
+	unsigned long long next;
+};
+
+// struct for how refused feature reports are retried, see sendTransaction
+struct writePolicy {
+	int attempts; // tries per transaction, the first one included
+	unsigned int backoffUs; // before the first retry, doubled for each next one
+	unsigned int maxBackoffUs;
+	unsigned int timeoutUs; // no retry starts after this long
+};
+
+// struct for what the write policy did since the start
+struct writeStats {
+	unsigned long long transactions, retries, abandoned;
+};
+
+// struct for a reports batch a timeline sends at seconds from its start
+struct timelineCue {
+	double at;
+	reportBatch batch;
+};
+
+// struct for a timeline compiled by parseTimeline: its cues in time order, fades already
+// sampled at fps and quantized, consecutive equal batches merged
+struct timeline {
+	timelineCue* cues;
+	size_t count;
+	int fps;
+	double duration; // time of the last keyframe
+};
+
+// struct for what runTimeline measured. Lateness is how long after its deadline a cue was
+// sent, a cue is missed when that is over half a frame; skipped cues were overtaken by the next
+struct timelineStats {
+	unsigned long long cues, sent, missed, skipped, failed;
+	double elapsed, meanLatenessUs, maxLatenessUs, worstAt;
+};
+
+// struct for the 16 bit PCM followed by -audio, from a WAV file or a WAV stream on stdin
+struct audio {
+	int fd;
+	bool paced; // files are read at the speed they would play, pipes as they come
+	unsigned int sampleRate;
+	unsigned short channels;
+	unsigned char colors[3];
+	double duration;
+};
+
+// struct for what -audio measured. Latency is from reading the last sample of a window to its
+// areas reaching the device
+struct audioStats {
+	unsigned long long analyses, skipped, sent, failed;
+	double elapsed, meanAnalysisUs, meanLatencyMs, maxLatencyMs;
+};
+
+// struct for the reports waiting for the writer thread of an async queue: one slot per area
+// register and one for the commit, so a newer write to a register replaces the queued one.
+// A slot holds the bytes that differ between reports (see ledqueue.cpp), 0 when empty
+struct reportQueue {
+	hid_device *handle;
+	keyboardState* state; // may be NULL, then every report is sent
+
+	pthread_t writer;
+	int wakeFds[2]; // the writer sleeps on the read end until a producer writes a byte
+	std::atomic<unsigned int> areas[STATE_AREAS];
+	std::atomic<unsigned int> commit;
+	std::atomic<bool> asleep, busy, stop;
+	std::atomic<unsigned long long> queued, superseded;
+
+	pthread_mutex_t mutex; // for flushQueue only, producers never take it
+	pthread_cond_t idle;
+	unsigned long long sent, failed; // written by the writer, read them after flushQueue
+};
+
+// struct for the header of a compiled profile library. Offsets are from the start of the file
+struct profileHeader {
+	unsigned int magic;
+	unsigned short version;
+	unsigned short stepSize; // sizeof(profileStep) of the compiler that wrote it
+	unsigned int profileCount, stepCount;
+	unsigned int entriesOffset, stepsOffset, namesOffset;
+	unsigned int length;
+};
+
+// struct for a profile in the index of a library, sorted by name hash then name
+struct profileEntry {
+	unsigned int hash;
+	unsigned int nameOffset; // from namesOffset, not terminated
+	unsigned short nameLength, stepCount;
+	unsigned int firstStep;
+};
+
+// struct for one step of a profile: its reports, encoded when the library was compiled, and
+// how long they stay before the next step
+struct profileStep {
+	unsigned int holdMs;
+	reportBatch batch;
+	unsigned char reserved;
+};
+
+// struct for a library mapped read only by openLibrary. Nothing of it is copied to the heap
+struct profileLibrary {
+	char path[512];
+	const unsigned char* base;
+	size_t length;
+	unsigned long long device, inode; // of the mapped file, compileProfiles always writes a new one
+	const profileHeader* header;
+	const profileEntry* entries;
+	const profileStep* steps;
+	const char* names;
+};
+
+// struct for the -profile and -compile params, as filled by parseProfile
+struct profileRequest {
+	const char* name; // -profile
+	const char* source; // -compile
+	const char* library; // -library, NULL for the default library
+	bool force;
+};
+
+// struct for the -daemon params, as filled by parseDaemon
+struct daemonOptions {
+	char socketPath[MAX_SOCKET_PATH];
+	const char* group; // -group allowed to connect, NULL for the user of the daemon only
+	char library[512]; // -library, the only one -profile lines may use
+};
+
+// struct for one of the keyboards driven by a fanout, with what the last apply did on it
+struct fanoutKeyboard {
+	hid_device *handle;
+	char path[MAX_DEVICE_PATH];
+	char serial[64];
+	keyboardState state;
+	int sent, failed;
+	double latencyUs;
+};
+
+// struct for every matching keyboard and the worker threads that send to them
+struct fanout {
+	int count;
+	fanoutKeyboard keyboards[MAX_KEYBOARDS];
+	reportBatch batch;
+	bool force;
+
+	int workers;
+	pthread_t threads[MAX_FANOUT_WORKERS];
+	pthread_mutex_t mutex; // protects everything below
+	pthread_cond_t start, done;
+	unsigned long generation;
+	int next, finished;
+	bool stop;
+};
+
+/**
+ * The hidapi calls, timed: what each call took goes to the histograms of formatTrace. The
+ * tool only goes through these. tracedOpen opens the first device like hid_open, by its
+ * path, and writes that path into path (may be NULL).
+ */
+hid_device_info* tracedEnumerate(unsigned short vendorId, unsigned short productId);
+hid_device* tracedOpen(unsigned short vendorId, unsigned short productId, char* path, size_t length);
+hid_device* tracedOpenPath(const char* path);
+int tracedSend(hid_device* handle, const unsigned char* report, size_t length);
+int tracedRead(hid_device* handle, unsigned char* report, size_t length);
+void tracedClose(hid_device* handle);
+void tracedExit();
+
+/**
+ * Monotonic clock ticks (the TSC on x86), and the recording of an operation of a STAGE_* that
+ * started at the start ticks.
+ */
+unsigned long long traceClock();
+void traceRecord(int stage, unsigned long long start);
+
+/**
+ * Writes into buffer the count, mean, p50, p99 and max of every stage seen so far, in us, their
+ * histograms and the retries of the write policy. Returns the length written, at most length - 1.
+ */
+size_t formatTrace(char* buffer, size_t length);
+
+/**
+ * Sends count reports in order as one transaction: the first refused report stops it, and the
+ * whole transaction is sent again with the write policy. Returns how many reports were not
+ * sent by the last try, 0 on success. Every feature report of the tool goes through it.
+ */
+int sendTransaction(hid_device *handle, const unsigned char (*reports)[REPORT_LENGTH], int count);
+
+/**
+ * The write policy of every transaction from now on. Set it before any thread writes.
+ */
+void setWritePolicy(const writePolicy* p);
+void getWritePolicy(writePolicy* p);
+void getWriteStats(writeStats* stats);
+
+/**
+ * Writes one report (REPORT_LENGTH bytes) into report.
+ */
+void encodeActivateArea(unsigned char* report, unsigned char modeValue, unsigned char area, unsigned char color, unsigned char level, unsigned char blue);
+void encodeCommit(unsigned char* report, unsigned char mode);
+
+/**
+ * Appends one report to batch. The batch must have been emptied (count = 0) first.
+ */
+void batchActivateArea(reportBatch* batch, unsigned char modeValue, unsigned char area, unsigned char color, unsigned char level, unsigned char blue);
+void batchCommit(reportBatch* batch, unsigned char mode);
+
+/**
+ * Sends every report of batch back to back, as one transaction (see sendTransaction).
+ * Returns the number of reports not sent.
+ */
+int submitBatch(hid_device *handle, const reportBatch* batch);
+
+/**
+ * Sends to the handler the area / color and level selected. NOTE you need to commit for this applies.
+ * Returns -1 if the report could not be sent.
+ */
+int sendActivateArea(hid_device *handle, unsigned char modeValue, unsigned char area, unsigned char color, unsigned char level, unsigned char blue);
+
+/**
+ * Commits the lights with the modes. Returns -1 if the report could not be sent.
+ */
+int commit(hid_device *handle, unsigned char mode);
+
+/**
+ * Finds word among the params, modes, colors and effects in constant time. NULL if it is none.
+ */
+const token* lookupToken(const char* word);
+
+/**
+ * Color names, "rrggbb" / "#rrggbb" hex or "r,g,b". An RGB color is mapped to the nearest
+ * controller color and level, and the level is stored in level (UCHAR_MAX for names).
+ * Returns UCHAR_MAX when color is none of these.
+ */
+unsigned char parseColorLevel(const char* color, unsigned char* level);
+unsigned char parseColor(char* color);
+
+/**
+ * Reads "rrggbb", "#rrggbb" or "r,g,b" into rgb[3]. Returns -1 if word is none of these.
+ */
+int parseRGB(const char* word, unsigned char rgb[3]);
+
+/**
+ * Nearest controller color and level for each of the count colors of rgb (3 bytes each).
+ */
+void quantizeColors(const unsigned char* rgb, size_t count, unsigned char* colors, unsigned char* levels);
+void nearestColor(unsigned char r, unsigned char g, unsigned char b, unsigned char* color, unsigned char* level);
+
+/**
+ * RGB color a controller color shows at a level, as nearestColor sees it.
+ */
+void levelRGB(unsigned char color, unsigned char level, unsigned char rgb[3]);
+unsigned char filterLevel(unsigned char color, unsigned char level);
+unsigned char convertLevel(char* level);
+unsigned char convertIdle(char* idle);
+rgb identifyRGBcolor(colors allowedColors, unsigned char colorN);
+unsigned char computeRampSpeed(double leftColor, double rightColor, double period);
+
+/**
+ * Ramp bytes (r, g, b) from one palette color to another over periodMs, copied into ramp. The
+ * tables of the PERIOD_* constants are built by the compiler, the ones of other periods once
+ * and cached. Safe from any thread.
+ */
+void rampBytes(unsigned int periodMs, unsigned char from, unsigned char to, unsigned char ramp[3]);
+
+/**
+ * Parses the command line params (argv[0] is skipped) into arguments[kSize] and checks the
+ * ones required by the selected mode. Returns NULL on success or the error message to show.
+ */
+const char* parseArguments(int argc, char* argv[], unsigned char arguments[kSize]);
+
+/**
+ * The first param of argv that only main() of the command line handles (-all, -animate,
+ * -daemon, -retries...), which parseArguments skips. NULL if there is none.
+ */
+const char* commandLineParam(int argc, char* argv[]);
+
+/**
+ * Encodes the reports for the mode in arguments (as filled by parseArguments), commit included.
+ */
+void buildBatch(const unsigned char arguments[kSize], reportBatch* batch);
+
+/**
+ * Sends the reports for the mode in arguments (as filled by parseArguments) and commits them.
+ * With a state, only the areas that differ from it are sent (nothing at all if none does)
+ * and the state is updated. Returns the number of reports the device refused.
+ */
+int applyArguments(hid_device *handle, const unsigned char arguments[kSize], keyboardState* state);
+
+/**
+ * Sends batch (commit included) like applyArguments: with a state, only what differs from it.
+ * Returns the number of reports the device refused.
+ */
+int applyBatch(hid_device *handle, const reportBatch* batch, keyboardState* state);
+
+/**
+ * Shadow state. load/save keep it in a directory of the user between runs (see statePath),
+ * one file per device path, so each keyboard and backend has its own. They return -1 on failure.
+ */
+void resetState(keyboardState* state);
+int loadState(const char* device, keyboardState* state);
+int saveState(const char* device, const keyboardState* state);
+
+/**
+ * Reads back the last report the controller took (hid_get_feature_report) and checks state
+ * against it: while the controller shows the committed mode of state, its areas are kept, so
+ * the next apply only sends what differs; otherwise state is reset to the mode read back, or
+ * to nothing when the controller took no report since it was powered. Returns a SYNC_* value.
+ */
+int syncState(hid_device *handle, keyboardState* state);
+
+/**
+ * Writes into buffer the mode and area colors of state, as syncState left it. Returns the
+ * length written, at most length - 1.
+ */
+size_t formatState(const keyboardState* state, int sync, char* buffer, size_t length);
+
+/**
+ * Copies into changes the reports of full that differ from state, plus the commit if any
+ * does. Returns changes->count, 0 when the device already shows full.
+ */
+int diffBatch(const keyboardState* state, const reportBatch* full, reportBatch* changes);
+void updateState(keyboardState* state, const reportBatch* sent);
+
+/**
+ * Async submission: queueBatch / queueArea / queueCommit only store the reports into q and
+ * return, one writer thread sends them. A report for a register still queued replaces it, so
+ * the keyboard never lags behind the latest state however fast the producers are. Any number
+ * of threads may queue, without locks: they never wait for the writer or each other. With a
+ * state, the writer only sends what differs from it. openQueue returns -1 if the writer could
+ * not be started.
+ */
+int openQueue(reportQueue* q, hid_device *handle, keyboardState* state);
+void queueBatch(reportQueue* q, const reportBatch* batch);
+void queueArea(reportQueue* q, unsigned char modeValue, unsigned char area, unsigned char color, unsigned char level, unsigned char blue);
+void queueCommit(reportQueue* q, unsigned char mode);
+
+/**
+ * Waits until everything queued so far was sent. closeQueue flushes and stops the writer.
+ */
+void flushQueue(reportQueue* q);
+void closeQueue(reportQueue* q);
+
+/**
+ * Parses the -animate params into anim. Returns NULL on success or the error message to show.
+ */
+const char* parseAnimation(int argc, char* argv[], animation* anim);
+
+/**
+ * Colors and levels of the three areas elapsed seconds into the animation.
+ */
+void renderFrame(const animation* anim, double elapsed, unsigned char colors[3], unsigned char levels[3]);
+
+/**
+ * Renders anim at anim->fps on absolute monotonic deadlines until its duration is over or
+ * stopAnimation is called (safe from a signal handler). Late frames are dropped, not queued.
+ * Only areas that differ from state are sent. Returns -1 if any frame could not be sent.
+ */
+int runAnimation(hid_device *handle, const animation* anim, keyboardState* state, frameStats* stats);
+void stopAnimation();
+
+/**
+ * The frame scheduler behind runAnimation, for any renderer: calls render for each frame due
+ * at fps with the seconds since the start, until duration (0 for ever) or stopAnimation.
+ */
+int runFrames(hid_device *handle, int fps, double duration, frameRenderer render, void* context, keyboardState* state, frameStats* stats);
+
+/**
+ * Sleeps until deadline, in ns of the CLOCK_MONOTONIC clock, or until *stop is set by a signal
+ * handler (stop may be NULL). Absolute, so the time spent before the call does not add up.
+ */
+void sleepUntil(double deadline, const volatile sig_atomic_t* stop);
+
+/**
+ * Parses the -timeline params, reads the keyframes of its file and compiles them into tl.
+ * Returns NULL on success or the error message to show, with the line it is about.
+ * closeTimeline frees the cues.
+ */
+const char* parseTimeline(int argc, char* argv[], timeline* tl);
+void closeTimeline(timeline* tl);
+
+/**
+ * Sends the cues of tl on absolute monotonic deadlines from the start, so the time spent
+ * sending never adds up, until the last one or stopTimeline (safe from a signal handler).
+ * Only areas that differ from state are sent. Returns -1 if any cue could not be sent.
+ */
+int runTimeline(hid_device *handle, const timeline* tl, keyboardState* state, timelineStats* stats);
+void stopTimeline();
+
+/**
+ * Parses the -ambient params into amb and opens its source. Returns NULL on success or the
+ * error message to show. closeAmbient releases the source.
+ */
+const char* parseAmbient(int argc, char* argv[], ambient* amb);
+void closeAmbient(ambient* amb);
+
+/**
+ * Average color of the left, middle and right thirds of a BGRX frame whose rows are stride
+ * bytes apart, sampling every rowStep rows, into rgb[9] (r, g, b of each area).
+ */
+void reduceFrame(const unsigned char* frame, int width, int height, size_t stride, int rowStep, unsigned char rgb[9]);
+
+/**
+ * Samples the source of amb at amb->fps, like runAnimation, sending the colors of the screen.
+ */
+int runAmbient(hid_device *handle, ambient* amb, keyboardState* state, frameStats* stats);
+
+/**
+ * Parses the -audio params into a and reads the WAV header of its source. Returns NULL on
+ * success or the error message to show. closeAudio closes the source.
+ */
+const char* parseAudio(int argc, char* argv[], audio* a);
+void closeAudio(audio* a);
+
+/**
+ * Splits the signal of a in low, mid and high bands on an analysis thread and shows them on the
+ * left, middle and right areas as they come, until the input ends, duration is over or stopAudio.
+ * Returns -1 if any update could not be sent.
+ */
+int runAudio(hid_device *handle, const audio* a, keyboardState* state, audioStats* stats);
+void stopAudio();
+
+/**
+ * Parses the -profile / -compile params into request. Returns NULL on success or the error
+ * message to show.
+ */
+const char* parseProfile(int argc, char* argv[], profileRequest* request);
+
+/**
+ * Compiles the profiles of the text file at sourcePath into the library at libraryPath, every
+ * step encoded into its reports. Stores how many profiles were compiled in count. Returns NULL
+ * on success or the error message to show, with the line it is about.
+ */
+const char* compileProfiles(const char* sourcePath, const char* libraryPath, int* count);
+
+/**
+ * Path of the library used when there is no -library.
+ */
+void defaultLibraryPath(char* path, size_t length);
+
+/**
+ * Maps the library at path into lib, which must be zeroed before its first use. A lib that
+ * already maps that file, unchanged since, is kept as is. Returns -1 if it is missing or not
+ * a library. closeLibrary unmaps it.
+ */
+int openLibrary(profileLibrary* lib, const char* path);
+void closeLibrary(profileLibrary* lib);
+
+/**
+ * Binary search of name in the index of lib. NULL if it is none or its steps are damaged.
+ */
+const profileEntry* findProfile(const profileLibrary* lib, const char* name);
+
+/**
+ * Sends the steps of profile one after the other, each after the hold of the previous one, on
+ * absolute monotonic deadlines. Returns the number of reports the device refused.
+ */
+int applyProfile(hid_device *handle, const profileLibrary* lib, const profileEntry* profile, keyboardState* state);
+
+/**
+ * Opens every enumerated MSI keyboard by path, each with the state a run left for its path
+ * checked against it (loadState, syncState), and starts the workers. Returns how many were opened.
+ */
+int openFanout(fanout* f);
+
+/**
+ * Encodes arguments once and sends to every keyboard in parallel, each only what differs from
+ * its own shadow state. Per keyboard results are left in f->keyboards. Returns the reports refused.
+ */
+int applyFanout(fanout* f, const unsigned char arguments[kSize]);
+
+/**
+ * Saves the state of each keyboard for its path (saveState), stops the workers and closes them.
+ */
+void closeFanout(fanout* f);
+
+/**
+ * Fills options from the -daemon params: the socket path, -group and -library. Returns NULL or the error.
+ */
+const char* parseDaemon(int argc, char* argv[], daemonOptions* options);
+void defaultSocketPath(char* path, size_t length);
+
+/**
+ * Runs the led daemon: keeps the device open and applies the commands received on the
+ * unix socket of options. Only returns on error or when asked to stop.
+ */
+int runDaemon(const daemonOptions* options);
+
+#endif
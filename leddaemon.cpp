@@ -0,0 +1,545 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * Daemon mode: the device is opened once and every line received on a unix socket is
+ * applied with only the feature report writes, instead of paying the process start,
+ * the enumeration and the open on each color change.
+ *
+ * Protocol: one command per line with the same params as the command line, e.g.
+ * "-mode normal -color1 red -level 0". Each line is answered with "ok" or "error: <reason>".
+ * Clients may keep the connection open and send as many lines as they want.
+ * "-profile <name>" sends a compiled profile of the library the daemon was started with; the
+ * library stays mapped and is mapped again when it was recompiled. Multi step profiles are
+ * answered after their last step.
+ * "--stats" is answered with the latency histograms of the HID operations of the daemon so far,
+ * then "ok". "-query" reads the mode back from the keyboard and is answered with it and the area
+ * colors of the shadow state, then "ok".
+ *
+ * The shadow state starts from the file the last command line run left for the same device,
+ * checked against the mode read back each time the device is opened (see syncState): a keyboard
+ * that kept its state gets only the changes from the first command on, one that was reset gets
+ * everything.
+ *
+ * The daemon usually runs as root to reach the device. Its socket lives in XDG_RUNTIME_DIR or
+ * /run, where other users can't create it first, and only its user may connect unless -group
+ * names the group allowed to. The library is the daemon's own: a client can't make it map
+ * another file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <grp.h>
+#include "ledcontrol.h"
+
+/** Daemon limits */
+#define MAX_CLIENTS							16
+#define MAX_COMMAND							512
+#define MAX_TOKENS							32
+#define MAX_OUTPUT							32768
+
+// struct for a connected client, its partial line and the replies it did not read yet. A client
+// whose replies no longer fit is dropped, the others and the keyboard never wait for it
+struct client {
+	int fd;
+	bool dropped;
+	size_t used;
+	char buffer[MAX_COMMAND];
+	size_t pending;
+	char output[MAX_OUTPUT];
+};
+
+const char* PARAM_GROUP =						"-group";
+
+static volatile sig_atomic_t stopRequested = 0;
+static const daemonOptions* options;
+static keyboardState state;
+static char stateDevice[MAX_DEVICE_PATH]; // device the state in memory is about, empty before the first open
+static profileLibrary library;
+
+static void
+onStopSignal(int signal) {
+
+	stopRequested = 1;
+}
+
+/**
+ * Splits line on blanks into argv (argv[0] is the program name, as parseArguments expects).
+ * Returns argc.
+ */
+static int
+tokenize(char* line, char* argv[], int maxTokens) {
+
+	static char programName[] = "msiledenabler";
+	char* saveptr = NULL;
+	int argc = 0;
+
+	argv[argc++] = programName;
+	for (char* token = strtok_r(line, " \t\r", &saveptr); token && argc < maxTokens - 1; token = strtok_r(NULL, " \t\r", &saveptr)) {
+		argv[argc++] = token;
+	}
+	argv[argc] = NULL;
+
+	return argc;
+}
+
+/**
+ * Sends the parsed command: the profile when there is one, else arguments. Returns the
+ * number of reports the device refused.
+ */
+static int
+sendCommand(hid_device *handle, const unsigned char arguments[kSize], const profileEntry* profile) {
+
+	if (profile) {
+		return applyProfile(handle, &library, profile, &state);
+	}
+
+	return applyArguments(handle, arguments, &state);
+}
+
+/**
+ * Opens the first keyboard into handle. When it is another device than the one of the state in
+ * memory, that state is saved for its device and the one kept for the new device is loaded.
+ * Returns what syncState found out, -2 if no keyboard could be opened.
+ */
+static int
+openDevice(hid_device **handle) {
+
+	char path[MAX_DEVICE_PATH];
+
+	*handle = tracedOpen(MSI_VENDOR_ID, MSI_PRODUCT_ID, path, sizeof(path));
+	if (!*handle) {
+		return -2;
+	}
+
+	if (strcmp(path, stateDevice) != 0) {
+		if (stateDevice[0]) {
+			saveState(stateDevice, &state);
+		}
+		loadState(path, &state);
+		snprintf(stateDevice, sizeof(stateDevice), "%s", path);
+	}
+
+	return syncState(*handle, &state);
+}
+
+/**
+ * Applies one command line on the (lazily opened) device. Returns NULL on success or the error.
+ */
+static const char*
+runCommand(hid_device **handle, char* line) {
+
+	char* argv[MAX_TOKENS];
+	unsigned char arguments[kSize];
+	const profileEntry* profile = NULL;
+	const char* error;
+
+	int argc = tokenize(line, argv, MAX_TOKENS);
+	if (argc < 3) {
+		return "Invalid parameter(s). Use --help for more information\n";
+	}
+
+	if (strcmp(argv[1], PARAM_PROFILE) == 0) {
+		profileRequest request;
+
+		error = parseProfile(argc, argv, &request);
+		if (error) {
+			return error;
+		}
+		if (request.library && strcmp(request.library, options->library) != 0) {
+			return "The library is set when the daemon starts. (-daemon -library)\n";
+		}
+		if (openLibrary(&library, options->library) < 0) {
+			return "Unable to open the profile library.\n";
+		}
+		profile = findProfile(&library, request.name);
+		if (!profile) {
+			return "Unknown profile. (-profile)\n";
+		}
+		if (request.force) {
+			resetState(&state);
+		}
+	} else {
+		// Parsed but ignored by parseArguments, they would apply a plain state and answer ok
+		const char* param = commandLineParam(argc, argv);
+		if (param) {
+			static char message[96];
+			snprintf(message, sizeof(message), "%.32s is only available on the command line.\n", param);
+			return message;
+		}
+		error = parseArguments(argc, argv, arguments);
+		if (error) {
+			return error;
+		}
+	}
+
+	if (!*handle && openDevice(handle) < SYNC_UNSUPPORTED) {
+		return "Unable to open MSI Led device.\n";
+	}
+
+	errno = 0;
+	if (sendCommand(*handle, arguments, profile) == 0) {
+		return NULL;
+	}
+
+	// Refused reports were already retried by the write policy. Only a keyboard that went
+	// away (replugged, resumed) is worth a reopen, once
+	if (errno != ENODEV && errno != EIO) {
+		return "Unable to send a feature report.\n";
+	}
+	tracedClose(*handle);
+	if (openDevice(handle) < SYNC_UNSUPPORTED) {
+		return "Unable to open MSI Led device.\n";
+	}
+	if (sendCommand(*handle, arguments, profile) != 0) {
+		return "Unable to send a feature report.\n";
+	}
+
+	return NULL;
+}
+
+/**
+ * Writes what the client can take of its pending replies without blocking. Drops it on error.
+ */
+static void
+flushClient(client* c) {
+
+	while (c->pending > 0 && !c->dropped) {
+		ssize_t written = write(c->fd, c->output, c->pending);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			c->dropped = errno != EAGAIN && errno != EWOULDBLOCK;
+			return;
+		}
+		c->pending -= written;
+		memmove(c->output, c->output + written, c->pending);
+	}
+}
+
+/**
+ * Queues length bytes of data after the pending replies of the client and sends what it can
+ * take. A client that let MAX_OUTPUT bytes pile up is dropped.
+ */
+static void
+sendClient(client* c, const char* data, size_t length) {
+
+	if (c->dropped) {
+		return;
+	}
+	if (length > sizeof(c->output) - c->pending) {
+		c->dropped = true;
+		return;
+	}
+
+	memcpy(c->output + c->pending, data, length);
+	c->pending += length;
+	flushClient(c);
+}
+
+static void
+reply(client* c, const char* error) {
+
+	char message[MAX_COMMAND];
+	size_t length;
+
+	if (!error) {
+		sendClient(c, "ok\n", 3);
+		return;
+	}
+
+	// Errors are shared with the command line and may end with blank lines
+	length = snprintf(message, sizeof(message), "error: %s", error);
+	if (length >= sizeof(message)) {
+		length = sizeof(message) - 1;
+	}
+	while (length > 0 && message[length - 1] == '\n') {
+		length--;
+	}
+	message[length++] = '\n';
+	sendClient(c, message, length);
+}
+
+static void
+replyStats(client* c) {
+
+	char buffer[16384];
+	size_t length = formatTrace(buffer, sizeof(buffer));
+
+	sendClient(c, buffer, length);
+	reply(c, NULL);
+}
+
+static void
+replyQuery(client* c, hid_device **handle) {
+
+	char buffer[512];
+
+	int sync = *handle ? syncState(*handle, &state) : openDevice(handle);
+	if (sync < SYNC_UNSUPPORTED) {
+		reply(c, "Unable to open MSI Led device.\n");
+		return;
+	}
+
+	size_t length = formatState(&state, sync, buffer, sizeof(buffer));
+	sendClient(c, buffer, length);
+	reply(c, NULL);
+}
+
+/**
+ * Reads what is available from the client and runs every complete line.
+ * Returns -1 when the client went away.
+ */
+static int
+serveClient(hid_device **handle, client* c) {
+
+	ssize_t received = recv(c->fd, c->buffer + c->used, sizeof(c->buffer) - c->used, 0);
+	if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		return 0;
+	}
+	if (received <= 0) {
+		return -1;
+	}
+	c->used += received;
+
+	char* start = c->buffer;
+	char* end;
+	while ((end = (char*) memchr(start, '\n', c->used - (start - c->buffer))) != NULL) {
+		*end = '\0';
+		if (end > start && end[-1] == '\r') {
+			end[-1] = '\0';
+		}
+		if (strcmp(start, PARAM_STATS) == 0) {
+			replyStats(c);
+		} else if (strcmp(start, PARAM_QUERY) == 0) {
+			replyQuery(c, handle);
+		} else if (end > start) {
+			reply(c, runCommand(handle, start));
+		}
+		start = end + 1;
+	}
+
+	c->used -= start - c->buffer;
+	if (c->used == sizeof(c->buffer)) {
+		reply(c, "Command too long.\n");
+		c->used = 0;
+	} else if (c->used > 0) {
+		memmove(c->buffer, start, c->used);
+	}
+
+	return 0;
+}
+
+/**
+ * Path of the socket when none is given: SOCKET_NAME in XDG_RUNTIME_DIR, else in SYSTEM_RUNTIME_DIR.
+ */
+void
+defaultSocketPath(char* path, size_t length) {
+
+	const char* runtime = getenv("XDG_RUNTIME_DIR");
+
+	snprintf(path, length, "%s/%s", runtime && runtime[0] == '/' ? runtime : SYSTEM_RUNTIME_DIR, SOCKET_NAME);
+}
+
+const char*
+parseDaemon(int argc, char* argv[], daemonOptions* options) {
+
+	memset(options, 0, sizeof(*options));
+	defaultSocketPath(options->socketPath, sizeof(options->socketPath));
+	defaultLibraryPath(options->library, sizeof(options->library));
+
+	for (int x = 2; x < argc; x++) {
+
+		if (argv[x][0] != '-' && x == 2) {
+			if (strlen(argv[x]) >= sizeof(options->socketPath)) {
+				return "Socket path too long. (-daemon)\n";
+			}
+			strcpy(options->socketPath, argv[x]);
+		} else if (strcmp(argv[x], PARAM_GROUP) == 0 && argv[x + 1]) {
+			options->group = argv[++x];
+		} else if (strcmp(argv[x], PARAM_LIBRARY) == 0 && argv[x + 1]) {
+			snprintf(options->library, sizeof(options->library), "%s", argv[++x]);
+		} else {
+			return "Invalid parameter(s). Use --help for more information\n\n";
+		}
+	}
+
+	return NULL;
+}
+
+static int
+openSocket(const char* socketPath, const char* groupName) {
+
+	struct sockaddr_un address;
+	struct group* group = NULL;
+	int fd;
+
+	if (strlen(socketPath) >= sizeof(address.sun_path)) {
+		printf("Socket path too long: %s\n", socketPath);
+		return -1;
+	}
+
+	if (groupName) {
+		group = getgrnam(groupName);
+		if (!group) {
+			printf("Unknown group: %s\n", groupName);
+			return -1;
+		}
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketPath);
+
+	// A previous daemon may have left its socket behind. The socket is created for the user of
+	// the daemon only, no one can connect before the group got it
+	unlink(socketPath);
+	mode_t mask = umask(0177);
+	int bound = bind(fd, (struct sockaddr*) &address, sizeof(address));
+	umask(mask);
+	if (bound < 0 || listen(fd, MAX_CLIENTS) < 0) {
+		perror(socketPath);
+		close(fd);
+		return -1;
+	}
+
+	if (group && (chown(socketPath, (uid_t) -1, group->gr_gid) < 0 || chmod(socketPath, 0660) < 0)) {
+		perror(socketPath);
+		close(fd);
+		unlink(socketPath);
+		return -1;
+	}
+
+	return fd;
+}
+
+int
+runDaemon(const daemonOptions* daemon) {
+
+	struct pollfd fds[MAX_CLIENTS + 1];
+	client* clients[MAX_CLIENTS + 1];
+	int nfds = 1;
+	hid_device *handle;
+
+	options = daemon;
+	stopRequested = 0;
+	int listenFd = openSocket(options->socketPath, options->group);
+	if (listenFd < 0) {
+		return 1;
+	}
+
+	signal(SIGINT, onStopSignal);
+	signal(SIGTERM, onStopSignal);
+	// Replies to clients that already left must not kill the daemon
+	signal(SIGPIPE, SIG_IGN);
+
+	// Start from what the last command line run left, kept in memory from now on
+	int sync = openDevice(&handle);
+	if (sync < SYNC_UNSUPPORTED) {
+		printf("Unable to open MSI Led device, will retry on the next command.\n");
+	} else {
+		static const char* syncMessages[] = {
+			"The keyboard does not answer reads, the last state is trusted",
+			"The keyboard still shows the last state, only changes will be sent",
+			"The keyboard does not show the last state, the first command sends everything",
+		};
+		printf("%s\n", syncMessages[sync - SYNC_UNSUPPORTED]);
+	}
+	printf("Listening on %s\n", options->socketPath);
+	fflush(stdout);
+
+	fds[0].fd = listenFd;
+	fds[0].events = POLLIN;
+	clients[0] = NULL;
+
+	while (!stopRequested) {
+
+		if (poll(fds, nfds, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("poll");
+			break;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			int fd = accept(listenFd, NULL, NULL);
+			if (fd >= 0) {
+				// Replies never block the loop, see sendClient
+				fcntl(fd, F_SETFD, FD_CLOEXEC);
+				fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+			}
+			if (fd >= 0 && nfds == MAX_CLIENTS + 1) {
+				close(fd);
+			} else if (fd >= 0) {
+				clients[nfds] = (client*) calloc(1, sizeof(client));
+				clients[nfds]->fd = fd;
+				fds[nfds].fd = fd;
+				fds[nfds].events = POLLIN;
+				fds[nfds].revents = 0;
+				nfds++;
+			}
+		}
+
+		for (int i = nfds - 1; i > 0; i--) {
+			client* c = clients[i];
+
+			if (fds[i].revents & POLLOUT) {
+				flushClient(c);
+			}
+			if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) && serveClient(&handle, c) < 0) {
+				c->dropped = true;
+			}
+			if (c->dropped) {
+				close(c->fd);
+				free(c);
+				nfds--;
+				fds[i] = fds[nfds];
+				clients[i] = clients[nfds];
+				continue;
+			}
+
+			// No new line is read until the replies went out, so a client that does not read
+			// them can only fill its own buffer
+			fds[i].events = c->pending > 0 ? POLLOUT : POLLIN;
+		}
+	}
+
+	for (int i = 1; i < nfds; i++) {
+		close(clients[i]->fd);
+		free(clients[i]);
+	}
+	close(listenFd);
+	unlink(options->socketPath);
+	if (stateDevice[0]) {
+		saveState(stateDevice, &state);
+	}
+	closeLibrary(&library);
+
+	unsigned long hits, scans;
+	hid_get_enumeration_stats(&hits, &scans);
+	printf("Device lookups: %lu from the cache, %lu full scans\n", hits, scans);
+
+	if (handle) {
+		tracedClose(handle);
+	}
+	tracedExit();
+
+	return 0;
+}
@@ -0,0 +1,175 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * Keyboard: the open device, its shadow state and the registers staged for the next commit.
+ * Everything is sent through applyBatch, so a commit costs what a daemon command costs: the
+ * reports that differ and nothing else.
+ */
+
+#include <string.h>
+#include <utility>
+#include "ledprotocol.h"
+#include "lededit.h"
+
+Keyboard::Keyboard(bool persist) : persist(persist), sync(SYNC_RESET), modeStaged(false), stagedMode(0), stagedMask(0) {
+
+	path[0] = '\0';
+	resetState(&shadow);
+}
+
+Keyboard::~Keyboard() {
+
+	close();
+}
+
+Keyboard::Keyboard(Keyboard&& other) noexcept : device(std::move(other.device)), persist(other.persist), shadow(other.shadow),
+	sync(other.sync), modeStaged(other.modeStaged), stagedMode(other.stagedMode), stagedMask(other.stagedMask) {
+
+	memcpy(path, other.path, sizeof(path));
+	memcpy(staged, other.staged, sizeof(staged));
+	other.discard();
+}
+
+Keyboard&
+Keyboard::operator=(Keyboard&& other) noexcept {
+
+	if (this != &other) {
+		close();
+		device = std::move(other.device);
+		persist = other.persist;
+		memcpy(path, other.path, sizeof(path));
+		shadow = other.shadow;
+		sync = other.sync;
+		modeStaged = other.modeStaged;
+		stagedMode = other.stagedMode;
+		stagedMask = other.stagedMask;
+		memcpy(staged, other.staged, sizeof(staged));
+		other.discard();
+	}
+
+	return *this;
+}
+
+int
+Keyboard::open(const char* path, bool force) {
+
+	close();
+
+	device = DeviceHandle::open(path, this->path, sizeof(this->path));
+	if (!device) {
+		return -1;
+	}
+
+	loadState(this->path, &shadow);
+	if (force) {
+		resetState(&shadow);
+		sync = SYNC_RESET;
+	} else {
+		sync = syncState(device.get(), &shadow);
+	}
+
+	return 0;
+}
+
+void
+Keyboard::close() {
+
+	discard();
+	if (device && persist) {
+		saveState(path, &shadow);
+	}
+	device.reset();
+}
+
+void
+Keyboard::setMode(unsigned char mode) {
+
+	modeStaged = true;
+	stagedMode = mode;
+}
+
+void
+Keyboard::setArea(unsigned char area, unsigned char color, unsigned char level, unsigned char blue) {
+
+	if (area < 1 || area > STATE_AREAS) {
+		return;
+	}
+
+	staged[area - 1][0] = color;
+	staged[area - 1][1] = level;
+	staged[area - 1][2] = blue;
+	stagedMask |= 1 << (area - 1);
+}
+
+void
+Keyboard::discard() {
+
+	modeStaged = false;
+	stagedMask = 0;
+}
+
+int
+Keyboard::commit() {
+
+	reportBatch batch;
+
+	if (!device || (!modeStaged && !shadow.valid)) {
+		return -1;
+	}
+
+	unsigned char mode = modeStaged ? stagedMode : shadow.mode;
+	unsigned char opcode = mode == MODE_NORMAL || mode == MODE_GAMING ? OPCODE_SET_COLOR : OPCODE_SET_SPECIAL;
+
+	batch.count = 0;
+	for (int i = 0; i < STATE_AREAS; i++) {
+		if (stagedMask & (1 << i)) {
+			batchActivateArea(&batch, opcode, i + 1, staged[i][0], staged[i][1], staged[i][2]);
+		}
+	}
+	batchCommit(&batch, mode);
+	discard();
+
+	return applyBatch(device.get(), &batch, &shadow);
+}
+
+int
+Keyboard::apply(const unsigned char arguments[kSize]) {
+
+	if (!device) {
+		return -1;
+	}
+
+	return applyArguments(device.get(), arguments, &shadow);
+}
+
+int
+Keyboard::apply(const reportBatch* batch) {
+
+	if (!device) {
+		return -1;
+	}
+
+	return applyBatch(device.get(), batch, &shadow);
+}
+
+int
+Keyboard::applyProfile(const profileLibrary* lib, const profileEntry* profile) {
+
+	if (!device) {
+		return -1;
+	}
+
+	return ::applyProfile(device.get(), lib, profile, &shadow);
+}
+
+int
+Keyboard::query(char* buffer, size_t length) {
+
+	if (!device) {
+		return -2;
+	}
+
+	sync = syncState(device.get(), &shadow);
+	formatState(&shadow, sync, buffer, length);
+
+	return sync;
+}
@@ -0,0 +1,173 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * liblededit: the keyboard as an object, for programs that change the lights in process
+ * (window manager plugins, notification daemons) instead of running the tool for each change.
+ * Link liblededit.a and one HID backend (hid_linux.o, hid.o or hid_mock.o).
+ *
+ *   Keyboard keyboard(true);
+ *   if (keyboard.open() == 0) {
+ *       keyboard.setMode(MODE_NORMAL);
+ *       keyboard.setArea(AREA_LEFT, COLOR_RED, LEVEL_4);
+ *       keyboard.commit();
+ *   }
+ *
+ * Nothing here throws or prints: calls return -1 or the number of reports refused, like the
+ * functions of ledcontrol.h they are built on. Not thread safe, keep a keyboard to one thread
+ * or use the queue of ledcontrol.h.
+ */
+
+#ifndef LEDEDIT_H__
+#define LEDEDIT_H__
+
+#include <stdio.h>
+#include "ledcontrol.h"
+
+// Owns an opened hid_device and closes it when destroyed. Moved, never copied
+class DeviceHandle {
+public:
+	DeviceHandle() : device(NULL) {}
+	explicit DeviceHandle(hid_device* device) : device(device) {}
+	~DeviceHandle() { reset(); }
+
+	DeviceHandle(DeviceHandle&& other) noexcept : device(other.release()) {}
+	DeviceHandle& operator=(DeviceHandle&& other) noexcept {
+		if (this != &other) {
+			reset(other.release());
+		}
+		return *this;
+	}
+	DeviceHandle(const DeviceHandle&) = delete;
+	DeviceHandle& operator=(const DeviceHandle&) = delete;
+
+	hid_device* get() const { return device; }
+	explicit operator bool() const { return device != NULL; }
+
+	/**
+	 * Gives up the device without closing it.
+	 */
+	hid_device* release() {
+		hid_device* released = device;
+		device = NULL;
+		return released;
+	}
+
+	/**
+	 * Closes the device held, if any, and holds replacement instead.
+	 */
+	void reset(hid_device* replacement = NULL) {
+		if (device) {
+			tracedClose(device);
+		}
+		device = replacement;
+	}
+
+	/**
+	 * The first MSI keyboard, or the one at path, and the path it was opened by in opened (may
+	 * be NULL). Empty if it could not be opened.
+	 */
+	static DeviceHandle open(const char* path = NULL, char* opened = NULL, size_t length = 0) {
+		if (!path) {
+			return DeviceHandle(tracedOpen(MSI_VENDOR_ID, MSI_PRODUCT_ID, opened, length));
+		}
+		if (opened) {
+			snprintf(opened, length, "%s", path);
+		}
+		return DeviceHandle(tracedOpenPath(path));
+	}
+
+private:
+	hid_device* device;
+};
+
+// A keyboard and the shadow state of what it shows. Changes are staged with setMode / setArea
+// and sent by commit as one transaction, only the registers that differ from the shadow state
+class Keyboard {
+public:
+	/**
+	 * With persist, close writes the shadow state back to the file the next run of the tool
+	 * starts from. Without it nothing is written, but that file no longer matches what the
+	 * keyboard shows once this keyboard changed it: the tool and the daemon may then skip
+	 * registers they believe sent, unless they run with -force.
+	 */
+	explicit Keyboard(bool persist = false);
+	~Keyboard();
+
+	Keyboard(Keyboard&& other) noexcept;
+	Keyboard& operator=(Keyboard&& other) noexcept;
+	Keyboard(const Keyboard&) = delete;
+	Keyboard& operator=(const Keyboard&) = delete;
+
+	/**
+	 * Opens the first MSI keyboard, or the one at path, and takes the shadow state the last
+	 * run left on the same device, checked against the keyboard (see syncState). With force, the first change
+	 * sends everything instead. Returns -1 if the keyboard could not be opened.
+	 */
+	int open(const char* path = NULL, bool force = false);
+
+	/**
+	 * Drops what is staged, writes the shadow state back for the next run if the keyboard
+	 * persists it, and closes the keyboard. Done when the keyboard is destroyed.
+	 */
+	void close();
+	bool isOpen() const { return static_cast<bool>(device); }
+
+	/**
+	 * Stages the mode to commit, and a register: an area (AREA_*, or up to STATE_AREAS for
+	 * the special modes) with its color and level, or its ramp bytes. A register staged twice
+	 * keeps the last value.
+	 */
+	void setMode(unsigned char mode);
+	void setArea(unsigned char area, unsigned char color, unsigned char level, unsigned char blue = 0x00);
+
+	/**
+	 * Sends the staged registers and the commit of the staged mode (the mode shown when none
+	 * was staged) as one transaction, and empties the stage. Returns the number of reports
+	 * refused, -1 if the keyboard is not open or no mode is known.
+	 */
+	int commit();
+	void discard();
+
+	/**
+	 * Sends a whole state, like commit: the params as filled by parseArguments, or a batch.
+	 * The stage is left alone.
+	 */
+	int apply(const unsigned char arguments[kSize]);
+	int apply(const reportBatch* batch);
+	int applyProfile(const profileLibrary* lib, const profileEntry* profile);
+
+	/**
+	 * Reads the mode back from the keyboard and writes what is known of its state into buffer
+	 * (see formatState). Returns a SYNC_* value, -2 if the keyboard is not open.
+	 */
+	int query(char* buffer, size_t length);
+
+	/**
+	 * What the last open or query found out checking the shadow state against the keyboard
+	 * (SYNC_RESET after a forced open).
+	 */
+	int lastSync() const { return sync; }
+
+	/**
+	 * Forgets the shadow state: the next change sends everything.
+	 */
+	void force() { resetState(&shadow); }
+
+	/**
+	 * For the runners of ledcontrol.h (runAnimation, runTimeline...). Owned by the keyboard.
+	 */
+	hid_device* handle() const { return device.get(); }
+	keyboardState* state() { return &shadow; }
+
+private:
+	DeviceHandle device;
+	bool persist;
+	char path[MAX_DEVICE_PATH]; // key of the shadow state file
+	keyboardState shadow;
+	int sync;
+	bool modeStaged;
+	unsigned char stagedMode;
+	unsigned short stagedMask;
+	unsigned char staged[STATE_AREAS][3]; // color, level, blue
+};
+
+#endif
@@ -0,0 +1,186 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * Fan-out to every matching keyboard: hid_open only ever returns the first one, so multi-seat
+ * and lab machines open each enumerated path instead. A state is encoded once and submitted
+ * to all of them at the same time from a small pool of worker threads, each keyboard keeping
+ * its own shadow state so it only gets the areas it is missing. The shadow states are the state
+ * files of the keyboard paths, the same ones a run on a single keyboard uses.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <time.h>
+#include <pthread.h>
+#include "ledcontrol.h"
+
+static double
+nowMicros() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/**
+ * Sends the shared batch to one keyboard. Runs on a worker thread.
+ */
+static void
+applyKeyboard(fanout* f, fanoutKeyboard* keyboard) {
+
+	reportBatch changes;
+	double start = nowMicros();
+
+	keyboard->sent = 0;
+	keyboard->failed = 0;
+	if (f->force) {
+		resetState(&keyboard->state);
+	}
+	if (diffBatch(&keyboard->state, &f->batch, &changes) > 0) {
+		keyboard->sent = changes.count;
+		keyboard->failed = submitBatch(keyboard->handle, &changes);
+		if (keyboard->failed) {
+			resetState(&keyboard->state);
+		} else {
+			updateState(&keyboard->state, &changes);
+		}
+	}
+	keyboard->latencyUs = nowMicros() - start;
+}
+
+static void*
+fanoutWorker(void* param) {
+
+	fanout* f = (fanout*) param;
+	unsigned long seen = 0;
+
+	pthread_mutex_lock(&f->mutex);
+	for (;;) {
+		while (f->generation == seen && !f->stop) {
+			pthread_cond_wait(&f->start, &f->mutex);
+		}
+		if (f->stop) {
+			break;
+		}
+		seen = f->generation;
+
+		// Take keyboards one at a time, so a slow one does not hold back the others' worker
+		while (f->next < f->count) {
+			fanoutKeyboard* keyboard = &f->keyboards[f->next++];
+			pthread_mutex_unlock(&f->mutex);
+			applyKeyboard(f, keyboard);
+			pthread_mutex_lock(&f->mutex);
+		}
+
+		if (++f->finished == f->workers) {
+			pthread_cond_signal(&f->done);
+		}
+	}
+	pthread_mutex_unlock(&f->mutex);
+
+	return NULL;
+}
+
+int
+openFanout(fanout* f) {
+
+	struct hid_device_info *devs, *cur;
+
+	memset(f, 0, sizeof(*f));
+
+	devs = tracedEnumerate(MSI_VENDOR_ID, MSI_PRODUCT_ID);
+	for (cur = devs; cur && f->count < MAX_KEYBOARDS; cur = cur->next) {
+		fanoutKeyboard* keyboard = &f->keyboards[f->count];
+
+		keyboard->handle = tracedOpenPath(cur->path);
+		if (!keyboard->handle) {
+			continue;
+		}
+		snprintf(keyboard->path, sizeof(keyboard->path), "%s", cur->path);
+		snprintf(keyboard->serial, sizeof(keyboard->serial), "%ls", cur->serial_number ? cur->serial_number : L"");
+		loadState(keyboard->path, &keyboard->state);
+		syncState(keyboard->handle, &keyboard->state);
+		f->count++;
+	}
+	hid_free_enumeration(devs);
+
+	if (f->count == 0) {
+		return 0;
+	}
+
+	// One keyboard is sent from the calling thread. Otherwise one worker per keyboard up to
+	// the limit, not per core: the workers mostly sleep in the control transfers
+	if (f->count == 1) {
+		return f->count;
+	}
+	f->workers = f->count < MAX_FANOUT_WORKERS ? f->count : MAX_FANOUT_WORKERS;
+
+	pthread_mutex_init(&f->mutex, NULL);
+	pthread_cond_init(&f->start, NULL);
+	pthread_cond_init(&f->done, NULL);
+	for (int i = 0; i < f->workers; i++) {
+		if (pthread_create(&f->threads[i], NULL, fanoutWorker, f) != 0) {
+			f->workers = i;
+			break;
+		}
+	}
+
+	return f->count;
+}
+
+int
+applyFanout(fanout* f, const unsigned char arguments[kSize]) {
+
+	int failed = 0;
+
+	buildBatch(arguments, &f->batch);
+	f->force = arguments[kForce] == 1;
+
+	if (f->workers == 0) {
+		for (int i = 0; i < f->count; i++) {
+			applyKeyboard(f, &f->keyboards[i]);
+		}
+	} else {
+		pthread_mutex_lock(&f->mutex);
+		f->next = 0;
+		f->finished = 0;
+		f->generation++;
+		pthread_cond_broadcast(&f->start);
+		while (f->finished < f->workers) {
+			pthread_cond_wait(&f->done, &f->mutex);
+		}
+		pthread_mutex_unlock(&f->mutex);
+	}
+
+	for (int i = 0; i < f->count; i++) {
+		failed += f->keyboards[i].failed;
+	}
+
+	return failed;
+}
+
+void
+closeFanout(fanout* f) {
+
+	if (f->workers > 0) {
+		pthread_mutex_lock(&f->mutex);
+		f->stop = true;
+		pthread_cond_broadcast(&f->start);
+		pthread_mutex_unlock(&f->mutex);
+
+		for (int i = 0; i < f->workers; i++) {
+			pthread_join(f->threads[i], NULL);
+		}
+		pthread_cond_destroy(&f->done);
+		pthread_cond_destroy(&f->start);
+		pthread_mutex_destroy(&f->mutex);
+	}
+
+	for (int i = 0; i < f->count; i++) {
+		saveState(f->keyboards[i].path, &f->keyboards[i].state);
+		tracedClose(f->keyboards[i].handle);
+	}
+	f->count = 0;
+	f->workers = 0;
+}
@@ -0,0 +1,456 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * Profile libraries: named lighting states written once as text, compiled into a file that
+ * holds every step already encoded as its reports. Switching profile is a binary search in the
+ * mapped index and a copy of the reports, whatever the size of the library: nothing is parsed
+ * and only the pages of the profile applied are read.
+ *
+ * Source: a "[name]" line starts a profile, each line after it is a step with the same params
+ * as the command line, plus "-hold <seconds>" for how long it stays before the next step.
+ * Blank lines and lines starting with '#' are skipped.
+ *
+ *   [alert]
+ *   -preset red -hold 0.3
+ *   -preset off -hold 0.3
+ *   -mode normal -color1 red -color2 ff8000 -color3 red -level 2
+ *
+ * Library: a profileHeader, the profileEntry index sorted by FNV-1a hash of the name then
+ * name, the profileStep array and the names, back to back.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <vector>
+#include "ledcontrol.h"
+
+/** Allowed params */
+const char* PARAM_COMPILE =						TEXT_PARAM_COMPILE;
+const char* PARAM_PROFILE =						TEXT_PARAM_PROFILE;
+const char* PARAM_LIBRARY =						TEXT_PARAM_LIBRARY;
+const char* PARAM_HOLD =						TEXT_PARAM_HOLD;
+
+/** Source limits */
+#define MAX_SOURCE_LINE							512
+#define MAX_SOURCE_TOKENS						32
+
+static_assert(sizeof(profileHeader) == 32 && sizeof(profileEntry) == 16, "library layout is fixed");
+static_assert(sizeof(profileStep) == 96, "steps are 4 + 91 + 1 bytes, whatever the compiler");
+
+static char compileError[MAX_SOURCE_LINE + 128];
+
+static unsigned int
+hashName(const char* name, size_t length) {
+
+	unsigned int h = 2166136261u;
+
+	for (size_t i = 0; i < length; i++) {
+		h = (h ^ (unsigned char) name[i]) * 16777619u;
+	}
+
+	return h;
+}
+
+static double
+nowNanos() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+const char*
+parseProfile(int argc, char* argv[], profileRequest* request) {
+
+	memset(request, 0, sizeof(*request));
+
+	for (int x = 1; x < argc; x++) {
+
+		if (argv[x][0] != '-') {
+			continue;
+		}
+
+		const token* param = lookupToken(argv[x]);
+		if (param && param->kind == TOKEN_PARAM && param->value == kParamForce) {
+			request->force = true;
+			continue;
+		} else if (!argv[x + 1]) {
+			return "Invalid parameter(s). Use --help for more information\n\n";
+		} else if (!param || param->kind != TOKEN_PARAM) {
+			continue;
+		}
+
+		switch (param->value) {
+
+		case kParamProfile:
+
+			request->name = argv[x + 1];
+			break;
+
+		case kParamCompile:
+
+			request->source = argv[x + 1];
+			break;
+
+		case kParamLibrary:
+
+			request->library = argv[x + 1];
+			break;
+		}
+	}
+
+	if (!request->name && !request->source) {
+		return "No profile specified. (-profile). Use --help for more information\n\n";
+	}
+	if (request->name && (!*request->name || strlen(request->name) >= MAX_PROFILE_NAME)) {
+		return "Invalid profile name. (-profile). Use --help for more information\n\n";
+	}
+
+	return NULL;
+}
+
+void
+defaultLibraryPath(char* path, size_t length) {
+
+	const char* config = getenv("XDG_CONFIG_HOME");
+	const char* home = getenv("HOME");
+
+	if (config && *config) {
+		snprintf(path, length, "%s/%s", config, PROFILE_LIBRARY_NAME);
+	} else if (home && *home) {
+		snprintf(path, length, "%s/.config/%s", home, PROFILE_LIBRARY_NAME);
+	} else {
+		snprintf(path, length, "/tmp/%s", PROFILE_LIBRARY_NAME);
+	}
+}
+
+static const char*
+sourceError(const char* sourcePath, int line, const char* message) {
+
+	snprintf(compileError, sizeof(compileError), "%s:%d: %s", sourcePath, line, message);
+	return compileError;
+}
+
+/**
+ * Encodes one step line, split into argv like the command line. Returns NULL or the error.
+ */
+static const char*
+compileStep(int argc, char* argv[], profileStep* step) {
+
+	unsigned char arguments[kSize];
+	double hold = 0;
+
+	for (int x = 1; x < argc - 1; x++) {
+		const token* param = lookupToken(argv[x]);
+		if (param && param->kind == TOKEN_PARAM && param->value == kParamHold) {
+			char* end;
+			hold = strtod(argv[x + 1], &end);
+			if (end == argv[x + 1] || *end || !(hold >= 0 && hold <= MAX_PROFILE_HOLD)) {
+				return "Invalid hold. (-hold)\n\n";
+			}
+		}
+	}
+
+	const char* error = parseArguments(argc, argv, arguments);
+	if (error) {
+		return error;
+	}
+
+	memset(step, 0, sizeof(*step));
+	step->holdMs = (unsigned int) (hold * 1000 + 0.5);
+	buildBatch(arguments, &step->batch);
+
+	return NULL;
+}
+
+/**
+ * Writes the library then renames it over libraryPath, so a daemon never maps half a file.
+ */
+static int
+writeLibrary(const char* libraryPath, const profileHeader* header, const std::vector<profileEntry>& entries,
+	const std::vector<profileStep>& steps, const std::vector<char>& names) {
+
+	char tmpPath[600];
+	snprintf(tmpPath, sizeof(tmpPath), "%s.%d", libraryPath, (int) getpid());
+
+	FILE* f = fopen(tmpPath, "wb");
+	if (!f) {
+		return -1;
+	}
+
+	bool written = fwrite(header, sizeof(*header), 1, f) == 1
+		&& fwrite(entries.data(), sizeof(profileEntry), entries.size(), f) == entries.size()
+		&& fwrite(steps.data(), sizeof(profileStep), steps.size(), f) == steps.size()
+		&& fwrite(names.data(), 1, names.size(), f) == names.size();
+	if (fclose(f) != 0 || !written) {
+		unlink(tmpPath);
+		return -1;
+	}
+
+	return rename(tmpPath, libraryPath);
+}
+
+const char*
+compileProfiles(const char* sourcePath, const char* libraryPath, int* count) {
+
+	std::vector<profileEntry> entries;
+	std::vector<profileStep> steps;
+	std::vector<char> names;
+	char line[MAX_SOURCE_LINE];
+	int lineNumber = 0;
+	profileEntry* current = NULL;
+
+	*count = 0;
+	FILE* source = fopen(sourcePath, "r");
+	if (!source) {
+		return "Unable to open the profiles source. (-compile)\n\n";
+	}
+
+	while (fgets(line, sizeof(line), source)) {
+
+		lineNumber++;
+		size_t length = strlen(line);
+		if (length == sizeof(line) - 1 && line[length - 1] != '\n' && !feof(source)) {
+			fclose(source);
+			return sourceError(sourcePath, lineNumber, "Line too long.\n\n");
+		}
+
+		char* start = line + strspn(line, " \t");
+		while (length > 0 && strchr(" \t\r\n", line[length - 1])) {
+			line[--length] = '\0';
+		}
+		if (!*start || *start == '#') {
+			continue;
+		}
+
+		if (*start == '[') {
+			char* name = start + 1;
+			size_t nameLength = strlen(name);
+			if (nameLength < 2 || name[nameLength - 1] != ']' || strpbrk(name, " \t[")
+				|| nameLength - 1 >= MAX_PROFILE_NAME) {
+				fclose(source);
+				return sourceError(sourcePath, lineNumber, "Invalid profile name, [name] without blanks.\n\n");
+			}
+			nameLength--;
+
+			profileEntry entry;
+			entry.hash = hashName(name, nameLength);
+			entry.nameOffset = names.size();
+			entry.nameLength = nameLength;
+			entry.stepCount = 0;
+			entry.firstStep = steps.size();
+			names.insert(names.end(), name, name + nameLength);
+			entries.push_back(entry);
+			current = &entries.back();
+			continue;
+		}
+
+		if (!current) {
+			fclose(source);
+			return sourceError(sourcePath, lineNumber, "Step before the first [name].\n\n");
+		}
+		if (current->stepCount == MAX_PROFILE_STEPS) {
+			fclose(source);
+			return sourceError(sourcePath, lineNumber, "Too many steps in this profile.\n\n");
+		}
+
+		// Split like the daemon does, argv[0] is the program name
+		static char programName[] = "msiledenabler";
+		char* argv[MAX_SOURCE_TOKENS];
+		char* saveptr = NULL;
+		int argc = 0;
+		argv[argc++] = programName;
+		for (char* word = strtok_r(start, " \t", &saveptr); word && argc < MAX_SOURCE_TOKENS - 1; word = strtok_r(NULL, " \t", &saveptr)) {
+			argv[argc++] = word;
+		}
+		argv[argc] = NULL;
+
+		profileStep step;
+		const char* error = compileStep(argc, argv, &step);
+		if (error) {
+			fclose(source);
+			return sourceError(sourcePath, lineNumber, error);
+		}
+		steps.push_back(step);
+		current->stepCount++;
+	}
+	fclose(source);
+
+	for (const profileEntry& entry : entries) {
+		if (entry.stepCount == 0) {
+			snprintf(compileError, sizeof(compileError), "%s: profile [%.*s] has no steps.\n\n", sourcePath,
+				(int) entry.nameLength, &names[entry.nameOffset]);
+			return compileError;
+		}
+	}
+
+	std::sort(entries.begin(), entries.end(), [&names](const profileEntry& a, const profileEntry& b) {
+		if (a.hash != b.hash) {
+			return a.hash < b.hash;
+		}
+		int order = memcmp(&names[a.nameOffset], &names[b.nameOffset], std::min(a.nameLength, b.nameLength));
+		return order < 0 || (order == 0 && a.nameLength < b.nameLength);
+	});
+	for (size_t i = 1; i < entries.size(); i++) {
+		const profileEntry& a = entries[i - 1];
+		const profileEntry& b = entries[i];
+		if (a.hash == b.hash && a.nameLength == b.nameLength && memcmp(&names[a.nameOffset], &names[b.nameOffset], a.nameLength) == 0) {
+			snprintf(compileError, sizeof(compileError), "%s: profile [%.*s] is defined twice.\n\n", sourcePath,
+				(int) b.nameLength, &names[b.nameOffset]);
+			return compileError;
+		}
+	}
+
+	unsigned long long length = sizeof(profileHeader) + entries.size() * sizeof(profileEntry)
+		+ steps.size() * sizeof(profileStep) + names.size();
+	if (length > 0xffffffffull) {
+		return "The library would be over 4GB.\n\n";
+	}
+
+	profileHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = PROFILE_MAGIC;
+	header.version = PROFILE_VERSION;
+	header.stepSize = sizeof(profileStep);
+	header.profileCount = entries.size();
+	header.stepCount = steps.size();
+	header.entriesOffset = sizeof(profileHeader);
+	header.stepsOffset = header.entriesOffset + entries.size() * sizeof(profileEntry);
+	header.namesOffset = header.stepsOffset + steps.size() * sizeof(profileStep);
+	header.length = length;
+
+	if (writeLibrary(libraryPath, &header, entries, steps, names) < 0) {
+		return "Unable to write the profile library. (-library)\n\n";
+	}
+
+	*count = entries.size();
+	return NULL;
+}
+
+void
+closeLibrary(profileLibrary* lib) {
+
+	if (lib->base) {
+		munmap((void*) lib->base, lib->length);
+	}
+	memset(lib, 0, sizeof(*lib));
+}
+
+int
+openLibrary(profileLibrary* lib, const char* path) {
+
+	struct stat st;
+
+	if (stat(path, &st) < 0) {
+		closeLibrary(lib);
+		return -1;
+	}
+	if (lib->base && strcmp(lib->path, path) == 0 && lib->device == (unsigned long long) st.st_dev
+		&& lib->inode == (unsigned long long) st.st_ino && lib->length == (size_t) st.st_size) {
+		return 0;
+	}
+	closeLibrary(lib);
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(profileHeader) || strlen(path) >= sizeof(lib->path)) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+
+	void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED) {
+		return -1;
+	}
+
+	const unsigned char* base = (const unsigned char*) mapped;
+	const profileHeader* header = (const profileHeader*) base;
+	unsigned long long size = st.st_size;
+
+	// Only the header and the sizes are checked here: the index and the steps are checked
+	// by findProfile for the profile asked for, so opening does not read the whole file
+	if (header->magic != PROFILE_MAGIC || header->version != PROFILE_VERSION || header->stepSize != sizeof(profileStep)
+		|| header->length != size || header->entriesOffset != sizeof(profileHeader)
+		|| header->stepsOffset != header->entriesOffset + (unsigned long long) header->profileCount * sizeof(profileEntry)
+		|| header->namesOffset != header->stepsOffset + (unsigned long long) header->stepCount * sizeof(profileStep)
+		|| header->namesOffset > size) {
+		munmap(mapped, st.st_size);
+		return -1;
+	}
+
+	strcpy(lib->path, path);
+	lib->base = base;
+	lib->length = st.st_size;
+	lib->device = st.st_dev;
+	lib->inode = st.st_ino;
+	lib->header = header;
+	lib->entries = (const profileEntry*) (base + header->entriesOffset);
+	lib->steps = (const profileStep*) (base + header->stepsOffset);
+	lib->names = (const char*) (base + header->namesOffset);
+
+	return 0;
+}
+
+const profileEntry*
+findProfile(const profileLibrary* lib, const char* name) {
+
+	if (!lib->base) {
+		return NULL;
+	}
+
+	size_t length = strlen(name);
+	unsigned int hash = hashName(name, length);
+	size_t namesLength = lib->length - lib->header->namesOffset;
+
+	// First entry with this hash, then the (rare) others sharing it
+	const profileEntry* end = lib->entries + lib->header->profileCount;
+	const profileEntry* entry = std::lower_bound(lib->entries, end, hash, [](const profileEntry& e, unsigned int h) {
+		return e.hash < h;
+	});
+	for (; entry != end && entry->hash == hash; entry++) {
+		if (entry->nameLength != length || (unsigned long long) entry->nameOffset + entry->nameLength > namesLength
+			|| memcmp(lib->names + entry->nameOffset, name, length) != 0) {
+			continue;
+		}
+
+		if (entry->stepCount == 0 || (unsigned long long) entry->firstStep + entry->stepCount > lib->header->stepCount) {
+			return NULL;
+		}
+		for (unsigned short i = 0; i < entry->stepCount; i++) {
+			unsigned char count = lib->steps[entry->firstStep + i].batch.count;
+			if (count == 0 || count > MAX_BATCH_REPORTS) {
+				return NULL;
+			}
+		}
+		return entry;
+	}
+
+	return NULL;
+}
+
+int
+applyProfile(hid_device *handle, const profileLibrary* lib, const profileEntry* profile, keyboardState* state) {
+
+	double deadline = nowNanos();
+	int failed = 0;
+
+	for (unsigned short i = 0; i < profile->stepCount; i++) {
+		const profileStep* step = &lib->steps[profile->firstStep + i];
+
+		if (i > 0) {
+			sleepUntil(deadline, NULL);
+		}
+		failed += applyBatch(handle, &step->batch, state);
+		deadline += step->holdMs * 1e6;
+	}
+
+	return failed;
+}
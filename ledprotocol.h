@@ -0,0 +1,113 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * Wire format of the controller as constexpr builders: a report, or a whole mode, built from
+ * constants is folded by the compiler into a ready-made byte array, so sending it is a copy.
+ */
+
+#ifndef LEDPROTOCOL_H__
+#define LEDPROTOCOL_H__
+
+#include <stdarg.h>
+#include <stdio.h>
+#include "ledcontrol.h"
+
+/** Report opcodes (byte 2) */
+#define OPCODE_COMMIT							0x41
+#define OPCODE_SET_COLOR						0x42
+#define OPCODE_SET_SPECIAL						0x43
+
+/** Fixed report bytes: report id, then 0x02, and the end of report marker */
+#define REPORT_ID							0x01
+#define REPORT_PREFIX							0x02
+#define REPORT_EOR							0xec
+
+/**
+ * The REPORT_LENGTH bytes of a report, as a brace initializer.
+ */
+#define REPORT_BYTES(opcode, area, color, level, blue) \
+	{ REPORT_ID, REPORT_PREFIX, (unsigned char) (opcode), (unsigned char) (area), (unsigned char) (color), \
+	  (unsigned char) (level), (unsigned char) (blue), REPORT_EOR, 0x00 }
+
+// struct for a single report, so it can be returned by value from constexpr builders
+struct reportBytes {
+	unsigned char bytes[REPORT_LENGTH];
+};
+
+static_assert(REPORT_LENGTH == 9, "reports are the report id plus 8 bytes");
+static_assert(sizeof(reportBytes) == REPORT_LENGTH, "reportBytes must be exactly one report");
+static_assert(sizeof(((reportBatch*) 0)->data[0]) == REPORT_LENGTH, "batch rows must be exactly one report");
+static_assert(MAX_BATCH_REPORTS == 3 * 3 + 1, "a batch holds the 9 special mode areas and the commit");
+
+constexpr reportBytes
+areaReport(unsigned char opcode, unsigned char area, unsigned char color, unsigned char level, unsigned char blue) {
+
+	return reportBytes { REPORT_BYTES(opcode, area, color, level, blue) };
+}
+
+constexpr reportBytes
+commitReport(unsigned char mode) {
+
+	return reportBytes { REPORT_BYTES(OPCODE_COMMIT, mode, 0x00, 0x00, 0x00) };
+}
+
+/**
+ * Whole batches for the modes that only depend on their params (no ramp speeds).
+ */
+constexpr reportBatch
+disableBatch() {
+
+	return reportBatch { 1, {
+		REPORT_BYTES(OPCODE_COMMIT, MODE_DISABLE, 0x00, 0x00, 0x00) } };
+}
+
+constexpr reportBatch
+normalBatch(unsigned char left, unsigned char middle, unsigned char right, unsigned char level) {
+
+	return reportBatch { 4, {
+		REPORT_BYTES(OPCODE_SET_COLOR, AREA_LEFT, left, level, 0x00),
+		REPORT_BYTES(OPCODE_SET_COLOR, AREA_MIDDLE, middle, level, 0x00),
+		REPORT_BYTES(OPCODE_SET_COLOR, AREA_RIGHT, right, level, 0x00),
+		REPORT_BYTES(OPCODE_COMMIT, MODE_NORMAL, 0x00, 0x00, 0x00) } };
+}
+
+constexpr reportBatch
+gamingBatch(unsigned char color, unsigned char level) {
+
+	return reportBatch { 2, {
+		REPORT_BYTES(OPCODE_SET_COLOR, AREA_LEFT, color, level, 0x00),
+		REPORT_BYTES(OPCODE_COMMIT, MODE_GAMING, 0x00, 0x00, 0x00) } };
+}
+
+// struct for a named state whose reports are encoded at compile time
+struct preset {
+	const char* name;
+	unsigned char mode;
+	reportBatch batch;
+};
+
+/**
+ * Returns the preset called name, NULL if there is none.
+ */
+const preset* findPreset(const char* name);
+
+/**
+ * printf at *used in buffer and moves *used past it. Text that does not fit is cut, *used stays
+ * below length, so the replies to a query or --stats are truncated instead of overrun.
+ */
+static inline void __attribute__((format(printf, 4, 5)))
+appendFormat(char* buffer, size_t length, size_t* used, const char* format, ...) {
+
+	va_list args;
+
+	if (*used >= length) {
+		return;
+	}
+
+	// vsnprintf returns what it would have written
+	va_start(args, format);
+	int n = vsnprintf(buffer + *used, length - *used, format, args);
+	va_end(args);
+	*used += n <= 0 ? 0 : (size_t) n < length - *used ? (size_t) n : length - *used - 1;
+}
+
+#endif
@@ -0,0 +1,303 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * Async report submission: effects, scripts and notifications queue reports and go on, one
+ * writer thread per keyboard spends the time in hid_send_feature_report.
+ *
+ * The queue holds the latest report per area register and the latest commit, not a list of
+ * every write: it is bounded by the registers of the controller, and a write to a register
+ * that was not sent yet replaces the queued one before it reaches the wire. The keyboard
+ * then shows the newest state after one round of reports, whatever was queued meanwhile.
+ *
+ * Producers never block: a report is one atomic exchange into its slot, and the writer is
+ * woken by a byte on a non blocking pipe, written only when it may be asleep. The writer
+ * takes the commit before the registers, so the registers queued before a commit go with it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "ledcontrol.h"
+#include "ledprotocol.h"
+
+/** Slot values: opcode, color, level and blue of an area report, or the mode of a commit */
+#define SLOT_AREA(opcode, color, level, blue)				((unsigned int) (opcode) << 24 | (color) << 16 | (level) << 8 | (blue))
+#define SLOT_COMMIT(mode)						(0x100u | (mode))
+
+/**
+ * Wakes the writer, unless it was already told and did not sleep since.
+ */
+static void
+wakeWriter(reportQueue* q) {
+
+	if (q->asleep.exchange(false)) {
+		char byte = 0;
+		// Full pipe (EAGAIN): the writer has bytes to read already
+		while (write(q->wakeFds[1], &byte, 1) < 0 && errno == EINTR) {
+		}
+	}
+}
+
+/**
+ * Stores one report in its slot.
+ */
+static void
+storeReport(reportQueue* q, const unsigned char* report) {
+
+	unsigned char area = report[3];
+	unsigned int previous = 0;
+
+	if (report[2] == OPCODE_COMMIT) {
+		previous = q->commit.exchange(SLOT_COMMIT(area));
+	} else if (area >= 1 && area <= STATE_AREAS) {
+		previous = q->areas[area - 1].exchange(SLOT_AREA(report[2], report[4], report[5], report[6]));
+	} else {
+		return;
+	}
+
+	q->queued.fetch_add(1, std::memory_order_relaxed);
+	if (previous) {
+		q->superseded.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+/**
+ * Empties the slots into batch, registers in order then the commit. Returns the reports taken.
+ */
+static int
+takeReports(reportQueue* q, reportBatch* batch) {
+
+	// The commit first: the registers queued before it are then in their slots
+	unsigned int commit = q->commit.exchange(0);
+
+	batch->count = 0;
+	for (int i = 0; i < STATE_AREAS; i++) {
+		unsigned int slot = q->areas[i].exchange(0);
+		if (slot) {
+			batchActivateArea(batch, slot >> 24, i + 1, slot >> 16 & 0xff, slot >> 8 & 0xff, slot & 0xff);
+		}
+	}
+	if (commit) {
+		batchCommit(batch, commit & 0xff);
+	}
+
+	return batch->count;
+}
+
+static bool
+queueEmpty(reportQueue* q) {
+
+	for (int i = 0; i < STATE_AREAS; i++) {
+		if (q->areas[i].load()) {
+			return false;
+		}
+	}
+
+	return !q->commit.load();
+}
+
+/**
+ * Copies the area reports of from that are not in skip to the end of batch.
+ */
+static void
+appendAreas(reportBatch* batch, const reportBatch* from, const reportBatch* skip) {
+
+	for (unsigned char i = 0; i < from->count; i++) {
+		bool skipped = false;
+		for (unsigned char j = 0; skip && j < skip->count; j++) {
+			skipped = skipped || (skip->data[j][2] != OPCODE_COMMIT && skip->data[j][3] == from->data[i][3]);
+		}
+		if (!skipped && from->data[i][2] != OPCODE_COMMIT) {
+			memcpy(batch->data[batch->count++], from->data[i], REPORT_LENGTH);
+		}
+	}
+}
+
+/**
+ * Sends batch, with a state only what differs from the registers. The registers written
+ * without a commit are kept in uncommitted, not in the state: the keyboard does not show them
+ * yet, so the next commit must go out even when nothing else differs, and only then they are
+ * folded into the state. Returns the reports sent and refused in failed.
+ */
+static int
+sendReports(reportQueue* q, const reportBatch* batch, reportBatch* uncommitted, int* failed) {
+
+	reportBatch changes, registers;
+	keyboardState written;
+
+	bool commit = batch->data[batch->count - 1][2] == OPCODE_COMMIT;
+	if (!q->state || !commit) {
+		*failed = submitBatch(q->handle, batch);
+		if (q->state && *failed) {
+			resetState(q->state);
+			uncommitted->count = 0;
+		} else if (q->state) {
+			registers.count = 0;
+			appendAreas(&registers, uncommitted, batch);
+			appendAreas(&registers, batch, NULL);
+			*uncommitted = registers;
+		}
+		return batch->count;
+	}
+
+	// Diff against what the registers hold, the writes of the pending commit included
+	written = *q->state;
+	updateState(&written, uncommitted);
+	diffBatch(&written, batch, &changes);
+	if (changes.count == 0 && uncommitted->count > 0) {
+		memcpy(changes.data[changes.count++], batch->data[batch->count - 1], REPORT_LENGTH);
+	}
+	if (changes.count == 0) {
+		*failed = 0;
+		return 0;
+	}
+
+	*failed = submitBatch(q->handle, &changes);
+	if (*failed) {
+		resetState(q->state);
+	} else {
+		registers.count = 0;
+		appendAreas(&registers, uncommitted, &changes);
+		appendAreas(&registers, &changes, NULL);
+		memcpy(registers.data[registers.count++], changes.data[changes.count - 1], REPORT_LENGTH);
+		updateState(q->state, &registers);
+	}
+	uncommitted->count = 0;
+
+	return changes.count;
+}
+
+static void*
+queueWriter(void* param) {
+
+	reportQueue* q = (reportQueue*) param;
+	reportBatch batch, uncommitted;
+	char bytes[16];
+
+	uncommitted.count = 0;
+	for (;;) {
+		// Set asleep before looking at the slots: a report stored after that look writes a byte
+		q->asleep.store(true);
+		if (queueEmpty(q)) {
+			if (q->stop.load()) {
+				break;
+			}
+			if (read(q->wakeFds[0], bytes, sizeof(bytes)) < 0 && errno != EINTR) {
+				break;
+			}
+			continue;
+		}
+		q->asleep.store(false);
+
+		q->busy.store(true);
+		while (takeReports(q, &batch) > 0) {
+			int failed;
+			int sent = sendReports(q, &batch, &uncommitted, &failed);
+			q->sent += sent - failed;
+			q->failed += failed;
+		}
+
+		pthread_mutex_lock(&q->mutex);
+		q->busy.store(false);
+		pthread_cond_broadcast(&q->idle);
+		pthread_mutex_unlock(&q->mutex);
+	}
+
+	return NULL;
+}
+
+int
+openQueue(reportQueue* q, hid_device *handle, keyboardState* state) {
+
+	q->handle = handle;
+	q->state = state;
+	for (int i = 0; i < STATE_AREAS; i++) {
+		q->areas[i].store(0);
+	}
+	q->commit.store(0);
+	q->asleep.store(false);
+	q->busy.store(false);
+	q->stop.store(false);
+	q->queued.store(0);
+	q->superseded.store(0);
+	q->sent = 0;
+	q->failed = 0;
+
+	if (pipe(q->wakeFds) < 0) {
+		return -1;
+	}
+	for (int i = 0; i < 2; i++) {
+		fcntl(q->wakeFds[i], F_SETFD, FD_CLOEXEC);
+	}
+	fcntl(q->wakeFds[1], F_SETFL, fcntl(q->wakeFds[1], F_GETFL) | O_NONBLOCK);
+
+	pthread_mutex_init(&q->mutex, NULL);
+	pthread_cond_init(&q->idle, NULL);
+	if (pthread_create(&q->writer, NULL, queueWriter, q) != 0) {
+		pthread_cond_destroy(&q->idle);
+		pthread_mutex_destroy(&q->mutex);
+		close(q->wakeFds[0]);
+		close(q->wakeFds[1]);
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+queueBatch(reportQueue* q, const reportBatch* batch) {
+
+	for (unsigned char i = 0; i < batch->count; i++) {
+		storeReport(q, batch->data[i]);
+	}
+	wakeWriter(q);
+}
+
+void
+queueArea(reportQueue* q, unsigned char modeValue, unsigned char area, unsigned char color, unsigned char level, unsigned char blue) {
+
+	unsigned char report[REPORT_LENGTH];
+	encodeActivateArea(report, modeValue, area, color, level, blue);
+
+	storeReport(q, report);
+	wakeWriter(q);
+}
+
+void
+queueCommit(reportQueue* q, unsigned char mode) {
+
+	unsigned char report[REPORT_LENGTH];
+	encodeCommit(report, mode);
+
+	storeReport(q, report);
+	wakeWriter(q);
+}
+
+void
+flushQueue(reportQueue* q) {
+
+	// busy is set before the slots are emptied, so one of them always shows work in progress
+	pthread_mutex_lock(&q->mutex);
+	while (!queueEmpty(q) || q->busy.load()) {
+		pthread_cond_wait(&q->idle, &q->mutex);
+	}
+	pthread_mutex_unlock(&q->mutex);
+}
+
+void
+closeQueue(reportQueue* q) {
+
+	// The writer sends what is left before it stops
+	q->stop.store(true);
+	q->asleep.store(true);
+	wakeWriter(q);
+
+	pthread_join(q->writer, NULL);
+	pthread_cond_destroy(&q->idle);
+	pthread_mutex_destroy(&q->mutex);
+	close(q->wakeFds[0]);
+	close(q->wakeFds[1]);
+}
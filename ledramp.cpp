@@ -0,0 +1,119 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * Ramp speeds of the special modes: the bytes the controller steps each channel by to go from
+ * one color to the other in a period, ceil(period * 250 / |from - to|) per channel.
+ *
+ * Colors only come from the palette, so every (from, to) pair is tabulated: the tables of the
+ * PERIOD_* constants are built by the compiler, the ones of periods given with -period once
+ * when they are first asked for. All in integer math, period in ms: the same bytes whatever
+ * the compiler or its floating point flags.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "ledcontrol.h"
+
+/** Tables kept for periods given with -period, reused round robin */
+#define RAMP_CACHE_SIZE							8
+#define PALETTE_SIZE							9
+
+// struct for the ramp bytes (r, g, b) of every palette pair at one period
+struct rampTable {
+	unsigned int periodMs;
+	unsigned char ramps[PALETTE_SIZE][PALETTE_SIZE][3];
+};
+
+static constexpr unsigned char
+rampSpeed(unsigned int from, unsigned int to, unsigned int periodMs) {
+
+	unsigned int difference = from > to ? from - to : to - from;
+	if (difference == 0) {
+		return 0;
+	}
+
+	// period * 250 / difference with the period in ms is periodMs / (4 * difference). Long
+	// periods over close colors don't fit a byte, the slowest ramp is the best there is
+	unsigned int speed = (periodMs + 4 * difference - 1) / (4 * difference);
+	return speed > 0xff ? 0xff : speed;
+}
+
+static constexpr rampTable
+buildRampTable(unsigned int periodMs) {
+
+	constexpr colors palette;
+	const rgb entries[PALETTE_SIZE] = { palette.black, palette.red, palette.orange, palette.yellow,
+		palette.green, palette.sky, palette.blue, palette.purple, palette.white };
+	rampTable table {};
+
+	table.periodMs = periodMs;
+	for (int from = 0; from < PALETTE_SIZE; from++) {
+		for (int to = 0; to < PALETTE_SIZE; to++) {
+			table.ramps[from][to][0] = rampSpeed(entries[from].r, entries[to].r, periodMs);
+			table.ramps[from][to][1] = rampSpeed(entries[from].g, entries[to].g, periodMs);
+			table.ramps[from][to][2] = rampSpeed(entries[from].b, entries[to].b, periodMs);
+		}
+	}
+
+	return table;
+}
+
+unsigned char
+computeRampSpeed(double leftColor, double rightColor, double period) {
+
+	// Channels are whole numbers, periods whole ms
+	return rampSpeed((unsigned int) (leftColor + 0.5), (unsigned int) (rightColor + 0.5), (unsigned int) (period * 1000 + 0.5));
+}
+
+/** The periods of the modes without -period */
+static constexpr rampTable standardRamps[] = {
+	buildRampTable(PERIOD_BREATHING_STD * 1000),
+	buildRampTable(PERIOD_BREATHING_IDLE * 1000),
+	buildRampTable(PERIOD_WAVE_STD * 1000),
+	buildRampTable(PERIOD_WAVE_IDLE * 1000),
+	buildRampTable(PERIOD_DUAL_COLOR * 1000),
+};
+
+static constexpr size_t STANDARD_RAMPS = sizeof(standardRamps) / sizeof(standardRamps[0]);
+
+static_assert(standardRamps[0].ramps[COLOR_RED][COLOR_BLACK][0] == 1, "1s over 255 steps is 1 per step");
+static_assert(standardRamps[4].ramps[COLOR_ORANGE][COLOR_GREEN][0] == 46, "ceil(500 / 11)");
+
+static rampTable cachedRamps[RAMP_CACHE_SIZE];
+static size_t cachedCount = 0, nextCached = 0;
+static pthread_mutex_t cacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
+void
+rampBytes(unsigned int periodMs, unsigned char from, unsigned char to, unsigned char ramp[3]) {
+
+	// Unknown colors ramp like black, as identifyRGBcolor maps them
+	from = from < PALETTE_SIZE ? from : COLOR_BLACK;
+	to = to < PALETTE_SIZE ? to : COLOR_BLACK;
+
+	for (size_t i = 0; i < STANDARD_RAMPS; i++) {
+		if (standardRamps[i].periodMs == periodMs) {
+			memcpy(ramp, standardRamps[i].ramps[from][to], 3);
+			return;
+		}
+	}
+
+	// Another thread may replace any cached table, so the bytes are copied under the lock
+	pthread_mutex_lock(&cacheMutex);
+	const rampTable* table = NULL;
+	for (size_t i = 0; i < cachedCount && !table; i++) {
+		if (cachedRamps[i].periodMs == periodMs) {
+			table = &cachedRamps[i];
+		}
+	}
+	if (!table) {
+		cachedRamps[nextCached] = buildRampTable(periodMs);
+		table = &cachedRamps[nextCached];
+		nextCached = (nextCached + 1) % RAMP_CACHE_SIZE;
+		if (cachedCount < RAMP_CACHE_SIZE) {
+			cachedCount++;
+		}
+	}
+	memcpy(ramp, table->ramps[from][to], 3);
+	pthread_mutex_unlock(&cacheMutex);
+}
@@ -0,0 +1,109 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * Write policy: a feature report can be refused when the bus is busy (a stall, a suspend in
+ * progress) and work again a few ms later. A batch is a transaction: its reports are sent in
+ * order and the first refusal stops it before the commit, then the whole batch is sent again
+ * after a backoff that doubles each time, so the controller never commits half of a state.
+ * Retries stop after policy.attempts tries or once policy.timeoutUs is spent.
+ *
+ * hidapi has no timeout on a feature report (the kernel has its own, seconds long), so the
+ * timeout bounds the retries, not a single report that hangs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include "ledcontrol.h"
+
+/** Allowed params */
+const char* PARAM_RETRIES =						TEXT_PARAM_RETRIES;
+const char* PARAM_TIMEOUT =						TEXT_PARAM_TIMEOUT;
+
+static writePolicy policy = { DEFAULT_WRITE_ATTEMPTS, DEFAULT_WRITE_BACKOFF_US, MAX_WRITE_BACKOFF_US, DEFAULT_WRITE_TIMEOUT_US };
+
+static std::atomic<unsigned long long> transactions(0), retries(0), abandoned(0);
+
+static unsigned long long
+nowMicros() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+void
+setWritePolicy(const writePolicy* p) {
+
+	policy = *p;
+	if (policy.attempts < 1) {
+		policy.attempts = 1;
+	}
+}
+
+void
+getWritePolicy(writePolicy* p) {
+
+	*p = policy;
+}
+
+void
+getWriteStats(writeStats* stats) {
+
+	stats->transactions = transactions.load(std::memory_order_relaxed);
+	stats->retries = retries.load(std::memory_order_relaxed);
+	stats->abandoned = abandoned.load(std::memory_order_relaxed);
+}
+
+/**
+ * Sends count reports of REPORT_LENGTH bytes in order, stopping at the first refused one.
+ * Returns how many were not sent.
+ */
+static int
+sendReports(hid_device *handle, const unsigned char (*reports)[REPORT_LENGTH], int count) {
+
+	for (int i = 0; i < count; i++) {
+		if (tracedSend(handle, reports[i], REPORT_LENGTH) < 0) {
+			return count - i;
+		}
+	}
+
+	return 0;
+}
+
+int
+sendTransaction(hid_device *handle, const unsigned char (*reports)[REPORT_LENGTH], int count) {
+
+	unsigned long long startTicks = traceClock();
+	unsigned long long start = nowMicros();
+	unsigned int backoff = policy.backoffUs;
+	int failed;
+
+	transactions.fetch_add(1, std::memory_order_relaxed);
+
+	for (int attempt = 1; ; attempt++) {
+
+		failed = sendReports(handle, reports, count);
+		if (failed == 0 || attempt >= policy.attempts) {
+			break;
+		}
+
+		// A retry that could not finish in time is not started
+		if (nowMicros() - start + backoff > policy.timeoutUs) {
+			break;
+		}
+
+		struct timespec pause = { (time_t) (backoff / 1000000), (long) (backoff % 1000000) * 1000L };
+		nanosleep(&pause, NULL);
+		backoff = backoff * 2 < policy.maxBackoffUs ? backoff * 2 : policy.maxBackoffUs;
+		retries.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	if (failed) {
+		abandoned.fetch_add(1, std::memory_order_relaxed);
+	}
+	traceRecord(STAGE_TRANSACTION, startTicks);
+
+	return failed;
+}
@@ -0,0 +1,328 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * Shadow copy of the last committed controller state, so only the areas that differ from
+ * it are sent again. The command line keeps it in a small file between runs, the daemon
+ * keeps it in memory.
+ *
+ * The controller does not let its area registers be read, but a feature report read answers
+ * with the last report it took, the commit of the last state. syncState checks the shadow
+ * state against the mode read back before it is trusted, so a keyboard replugged or resumed
+ * (back to its defaults while the file says otherwise) gets everything again instead of
+ * nothing. Another program that committed the same mode with other colors is not seen, -force
+ * is still there for that.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "ledprotocol.h"
+
+/** Allowed params */
+const char* PARAM_QUERY =						TEXT_PARAM_QUERY;
+
+/** Shadow state files, one per device path, in the runtime dir so they go away with the keyboard state on reboot */
+#define STATE_FILE_PREFIX						"msiledenabler-"
+#define STATE_FILE_SUFFIX						".state"
+#define STATE_CACHE_DIR							".cache/msiledenabler"
+#define STATE_MAGIC							0x314c534d // "MSL1"
+
+/**
+ * Whether dir is a directory of the effective user that no one else can write into.
+ */
+static bool
+privateDir(const char* dir) {
+
+	struct stat st;
+
+	return lstat(dir, &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == geteuid()
+		&& (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+/**
+ * Path of the state file of the device at path device, in a directory only the effective user
+ * can write into: the runtime dir, else ~/.cache/msiledenabler of the effective user (sudo may
+ * keep the caller's HOME and drops XDG_RUNTIME_DIR). Never /tmp, where anyone could plant the
+ * file or a symlink in its place. Returns -1 if there is no such directory.
+ *
+ * The device path names the backend too (/dev/hidraw3, mock:0, an IOService path), so a
+ * loopback run or a second keyboard never takes the state of another.
+ */
+static int
+statePath(const char* device, char* path, size_t length) {
+
+	char name[MAX_DEVICE_PATH + 32];
+	const char* dir = getenv("XDG_RUNTIME_DIR");
+	size_t used = snprintf(name, sizeof(name), "%s", STATE_FILE_PREFIX);
+
+	// Only the letters and digits of the path, the rest would be directories
+	for (const char* c = device; *c && used < sizeof(name) - sizeof(STATE_FILE_SUFFIX); c++) {
+		name[used++] = isalnum((unsigned char) *c) ? *c : '_';
+	}
+	snprintf(name + used, sizeof(name) - used, "%s", STATE_FILE_SUFFIX);
+
+	if (dir && *dir && privateDir(dir)) {
+		snprintf(path, length, "%s/%s", dir, name);
+		return 0;
+	}
+
+	struct passwd* pw = getpwuid(geteuid());
+	if (!pw || !pw->pw_dir) {
+		return -1;
+	}
+	snprintf(path, length, "%s/.cache", pw->pw_dir);
+	mkdir(path, 0700);
+	snprintf(path, length, "%s/%s", pw->pw_dir, STATE_CACHE_DIR);
+	mkdir(path, 0700);
+	if (!privateDir(path)) {
+		return -1;
+	}
+	snprintf(path, length, "%s/%s/%s", pw->pw_dir, STATE_CACHE_DIR, name);
+
+	return 0;
+}
+
+static bool
+isCommit(const unsigned char* report) {
+
+	return report[2] == OPCODE_COMMIT;
+}
+
+void
+resetState(keyboardState* state) {
+
+	memset(state, 0, sizeof(*state));
+	state->magic = STATE_MAGIC;
+}
+
+int
+loadState(const char* device, keyboardState* state) {
+
+	char path[1024];
+	struct stat st;
+	int fd;
+
+	resetState(state);
+	if (statePath(device, path, sizeof(path)) < 0) {
+		return -1;
+	}
+
+	fd = open(path, O_RDONLY | O_NOFOLLOW);
+	if (fd < 0) {
+		return -1;
+	}
+
+	// Only a state this user wrote, another one could make the next run skip areas
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	ssize_t length = read(fd, state, sizeof(*state));
+	close(fd);
+	if (length != sizeof(*state) || state->magic != STATE_MAGIC) {
+		resetState(state);
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+saveState(const char* device, const keyboardState* state) {
+
+	char path[1024], tmpPath[1040];
+	int fd;
+
+	if (statePath(device, path, sizeof(path)) < 0) {
+		return -1;
+	}
+	snprintf(tmpPath, sizeof(tmpPath), "%s.XXXXXX", path);
+
+	// A new file (0600) no one else can have planted, renamed over the last state, so
+	// concurrent runs never read half a state
+	fd = mkstemp(tmpPath);
+	if (fd < 0) {
+		return -1;
+	}
+	if (write(fd, state, sizeof(*state)) != sizeof(*state)) {
+		close(fd);
+		unlink(tmpPath);
+		return -1;
+	}
+	close(fd);
+
+	if (rename(tmpPath, path) < 0) {
+		unlink(tmpPath);
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+diffBatch(const keyboardState* state, const reportBatch* full, reportBatch* changes) {
+
+	// No report, not even a commit: nothing to send
+	if (full->count == 0) {
+		changes->count = 0;
+		return 0;
+	}
+
+	const unsigned char* last = full->data[full->count - 1];
+
+	// Area registers are only comparable while the same mode stays committed
+	if (!state->valid || !isCommit(last) || state->mode != last[3]) {
+		*changes = *full;
+		return changes->count;
+	}
+
+	changes->count = 0;
+	for (unsigned char i = 0; i < full->count; i++) {
+		const unsigned char* report = full->data[i];
+		unsigned char area = report[3];
+
+		if (isCommit(report)) {
+			continue;
+		}
+		if (area >= 1 && area <= STATE_AREAS && (state->areaMask & (1 << (area - 1)))
+			&& memcmp(state->areas[area - 1], report, REPORT_LENGTH) == 0) {
+			continue;
+		}
+		memcpy(changes->data[changes->count++], report, REPORT_LENGTH);
+	}
+
+	// Nothing differs: skip the round-trip, commit included
+	if (changes->count > 0) {
+		memcpy(changes->data[changes->count++], last, REPORT_LENGTH);
+	}
+
+	return changes->count;
+}
+
+void
+updateState(keyboardState* state, const reportBatch* sent) {
+
+	unsigned short written = 0;
+
+	for (unsigned char i = 0; i < sent->count; i++) {
+		const unsigned char* report = sent->data[i];
+		unsigned char area = report[3];
+
+		if (isCommit(report)) {
+			if (!state->valid || state->mode != report[3]) {
+				// The registers of the previous mode say nothing about this one
+				state->areaMask &= written;
+			}
+			state->valid = 1;
+			state->mode = report[3];
+		} else if (area >= 1 && area <= STATE_AREAS) {
+			memcpy(state->areas[area - 1], report, REPORT_LENGTH);
+			written |= 1 << (area - 1);
+			state->areaMask |= 1 << (area - 1);
+		}
+	}
+}
+
+int
+syncState(hid_device *handle, keyboardState* state) {
+
+	unsigned char report[REPORT_LENGTH] = { REPORT_ID };
+
+	int length = tracedRead(handle, report, sizeof(report));
+	if (length < 0) {
+		return SYNC_UNSUPPORTED;
+	}
+
+	// Some backends leave the report id out, then everything is one byte lower
+	int prefix = report[0] == REPORT_ID ? 1 : 0;
+	bool commitRead = length > prefix + 6 && report[prefix] == REPORT_PREFIX && report[prefix + 1] == OPCODE_COMMIT
+		&& report[prefix + 6] == REPORT_EOR;
+	unsigned char mode = report[prefix + 2];
+	if (commitRead && state->valid && state->mode == mode) {
+		return SYNC_KEPT;
+	}
+
+	// Powered since (nothing read back), a transaction cut before its commit or another mode
+	resetState(state);
+	if (commitRead) {
+		state->valid = 1;
+		state->mode = mode;
+	}
+
+	return SYNC_RESET;
+}
+
+size_t
+formatState(const keyboardState* state, int sync, char* buffer, size_t length) {
+
+	const char* modeNames[] = { VALUE_MODE_DISABLE, VALUE_MODE_NORMAL, VALUE_MODE_GAMING, VALUE_MODE_BREATHING,
+		"audio", VALUE_MODE_WAVE, VALUE_MODE_DUALCOLOR, "off", "breathing -idle 1", "wave -idle 1" };
+	const char* colorNames[] = { VALUE_COLOR_BLACK, VALUE_COLOR_RED, VALUE_COLOR_ORANGE, VALUE_COLOR_YELLOW,
+		VALUE_COLOR_GREEN, VALUE_COLOR_SKY, VALUE_COLOR_BLUE, VALUE_COLOR_PURPLE, VALUE_COLOR_WHITE };
+	const char* names[3] = { NULL };
+	unsigned char areas[3] = { 0 };
+	bool levels = false;
+	size_t used = 0;
+
+	if (!state->valid) {
+		appendFormat(buffer, length, &used, "mode unknown (%s)\n", sync == SYNC_UNSUPPORTED ? "the firmware does not answer reads and nothing is cached"
+			: "nothing committed since the keyboard was powered");
+		return used;
+	}
+
+	if (state->mode < sizeof(modeNames) / sizeof(modeNames[0])) {
+		appendFormat(buffer, length, &used, "mode %s", modeNames[state->mode]);
+	} else {
+		appendFormat(buffer, length, &used, "mode 0x%02x", state->mode);
+	}
+	appendFormat(buffer, length, &used, " (%s)\n", sync == SYNC_UNSUPPORTED ? "cached, the firmware does not answer reads" : "read back");
+
+	// The registers holding the colors of each mode, see buildBatch
+	switch (state->mode) {
+	case MODE_NORMAL:
+		names[0] = "left", names[1] = "middle", names[2] = "right";
+		areas[0] = AREA_LEFT, areas[1] = AREA_MIDDLE, areas[2] = AREA_RIGHT;
+		levels = true;
+		break;
+	case MODE_GAMING:
+		names[0] = "left";
+		areas[0] = AREA_LEFT;
+		levels = true;
+		break;
+	case MODE_BREATHING_STD:
+	case MODE_BREATHING_IDLE:
+	case MODE_WAVE_STD:
+	case MODE_WAVE_IDLE:
+		names[0] = "color1", names[1] = "color2", names[2] = "color3";
+		areas[0] = AREA_LEFT, areas[1] = AREA_LEFT + 3, areas[2] = AREA_LEFT + 6;
+		break;
+	case MODE_DUAL_COLOR:
+		names[0] = "color1", names[1] = "color2";
+		areas[0] = AREA_LEFT, areas[1] = AREA_MIDDLE;
+		break;
+	}
+
+	for (int i = 0; i < 3 && names[i]; i++) {
+		const unsigned char* report = state->areas[areas[i] - 1];
+		if (!(state->areaMask & (1 << (areas[i] - 1)))) {
+			appendFormat(buffer, length, &used, "%-7s unknown, the next change sends it\n", names[i]);
+			continue;
+		}
+		if (report[4] < sizeof(colorNames) / sizeof(colorNames[0])) {
+			appendFormat(buffer, length, &used, "%-7s %s", names[i], colorNames[report[4]]);
+		} else {
+			appendFormat(buffer, length, &used, "%-7s 0x%02x", names[i], report[4]);
+		}
+		if (levels && report[5] <= LEVEL_4) {
+			appendFormat(buffer, length, &used, " level %d", LEVEL_4 - report[5]);
+		}
+		appendFormat(buffer, length, &used, " (cached)\n");
+	}
+
+	return used;
+}
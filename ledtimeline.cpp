@@ -0,0 +1,340 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * Timelines: a show of keyframes read from a file, compiled before it starts into a flat array
+ * of encoded batches with the time each one is due, then played on absolute deadlines from a
+ * single start time, so a long show ends when it should however many steps it has.
+ *
+ * File: one keyframe per line, its time in seconds from the start then the same params as the
+ * command line, plus "-ease <step|linear|smooth>" for how it goes to the next keyframe. Fades
+ * are only made between normal mode keyframes, sampled at -fps and set to the nearest color and
+ * level; anything else steps. The last keyframe ends the show. '#' starts a comment line.
+ *
+ *   0    -mode normal -color1 red -level 3 -ease linear
+ *   2.5  -mode normal -color1 blue -color2 sky -color3 purple -level 3 -ease smooth
+ *   5    -preset off
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <vector>
+#include "ledcontrol.h"
+
+/** Allowed params */
+const char* PARAM_TIMELINE =						TEXT_PARAM_TIMELINE;
+const char* PARAM_EASE =						TEXT_PARAM_EASE;
+
+/** Allowed ease values */
+#define VALUE_EASE_STEP							"step"
+#define VALUE_EASE_LINEAR						"linear"
+#define VALUE_EASE_SMOOTH						"smooth"
+
+/** File limits */
+#define MAX_TIMELINE_LINE						512
+#define MAX_TIMELINE_TOKENS						32
+
+// struct for a keyframe while the file is compiled
+struct keyframe {
+	double at;
+	unsigned char ease;
+	reportBatch batch;
+};
+
+static volatile sig_atomic_t stopRequested = 0;
+static char timelineError[MAX_TIMELINE_LINE + 128];
+
+static double
+nowNanos() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static const char*
+lineError(const char* path, int line, const char* message) {
+
+	snprintf(timelineError, sizeof(timelineError), "%s:%d: %s", path, line, message);
+	return timelineError;
+}
+
+/**
+ * Whether batch is a normal mode state, its three areas first: the only ones that can fade.
+ */
+static bool
+canFade(const reportBatch* batch) {
+
+	return batch->count == 4 && batch->data[3][3] == MODE_NORMAL;
+}
+
+static void
+addCue(std::vector<timelineCue>& cues, double at, const reportBatch* batch) {
+
+	// The device already shows it, nothing to send at that time
+	if (!cues.empty() && cues.back().batch.count == batch->count
+		&& memcmp(cues.back().batch.data, batch->data, batch->count * REPORT_LENGTH) == 0) {
+		return;
+	}
+
+	timelineCue cue;
+	cue.at = at;
+	cue.batch = *batch;
+	cues.push_back(cue);
+}
+
+/**
+ * Adds the frames between from and to, each area's RGB color moving along ease.
+ */
+static void
+addFade(std::vector<timelineCue>& cues, const keyframe* from, const keyframe* to, int fps) {
+
+	unsigned char start[3][3], end[3][3];
+	reportBatch batch = from->batch;
+	int frames = (int) ((to->at - from->at) * fps + 0.5);
+
+	for (int i = 0; i < 3; i++) {
+		levelRGB(from->batch.data[i][4], from->batch.data[i][5], start[i]);
+		levelRGB(to->batch.data[i][4], to->batch.data[i][5], end[i]);
+	}
+
+	for (int f = 1; f < frames; f++) {
+		double t = (double) f / frames;
+		if (from->ease == EASE_SMOOTH) {
+			t = t * t * (3 - 2 * t);
+		}
+
+		for (int i = 0; i < 3; i++) {
+			unsigned char mixed[3];
+			for (int c = 0; c < 3; c++) {
+				mixed[c] = (unsigned char) (start[i][c] + (end[i][c] - start[i][c]) * t + 0.5);
+			}
+			nearestColor(mixed[0], mixed[1], mixed[2], &batch.data[i][4], &batch.data[i][5]);
+		}
+		addCue(cues, from->at + (double) f / fps, &batch);
+	}
+}
+
+/**
+ * Reads one keyframe line, split into argv with its time in argv[1]. Returns NULL or the error.
+ */
+static const char*
+parseKeyframe(int argc, char* argv[], keyframe* key) {
+
+	unsigned char arguments[kSize];
+	char* end;
+
+	key->at = strtod(argv[1], &end);
+	if (end == argv[1] || *end || !(key->at >= 0)) {
+		return "A keyframe starts with its time in seconds.\n\n";
+	}
+
+	key->ease = EASE_STEP;
+	for (int x = 2; x < argc - 1; x++) {
+		const token* param = lookupToken(argv[x]);
+		if (param && param->kind == TOKEN_PARAM && param->value == kParamEase) {
+			if (strcmp(argv[x + 1], VALUE_EASE_STEP) == 0) {
+				key->ease = EASE_STEP;
+			} else if (strcmp(argv[x + 1], VALUE_EASE_LINEAR) == 0) {
+				key->ease = EASE_LINEAR;
+			} else if (strcmp(argv[x + 1], VALUE_EASE_SMOOTH) == 0) {
+				key->ease = EASE_SMOOTH;
+			} else {
+				return "Invalid ease. (-ease)\n\n";
+			}
+		}
+	}
+
+	// The params without the time, argv[0] stays the program name
+	argv[1] = argv[0];
+	const char* error = parseArguments(argc - 1, argv + 1, arguments);
+	if (error) {
+		return error;
+	}
+	buildBatch(arguments, &key->batch);
+
+	return NULL;
+}
+
+/**
+ * Reads the keyframes of the file at path and compiles them into tl.
+ */
+static const char*
+compileTimeline(const char* path, timeline* tl) {
+
+	std::vector<keyframe> keys;
+	std::vector<timelineCue> cues;
+	char line[MAX_TIMELINE_LINE];
+	int lineNumber = 0;
+
+	FILE* f = fopen(path, "r");
+	if (!f) {
+		return "Unable to open the timeline. (-timeline)\n\n";
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+
+		lineNumber++;
+		size_t length = strlen(line);
+		if (length == sizeof(line) - 1 && line[length - 1] != '\n' && !feof(f)) {
+			fclose(f);
+			return lineError(path, lineNumber, "Line too long.\n\n");
+		}
+
+		static char programName[] = "msiledenabler";
+		char* argv[MAX_TIMELINE_TOKENS];
+		char* saveptr = NULL;
+		int argc = 0;
+		argv[argc++] = programName;
+		for (char* word = strtok_r(line, " \t\r\n", &saveptr); word && argc < MAX_TIMELINE_TOKENS - 1; word = strtok_r(NULL, " \t\r\n", &saveptr)) {
+			argv[argc++] = word;
+		}
+		argv[argc] = NULL;
+		if (argc == 1 || argv[1][0] == '#') {
+			continue;
+		}
+
+		keyframe key;
+		const char* error = parseKeyframe(argc, argv, &key);
+		if (!error && !keys.empty() && key.at < keys.back().at) {
+			error = "Keyframes must be in time order.\n\n";
+		}
+		if (error) {
+			fclose(f);
+			return lineError(path, lineNumber, error);
+		}
+		keys.push_back(key);
+	}
+	fclose(f);
+
+	if (keys.empty()) {
+		return "The timeline has no keyframes. (-timeline)\n\n";
+	}
+
+	for (size_t i = 0; i < keys.size(); i++) {
+		addCue(cues, keys[i].at, &keys[i].batch);
+		if (i + 1 < keys.size() && keys[i].ease != EASE_STEP && canFade(&keys[i].batch) && canFade(&keys[i + 1].batch)) {
+			addFade(cues, &keys[i], &keys[i + 1], tl->fps);
+		}
+	}
+
+	tl->cues = (timelineCue*) malloc(cues.size() * sizeof(timelineCue));
+	if (!tl->cues) {
+		return "Not enough memory for the timeline. (-timeline)\n\n";
+	}
+	memcpy(tl->cues, cues.data(), cues.size() * sizeof(timelineCue));
+	tl->count = cues.size();
+	tl->duration = keys.back().at;
+
+	return NULL;
+}
+
+const char*
+parseTimeline(int argc, char* argv[], timeline* tl) {
+
+	const char* path = NULL;
+
+	memset(tl, 0, sizeof(*tl));
+	tl->fps = DEFAULT_ANIMATION_FPS;
+
+	for (int x = 1; x < argc; x++) {
+
+		if (argv[x][0] != '-') {
+			continue;
+		} else if (!argv[x + 1]) {
+			return "Invalid parameter(s). Use --help for more information\n\n";
+		}
+
+		const token* param = lookupToken(argv[x]);
+		if (!param || param->kind != TOKEN_PARAM) {
+			continue;
+		}
+
+		switch (param->value) {
+
+		case kParamTimeline:
+
+			path = argv[x + 1];
+			break;
+
+		case kParamFps:
+
+			tl->fps = atoi(argv[x + 1]);
+			break;
+		}
+	}
+
+	if (!path) {
+		return "No timeline specified. (-timeline). Use --help for more information\n\n";
+	}
+	if (tl->fps < MIN_ANIMATION_FPS || tl->fps > MAX_ANIMATION_FPS) {
+		return "Invalid frame rate. (-fps). Use --help for more information\n\n";
+	}
+
+	return compileTimeline(path, tl);
+}
+
+void
+closeTimeline(timeline* tl) {
+
+	free(tl->cues);
+	tl->cues = NULL;
+	tl->count = 0;
+}
+
+void
+stopTimeline() {
+
+	stopRequested = 1;
+}
+
+int
+runTimeline(hid_device *handle, const timeline* tl, keyboardState* state, timelineStats* stats) {
+
+	double latenessSum = 0;
+	double missedAfter = 0.5e9 / tl->fps;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->cues = tl->count;
+	stopRequested = 0;
+
+	double start = nowNanos();
+
+	for (size_t i = 0; i < tl->count && !stopRequested; i++) {
+
+		double deadline = start + tl->cues[i].at * 1e9;
+
+		// Behind schedule: a cue the next one already overtook would only be overwritten
+		if (i + 1 < tl->count && nowNanos() >= start + tl->cues[i + 1].at * 1e9) {
+			stats->skipped++;
+			continue;
+		}
+
+		sleepUntil(deadline, &stopRequested);
+		if (stopRequested) {
+			break;
+		}
+
+		double lateness = nowNanos() - deadline;
+		latenessSum += lateness / 1e3;
+		if (lateness > missedAfter) {
+			stats->missed++;
+		}
+		if (lateness / 1e3 > stats->maxLatenessUs) {
+			stats->maxLatenessUs = lateness / 1e3;
+			stats->worstAt = tl->cues[i].at;
+		}
+
+		if (applyBatch(handle, &tl->cues[i].batch, state) != 0) {
+			stats->failed++;
+		} else {
+			stats->sent++;
+		}
+	}
+
+	stats->elapsed = (nowNanos() - start) / 1e9;
+	stats->meanLatenessUs = stats->sent + stats->failed ? latenessSum / (stats->sent + stats->failed) : 0;
+
+	return stats->failed ? -1 : 0;
+}
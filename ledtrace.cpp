@@ -0,0 +1,311 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * Latency of every HID operation: the traced* wrappers read the TSC (the monotonic clock on
+ * other CPUs) before and after the call and store the ticks in a ring and a log2 histogram owned
+ * by the calling thread, so recording takes no lock and shares no cache line. About 50ns per
+ * call against the hundreds of us of a control transfer, so it is always on. Ticks are only
+ * turned into time when the stats are formatted, against the monotonic clock.
+ *
+ * formatTrace sums the histograms of every thread (counts, mean, max since the start) and takes
+ * p50 / p99 from the last TRACE_RING_SIZE samples of each thread; it may miss the samples being
+ * written while it reads. A thread gives its block back when it exits, the next thread to trace
+ * takes it with what it holds, so the stats stay since the start.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+#include <algorithm>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+	#include <x86intrin.h>
+#endif
+#include "ledprotocol.h"
+
+/** Allowed params */
+const char* PARAM_STATS =						TEXT_PARAM_STATS;
+
+/** Threads running at once that get their own block, the others are not traced */
+#define MAX_TRACE_THREADS						32
+
+static const char* stageNames[TRACE_STAGES] = { "enumerate", "open", "report", "close", "exit", "transaction", "read" };
+
+// struct for one timed operation
+struct traceEvent {
+	std::atomic<unsigned int> stage;
+	std::atomic<unsigned long long> ticks;
+};
+
+// struct for what one thread recorded. Only written by its thread
+struct traceBlock {
+	std::atomic<unsigned long long> head;
+	traceEvent ring[TRACE_RING_SIZE];
+	std::atomic<unsigned long long> buckets[TRACE_STAGES][TRACE_BUCKETS];
+	std::atomic<unsigned long long> sum[TRACE_STAGES], max[TRACE_STAGES];
+};
+
+static traceBlock blocks[MAX_TRACE_THREADS];
+static std::atomic<bool> blockTaken[MAX_TRACE_THREADS];
+static std::atomic<int> blockCount(0);
+static std::atomic<unsigned long long> untracedThreads(0);
+static thread_local traceBlock* threadBlock = NULL;
+static thread_local bool untraced = false;
+
+/** Gives the block of an exiting thread back */
+static pthread_key_t blockKey;
+static pthread_once_t blockKeyOnce = PTHREAD_ONCE_INIT;
+
+static unsigned long long
+monotonicNanos() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+unsigned long long
+traceClock() {
+
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return monotonicNanos();
+#endif
+}
+
+/** Both clocks when the program started, to turn ticks into ns */
+static const unsigned long long startTicks = traceClock();
+static const unsigned long long startNanos = monotonicNanos();
+
+static double
+nanosPerTick() {
+
+	// Over the whole run, the ticks read between two clock reads: the error is the tens of ns
+	// between them, against at least the open of the keyboard
+	unsigned long long before = monotonicNanos();
+	unsigned long long ticks = traceClock() - startTicks;
+	unsigned long long nanos = (before + monotonicNanos()) / 2 - startNanos;
+	return ticks && nanos ? (double) nanos / ticks : 1;
+}
+
+static void
+releaseBlock(void* block) {
+
+	// Release: the next thread on it sees all this one wrote
+	blockTaken[(traceBlock*) block - blocks].store(false, std::memory_order_release);
+}
+
+static void
+createBlockKey() {
+
+	pthread_key_create(&blockKey, releaseBlock);
+}
+
+/**
+ * First free block for the calling thread, NULL when MAX_TRACE_THREADS threads hold one.
+ */
+static traceBlock*
+takeBlock() {
+
+	pthread_once(&blockKeyOnce, createBlockKey);
+	for (int i = 0; i < MAX_TRACE_THREADS; i++) {
+		if (!blockTaken[i].load(std::memory_order_relaxed) && !blockTaken[i].exchange(true, std::memory_order_acquire)) {
+			// blockCount is how many formatTrace reads, the highest one taken
+			int count = blockCount.load(std::memory_order_relaxed);
+			while (count <= i && !blockCount.compare_exchange_weak(count, i + 1, std::memory_order_release)) {
+			}
+			pthread_setspecific(blockKey, &blocks[i]);
+			return &blocks[i];
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Histogram bucket of a duration: bucket b holds [2^b, 2^(b+1)) ticks, the last one the rest.
+ */
+static int
+bucketOf(unsigned long long ticks) {
+
+	int bucket = ticks ? 63 - __builtin_clzll(ticks) : 0;
+	return bucket < TRACE_BUCKETS ? bucket : TRACE_BUCKETS - 1;
+}
+
+void
+traceRecord(int stage, unsigned long long start) {
+
+	unsigned long long ticks = traceClock() - start;
+
+	if (!threadBlock) {
+		if (untraced) {
+			return;
+		}
+		threadBlock = takeBlock();
+		if (!threadBlock) {
+			untraced = true;
+			untracedThreads.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+	}
+
+	// Plain load and store: this thread is the only writer
+	traceBlock* b = threadBlock;
+	unsigned long long head = b->head.load(std::memory_order_relaxed);
+	traceEvent* event = &b->ring[head % TRACE_RING_SIZE];
+	event->stage.store(stage, std::memory_order_relaxed);
+	event->ticks.store(ticks, std::memory_order_relaxed);
+	b->head.store(head + 1, std::memory_order_release);
+
+	std::atomic<unsigned long long>* bucket = &b->buckets[stage][bucketOf(ticks)];
+	bucket->store(bucket->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	b->sum[stage].store(b->sum[stage].load(std::memory_order_relaxed) + ticks, std::memory_order_relaxed);
+	if (ticks > b->max[stage].load(std::memory_order_relaxed)) {
+		b->max[stage].store(ticks, std::memory_order_relaxed);
+	}
+}
+
+hid_device_info*
+tracedEnumerate(unsigned short vendorId, unsigned short productId) {
+
+	unsigned long long start = traceClock();
+	hid_device_info* devs = hid_enumerate(vendorId, productId);
+	traceRecord(STAGE_ENUMERATE, start);
+
+	return devs;
+}
+
+hid_device*
+tracedOpen(unsigned short vendorId, unsigned short productId, char* path, size_t length) {
+
+	hid_device_info* devs = tracedEnumerate(vendorId, productId);
+	hid_device* handle = NULL;
+
+	// The first one like hid_open, but its path is needed to find its shadow state
+	if (devs) {
+		handle = tracedOpenPath(devs->path);
+		if (handle && path) {
+			snprintf(path, length, "%s", devs->path);
+		}
+	}
+	hid_free_enumeration(devs);
+
+	return handle;
+}
+
+hid_device*
+tracedOpenPath(const char* path) {
+
+	unsigned long long start = traceClock();
+	hid_device* handle = hid_open_path(path);
+	traceRecord(STAGE_OPEN, start);
+
+	return handle;
+}
+
+int
+tracedSend(hid_device* handle, const unsigned char* report, size_t length) {
+
+	unsigned long long start = traceClock();
+	int result = hid_send_feature_report(handle, report, length);
+	traceRecord(STAGE_REPORT, start);
+
+	return result;
+}
+
+int
+tracedRead(hid_device* handle, unsigned char* report, size_t length) {
+
+	unsigned long long start = traceClock();
+	int result = hid_get_feature_report(handle, report, length);
+	traceRecord(STAGE_READ, start);
+
+	return result;
+}
+
+void
+tracedClose(hid_device* handle) {
+
+	unsigned long long start = traceClock();
+	hid_close(handle);
+	traceRecord(STAGE_CLOSE, start);
+}
+
+void
+tracedExit() {
+
+	unsigned long long start = traceClock();
+	hid_exit();
+	traceRecord(STAGE_EXIT, start);
+}
+
+size_t
+formatTrace(char* buffer, size_t length) {
+
+	size_t used = 0;
+	double us = nanosPerTick() / 1e3;
+	int threads = std::min(blockCount.load(std::memory_order_acquire), MAX_TRACE_THREADS);
+
+	appendFormat(buffer, length, &used, "%-10s %8s %10s %10s %10s %10s  (us)\n", "stage", "count", "mean", "p50", "p99", "max");
+
+	for (int stage = 0; stage < TRACE_STAGES; stage++) {
+		unsigned long long buckets[TRACE_BUCKETS] = { 0 }, count = 0, sum = 0, max = 0;
+		std::vector<unsigned long long> recent;
+
+		for (int t = 0; t < threads; t++) {
+			traceBlock* b = &blocks[t];
+			for (int i = 0; i < TRACE_BUCKETS; i++) {
+				unsigned long long n = b->buckets[stage][i].load(std::memory_order_relaxed);
+				buckets[i] += n;
+				count += n;
+			}
+			sum += b->sum[stage].load(std::memory_order_relaxed);
+			max = std::max(max, b->max[stage].load(std::memory_order_relaxed));
+
+			unsigned long long head = b->head.load(std::memory_order_acquire);
+			unsigned long long first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+			for (unsigned long long i = first; i < head; i++) {
+				const traceEvent* event = &b->ring[i % TRACE_RING_SIZE];
+				if (event->stage.load(std::memory_order_relaxed) == (unsigned int) stage) {
+					recent.push_back(event->ticks.load(std::memory_order_relaxed));
+				}
+			}
+		}
+		if (count == 0) {
+			continue;
+		}
+
+		std::sort(recent.begin(), recent.end());
+		double p50 = recent.empty() ? 0 : recent[recent.size() / 2] * us;
+		double p99 = recent.empty() ? 0 : recent[std::min(recent.size() - 1, (size_t) (recent.size() * 0.99))] * us;
+		appendFormat(buffer, length, &used, "%-10s %8llu %10.1f %10.1f %10.1f %10.1f\n", stageNames[stage], count, (double) sum / count * us, p50, p99, max * us);
+
+		// One line per non empty bucket, bars scaled to the fullest one
+		unsigned long long fullest = *std::max_element(buckets, buckets + TRACE_BUCKETS);
+		for (int i = 0; i < TRACE_BUCKETS; i++) {
+			if (!buckets[i]) {
+				continue;
+			}
+			char bar[41];
+			int width = (int) ((buckets[i] * 40 + fullest - 1) / fullest);
+			memset(bar, '#', width);
+			bar[width] = '\0';
+			appendFormat(buffer, length, &used, "  %10.3f - %-10.3f %6llu %s\n", (1ull << i) * us, (2ull << i) * us, buckets[i], bar);
+		}
+	}
+
+	writeStats writes;
+	getWriteStats(&writes);
+	if (writes.transactions) {
+		appendFormat(buffer, length, &used, "%llu transactions, %llu retries, %llu abandoned\n", writes.transactions, writes.retries, writes.abandoned);
+	}
+	unsigned long long skipped = untracedThreads.load(std::memory_order_relaxed);
+	if (skipped) {
+		appendFormat(buffer, length, &used, "%llu threads not traced, more than %d at once\n", skipped, MAX_TRACE_THREADS);
+	}
+
+	return used;
+}
@@ -0,0 +1,272 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * C interface of libmsiled: each handle is a Keyboard (lededit.h) and the message of its last
+ * error. The constants of msiled.h are the protocol values, checked against ledcontrol.h below
+ * so they can be passed through as they are.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <new>
+#include "lededit.h"
+#include "msiled.h"
+
+/** Params accepted by msiled_apply */
+#define MAX_APPLY_PARAMS						512
+#define MAX_APPLY_TOKENS						32
+
+static_assert(MSILED_AREA_LEFT == AREA_LEFT && MSILED_AREA_RIGHT == AREA_RIGHT, "msiled.h areas are the protocol ones");
+static_assert(MSILED_COLOR_BLACK == COLOR_BLACK && MSILED_COLOR_WHITE == COLOR_WHITE, "msiled.h colors are the protocol ones");
+static_assert(MSILED_LEVEL_1 == LEVEL_1 && MSILED_LEVEL_4 == LEVEL_4, "msiled.h levels are the protocol ones");
+static_assert(MSILED_MODE_NORMAL == MODE_NORMAL && MSILED_MODE_BREATHING == MODE_BREATHING_STD
+	&& MSILED_MODE_WAVE == MODE_WAVE_STD && MSILED_MODE_DUAL_COLOR == MODE_DUAL_COLOR
+	&& MSILED_MODE_BREATHING_IDLE == MODE_BREATHING_IDLE && MSILED_MODE_WAVE_IDLE == MODE_WAVE_IDLE, "msiled.h modes are the protocol ones");
+
+// struct behind the opaque handle of msiled.h. The state is persisted like the tool does, so
+// a run of the tool after a change made here still knows what the keyboard shows
+struct msiled {
+	Keyboard keyboard { true };
+	char error[256];
+};
+
+/**
+ * Keeps message (without its trailing blank lines) as the last error of keyboard, returns code.
+ */
+static int
+fail(msiled* keyboard, int code, const char* message) {
+
+	size_t length = strlen(message);
+	while (length > 0 && message[length - 1] == '\n') {
+		length--;
+	}
+	if (length >= sizeof(keyboard->error)) {
+		length = sizeof(keyboard->error) - 1;
+	}
+	memcpy(keyboard->error, message, length);
+	keyboard->error[length] = '\0';
+
+	return code;
+}
+
+/**
+ * Result of a send through the keyboard: the number of reports refused, -1 when not sent.
+ */
+static int
+sent(msiled* keyboard, int failed) {
+
+	if (failed < 0) {
+		return fail(keyboard, MSILED_ERR_NO_MODE, msiled_strerror(MSILED_ERR_NO_MODE));
+	}
+	if (failed > 0) {
+		return fail(keyboard, MSILED_ERR_IO, msiled_strerror(MSILED_ERR_IO));
+	}
+
+	keyboard->error[0] = '\0';
+	return MSILED_OK;
+}
+
+static bool
+validMode(int mode) {
+
+	return mode == MSILED_MODE_DISABLE || mode == MSILED_MODE_NORMAL || mode == MSILED_MODE_GAMING
+		|| mode == MSILED_MODE_BREATHING || mode == MSILED_MODE_WAVE || mode == MSILED_MODE_DUAL_COLOR
+		|| mode == MSILED_MODE_BREATHING_IDLE || mode == MSILED_MODE_WAVE_IDLE;
+}
+
+static bool
+validArea(int area, int color, int level) {
+
+	return area >= MSILED_AREA_LEFT && area <= MSILED_AREA_RIGHT && color >= MSILED_COLOR_BLACK
+		&& color <= MSILED_COLOR_WHITE && level >= MSILED_LEVEL_1 && level <= MSILED_LEVEL_4;
+}
+
+int
+msiled_abi_version(void) {
+
+	return MSILED_ABI_VERSION;
+}
+
+msiled*
+msiled_open(const char* path, unsigned int flags, int* error) {
+
+	msiled* keyboard = new (std::nothrow) msiled();
+	if (!keyboard) {
+		if (error) {
+			*error = MSILED_ERR_NO_MEMORY;
+		}
+		return NULL;
+	}
+
+	// Like the tool: the keyboard is only written, no reader thread per device
+	hid_set_input_reports(0);
+
+	if (keyboard->keyboard.open(path, (flags & MSILED_OPEN_FORCE) != 0) < 0) {
+		delete keyboard;
+		if (error) {
+			*error = MSILED_ERR_NO_DEVICE;
+		}
+		return NULL;
+	}
+
+	if (error) {
+		*error = MSILED_OK;
+	}
+	return keyboard;
+}
+
+void
+msiled_close(msiled* keyboard) {
+
+	// The keyboard closes and saves its state when destroyed
+	delete keyboard;
+}
+
+int
+msiled_set_mode(msiled* keyboard, int mode) {
+
+	if (!validMode(mode)) {
+		return fail(keyboard, MSILED_ERR_INVALID, "Invalid mode.");
+	}
+
+	keyboard->keyboard.setMode(mode);
+	return MSILED_OK;
+}
+
+int
+msiled_set_area(msiled* keyboard, int area, int color, int level) {
+
+	if (!validArea(area, color, level)) {
+		return fail(keyboard, MSILED_ERR_INVALID, "Invalid area, color or level.");
+	}
+
+	keyboard->keyboard.setArea(area, color, level);
+	return MSILED_OK;
+}
+
+int
+msiled_set_area_rgb(msiled* keyboard, int area, unsigned char r, unsigned char g, unsigned char b) {
+
+	unsigned char color, level;
+
+	nearestColor(r, g, b, &color, &level);
+	return msiled_set_area(keyboard, area, color, level);
+}
+
+int
+msiled_commit(msiled* keyboard) {
+
+	return sent(keyboard, keyboard->keyboard.commit());
+}
+
+void
+msiled_discard(msiled* keyboard) {
+
+	keyboard->keyboard.discard();
+}
+
+int
+msiled_apply_batch(msiled* keyboard, int mode, const msiled_area* areas, size_t count) {
+
+	if (!validMode(mode)) {
+		return fail(keyboard, MSILED_ERR_INVALID, "Invalid mode.");
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (!validArea(areas[i].area, areas[i].color, areas[i].level)) {
+			return fail(keyboard, MSILED_ERR_INVALID, "Invalid area, color or level.");
+		}
+	}
+
+	keyboard->keyboard.discard();
+	keyboard->keyboard.setMode(mode);
+	for (size_t i = 0; i < count; i++) {
+		keyboard->keyboard.setArea(areas[i].area, areas[i].color, areas[i].level);
+	}
+
+	return msiled_commit(keyboard);
+}
+
+int
+msiled_apply(msiled* keyboard, const char* params) {
+
+	static char programName[] = "msiledenabler";
+	char line[MAX_APPLY_PARAMS];
+	char* argv[MAX_APPLY_TOKENS];
+	unsigned char arguments[kSize];
+	char* saveptr = NULL;
+	int argc = 0;
+
+	if (!params || strlen(params) >= sizeof(line)) {
+		return fail(keyboard, MSILED_ERR_INVALID, "Params too long.");
+	}
+	strcpy(line, params);
+
+	// Split like the daemon does its lines, all of them: a state cut short would still apply
+	argv[argc++] = programName;
+	for (char* word = strtok_r(line, " \t\r\n", &saveptr); word; word = strtok_r(NULL, " \t\r\n", &saveptr)) {
+		if (argc == MAX_APPLY_TOKENS - 1) {
+			return fail(keyboard, MSILED_ERR_INVALID, "Too many params.");
+		}
+		argv[argc++] = word;
+	}
+	argv[argc] = NULL;
+
+	// Parsed but ignored by parseArguments, -all included: open each keyboard by its path
+	const char* param = commandLineParam(argc, argv);
+	if (param) {
+		char message[96];
+		snprintf(message, sizeof(message), "%.32s is only available on the command line.", param);
+		return fail(keyboard, MSILED_ERR_INVALID, message);
+	}
+
+	const char* error = argc < 3 ? "Invalid parameter(s)." : parseArguments(argc, argv, arguments);
+	if (error) {
+		return fail(keyboard, MSILED_ERR_INVALID, error);
+	}
+
+	return sent(keyboard, keyboard->keyboard.apply(arguments));
+}
+
+int
+msiled_query(msiled* keyboard, char* buffer, size_t length) {
+
+	if (length == 0) {
+		return fail(keyboard, MSILED_ERR_INVALID, "Empty buffer.");
+	}
+
+	keyboard->keyboard.query(buffer, length);
+	keyboard->error[0] = '\0';
+	return MSILED_OK;
+}
+
+const char*
+msiled_strerror(int error) {
+
+	switch (error) {
+	case MSILED_OK:
+		return "No error.";
+	case MSILED_ERR_NO_DEVICE:
+		return "Unable to open MSI Led device.";
+	case MSILED_ERR_INVALID:
+		return "Invalid parameter(s).";
+	case MSILED_ERR_IO:
+		return "Unable to send a feature report.";
+	case MSILED_ERR_NO_MODE:
+		return "No mode to commit.";
+	case MSILED_ERR_NO_MEMORY:
+		return "Not enough memory.";
+	}
+
+	return "Unknown error.";
+}
+
+const char*
+msiled_last_error(const msiled* keyboard) {
+
+	return keyboard->error;
+}
+
+void
+msiled_exit(void) {
+
+	tracedExit();
+}
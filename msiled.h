@@ -0,0 +1,152 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * libmsiled: C interface for programs that change the lights in process (status bars,
+ * compositors) instead of running msiledenabler for each change.
+ *
+ *   int error;
+ *   msiled *keyboard = msiled_open(NULL, 0, &error);
+ *   if (keyboard) {
+ *       msiled_set_mode(keyboard, MSILED_MODE_NORMAL);
+ *       msiled_set_area(keyboard, MSILED_AREA_LEFT, MSILED_COLOR_RED, MSILED_LEVEL_4);
+ *       msiled_commit(keyboard);
+ *       msiled_close(keyboard);
+ *   }
+ *
+ * Link with -lmsiled. Calls return MSILED_OK or one of the negative MSILED_ERR_* codes, and
+ * never print. A handle must not be used by two threads at once. Handles share what is kept per
+ * process: the retry policy of refused reports, the cache of breathing and wave ramps, and
+ * the HID backend msiled_exit releases. Only functions are exported and the handle is opaque,
+ * so programs keep working with any libmsiled.so.1; the values below never change meaning,
+ * new ones may be added.
+ */
+
+#ifndef MSILED_H__
+#define MSILED_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MSILED_EXPORT							__attribute__((visibility("default")))
+
+/** ABI version, the number after the .so of the library */
+#define MSILED_ABI_VERSION						1
+
+/** Error codes */
+#define MSILED_OK							0
+#define MSILED_ERR_NO_DEVICE						-1 /* no keyboard, or it could not be opened */
+#define MSILED_ERR_INVALID						-2 /* a value out of range, or params that don't parse */
+#define MSILED_ERR_IO							-3 /* the keyboard refused reports, retries included */
+#define MSILED_ERR_NO_MODE						-4 /* commit without a mode staged or read back */
+#define MSILED_ERR_NO_MEMORY						-5
+
+/** msiled_open flags */
+#define MSILED_OPEN_FORCE						0x01 /* ignore the last state, the first commit sends everything */
+
+/** Areas. The special modes use 3 registers per area, set them with msiled_apply */
+#define MSILED_AREA_LEFT						1
+#define MSILED_AREA_MIDDLE						2
+#define MSILED_AREA_RIGHT						3
+
+/** Colors */
+#define MSILED_COLOR_BLACK						0
+#define MSILED_COLOR_RED						1
+#define MSILED_COLOR_ORANGE						2
+#define MSILED_COLOR_YELLOW						3
+#define MSILED_COLOR_GREEN						4
+#define MSILED_COLOR_SKY						5
+#define MSILED_COLOR_BLUE						6
+#define MSILED_COLOR_PURPLE						7
+#define MSILED_COLOR_WHITE						8
+
+/** Levels. MSILED_LEVEL_4 is the brightest, -level 0 on the command line */
+#define MSILED_LEVEL_1							0
+#define MSILED_LEVEL_2							1
+#define MSILED_LEVEL_3							2
+#define MSILED_LEVEL_4							3
+
+/** Modes */
+#define MSILED_MODE_DISABLE						0
+#define MSILED_MODE_NORMAL						1
+#define MSILED_MODE_GAMING						2
+#define MSILED_MODE_BREATHING						3
+#define MSILED_MODE_WAVE						5
+#define MSILED_MODE_DUAL_COLOR						6
+#define MSILED_MODE_BREATHING_IDLE					8
+#define MSILED_MODE_WAVE_IDLE						9
+
+typedef struct msiled msiled;
+
+/* One area of msiled_apply_batch */
+typedef struct msiled_area {
+	int area;
+	int color;
+	int level;
+} msiled_area;
+
+MSILED_EXPORT int msiled_abi_version(void);
+
+/**
+ * Opens the first MSI keyboard, or the one at path (NULL for the first), with the state the
+ * last run left, checked against the keyboard. Returns NULL on failure, the reason in error
+ * (may be NULL).
+ */
+MSILED_EXPORT msiled* msiled_open(const char* path, unsigned int flags, int* error);
+
+/**
+ * Drops what is staged, saves the state for the next run and closes the keyboard. NULL is ignored.
+ */
+MSILED_EXPORT void msiled_close(msiled* keyboard);
+
+/**
+ * Stages the mode, or the color and level of an area (normal and gaming modes), for the next
+ * msiled_commit. msiled_set_area_rgb sets the nearest color and level to r, g, b.
+ */
+MSILED_EXPORT int msiled_set_mode(msiled* keyboard, int mode);
+MSILED_EXPORT int msiled_set_area(msiled* keyboard, int area, int color, int level);
+MSILED_EXPORT int msiled_set_area_rgb(msiled* keyboard, int area, unsigned char r, unsigned char g, unsigned char b);
+
+/**
+ * Sends what is staged and the commit as one transaction, only the areas that differ from
+ * what the keyboard shows. msiled_discard drops what is staged instead.
+ */
+MSILED_EXPORT int msiled_commit(msiled* keyboard);
+MSILED_EXPORT void msiled_discard(msiled* keyboard);
+
+/**
+ * Sends mode and count areas at once, like set then commit. Nothing is sent if any is invalid.
+ */
+MSILED_EXPORT int msiled_apply_batch(msiled* keyboard, int mode, const msiled_area* areas, size_t count);
+
+/**
+ * Sends a whole state given as command line params, e.g. "-mode wave -color1 red -color2 blue
+ * -color3 green -period 3" or "-preset dim", at most 30 params and values. The params of the
+ * tool itself (-all, -animate, -daemon...) are refused. For MSILED_ERR_INVALID,
+ * msiled_last_error says why.
+ */
+MSILED_EXPORT int msiled_apply(msiled* keyboard, const char* params);
+
+/**
+ * Reads the mode back from the keyboard and writes what is known of its state into buffer,
+ * as msiledenabler -query prints it.
+ */
+MSILED_EXPORT int msiled_query(msiled* keyboard, char* buffer, size_t length);
+
+/**
+ * Message of an error code, and of the last error of a handle.
+ */
+MSILED_EXPORT const char* msiled_strerror(int error);
+MSILED_EXPORT const char* msiled_last_error(const msiled* keyboard);
+
+/**
+ * Releases the HID backend once every handle is closed.
+ */
+MSILED_EXPORT void msiled_exit(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -6,9 +6,8 @@
  */
 
 #include <stdio.h>
-#include <math.h>
 #include <wchar.h>
-#include "hidapi.h"
+#include <signal.h>
 
 // Headers needed for sleeping.
 #ifdef _WIN32
@@ -18,116 +17,9 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 #include <string>
-
-/** Max char params */
-#define UCHAR_MAX							0x10
-
-/** Area constants */
-#define AREA_LEFT							0x01
-#define AREA_MIDDLE							0x02
-#define AREA_RIGHT							0x03
-
-/** Color constants */
-#define COLOR_BLACK							0x00
-#define COLOR_RED							0x01
-#define COLOR_ORANGE							0x02
-#define COLOR_YELLOW							0x03
-#define COLOR_GREEN							0x04
-#define COLOR_SKY							0x05
-#define COLOR_BLUE							0x06
-#define COLOR_PURPLE							0x07
-#define COLOR_WHITE							0x08
-
-/** Level constants. High is more intense light */
-#define LEVEL_1								0x00
-#define LEVEL_2								0x01
-#define LEVEL_3								0x02
-#define LEVEL_4								0x03
-
-/** Lights modes */
-#define MODE_DISABLE							0x00
-#define MODE_NORMAL							0x01
-#define MODE_GAMING							0x02
-#define MODE_BREATHING_STD						0x03
-#define MODE_AUDIO							0x04 // not implemented
-#define MODE_WAVE_STD  							0x05
-#define MODE_DUAL_COLOR							0x06
-#define MODE_OFF							0x07 // not implemented, same as MODE_DISABLE ?
-#define MODE_BREATHING_IDLE						0x08
-#define MODE_WAVE_IDLE							0x09
-
-/** Mode color change period constants */
-#define PERIOD_WAVE_STD	   						1.5
-#define PERIOD_BREATHING_STD						1
-#define PERIOD_DUAL_COLOR  						2
-#define PERIOD_WAVE_IDLE						6
-#define PERIOD_BREATHING_IDLE						5.5
-
-/** Allowed params */
-const char* PARAM_HELP =						"--help";
-const char* PARAM_HELP_SHORT=						"-h";
-const char* PARAM_VERS =						"--version";
-const char* PARAM_VERS_SHORT=						"-v";
-const char* PARAM_MODE =						"-mode";
-const char* PARAM_COLOR1 =						"-color1";
-const char* PARAM_COLOR2 =						"-color2";
-const char* PARAM_COLOR3 =						"-color3";
-const char* PARAM_LEVEL	=						"-level";
-const char* PARAM_IDLE	=						"-idle";
-
-/** Allowed modes values */
-const char* VALUE_MODE_DISABLE = 					"disable";
-const char* VALUE_MODE_NORMAL = 					"normal";
-const char* VALUE_MODE_GAMING = 					"gaming";
-const char* VALUE_MODE_BREATHING = 					"breathing";
-const char* VALUE_MODE_WAVE = 						"wave";
-const char* VALUE_MODE_DUALCOLOR =					"dualcolor";
-
-/** Allowed colors values */
-const char* VALUE_COLOR_BLACK =						"black";
-const char* VALUE_COLOR_RED	=					"red";
-const char* VALUE_COLOR_ORANGE =					"orange";
-const char* VALUE_COLOR_YELLOW =					"yellow";
-const char* VALUE_COLOR_GREEN =						"green";
-const char* VALUE_COLOR_SKY =						"sky";
-const char* VALUE_COLOR_BLUE =						"blue";
-const char* VALUE_COLOR_PURPLE =					"purple";
-const char* VALUE_COLOR_WHITE =						"white";
-
-// enum for array param values positions
-enum values {
-	kMode,
-	kColor1,
-	kColor2,
-	kColor3,
-	kLevel,
-	kIdle,
-	kSize,
-};
-
-// struct for RedGreenBlue color model
-struct rgb {
-	rgb() : color(COLOR_BLACK), r(0), g(0), b(0) {}
-	rgb(unsigned char color, unsigned char r, unsigned char g, unsigned char b) : color(color), r(r), g(g), b(b) {}
-	unsigned char color, r, g, b;
-	void setRGBvalues(rgb rgbColor) {
-		color = rgbColor.color;
-		r = rgbColor.r;
-		g = rgbColor.g;
-		b = rgbColor.b;
-	}
-};
-
-// struct for colors defined with RGB values at intensity LEVEL_2
-struct colors {
-	colors() : black(COLOR_BLACK, 0, 0, 0), red(COLOR_RED, 255, 0, 0),
-				orange(COLOR_ORANGE, 187, 112, 0), yellow(COLOR_YELLOW, 238, 238, 0),
-				green(COLOR_GREEN, 176, 255, 0), sky(COLOR_SKY, 0, 255, 255),
-				blue(COLOR_BLUE, 0, 0, 255), purple(COLOR_PURPLE, 48, 0, 255),
-				white(COLOR_WHITE, 176, 255, 176) {}
-	const rgb black, red, orange, yellow, green, sky, blue, purple, white;
-};
+#include "lededit.h"
 
 char usage[] =
 "Usage [DISABLE MODE]:\n"
@@ -139,14 +31,56 @@ char usage[] =
 "msiledenabler -mode gaming -color1 <valid_color> -level <valid_intensity_level>\n"
 "Usage [BEATHING MODE]:\n"
 "msiledenabler -mode breathing -color1 <valid_color> -color2 <valid_color> -color3 <valid_color>\n"
-"\t     [-idle <valid_idle_value>]\n"
+"\t     [-idle <valid_idle_value>] [-period <seconds>]\n"
 "Usage [WAVE MODE]:\n"
 "msiledenabler -mode wave -color1 <valid_color> -color2 <valid_color> -color3 <valid_color>\n"
-"\t     [-idle <valid_idle_value>]\n"
+"\t     [-idle <valid_idle_value>] [-period <seconds>]\n"
 "Usage [DUAL_COLOR MODE]:\n"
-"msiledenabler -mode dualcolor -color1 <valid_color> -color2 <valid_color>\n\n"
+"msiledenabler -mode dualcolor -color1 <valid_color> -color2 <valid_color> [-period <seconds>]\n"
+"Usage [ANIMATION]:\n"
+"msiledenabler -animate <pulse|cycle|scan> -color1 <valid_color> [-color2 <valid_color>] [-color3 <valid_color>]\n"
+"\t      [-level <valid_intensity_level>] [-fps <1-240>] [-period <seconds>] [-duration <seconds>]\n"
+"\t      rendered by the host in normal mode, until -duration is over or Ctrl-C\n"
+"Usage [SCREEN SYNC]:\n"
+"msiledenabler -ambient <test|frames_file> [-size <width>x<height>] [-step <rows>] [-fps <1-240>] [-duration <seconds>]\n"
+"\t      each area follows the average color of its third of the screen. frames_file holds\n"
+"\t      BGRX frames of -size (default 3840x2160) back to back; test generates moving colors\n"
+"Usage [AUDIO]:\n"
+"msiledenabler -audio <wav_file|-> [-color1 <valid_color>] [-color2 <valid_color>] [-color3 <valid_color>] [-duration <seconds>]\n"
+"\t      low, mid and high frequencies light the left, middle and right areas (default red, green,\n"
+"\t      blue) brighter the louder they are. 16 bit PCM WAV, - reads it from stdin\n"
+"Usage [TIMELINE]:\n"
+"msiledenabler -timeline <keyframes_file> [-fps <1-240>]\n"
+"\t      plays a show: each line a time in seconds then the params of a state, and\n"
+"\t      [-ease <step|linear|smooth>] to fade to the next one (normal mode, sampled at -fps)\n"
+"Add -force to any of the above to resend every area, even the ones the last run already set\n"
+"Add -retries <n> and -timeout <ms> to any of the above to change how refused reports are\n"
+"\t      retried (default 3 retries within 500ms): the areas and the commit are sent again as a whole\n"
+"Add --stats to any of the above to print how long each HID operation took\n"
+"Add -all to any of the above to set every MSI keyboard plugged, not only the first one\n"
+"Usage [PRESET]:\n"
+"msiledenabler -preset <off|red|orange|yellow|green|sky|blue|purple|white|rgb|dim>\n"
+"\t      normal mode at the highest level (dim: white at the lowest), reports encoded at build time\n"
+"Usage [PROFILES]:\n"
+"msiledenabler -compile <profiles_source> [-library <file>]\n"
+"\t      encodes every profile of the source into a library (default $XDG_CONFIG_HOME/msiledenabler.profiles)\n"
+"msiledenabler -profile <name> [-library <file>]\n"
+"\t      sends the reports stored for the profile, step after step\n"
+"Usage [QUERY]:\n"
+"msiledenabler -query\n"
+"\t      prints the mode the keyboard shows, read back from it, and the colors last sent to it\n"
+"Usage [DAEMON]:\n"
+"msiledenabler -daemon [<socket_path>] [-group <name>] [-library <file>]\n"
+"\t      keeps the device open and applies each line received on the socket\n"
+"\t      (same params as above, e.g. \"-mode normal -color1 red -level 0\" or \"-profile work\")\n"
+"\t      the socket defaults to $XDG_RUNTIME_DIR/msiledenabler.sock, else /run/msiledenabler.sock,\n"
+"\t      and only the user of the daemon and the members of -group may connect\n"
+"\t      -profile lines use the -library of the daemon, the default library if none is given\n"
+"\t      \"--stats\" is answered with the HID latency histograms of the daemon, \"-query\" like -query\n\n"
 "Valid intensity levels: [0,1,2,3]\n"
 "Valid colors: [black|red|orange|yellow|green|sky|blue|purple|white]\n"
+"\t      or any RGB color as rrggbb, #rrggbb or r,g,b, set to the nearest color and level\n"
+"\t      (normal and gaming modes take that level when -level is not given)\n"
 "Valid idle value: [1]\n"
 "Example usage: ./msiledenabler -mode normal -color1 blue -color2 green -color3 yellow -level 0\n\n";
 
@@ -154,387 +88,436 @@ char version[] =
 "MSI Led Enabler v0.5+\n"
 "Author: Christian Panadero @ bakingcode.com - Twitter: @PaNaVTEC\n";
 
-/**
- * Sends to the handler the area / color and level selected. NOTE you need to commit for this applies
- */
-void
-sendActivateArea(hid_device *handle, unsigned char modeValue, unsigned char area, unsigned char color, unsigned char level, unsigned char blue) {
-
-	// Will send a 8 bytes array
-	unsigned char data[8];
-	memset(&data, 0x00, 8);
-	data[0] = 0x01; // Fixed report value
-	data[1] = 0x02; // Fixed report value
-
-	data[2] = modeValue; // 43 = set special modes color input / 42 = set color input / 41 = confirm
-	data[3] = area; // 1 = left / 2 = middle / 3 = right
-	data[4] = color; // see color constants
-	data[5] = level; // see level constants
-	data[6] = blue; // blue component gain speed for special modes
-	data[7] = 0xec; // EOR
-
-	if (hid_send_feature_report(handle, data, 9) < 0) {
-		printf("Unable to send a feature report.\n");
-	}
-	
+static void
+onStopSignal(int signal) {
+
+	stopAnimation();
+	stopAudio();
+	stopTimeline();
 }
 
-/**
- * Commits the lights with the modes
- */
-void
-commit(hid_device *handle, unsigned char mode) {
-
-	//CONFIRMATION. This needs to be sent for confirmate all the led operations
-	unsigned char data[8];
-	data[0] = 0x01;
-	data[1] = 0x02;
-
-	data[2] = 0x41; // commit byte
-	data[3] = mode; // current mode
-	data[4] = 0x00;  
-	data[5] = 0x00; 
-	data[6] = 0x00;
-	data[7] = 0xec;
-
-	if (hid_send_feature_report(handle, data, 9) < 0) {
-		printf("Unable to send a feature report.\n");
-	}
+static void
+printTrace() {
 
+	char buffer[16384];
+	formatTrace(buffer, sizeof(buffer));
+	printf("%s", buffer);
 }
 
-unsigned char
-parseColor(char* color) {
-
-	if (strcmp(color, VALUE_COLOR_BLACK) == 0) {
-		return COLOR_BLACK;
-	} else if (strcmp(color, VALUE_COLOR_RED) == 0) {
-		return COLOR_RED;
-	} else if (strcmp(color, VALUE_COLOR_ORANGE) == 0) {
-		return COLOR_ORANGE;
-	} else if (strcmp(color, VALUE_COLOR_YELLOW) == 0) {
-		return COLOR_YELLOW;
-	} else if (strcmp(color, VALUE_COLOR_ORANGE) == 0) {
-		return COLOR_ORANGE;
-	} else if (strcmp(color, VALUE_COLOR_GREEN) == 0) {
-		return COLOR_GREEN;
-	} else if (strcmp(color, VALUE_COLOR_SKY) == 0) {
-		return COLOR_SKY;
-	} else if (strcmp(color, VALUE_COLOR_BLUE) == 0) {
-		return COLOR_BLUE;
-	} else if (strcmp(color, VALUE_COLOR_PURPLE) == 0) {
-		return COLOR_PURPLE;
-	} else if (strcmp(color, VALUE_COLOR_WHITE) == 0) {
-		return COLOR_WHITE;
-	}
+static void
+printFrameStats(const frameStats* stats, int fps) {
 
-	return UCHAR_MAX;
+	printf("%llu frames in %.2fs at %d fps: %llu dropped, %llu sent, %llu failed, jitter mean %.1fus max %.1fus\n",
+		stats->frames, stats->elapsed, fps, stats->dropped, stats->sent, stats->failed, stats->meanJitterUs, stats->maxJitterUs);
 }
 
-unsigned char
-filterLevel(unsigned char color, unsigned char level)
-{
-	if (color == COLOR_BLACK || color == COLOR_WHITE) {
-		return 0;
-	}
+/**
+ * Runs the -animate params until done and prints what the frame scheduler measured.
+ */
+static int
+animate(int argc, char* argv[]) {
 
-	return level;
-}
+	animation anim;
+	frameStats stats;
+	Keyboard keyboard(true);
 
-unsigned char
-convertLevel(char* level) {
-
-    if (strlen(level) == 1) {
-		char clevel = *level-'0';
-		if (clevel == LEVEL_1) {
-			return LEVEL_4;
-		} else if (clevel == LEVEL_2) {
-			return LEVEL_3;
-		} else if (clevel == LEVEL_3) {
-			return LEVEL_2;
-		} else if (clevel == LEVEL_4) {
-			return LEVEL_1;
-		}
+	const char* error = parseAnimation(argc, argv, &anim);
+	if (error) {
+		printf("%s", error);
+		return 1;
 	}
 
-	return UCHAR_MAX;
-}
+	if (keyboard.open() < 0) {
+		printf("Unable to open MSI Led device.\n");
+		return 1;
+	}
 
-unsigned char
-convertIdle(char* idle) {
+	signal(SIGINT, onStopSignal);
+	signal(SIGTERM, onStopSignal);
 
-    if (strlen(idle) == 1) {
-		char cidle = *idle-'0';
-		if (cidle == 1) {			
-			return 1; // idle
-		}
-	}
+	runAnimation(keyboard.handle(), &anim, keyboard.state(), &stats);
+	keyboard.close();
 
-	return 0; // std
-}
+	printFrameStats(&stats, anim.fps);
 
-rgb
-identifyRGBcolor(colors allowedColors, unsigned char colorN) {
-
-	if (colorN == allowedColors.red.color) {
-		return allowedColors.red;
-	} else if (colorN == allowedColors.orange.color) {
-		return allowedColors.orange;
-	} else if (colorN == allowedColors.yellow.color) {
-		return allowedColors.yellow;
-	} else if (colorN == allowedColors.green.color) {
-		return allowedColors.green;
-	} else if (colorN == allowedColors.sky.color) {
-		return allowedColors.sky;
-	} else if (colorN == allowedColors.blue.color) {
-		return allowedColors.blue;
-	} else if (colorN == allowedColors.purple.color) {
-		return allowedColors.purple;
-	} else if (colorN == allowedColors.white.color) {
-		return allowedColors.white;
-	}
+	tracedExit();
 
-	return allowedColors.black;
+	return stats.failed ? 1 : 0;
 }
 
-unsigned char
-computeRampSpeed(double leftColor, double rightColor, double period) {
+/**
+ * Plays the show of the -timeline params and prints the deadlines it missed.
+ */
+static int
+playTimeline(int argc, char* argv[]) {
+
+	timeline tl;
+	timelineStats stats;
+	Keyboard keyboard(true);
 
-	if (leftColor - rightColor == 0) {
-		return 0;
+	const char* error = parseTimeline(argc, argv, &tl);
+	if (error) {
+		printf("%s", error);
+		closeTimeline(&tl);
+		return 1;
 	}
 
-	return ceil((period * 250) / (abs(leftColor - rightColor)));
-}
+	if (keyboard.open() < 0) {
+		printf("Unable to open MSI Led device.\n");
+		closeTimeline(&tl);
+		return 1;
+	}
 
-int 
-main(int argc, char* argv[]) {
+	signal(SIGINT, onStopSignal);
+	signal(SIGTERM, onStopSignal);
 
-  	/** set default values to std */
-	unsigned char cMODE_BREATHING = MODE_BREATHING_STD;
-	unsigned char cMODE_WAVE      = MODE_WAVE_STD;
-	double dPERIOD_WAVE	      = PERIOD_WAVE_STD;
-	double dPERIOD_BREATHING      = PERIOD_BREATHING_STD;
+	runTimeline(keyboard.handle(), &tl, keyboard.state(), &stats);
+	keyboard.close();
 
-	unsigned char arguments[kSize]; arguments[kIdle] = 0x00;
-	colors allowedColors;
-	rgb color1, color2, color3, speedColor1, speedColor2, speedColor3; 
-	hid_device *handle;
+	printf("%llu cues in %.3fs of a %.3fs show: %llu sent, %llu missed, %llu skipped, %llu failed, lateness mean %.1fus max %.1fus at %.3fs\n",
+		stats.cues, stats.elapsed, tl.duration, stats.sent, stats.missed, stats.skipped, stats.failed,
+		stats.meanLatenessUs, stats.maxLatenessUs, stats.worstAt);
 
-#ifdef WIN32
-	UNREFERENCED_PARAMETER(argc);
-	UNREFERENCED_PARAMETER(argv);
-#endif
+	closeTimeline(&tl);
+	tracedExit();
 
-	memset(&arguments, UCHAR_MAX, kSize);
+	return stats.failed ? 1 : 0;
+}
 
-	if (argc == 2 && (strcmp(argv[1], PARAM_HELP_SHORT) == 0 || strcmp(argv[1], PARAM_HELP) == 0)) {
+/**
+ * Follows the screen frames of the -ambient params until done, like animate.
+ */
+static int
+ambientSync(int argc, char* argv[]) {
 
-		printf("%s", usage);
-		return 1;
-	} else if (argc == 2 && (strcmp(argv[1], PARAM_VERS_SHORT) == 0 || strcmp(argv[1], PARAM_VERS) == 0)) {
+	ambient amb;
+	frameStats stats;
+	Keyboard keyboard(true);
 
-		printf("%s", version);
+	const char* error = parseAmbient(argc, argv, &amb);
+	if (error) {
+		printf("%s", error);
 		return 1;
-	} else if (argc < 3) {
+	}
 
-		printf("%s", usage);
+	if (keyboard.open() < 0) {
+		printf("Unable to open MSI Led device.\n");
+		closeAmbient(&amb);
 		return 1;
-	} else {
-
-		// Get arguments for program
-		for (int x = 1; x < argc; x++) {
+	}
 
-			// The params needs to start with "-"
-			if (argv[x][0] == '-') {
+	signal(SIGINT, onStopSignal);
+	signal(SIGTERM, onStopSignal);
 
-				if (!argv[x + 1]) {
+	runAmbient(keyboard.handle(), &amb, keyboard.state(), &stats);
+	keyboard.close();
 
-					printf("Invalid parameter(s). Use --help for more information\n\n");
-					return 1;
+	printFrameStats(&stats, amb.fps);
 
-				} else if (strcmp(argv[x], PARAM_MODE) == 0) {
+	closeAmbient(&amb);
+	tracedExit();
 
-					if (strcmp(argv[x + 1], VALUE_MODE_DISABLE) == 0) {
+	return stats.failed ? 1 : 0;
+}
 
-						arguments[kMode] = MODE_DISABLE;
+/**
+ * Follows the -audio input until it ends and prints the latency measured.
+ */
+static int
+audioReactive(int argc, char* argv[]) {
 
-					} else if (strcmp(argv[x + 1], VALUE_MODE_NORMAL) == 0) {
+	audio a;
+	audioStats stats;
+	Keyboard keyboard(true);
 
-						arguments[kMode] = MODE_NORMAL;
+	const char* error = parseAudio(argc, argv, &a);
+	if (error) {
+		printf("%s", error);
+		closeAudio(&a);
+		return 1;
+	}
 
-					} else if (strcmp(argv[x + 1], VALUE_MODE_GAMING) == 0) {
+	if (keyboard.open() < 0) {
+		printf("Unable to open MSI Led device.\n");
+		closeAudio(&a);
+		return 1;
+	}
 
-						arguments[kMode] = MODE_GAMING;
+	signal(SIGINT, onStopSignal);
+	signal(SIGTERM, onStopSignal);
 
-					} else if (strcmp(argv[x + 1], VALUE_MODE_BREATHING) == 0) {
+	runAudio(keyboard.handle(), &a, keyboard.state(), &stats);
+	keyboard.close();
 
-						arguments[kMode] = cMODE_BREATHING;
+	printf("%llu analyses in %.2fs (%u Hz, %.1fus each): %llu skipped, %llu sent, %llu failed, latency mean %.2fms max %.2fms\n",
+		stats.analyses, stats.elapsed, a.sampleRate, stats.meanAnalysisUs, stats.skipped, stats.sent, stats.failed,
+		stats.meanLatencyMs, stats.maxLatencyMs);
 
-					} else if (strcmp(argv[x + 1], VALUE_MODE_WAVE) == 0) {
+	closeAudio(&a);
+	tracedExit();
 
-						arguments[kMode] = cMODE_WAVE;
-					
-					} else if (strcmp(argv[x + 1], VALUE_MODE_DUALCOLOR) == 0) {
+	return stats.failed ? 1 : 0;
+}
 
-						arguments[kMode] = MODE_DUAL_COLOR;
-					}
+/**
+ * Compiles the profiles source of the -compile params into its library.
+ */
+static int
+compileLibrary(int argc, char* argv[]) {
 
-				} else if (strcmp(argv[x], PARAM_COLOR1) == 0) {
+	profileRequest request;
+	char path[512];
+	int count;
 
-					arguments[kColor1] = parseColor(argv[x + 1]);
-				
-				} else if (strcmp(argv[x], PARAM_COLOR2) == 0) {
+	const char* error = parseProfile(argc, argv, &request);
+	if (!error && !request.source) {
+		error = "No profiles source specified. (-compile). Use --help for more information\n\n";
+	}
+	if (error) {
+		printf("%s", error);
+		return 1;
+	}
 
-					arguments[kColor2] = parseColor(argv[x + 1]);
-				
-				} else if (strcmp(argv[x], PARAM_COLOR3) == 0) {
+	if (!request.library) {
+		defaultLibraryPath(path, sizeof(path));
+		request.library = path;
+	}
+	error = compileProfiles(request.source, request.library, &count);
+	if (error) {
+		printf("%s", error);
+		return 1;
+	}
 
-					arguments[kColor3] = parseColor(argv[x + 1]);				
+	printf("%d profiles compiled into %s\n", count, request.library);
+	return 0;
+}
 
-				} else if (strcmp(argv[x], PARAM_LEVEL) == 0) {
-					
-					arguments[kLevel] = convertLevel(argv[x + 1]);
+/**
+ * Sends the profile of the -profile params from its library.
+ */
+static int
+switchProfile(int argc, char* argv[]) {
 
-				} else if (strcmp(argv[x], PARAM_IDLE) == 0) {
+	profileRequest request;
+	profileLibrary lib;
+	Keyboard keyboard(true);
+	char path[512];
 
-					arguments[kIdle] = convertIdle(argv[x + 1]);
-				}
-			}
-		}
+	const char* error = parseProfile(argc, argv, &request);
+	if (error) {
+		printf("%s", error);
+		return 1;
 	}
 
-	// Check required params
-	if (arguments[kMode] == UCHAR_MAX) {
-		printf("No mode specified. (-mode). Use --help for more information\n\n");
+	if (!request.library) {
+		defaultLibraryPath(path, sizeof(path));
+		request.library = path;
+	}
+	memset(&lib, 0, sizeof(lib));
+	if (openLibrary(&lib, request.library) < 0) {
+		printf("Unable to open the profile library %s, compile it with -compile.\n", request.library);
+		return 1;
+	}
+	const profileEntry* profile = findProfile(&lib, request.name);
+	if (!profile) {
+		printf("Unknown profile. (-profile). Use --help for more information\n\n");
+		closeLibrary(&lib);
 		return 1;
 	}
 
-	if ((arguments[kColor1] == UCHAR_MAX && arguments[kMode] != MODE_DISABLE)
-		|| (arguments[kColor2] == UCHAR_MAX && arguments[kMode] == MODE_DUAL_COLOR)
-		|| ((arguments[kColor2] == UCHAR_MAX || arguments[kColor3] == UCHAR_MAX) && (arguments[kMode] == cMODE_WAVE || arguments[kMode] == cMODE_BREATHING))) {
-		printf("No color specified. (-color1). Use --help for more information\n\n");
+	if (keyboard.open(NULL, request.force) < 0) {
+		printf("Unable to open MSI Led device.\n");
+		closeLibrary(&lib);
 		return 1;
 	}
 
-	if (arguments[kLevel] == UCHAR_MAX && (arguments[kMode] == MODE_NORMAL || arguments[kMode] == MODE_GAMING)) {
-		printf("No intensity level specified. (-level). Use --help for more information\n\n");
+	int failed = keyboard.applyProfile(&lib, profile);
+	if (failed) {
+		printf("Unable to send a feature report.\n");
+	}
+	keyboard.close();
+
+	closeLibrary(&lib);
+	tracedExit();
+
+	return failed ? 1 : 0;
+}
+
+/**
+ * Reads back what the keyboard shows and prints it. The shadow state file keeps what was found.
+ */
+static int
+queryState() {
+
+	Keyboard keyboard(true);
+	char buffer[512];
+
+	if (keyboard.open() < 0) {
+		printf("Unable to open MSI Led device.\n");
 		return 1;
 	}
 
-	// Ready to open lights
-	// Open the device using the VID, PID
-	handle = hid_open(0x1770, 0xff00, NULL);
-	if (!handle) {
+	// open already read the mode back
+	formatState(keyboard.state(), keyboard.lastSync(), buffer, sizeof(buffer));
+	keyboard.close();
+	printf("%s", buffer);
+
+	tracedExit();
+
+	return 0;
+}
+
+/**
+ * Applies arguments to every keyboard at once and prints how long each one took.
+ */
+static int
+applyToAll(const unsigned char arguments[kSize]) {
+
+	fanout f;
+
+	if (openFanout(&f) == 0) {
 		printf("Unable to open MSI Led device.\n");
- 		return 1;
+		return 1;
 	}
 
-	// Check Modes
-	if (arguments[kMode] == MODE_DISABLE) {
+	int failed = applyFanout(&f, arguments);
+	for (int i = 0; i < f.count; i++) {
+		fanoutKeyboard* keyboard = &f.keyboards[i];
+		printf("%s (%s): %d reports in %.1fus%s\n", keyboard->path, keyboard->serial,
+			keyboard->sent, keyboard->latencyUs, keyboard->failed ? ", some refused" : "");
+	}
 
-		// Disable mode = turn off keyboard led
-		commit(handle, MODE_DISABLE);
+	closeFanout(&f);
+	tracedExit();
 
-	} else if (arguments[kMode] == MODE_NORMAL) {
+	return failed ? 1 : 0;
+}
 
-		//Gaming mode = full keyboard illumination 
-		if (arguments[kColor3] == UCHAR_MAX && arguments[kColor2] == UCHAR_MAX) {
+int 
+main(int argc, char* argv[]) {
 
-			sendActivateArea(handle, 0x42, AREA_LEFT, arguments[kColor1], arguments[kLevel], 0x00);
-			sendActivateArea(handle, 0x42, AREA_MIDDLE, arguments[kColor1], arguments[kLevel], 0x00);
-			sendActivateArea(handle, 0x42, AREA_RIGHT, arguments[kColor1], arguments[kLevel], 0x00);
+	unsigned char arguments[kSize];
+	Keyboard keyboard(true);
+	const char* error;
 
-		} else {
+#ifdef WIN32
+	UNREFERENCED_PARAMETER(argc);
+	UNREFERENCED_PARAMETER(argv);
+#endif
 
-			//Normal mode = full keyboard illumination, 3 colors
-			sendActivateArea(handle, 0x42, AREA_LEFT, arguments[kColor1], arguments[kLevel], 0x00);
-			sendActivateArea(handle, 0x42, AREA_MIDDLE, arguments[kColor2], arguments[kLevel], 0x00);
-			sendActivateArea(handle, 0x42, AREA_RIGHT, arguments[kColor3], arguments[kLevel], 0x00);
+	// Only feature reports are sent: no reader thread or run loop per opened device
+	hid_set_input_reports(0);
+
+	// --stats, -retries and -timeout may come anywhere, the params parsers never see them
+	int kept = 1;
+	bool stats = false;
+	writePolicy policy;
+	getWritePolicy(&policy);
+	for (int x = 1; x < argc; x++) {
+		if (strcmp(argv[x], PARAM_STATS) == 0) {
+			stats = true;
+		} else if (strcmp(argv[x], PARAM_RETRIES) == 0 && argv[x + 1]) {
+			int retries = atoi(argv[++x]);
+			if (retries < 0 || retries > 100) {
+				printf("Invalid retries. (-retries). Use --help for more information\n\n");
+				return 1;
+			}
+			policy.attempts = retries + 1;
+		} else if (strcmp(argv[x], PARAM_TIMEOUT) == 0 && argv[x + 1]) {
+			int timeout = atoi(argv[++x]);
+			if (timeout < 1 || timeout > 60000) {
+				printf("Invalid timeout. (-timeout). Use --help for more information\n\n");
+				return 1;
+			}
+			policy.timeoutUs = timeout * 1000;
+		} else {
+			argv[kept++] = argv[x];
 		}
-		commit(handle, MODE_NORMAL);
+	}
+	argc = kept;
+	argv[argc] = NULL;
+	setWritePolicy(&policy);
+	if (stats) {
+		atexit(printTrace);
+	}
 
-	} else if (arguments[kMode] == MODE_GAMING) {
+	if (argc == 2 && (strcmp(argv[1], PARAM_HELP_SHORT) == 0 || strcmp(argv[1], PARAM_HELP) == 0)) {
 
-		//Gaming mode = only left area on 1 color with a intensity level
-		sendActivateArea(handle, 0x42, AREA_LEFT, arguments[kColor1], arguments[kLevel], 0x00);
-		commit(handle, MODE_GAMING);
+		printf("%s", usage);
+		return 1;
+	} else if (argc == 2 && (strcmp(argv[1], PARAM_VERS_SHORT) == 0 || strcmp(argv[1], PARAM_VERS) == 0)) {
 
-	} else if (arguments[kMode] == cMODE_BREATHING) {
+		printf("%s", version);
+		return 1;
+	} else if (argc == 2 && strcmp(argv[1], PARAM_QUERY) == 0) {
 
-		if (arguments[kIdle] == 1) {
-			dPERIOD_BREATHING = PERIOD_BREATHING_IDLE; cMODE_BREATHING = MODE_BREATHING_IDLE;
-		}
+		return queryState();
+	} else if (argc >= 2 && strcmp(argv[1], PARAM_DAEMON) == 0) {
 
-		//Breathing mode = 3 areas colors blink with a intensity level of 2
-		color1.setRGBvalues(identifyRGBcolor(allowedColors, arguments[kColor1])); color2.setRGBvalues(identifyRGBcolor(allowedColors, arguments[kColor2])); color3.setRGBvalues(identifyRGBcolor(allowedColors, arguments[kColor3]));
-    		speedColor1.r = computeRampSpeed(color1.r, 0x00, dPERIOD_BREATHING); speedColor1.g = computeRampSpeed(color1.g, 0x00, dPERIOD_BREATHING); speedColor1.b = computeRampSpeed(color1.b, 0x00, dPERIOD_BREATHING);
-		speedColor2.r = computeRampSpeed(color2.r, 0x00, dPERIOD_BREATHING); speedColor2.g = computeRampSpeed(color2.g, 0x00, dPERIOD_BREATHING); speedColor2.b = computeRampSpeed(color2.b, 0x00, dPERIOD_BREATHING);
-		speedColor3.r = computeRampSpeed(color3.r, 0x00, dPERIOD_BREATHING); speedColor3.g = computeRampSpeed(color3.g, 0x00, dPERIOD_BREATHING); speedColor3.b = computeRampSpeed(color3.b, 0x00, dPERIOD_BREATHING);
-
-		sendActivateArea(handle, 0x43, AREA_LEFT, arguments[kColor1], LEVEL_2, 0x00);
-		sendActivateArea(handle, 0x43, AREA_MIDDLE, 0x00, LEVEL_2, 0x00);
-		sendActivateArea(handle, 0x43, AREA_RIGHT, speedColor1.r, speedColor1.g, speedColor1.b);
-		sendActivateArea(handle, 0x43, AREA_LEFT+3, arguments[kColor2], LEVEL_2, 0x00);
-		sendActivateArea(handle, 0x43, AREA_MIDDLE+3, 0x00, LEVEL_2, 0x00);
-		sendActivateArea(handle, 0x43, AREA_RIGHT+3, speedColor2.r, speedColor2.g, speedColor2.b);
-		sendActivateArea(handle, 0x43, AREA_LEFT+6, arguments[kColor3], LEVEL_2, 0x00);
-		sendActivateArea(handle, 0x43, AREA_MIDDLE+6, 0x00, LEVEL_2, 0x00);
-		sendActivateArea(handle, 0x43, AREA_RIGHT+6, speedColor3.r, speedColor3.g, speedColor3.b);
-		commit(handle, cMODE_BREATHING);
-
-	} else if (arguments[kMode] == cMODE_WAVE) {
-
-		if (arguments[kIdle] == 1) {
-			dPERIOD_WAVE = PERIOD_WAVE_IDLE; cMODE_WAVE = MODE_WAVE_IDLE;
+		daemonOptions options;
+		error = parseDaemon(argc, argv, &options);
+		if (error) {
+			printf("%s", error);
+			return 1;
 		}
+		return runDaemon(&options);
+	} else if (argc >= 3 && strcmp(argv[1], PARAM_ANIMATE) == 0) {
+
+		return animate(argc, argv);
+	} else if (argc >= 3 && strcmp(argv[1], PARAM_AMBIENT) == 0) {
+
+		return ambientSync(argc, argv);
+	} else if (argc >= 3 && strcmp(argv[1], PARAM_AUDIO) == 0) {
+
+		return audioReactive(argc, argv);
+	} else if (argc >= 3 && strcmp(argv[1], PARAM_TIMELINE) == 0) {
+
+		return playTimeline(argc, argv);
+	} else if (argc >= 3 && strcmp(argv[1], PARAM_COMPILE) == 0) {
+
+		return compileLibrary(argc, argv);
+	} else if (argc >= 3 && strcmp(argv[1], PARAM_PROFILE) == 0) {
 
-		//Wave mode = 3 areas colors blink with a intensity level of 2
-		color1.setRGBvalues(identifyRGBcolor(allowedColors, arguments[kColor1])); color2.setRGBvalues(identifyRGBcolor(allowedColors, arguments[kColor2])); color3.setRGBvalues(identifyRGBcolor(allowedColors, arguments[kColor3]));
-    		speedColor1.r = computeRampSpeed(color1.r, 0x00, dPERIOD_WAVE); speedColor1.g = computeRampSpeed(color1.g, 0x00, dPERIOD_WAVE); speedColor1.b = computeRampSpeed(color1.b, 0x00, dPERIOD_WAVE);
-		speedColor2.r = computeRampSpeed(color2.r, 0x00, dPERIOD_WAVE); speedColor2.g = computeRampSpeed(color2.g, 0x00, dPERIOD_WAVE); speedColor2.b = computeRampSpeed(color2.b, 0x00, dPERIOD_WAVE);
-		speedColor3.r = computeRampSpeed(color3.r, 0x00, dPERIOD_WAVE); speedColor3.g = computeRampSpeed(color3.g, 0x00, dPERIOD_WAVE); speedColor3.b = computeRampSpeed(color3.b, 0x00, dPERIOD_WAVE);
-
-		sendActivateArea(handle, 0x43, AREA_LEFT, arguments[kColor1], LEVEL_2, 0x00);
-		sendActivateArea(handle, 0x43, AREA_MIDDLE, 0x00, LEVEL_2, 0x00);
-		sendActivateArea(handle, 0x43, AREA_RIGHT, speedColor1.r, speedColor1.g, speedColor1.b);
-		sendActivateArea(handle, 0x43, AREA_LEFT+3, arguments[kColor2], LEVEL_2, 0x00);
-		sendActivateArea(handle, 0x43, AREA_MIDDLE+3, 0x00, LEVEL_2, 0x00);
-		sendActivateArea(handle, 0x43, AREA_RIGHT+3, speedColor2.r, speedColor2.g, speedColor2.b);
-		sendActivateArea(handle, 0x43, AREA_LEFT+6, arguments[kColor3], LEVEL_2, 0x00);
-		sendActivateArea(handle, 0x43, AREA_MIDDLE+6, 0x00, LEVEL_2, 0x00);
-		sendActivateArea(handle, 0x43, AREA_RIGHT+6, speedColor3.r, speedColor3.g, speedColor3.b);
-		commit(handle, cMODE_WAVE);
-
-	} else if (arguments[kMode] == MODE_DUAL_COLOR) {
-
-		//Dual color mode = 2 areas colors blink with a intensity level of 2
-		color1.setRGBvalues(identifyRGBcolor(allowedColors, arguments[kColor1])); color2.setRGBvalues(identifyRGBcolor(allowedColors, arguments[kColor2]));
-    		speedColor1.r = computeRampSpeed(color1.r, color2.r, PERIOD_DUAL_COLOR); 
-	  	speedColor1.g = computeRampSpeed(color1.g, color2.g, PERIOD_DUAL_COLOR); 
-		speedColor1.b = computeRampSpeed(color1.b, color2.b, PERIOD_DUAL_COLOR);
-
-		sendActivateArea(handle, 0x43, AREA_LEFT, arguments[kColor1], filterLevel(arguments[kColor1], LEVEL_2), 0x00);
-		sendActivateArea(handle, 0x43, AREA_MIDDLE, arguments[kColor2], filterLevel(arguments[kColor2], LEVEL_2), 0x00);
-		sendActivateArea(handle, 0x43, AREA_RIGHT, speedColor1.r, speedColor1.g, speedColor1.b);
-		sendActivateArea(handle, 0x43, AREA_LEFT+3, arguments[kColor1], filterLevel(arguments[kColor1], LEVEL_2), 0x00);
-		sendActivateArea(handle, 0x43, AREA_MIDDLE+3, arguments[kColor2], filterLevel(arguments[kColor2], LEVEL_2), 0x00);
-		sendActivateArea(handle, 0x43, AREA_RIGHT+3, speedColor1.r, speedColor1.g, speedColor1.b);
-		sendActivateArea(handle, 0x43, AREA_LEFT+6, arguments[kColor1], filterLevel(arguments[kColor1], LEVEL_2), 0x00);
-		sendActivateArea(handle, 0x43, AREA_MIDDLE+6, arguments[kColor2], filterLevel(arguments[kColor2], LEVEL_2), 0x00);
-		sendActivateArea(handle, 0x43, AREA_RIGHT+6, speedColor1.r, speedColor1.g, speedColor1.b);
-		commit(handle, MODE_DUAL_COLOR);
+		return switchProfile(argc, argv);
+	} else if (argc < 3) {
+
+		printf("%s", usage);
+		return 1;
+	}
+
+	error = parseArguments(argc, argv, arguments);
+	if (error) {
+		printf("%s", error);
+		return 1;
+	}
+
+	// Every keyboard, each diffed against the state file of its own path like a single one
+	if (arguments[kAll] == 1) {
+		return applyToAll(arguments);
 	}
 
-	// close actual HID handler
-	hid_close(handle);
+	// Ready to open lights
+	// Open the device using the VID, PID. Only what differs from the last run reaches the
+	// device, if the keyboard still shows it
+	if (keyboard.open(NULL, arguments[kForce] == 1) < 0) {
+		printf("Unable to open MSI Led device.\n");
+ 		return 1;
+	}
+
+	int failed = keyboard.apply(arguments);
+	if (failed) {
+		printf("Unable to send a feature report.\n");
+	}
+
+	// close actual HID handler, the shadow state is saved for the next run
+	keyboard.close();
 
 	// Free static HIDAPI objects. 
-	hid_exit();
+	tracedExit();
 
 #ifdef WIN32
 	system("pause");
 #endif
 
-	return 0;
+	return failed ? 1 : 0;
 }
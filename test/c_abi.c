@@ -0,0 +1,180 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * Regression tests of the C interface (msiled.h) through the loopback build of the shared
+ * library, libmsiled-mock.so, from a C program: what a change staged, committed, applied as a
+ * batch or as params leaves on the keyboard as msiled_query reads it back, the values and
+ * params refused, and the state kept from one handle to the next.
+ *
+ * Usage: make test, or test/c_abi after a build
+ *
+ * Prints each failed check with its line and exits 1 if any failed (see check.h).
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include "../msiled.h"
+#include "check.h"
+
+/**
+ * Whether what msiled_query writes for keyboard has line in it.
+ */
+static int
+queryHas(msiled* keyboard, const char* line) {
+
+	char buffer[512];
+
+	return msiled_query(keyboard, buffer, sizeof(buffer)) == MSILED_OK && strstr(buffer, line) != NULL;
+}
+
+static void
+testStaged(msiled* keyboard) {
+
+	current = "stage and commit";
+	CHECK(msiled_set_mode(keyboard, MSILED_MODE_NORMAL) == MSILED_OK);
+	CHECK(msiled_set_area(keyboard, MSILED_AREA_LEFT, MSILED_COLOR_RED, MSILED_LEVEL_4) == MSILED_OK);
+	CHECK(msiled_set_area_rgb(keyboard, MSILED_AREA_MIDDLE, 0, 0, 255) == MSILED_OK);
+	CHECK(msiled_set_area(keyboard, MSILED_AREA_RIGHT, MSILED_COLOR_GREEN, MSILED_LEVEL_1) == MSILED_OK);
+	CHECK(msiled_commit(keyboard) == MSILED_OK);
+	CHECK(queryHas(keyboard, "mode normal (read back)"));
+	CHECK(queryHas(keyboard, "left    red level 0") && queryHas(keyboard, "middle  blue level 0")
+		&& queryHas(keyboard, "right   green level 3"));
+
+	current = "discard";
+	CHECK(msiled_set_area(keyboard, MSILED_AREA_LEFT, MSILED_COLOR_WHITE, MSILED_LEVEL_4) == MSILED_OK);
+	msiled_discard(keyboard);
+	CHECK(msiled_commit(keyboard) == MSILED_OK && queryHas(keyboard, "left    red level 0"));
+
+	current = "invalid values";
+	CHECK(msiled_set_mode(keyboard, 4) == MSILED_ERR_INVALID && msiled_set_mode(keyboard, 10) == MSILED_ERR_INVALID);
+	CHECK(msiled_set_area(keyboard, 0, MSILED_COLOR_RED, MSILED_LEVEL_4) == MSILED_ERR_INVALID);
+	CHECK(msiled_set_area(keyboard, MSILED_AREA_LEFT, MSILED_COLOR_WHITE + 1, MSILED_LEVEL_4) == MSILED_ERR_INVALID);
+	CHECK(msiled_set_area(keyboard, MSILED_AREA_LEFT, MSILED_COLOR_RED, MSILED_LEVEL_4 + 1) == MSILED_ERR_INVALID);
+	CHECK(msiled_commit(keyboard) == MSILED_OK && queryHas(keyboard, "left    red level 0"));
+}
+
+static void
+testBatch(msiled* keyboard) {
+
+	msiled_area areas[3] = {
+		{ MSILED_AREA_LEFT, MSILED_COLOR_YELLOW, MSILED_LEVEL_3 },
+		{ MSILED_AREA_MIDDLE, MSILED_COLOR_SKY, MSILED_LEVEL_3 },
+		{ MSILED_AREA_RIGHT, MSILED_COLOR_PURPLE, MSILED_LEVEL_3 },
+	};
+
+	current = "apply batch";
+	CHECK(msiled_apply_batch(keyboard, MSILED_MODE_NORMAL, areas, 3) == MSILED_OK);
+	CHECK(queryHas(keyboard, "left    yellow level 1") && queryHas(keyboard, "middle  sky level 1")
+		&& queryHas(keyboard, "right   purple level 1"));
+
+	// One invalid area and nothing of the batch is sent
+	current = "invalid batch";
+	areas[0].color = MSILED_COLOR_RED;
+	areas[2].area = 4;
+	CHECK(msiled_apply_batch(keyboard, MSILED_MODE_NORMAL, areas, 3) == MSILED_ERR_INVALID);
+	CHECK(msiled_apply_batch(keyboard, 7, areas, 2) == MSILED_ERR_INVALID);
+	CHECK(queryHas(keyboard, "left    yellow level 1"));
+}
+
+static void
+testParams(msiled* keyboard) {
+
+	char params[1024];
+
+	current = "apply params";
+	CHECK(msiled_apply(keyboard, "-preset dim") == MSILED_OK && queryHas(keyboard, "left    white level 3"));
+	CHECK(msiled_apply(keyboard, "-mode wave -color1 red -color2 blue -color3 green -period 3") == MSILED_OK);
+	CHECK(queryHas(keyboard, "mode wave") && queryHas(keyboard, "color2  blue"));
+	CHECK(msiled_apply(keyboard, "-preset off") == MSILED_OK && queryHas(keyboard, "mode disable"));
+
+	current = "invalid params";
+	CHECK(msiled_apply(keyboard, "-preset nope") == MSILED_ERR_INVALID && *msiled_last_error(keyboard));
+	CHECK(msiled_apply(keyboard, "-all -preset red") == MSILED_ERR_INVALID && strstr(msiled_last_error(keyboard), "-all"));
+	CHECK(msiled_apply(keyboard, "") == MSILED_ERR_INVALID && msiled_apply(keyboard, NULL) == MSILED_ERR_INVALID);
+	memset(params, 'x', sizeof(params) - 1);
+	params[sizeof(params) - 1] = '\0';
+	CHECK(msiled_apply(keyboard, params) == MSILED_ERR_INVALID);
+	CHECK(queryHas(keyboard, "mode disable"));
+	CHECK(msiled_apply(keyboard, "-preset red") == MSILED_OK && *msiled_last_error(keyboard) == '\0');
+}
+
+static void
+testErrors(void) {
+
+	int error = MSILED_OK;
+	int codes[] = { MSILED_OK, MSILED_ERR_NO_DEVICE, MSILED_ERR_INVALID, MSILED_ERR_IO, MSILED_ERR_NO_MODE, MSILED_ERR_NO_MEMORY };
+
+	current = "error messages";
+	for (size_t i = 0; i < sizeof(codes) / sizeof(codes[0]); i++) {
+		CHECK(strcmp(msiled_strerror(codes[i]), "Unknown error.") != 0);
+	}
+	CHECK(strcmp(msiled_strerror(-100), "Unknown error.") == 0);
+
+	current = "no device";
+	CHECK(msiled_open("mock:9", 0, &error) == NULL && error == MSILED_ERR_NO_DEVICE);
+	CHECK(msiled_open("mock:9", 0, NULL) == NULL);
+	msiled_close(NULL);
+}
+
+/**
+ * Removes the runtime dir of the tests and the state files left in it.
+ */
+static void
+removeDir(const char* dir) {
+
+	char path[512];
+	DIR* d = opendir(dir);
+
+	for (struct dirent* entry = d ? readdir(d) : NULL; entry; entry = readdir(d)) {
+		if (entry->d_name[0] != '.') {
+			snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+			unlink(path);
+		}
+	}
+	if (d) {
+		closedir(d);
+	}
+	rmdir(dir);
+}
+
+int
+main(void) {
+
+	// The state files of the tests never touch the real ones
+	char runtimeDir[] = "/tmp/msiled-c-abi-XXXXXX";
+	if (!mkdtemp(runtimeDir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	setenv("XDG_RUNTIME_DIR", runtimeDir, 1);
+
+	int error;
+	current = "open";
+	CHECK(msiled_abi_version() == MSILED_ABI_VERSION);
+	msiled* keyboard = msiled_open(NULL, MSILED_OPEN_FORCE, &error);
+	CHECK(keyboard && error == MSILED_OK);
+	if (!keyboard) {
+		removeDir(runtimeDir);
+		return TEST_RESULT();
+	}
+
+	testStaged(keyboard);
+	testBatch(keyboard);
+	testParams(keyboard);
+	testErrors();
+
+	// The next handle starts from the state the last one saved, as read back
+	current = "reopen";
+	msiled_close(keyboard);
+	keyboard = msiled_open("mock:0", 0, &error);
+	CHECK(keyboard && queryHas(keyboard, "left    red level 0") && queryHas(keyboard, "right   red level 0"));
+	msiled_close(keyboard);
+	msiled_exit();
+	removeDir(runtimeDir);
+
+	return TEST_RESULT();
+}
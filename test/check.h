@@ -0,0 +1,28 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * Checks shared by the test programs, each one a single file: CHECK counts and prints the
+ * failed ones with the case running, TEST_RESULT prints the totals and gives the exit code.
+ * Works from C and C++.
+ */
+
+#ifndef TEST_CHECK_H__
+#define TEST_CHECK_H__
+
+#include <stdio.h>
+
+static int checks = 0, failures = 0;
+
+/** Name of the case running, printed with its failed checks */
+static const char* current = "";
+
+#define CHECK(condition) do { \
+	checks++; \
+	if (!(condition)) { \
+		failures++; \
+		printf("%s:%d: %s: %s\n", __FILE__, __LINE__, current, #condition); \
+	} \
+} while (0)
+
+#define TEST_RESULT() (printf("%s: %d checks, %d failed\n", __FILE__, checks, failures), failures ? 1 : 0)
+
+#endif
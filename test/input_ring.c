@@ -0,0 +1,212 @@
+/**
+ * MSI Led enabler for MSI GT60 / 70 can works with other MSIs with the same keyboard.
+ * Regression tests of the input report ring of the Mac backend (input_ring.h), built on every
+ * platform: a full ring drops the newest report and counts it, reports are cut to their slot
+ * and to the reader's buffer, and a producer thread feeding a reader that sleeps the way
+ * hid_read_timeout() does loses or repeats nothing but the overflows it counted.
+ *
+ * Usage: make test, or test/input_ring after a build
+ *
+ * Prints each failed check with its line and exits 1 if any failed (see check.h).
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include "../input_ring.h"
+#include "check.h"
+
+/** Reports the producer thread sends, and how often the reader falls behind on purpose */
+#define LOAD_REPORTS							200000
+#define LOAD_STALL_EVERY						5000
+
+static void
+testFull(void) {
+
+	struct input_ring *ring = new_input_ring(8);
+	unsigned char report[8], data[8];
+	int accepted = 0;
+
+	current = "full ring";
+	CHECK(ring && input_ring_empty(ring) && input_ring_overflows(ring) == 0);
+	for (int i = 0; i < INPUT_RING_SLOTS + 8; i++) {
+		memset(report, i, sizeof(report));
+		accepted += input_ring_push(ring, report, sizeof(report)) == 0;
+	}
+	CHECK(accepted == INPUT_RING_SLOTS && input_ring_overflows(ring) == 8);
+
+	// The reports queued first are kept, the ones that came on a full ring are gone
+	current = "full ring, newest dropped";
+	for (int i = 0; i < INPUT_RING_SLOTS; i++) {
+		CHECK(!input_ring_empty(ring) && input_ring_pop(ring, data, sizeof(data)) == 8 && data[0] == i && data[7] == i);
+	}
+	CHECK(input_ring_empty(ring));
+
+	// Slots are handed back: the ring takes reports again, the count stays
+	current = "full ring, drained";
+	memset(report, 0xaa, sizeof(report));
+	CHECK(input_ring_push(ring, report, sizeof(report)) == 0 && input_ring_overflows(ring) == 8);
+	CHECK(input_ring_pop(ring, data, sizeof(data)) == 8 && data[0] == 0xaa && input_ring_empty(ring));
+	free_input_ring(ring);
+	free_input_ring(NULL);
+}
+
+static void
+testLengths(void) {
+
+	struct input_ring *ring = new_input_ring(8);
+	unsigned char report[12], data[12];
+
+	for (int i = 0; i < 12; i++) {
+		report[i] = i + 1;
+	}
+
+	current = "lengths";
+	CHECK(input_ring_push(ring, report, 12) == 0 && input_ring_pop(ring, data, sizeof(data)) == 8 && data[7] == 8);
+	CHECK(input_ring_push(ring, report, 6) == 0 && input_ring_pop(ring, data, 4) == 4 && data[3] == 4);
+	CHECK(input_ring_push(ring, report, 0) == 0 && input_ring_pop(ring, data, sizeof(data)) == 0);
+	CHECK(input_ring_empty(ring) && input_ring_overflows(ring) == 0);
+	free_input_ring(ring);
+}
+
+// struct for the device side of the load test: the ring and the sleep of its reader
+struct loadDevice {
+	struct input_ring *ring;
+	pthread_mutex_t mutex;
+	pthread_cond_t condition;
+	atomic_int done;
+};
+
+/**
+ * Pushes LOAD_REPORTS numbered reports, waking the reader like hid_report_callback() does.
+ */
+static void*
+produce(void* param) {
+
+	struct loadDevice *dev = param;
+	unsigned char report[8];
+
+	for (unsigned int sequence = 0; sequence < LOAD_REPORTS; sequence++) {
+		memcpy(report, &sequence, 4);
+		unsigned int check = ~sequence;
+		memcpy(report + 4, &check, 4);
+		if (input_ring_push(dev->ring, report, sizeof(report)) < 0)
+			continue;
+
+		if (atomic_load(&dev->ring->reader_waiting)) {
+			pthread_mutex_lock(&dev->mutex);
+			pthread_cond_signal(&dev->condition);
+			pthread_mutex_unlock(&dev->mutex);
+		}
+	}
+
+	pthread_mutex_lock(&dev->mutex);
+	atomic_store(&dev->done, 1);
+	pthread_cond_signal(&dev->condition);
+	pthread_mutex_unlock(&dev->mutex);
+
+	return NULL;
+}
+
+/**
+ * hid_read_timeout() of the Mac backend on dev: the report without locking if there is one,
+ * else announce the reader, look again and sleep. Returns 0 on timeout or once the producer
+ * is done and the ring empty.
+ */
+static int
+readTimeout(struct loadDevice *dev, unsigned char *data, size_t length, int milliseconds) {
+
+	int bytes_read = 0;
+
+	if (!input_ring_empty(dev->ring))
+		return input_ring_pop(dev->ring, data, length);
+
+	pthread_mutex_lock(&dev->mutex);
+	atomic_store(&dev->ring->reader_waiting, 1);
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += milliseconds / 1000;
+	ts.tv_nsec += (milliseconds % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	while (input_ring_empty(dev->ring) && !atomic_load(&dev->done)) {
+		if (pthread_cond_timedwait(&dev->condition, &dev->mutex, &ts) == ETIMEDOUT)
+			break;
+	}
+	if (!input_ring_empty(dev->ring))
+		bytes_read = input_ring_pop(dev->ring, data, length);
+
+	atomic_store(&dev->ring->reader_waiting, 0);
+	pthread_mutex_unlock(&dev->mutex);
+
+	return bytes_read;
+}
+
+static void
+testLoad(void) {
+
+	struct loadDevice dev;
+	pthread_t producer;
+	unsigned char data[8];
+	unsigned long received = 0, timeouts = 0;
+	long last = -1;
+	int ordered = 1, intact = 1;
+
+	dev.ring = new_input_ring(8);
+	pthread_mutex_init(&dev.mutex, NULL);
+	pthread_cond_init(&dev.condition, NULL);
+	atomic_init(&dev.done, 0);
+
+	current = "producer and sleeping reader";
+	pthread_create(&producer, NULL, produce, &dev);
+	for (;;) {
+		int n = readTimeout(&dev, data, sizeof(data), 1000);
+		if (n == 0) {
+			if (atomic_load(&dev.done) && input_ring_empty(dev.ring))
+				break;
+			timeouts++;
+			continue;
+		}
+
+		unsigned int sequence, check;
+		memcpy(&sequence, data, 4);
+		memcpy(&check, data + 4, 4);
+		ordered = ordered && n == 8 && (long) sequence > last;
+		intact = intact && check == ~sequence;
+		last = sequence;
+		received++;
+
+		// Behind now and then, so the producer fills the ring
+		if (received % LOAD_STALL_EVERY == 0) {
+			struct timespec pause = { 0, 1000000 };
+			nanosleep(&pause, NULL);
+		}
+	}
+	pthread_join(producer, NULL);
+
+	CHECK(ordered && intact && timeouts == 0);
+	CHECK(received + input_ring_overflows(dev.ring) == LOAD_REPORTS);
+	CHECK(received >= INPUT_RING_SLOTS && last >= 0);
+
+	pthread_cond_destroy(&dev.condition);
+	pthread_mutex_destroy(&dev.mutex);
+	free_input_ring(dev.ring);
+}
+
+int
+main(void) {
+
+	testFull();
+	testLengths();
+	testLoad();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,1388 @@
+/**
+ * Regression tests on the loopback backend (hid_mock.c), no keyboard needed: what the
+ * controller decodes for each mode and preset, that a change only sends the registers that
+ * differ, that refused reports are retried as one transaction, what syncState reads back, the
+ * command line words, the RGB colors, the Keyboard class, -all on several keyboards, the async
+ * queue, the frames of the host side animations, the -ambient frame reduction, -audio on
+ * generated tones, compiled and damaged profile libraries, timelines, and the daemon protocol
+ * on a socket of a temporary runtime dir.
+ *
+ * Usage: make test, or test/mock_backend after a build
+ *
+ * Prints each failed check with its line and exits 1 if any failed (see check.h).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <utility>
+#include "../ledcontrol.h"
+#include "../ledprotocol.h"
+#include "../lededit.h"
+#include "../hid_mock.h"
+#include "check.h"
+
+/**
+ * Fills arguments from command line params as one string, returns the parseArguments error.
+ */
+static const char*
+parse(const char* params, unsigned char arguments[kSize]) {
+
+	static char programName[] = "msiledenabler";
+	static char line[256];
+	char* argv[32];
+	char* saveptr = NULL;
+	int argc = 0;
+
+	snprintf(line, sizeof(line), "%s", params);
+	argv[argc++] = programName;
+	for (char* word = strtok_r(line, " ", &saveptr); word && argc < 31; word = strtok_r(NULL, " ", &saveptr)) {
+		argv[argc++] = word;
+	}
+	argv[argc] = NULL;
+
+	return parseArguments(argc, argv, arguments);
+}
+
+/**
+ * Applies params to a controller just powered, with an empty shadow state. Returns the
+ * controller state, or one never committed when the params did not parse or were refused.
+ */
+static hid_mock_controller
+applyFresh(hid_device* handle, const char* params) {
+
+	unsigned char arguments[kSize];
+	keyboardState state;
+	hid_mock_controller controller;
+
+	hid_mock_reset();
+	resetState(&state);
+	memset(&controller, 0, sizeof(controller));
+
+	const char* error = parse(params, arguments);
+	CHECK(error == NULL);
+	if (!error) {
+		CHECK(applyArguments(handle, arguments, &state) == 0);
+		hid_mock_controller_state(0, &controller);
+	}
+
+	return controller;
+}
+
+static bool
+areaIs(const hid_mock_controller& controller, int area, unsigned char opcode, unsigned char color, unsigned char level, unsigned char blue) {
+
+	const hid_mock_area* a = &controller.areas[area - 1];
+	return a->opcode == opcode && a->color == color && a->level == level && a->blue == blue;
+}
+
+/**
+ * The 3 areas of a breathing, wave or dual color mode: a first color, a second one and the
+ * ramp bytes between them for period.
+ */
+static bool
+rampAreasAre(const hid_mock_controller& controller, int first, unsigned char from, unsigned char fromLevel,
+	unsigned char to, unsigned char toLevel, unsigned int periodMs) {
+
+	unsigned char ramp[3];
+	rampBytes(periodMs, from, to, ramp);
+	return areaIs(controller, first, OPCODE_SET_SPECIAL, from, fromLevel, 0x00)
+		&& areaIs(controller, first + 1, OPCODE_SET_SPECIAL, to, toLevel, 0x00)
+		&& areaIs(controller, first + 2, OPCODE_SET_SPECIAL, ramp[0], ramp[1], ramp[2]);
+}
+
+static void
+testModes(hid_device* handle) {
+
+	hid_mock_controller c;
+
+	current = "disable";
+	c = applyFresh(handle, "-mode disable");
+	CHECK(c.committed && c.mode == MODE_DISABLE && c.commits == 1);
+
+	current = "normal";
+	c = applyFresh(handle, "-mode normal -color1 red -color2 green -color3 blue -level 0");
+	CHECK(c.committed && c.mode == MODE_NORMAL);
+	CHECK(areaIs(c, AREA_LEFT, OPCODE_SET_COLOR, COLOR_RED, LEVEL_4, 0x00));
+	CHECK(areaIs(c, AREA_MIDDLE, OPCODE_SET_COLOR, COLOR_GREEN, LEVEL_4, 0x00));
+	CHECK(areaIs(c, AREA_RIGHT, OPCODE_SET_COLOR, COLOR_BLUE, LEVEL_4, 0x00));
+
+	current = "normal, one color";
+	c = applyFresh(handle, "-mode normal -color1 purple -level 3");
+	CHECK(c.committed && c.mode == MODE_NORMAL);
+	for (int area = AREA_LEFT; area <= AREA_RIGHT; area++) {
+		CHECK(areaIs(c, area, OPCODE_SET_COLOR, COLOR_PURPLE, LEVEL_1, 0x00));
+	}
+
+	current = "gaming";
+	c = applyFresh(handle, "-mode gaming -color1 sky -level 2");
+	CHECK(c.committed && c.mode == MODE_GAMING);
+	CHECK(c.area_mask == 1 << (AREA_LEFT - 1));
+	CHECK(areaIs(c, AREA_LEFT, OPCODE_SET_COLOR, COLOR_SKY, LEVEL_2, 0x00));
+
+	current = "breathing";
+	c = applyFresh(handle, "-mode breathing -color1 red -color2 green -color3 blue");
+	CHECK(c.committed && c.mode == MODE_BREATHING_STD);
+	CHECK(rampAreasAre(c, 1, COLOR_RED, LEVEL_2, COLOR_BLACK, LEVEL_2, PERIOD_BREATHING_STD * 1000));
+	CHECK(rampAreasAre(c, 4, COLOR_GREEN, LEVEL_2, COLOR_BLACK, LEVEL_2, PERIOD_BREATHING_STD * 1000));
+	CHECK(rampAreasAre(c, 7, COLOR_BLUE, LEVEL_2, COLOR_BLACK, LEVEL_2, PERIOD_BREATHING_STD * 1000));
+
+	current = "breathing, idle";
+	c = applyFresh(handle, "-mode breathing -color1 red -color2 green -color3 blue -idle 1");
+	CHECK(c.committed && c.mode == MODE_BREATHING_IDLE);
+	CHECK(rampAreasAre(c, 1, COLOR_RED, LEVEL_2, COLOR_BLACK, LEVEL_2, PERIOD_BREATHING_IDLE * 1000));
+
+	current = "wave";
+	c = applyFresh(handle, "-mode wave -color1 orange -color2 yellow -color3 white");
+	CHECK(c.committed && c.mode == MODE_WAVE_STD);
+	CHECK(rampAreasAre(c, 1, COLOR_ORANGE, LEVEL_2, COLOR_BLACK, LEVEL_2, PERIOD_WAVE_STD * 1000));
+	CHECK(rampAreasAre(c, 7, COLOR_WHITE, LEVEL_2, COLOR_BLACK, LEVEL_2, PERIOD_WAVE_STD * 1000));
+
+	current = "wave, idle";
+	c = applyFresh(handle, "-mode wave -color1 orange -color2 yellow -color3 white -idle 1");
+	CHECK(c.committed && c.mode == MODE_WAVE_IDLE);
+	CHECK(rampAreasAre(c, 4, COLOR_YELLOW, LEVEL_2, COLOR_BLACK, LEVEL_2, PERIOD_WAVE_IDLE * 1000));
+
+	current = "wave, period";
+	c = applyFresh(handle, "-mode wave -color1 orange -color2 yellow -color3 white -period 3.25");
+	CHECK(c.committed && c.mode == MODE_WAVE_STD);
+	CHECK(rampAreasAre(c, 1, COLOR_ORANGE, LEVEL_2, COLOR_BLACK, LEVEL_2, 3250));
+
+	current = "dualcolor";
+	c = applyFresh(handle, "-mode dualcolor -color1 red -color2 white");
+	CHECK(c.committed && c.mode == MODE_DUAL_COLOR);
+	for (int first = 1; first <= 7; first += 3) {
+		CHECK(rampAreasAre(c, first, COLOR_RED, LEVEL_2, COLOR_WHITE, filterLevel(COLOR_WHITE, LEVEL_2), PERIOD_DUAL_COLOR * 1000));
+	}
+}
+
+static void
+testPresets(hid_device* handle) {
+
+	// name, mode, then the color of each area and their level
+	struct {
+		const char* name;
+		unsigned char mode, colors[3], level;
+	} presets[] = {
+		{ "off", MODE_DISABLE, { 0, 0, 0 }, 0 },
+		{ "red", MODE_NORMAL, { COLOR_RED, COLOR_RED, COLOR_RED }, LEVEL_4 },
+		{ "orange", MODE_NORMAL, { COLOR_ORANGE, COLOR_ORANGE, COLOR_ORANGE }, LEVEL_4 },
+		{ "yellow", MODE_NORMAL, { COLOR_YELLOW, COLOR_YELLOW, COLOR_YELLOW }, LEVEL_4 },
+		{ "green", MODE_NORMAL, { COLOR_GREEN, COLOR_GREEN, COLOR_GREEN }, LEVEL_4 },
+		{ "sky", MODE_NORMAL, { COLOR_SKY, COLOR_SKY, COLOR_SKY }, LEVEL_4 },
+		{ "blue", MODE_NORMAL, { COLOR_BLUE, COLOR_BLUE, COLOR_BLUE }, LEVEL_4 },
+		{ "purple", MODE_NORMAL, { COLOR_PURPLE, COLOR_PURPLE, COLOR_PURPLE }, LEVEL_4 },
+		{ "white", MODE_NORMAL, { COLOR_WHITE, COLOR_WHITE, COLOR_WHITE }, LEVEL_4 },
+		{ "rgb", MODE_NORMAL, { COLOR_RED, COLOR_GREEN, COLOR_BLUE }, LEVEL_4 },
+		{ "dim", MODE_NORMAL, { COLOR_WHITE, COLOR_WHITE, COLOR_WHITE }, LEVEL_1 },
+	};
+
+	for (size_t i = 0; i < sizeof(presets) / sizeof(presets[0]); i++) {
+		char params[64];
+		snprintf(params, sizeof(params), "-preset %s", presets[i].name);
+		current = params;
+
+		hid_mock_controller c = applyFresh(handle, params);
+		CHECK(c.committed && c.mode == presets[i].mode);
+		if (presets[i].mode == MODE_NORMAL) {
+			for (int area = AREA_LEFT; area <= AREA_RIGHT; area++) {
+				CHECK(areaIs(c, area, OPCODE_SET_COLOR, presets[i].colors[area - 1], presets[i].level, 0x00));
+			}
+		}
+	}
+
+	unsigned char arguments[kSize];
+	current = "unknown preset";
+	CHECK(parse("-preset nope", arguments) != NULL);
+}
+
+static void
+testDiff(hid_device* handle) {
+
+	unsigned char arguments[kSize];
+	keyboardState state;
+	hid_mock_controller c;
+	hid_mock_report report;
+
+	hid_mock_reset();
+	resetState(&state);
+
+	current = "diff, first change";
+	CHECK(parse("-mode normal -color1 red -color2 green -color3 blue -level 0", arguments) == NULL);
+	CHECK(applyArguments(handle, arguments, &state) == 0);
+	CHECK(hid_mock_report_count() == 4);
+
+	current = "diff, one area";
+	CHECK(parse("-mode normal -color1 red -color2 green -color3 purple -level 0", arguments) == NULL);
+	CHECK(applyArguments(handle, arguments, &state) == 0);
+	CHECK(hid_mock_report_count() == 6);
+	CHECK(hid_mock_report_at(4, &report) == 0 && report.data[2] == OPCODE_SET_COLOR && report.data[3] == AREA_RIGHT
+		&& report.data[4] == COLOR_PURPLE);
+	CHECK(hid_mock_report_at(5, &report) == 0 && report.data[2] == OPCODE_COMMIT && report.data[3] == MODE_NORMAL);
+	hid_mock_controller_state(0, &c);
+	CHECK(c.commits == 2 && areaIs(c, AREA_LEFT, OPCODE_SET_COLOR, COLOR_RED, LEVEL_4, 0x00)
+		&& areaIs(c, AREA_RIGHT, OPCODE_SET_COLOR, COLOR_PURPLE, LEVEL_4, 0x00));
+
+	current = "diff, same state";
+	CHECK(applyArguments(handle, arguments, &state) == 0);
+	CHECK(hid_mock_report_count() == 6);
+
+	current = "diff, other mode";
+	CHECK(parse("-mode gaming -color1 red -level 0", arguments) == NULL);
+	CHECK(applyArguments(handle, arguments, &state) == 0);
+	CHECK(hid_mock_report_count() == 8);
+
+	current = "diff, force";
+	CHECK(parse("-mode gaming -color1 red -level 0 -force", arguments) == NULL);
+	CHECK(applyArguments(handle, arguments, &state) == 0);
+	CHECK(hid_mock_report_count() == 10);
+}
+
+static void
+testRetries() {
+
+	writePolicy saved, quick = { 8, 1000, 4000, 200000 }, once = { 1, 1000, 4000, 200000 };
+	writeStats before, after;
+	unsigned char arguments[kSize];
+	keyboardState state;
+	hid_mock_controller c;
+
+	getWritePolicy(&saved);
+	CHECK(parse("-mode normal -color1 red -color2 green -color3 blue -level 0", arguments) == NULL);
+
+	// The stall counts from the open, so each case opens its own handle
+	current = "stall, retried";
+	hid_mock_reset();
+	resetState(&state);
+	setWritePolicy(&quick);
+	hid_mock_set_stall(3000);
+	getWriteStats(&before);
+	hid_device* handle = hid_open_path("mock:0");
+	CHECK(handle != NULL);
+	CHECK(applyArguments(handle, arguments, &state) == 0);
+	getWriteStats(&after);
+	CHECK(after.transactions == before.transactions + 1);
+	CHECK(after.retries > before.retries && after.abandoned == before.abandoned);
+	hid_mock_controller_state(0, &c);
+	CHECK(c.committed && c.commits == 1 && c.mode == MODE_NORMAL && c.failed > 0);
+	CHECK(areaIs(c, AREA_MIDDLE, OPCODE_SET_COLOR, COLOR_GREEN, LEVEL_4, 0x00));
+	hid_close(handle);
+
+	current = "stall, abandoned";
+	hid_mock_reset();
+	resetState(&state);
+	setWritePolicy(&once);
+	hid_mock_set_stall(1000000);
+	getWriteStats(&before);
+	handle = hid_open_path("mock:0");
+	CHECK(applyArguments(handle, arguments, &state) > 0);
+	getWriteStats(&after);
+	CHECK(after.abandoned == before.abandoned + 1);
+	CHECK(!state.valid);
+	hid_mock_controller_state(0, &c);
+	CHECK(!c.committed);
+	hid_close(handle);
+
+	hid_mock_set_stall(0);
+	setWritePolicy(&saved);
+}
+
+static void
+testSync(hid_device* handle) {
+
+	unsigned char arguments[kSize];
+	keyboardState state;
+
+	hid_mock_reset();
+	resetState(&state);
+
+	current = "sync, powered";
+	CHECK(syncState(handle, &state) == SYNC_RESET);
+	CHECK(!state.valid);
+
+	current = "sync, kept";
+	CHECK(parse("-mode gaming -color1 red -level 0", arguments) == NULL);
+	CHECK(applyArguments(handle, arguments, &state) == 0);
+	CHECK(syncState(handle, &state) == SYNC_KEPT);
+	CHECK(state.valid && state.mode == MODE_GAMING && state.areaMask != 0);
+
+	current = "sync, query cut to the buffer";
+	char text[256], cut[8];
+	size_t length = formatState(&state, SYNC_KEPT, text, sizeof(text));
+	CHECK(length == strlen(text) && strncmp(text, "mode gaming (read back)\nleft    red level 0", 43) == 0);
+	CHECK(formatState(&state, SYNC_KEPT, cut, sizeof(cut)) == 7 && strcmp(cut, "mode ga") == 0);
+
+	current = "sync, other mode";
+	keyboardState other = state;
+	other.mode = MODE_NORMAL;
+	CHECK(syncState(handle, &other) == SYNC_RESET);
+	CHECK(other.valid && other.mode == MODE_GAMING && other.areaMask == 0);
+
+	current = "sync, no report id";
+	hid_mock_set_readback_id(0);
+	CHECK(syncState(handle, &state) == SYNC_KEPT);
+	hid_mock_set_readback_id(1);
+
+	current = "sync, cut before the commit";
+	unsigned char area[REPORT_LENGTH];
+	encodeActivateArea(area, OPCODE_SET_COLOR, AREA_LEFT, COLOR_BLUE, LEVEL_4, 0x00);
+	CHECK(tracedSend(handle, area, sizeof(area)) == REPORT_LENGTH);
+	CHECK(syncState(handle, &state) == SYNC_RESET);
+	CHECK(!state.valid);
+
+	current = "sync, no readback";
+	hid_mock_set_readback(0);
+	CHECK(syncState(handle, &state) == SYNC_UNSUPPORTED);
+	hid_mock_set_readback(1);
+}
+
+static void
+testTokens() {
+
+	struct { const char* word; unsigned char kind, value; } known[] = {
+		{ PARAM_HELP, TOKEN_PARAM, kParamHelp }, { PARAM_HELP_SHORT, TOKEN_PARAM, kParamHelp },
+		{ PARAM_VERS_SHORT, TOKEN_PARAM, kParamVersion }, { PARAM_MODE, TOKEN_PARAM, kParamMode },
+		{ PARAM_COLOR3, TOKEN_PARAM, kParamColor3 }, { PARAM_DURATION, TOKEN_PARAM, kParamDuration },
+		{ PARAM_STATS, TOKEN_PARAM, kParamStats }, { PARAM_QUERY, TOKEN_PARAM, kParamQuery },
+		{ VALUE_MODE_DUALCOLOR, TOKEN_MODE, MODE_DUAL_COLOR }, { VALUE_MODE_BREATHING, TOKEN_MODE, MODE_BREATHING_STD },
+		{ VALUE_COLOR_BLACK, TOKEN_COLOR, COLOR_BLACK }, { VALUE_COLOR_SKY, TOKEN_COLOR, COLOR_SKY },
+		{ VALUE_EFFECT_SCAN, TOKEN_EFFECT, EFFECT_SCAN },
+	};
+
+	current = "tokens, known";
+	for (const auto& k : known) {
+		const token* t = lookupToken(k.word);
+		CHECK(t && strcmp(t->name, k.word) == 0 && t->kind == k.kind && t->value == k.value);
+	}
+
+	// Same slot as a token or cut from one, and longer than any token: never hashed to the end
+	current = "tokens, unknown";
+	const char* unknown[] = { "", "-", "-mod", "-modes", "-Mode", "mode", "--help ", "reds", "-group",
+		"-colorrrrrrrrrrr1", "-timeline-timeline-timeline" };
+	for (const char* word : unknown) {
+		CHECK(lookupToken(word) == NULL);
+	}
+}
+
+static void
+testColors() {
+
+	constexpr colors palette;
+	unsigned char value[3], expected[3];
+
+	current = "rgb, parse";
+	const char* orange[] = { "#ff8000", "ff8000", "FF8000", "255,128,0" };
+	for (const char* word : orange) {
+		CHECK(parseRGB(word, value) == 0 && value[0] == 255 && value[1] == 128 && value[2] == 0);
+	}
+	const char* bad[] = { "", "#", "ff80", "#ff80000", "gg8000", "256,0,0", "-1,0,0", "1,2", "1,2,3,", "1,,3", "red" };
+	for (const char* word : bad) {
+		CHECK(parseRGB(word, value) < 0);
+	}
+
+	// The palette is what LEVEL_2 shows. A channel already at 255 can't tell the brighter
+	// levels apart, those colors are set to the brightest
+	current = "rgb, palette";
+	const rgb entries[] = { palette.red, palette.orange, palette.yellow, palette.green, palette.sky,
+		palette.blue, palette.purple, palette.white };
+	const unsigned char levels[] = { LEVEL_4, LEVEL_2, LEVEL_2, LEVEL_2, LEVEL_4, LEVEL_4, LEVEL_2, LEVEL_2 };
+	unsigned char input[8 * 3], quantized[8], quantizedLevels[8];
+	for (int i = 0; i < 8; i++) {
+		input[i * 3] = entries[i].r;
+		input[i * 3 + 1] = entries[i].g;
+		input[i * 3 + 2] = entries[i].b;
+		levelRGB(entries[i].color, LEVEL_2, value);
+		CHECK(value[0] == entries[i].r && value[1] == entries[i].g && value[2] == entries[i].b);
+	}
+	quantizeColors(input, 8, quantized, quantizedLevels);
+	for (int i = 0; i < 8; i++) {
+		CHECK(quantized[i] == entries[i].color && quantizedLevels[i] == levels[i]);
+	}
+
+	current = "rgb, levels";
+	unsigned char color, level;
+	levelRGB(COLOR_ORANGE, LEVEL_1, value);
+	expected[0] = (palette.orange.r + 1) / 2;
+	expected[1] = (palette.orange.g + 1) / 2;
+	expected[2] = 0;
+	CHECK(memcmp(value, expected, 3) == 0);
+	nearestColor(value[0], value[1], value[2], &color, &level);
+	CHECK(color == COLOR_ORANGE && level == LEVEL_1);
+	levelRGB(COLOR_ORANGE, LEVEL_3, value);
+	CHECK(value[0] == 255 && value[1] == (palette.orange.g * 3 + 1) / 2 && value[2] == 0);
+	nearestColor(value[0], value[1], value[2], &color, &level);
+	CHECK(color == COLOR_ORANGE && level == LEVEL_3);
+	nearestColor(0, 0, 0, &color, &level);
+	CHECK(color == COLOR_BLACK);
+	nearestColor(4, 2, 6, &color, &level);
+	CHECK(color == COLOR_BLACK);
+}
+
+static void
+testKeyboard() {
+
+	keyboardState saved;
+	hid_mock_controller c;
+	char text[256];
+
+	hid_mock_reset();
+
+	current = "keyboard, commit";
+	{
+		Keyboard keyboard(true);
+		CHECK(keyboard.commit() == -1);
+		CHECK(keyboard.open("mock:0") == 0 && keyboard.isOpen() && keyboard.lastSync() == SYNC_RESET);
+		keyboard.setMode(MODE_NORMAL);
+		keyboard.setArea(AREA_LEFT, COLOR_RED, LEVEL_4);
+		keyboard.setArea(AREA_MIDDLE, COLOR_GREEN, LEVEL_4);
+		keyboard.setArea(AREA_RIGHT, COLOR_BLUE, LEVEL_2);
+		CHECK(keyboard.commit() == 0 && hid_mock_report_count() == 4);
+		hid_mock_controller_state(0, &c);
+		CHECK(c.commits == 1 && areaIs(c, AREA_RIGHT, OPCODE_SET_COLOR, COLOR_BLUE, LEVEL_2, 0x00));
+
+		// A staged area without a mode keeps the mode shown
+		keyboard.setArea(AREA_RIGHT, COLOR_BLUE, LEVEL_2);
+		CHECK(keyboard.commit() == 0 && hid_mock_report_count() == 4);
+
+		current = "keyboard, move";
+		Keyboard moved(std::move(keyboard));
+		CHECK(!keyboard.isOpen() && moved.isOpen() && keyboard.commit() == -1);
+		moved.setArea(AREA_LEFT, COLOR_PURPLE, LEVEL_4);
+		CHECK(moved.commit() == 0 && hid_mock_report_count() == 6);
+
+		Keyboard assigned;
+		assigned = std::move(moved);
+		CHECK(!moved.isOpen() && assigned.isOpen());
+		assigned.setArea(AREA_LEFT, COLOR_PURPLE, LEVEL_4);
+		CHECK(assigned.commit() == 0 && hid_mock_report_count() == 6);
+		CHECK(assigned.query(text, sizeof(text)) == SYNC_KEPT && strstr(text, "left    purple") != NULL);
+	}
+
+	// The persisting keyboard, moved twice, saved its state once destroyed
+	current = "keyboard, persisted";
+	CHECK(loadState("mock:0", &saved) == 0 && saved.valid && saved.areas[AREA_LEFT - 1][4] == COLOR_PURPLE);
+	{
+		Keyboard keyboard;
+		CHECK(keyboard.open("mock:0") == 0 && keyboard.lastSync() == SYNC_KEPT);
+		keyboard.setArea(AREA_LEFT, COLOR_YELLOW, LEVEL_4);
+		CHECK(keyboard.commit() == 0 && hid_mock_report_count() == 8);
+		keyboard.close();
+		CHECK(!keyboard.isOpen() && keyboard.commit() == -1);
+	}
+
+	current = "keyboard, not persisted";
+	CHECK(loadState("mock:0", &saved) == 0 && saved.areas[AREA_LEFT - 1][4] == COLOR_PURPLE);
+
+	current = "device handle";
+	DeviceHandle handle = DeviceHandle::open("mock:0");
+	CHECK(static_cast<bool>(handle));
+	DeviceHandle other(std::move(handle));
+	CHECK(!handle && other && other.get() != NULL);
+	hid_device* released = other.release();
+	CHECK(!other && released != NULL);
+	other.reset(released);
+	CHECK(other.get() == released);
+	CHECK(!DeviceHandle::open("mock:99"));
+}
+
+static void
+testFanout() {
+
+	unsigned char arguments[kSize];
+	hid_mock_controller c;
+	fanout f;
+
+	hid_mock_reset();
+	hid_mock_set_devices(3);
+
+	current = "fanout, powered";
+	CHECK(parse("-mode normal -color1 red -color2 green -color3 blue -level 0 -all", arguments) == NULL);
+	CHECK(openFanout(&f) == 3);
+	CHECK(applyFanout(&f, arguments) == 0);
+	closeFanout(&f);
+	for (int i = 0; i < 3; i++) {
+		CHECK(hid_mock_controller_state(i, &c) == 0 && c.commits == 1 && c.reports == 4
+			&& areaIs(c, AREA_MIDDLE, OPCODE_SET_COLOR, COLOR_GREEN, LEVEL_4, 0x00));
+	}
+
+	// The first keyboard on its own, from the state file -all left for it
+	current = "fanout, then one keyboard";
+	{
+		Keyboard keyboard(true);
+		CHECK(keyboard.open() == 0 && keyboard.lastSync() == SYNC_KEPT);
+		CHECK(parse("-mode normal -color1 red -color2 green -color3 purple -level 0", arguments) == NULL);
+		CHECK(keyboard.apply(arguments) == 0);
+	}
+	hid_mock_controller_state(0, &c);
+	CHECK(c.commits == 2 && c.reports == 6 && areaIs(c, AREA_RIGHT, OPCODE_SET_COLOR, COLOR_PURPLE, LEVEL_4, 0x00));
+
+	// Back to blue: only the first keyboard shows something else
+	current = "fanout, then -all";
+	CHECK(parse("-mode normal -color1 red -color2 green -color3 blue -level 0 -all", arguments) == NULL);
+	CHECK(openFanout(&f) == 3);
+	CHECK(applyFanout(&f, arguments) == 0);
+	CHECK(f.keyboards[0].sent == 2 && f.keyboards[1].sent == 0 && f.keyboards[2].sent == 0);
+	closeFanout(&f);
+	for (int i = 0; i < 3; i++) {
+		CHECK(hid_mock_controller_state(i, &c) == 0 && areaIs(c, AREA_LEFT, OPCODE_SET_COLOR, COLOR_RED, LEVEL_4, 0x00)
+			&& areaIs(c, AREA_RIGHT, OPCODE_SET_COLOR, COLOR_BLUE, LEVEL_4, 0x00));
+	}
+	hid_mock_controller_state(0, &c);
+	CHECK(c.commits == 3 && c.reports == 8);
+
+	current = "fanout, force";
+	CHECK(parse("-mode normal -color1 red -color2 green -color3 blue -level 0 -all -force", arguments) == NULL);
+	CHECK(openFanout(&f) == 3);
+	CHECK(applyFanout(&f, arguments) == 0);
+	CHECK(f.keyboards[0].sent == 4 && f.keyboards[1].sent == 4 && f.keyboards[2].sent == 4);
+	closeFanout(&f);
+
+	hid_mock_set_devices(1);
+}
+
+static double
+nowMillis() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// struct for a producer thread of testQueue
+struct producer {
+	reportQueue* q;
+	unsigned int seed;
+};
+
+/**
+ * Queues random normal mode colors, a whole batch or one area and a commit at a time.
+ */
+static void*
+produceColors(void* param) {
+
+	producer* p = (producer*) param;
+	reportBatch batch;
+
+	for (int i = 0; i < 2000; i++) {
+		unsigned char color = COLOR_RED + rand_r(&p->seed) % 8;
+		if (i % 3 == 0) {
+			batch.count = 0;
+			for (int area = AREA_LEFT; area <= AREA_RIGHT; area++) {
+				batchActivateArea(&batch, OPCODE_SET_COLOR, area, color, LEVEL_4, 0x00);
+			}
+			batchCommit(&batch, MODE_NORMAL);
+			queueBatch(p->q, &batch);
+		} else {
+			queueArea(p->q, OPCODE_SET_COLOR, AREA_LEFT + i % 3, color, LEVEL_4, 0x00);
+			queueCommit(p->q, MODE_NORMAL);
+		}
+	}
+
+	return NULL;
+}
+
+static void
+testQueue(hid_device* handle) {
+
+	reportBatch batch;
+	keyboardState state;
+	hid_mock_controller c;
+	reportQueue q;
+
+	hid_mock_reset();
+	resetState(&state);
+	CHECK(openQueue(&q, handle, &state) == 0);
+
+	current = "queue, batch";
+	batch.count = 0;
+	batchActivateArea(&batch, OPCODE_SET_COLOR, AREA_LEFT, COLOR_RED, LEVEL_4, 0x00);
+	batchActivateArea(&batch, OPCODE_SET_COLOR, AREA_MIDDLE, COLOR_GREEN, LEVEL_4, 0x00);
+	batchActivateArea(&batch, OPCODE_SET_COLOR, AREA_RIGHT, COLOR_BLUE, LEVEL_4, 0x00);
+	batchCommit(&batch, MODE_NORMAL);
+	queueBatch(&q, &batch);
+	flushQueue(&q);
+	hid_mock_controller_state(0, &c);
+	CHECK(c.commits == 1 && c.reports == 4 && areaIs(c, AREA_RIGHT, OPCODE_SET_COLOR, COLOR_BLUE, LEVEL_4, 0x00));
+
+	// The area goes out on its own, the keyboard only shows it once the commit follows
+	current = "queue, commit after its area was sent";
+	queueArea(&q, OPCODE_SET_COLOR, AREA_LEFT, COLOR_PURPLE, LEVEL_4, 0x00);
+	flushQueue(&q);
+	hid_mock_controller_state(0, &c);
+	CHECK(c.reports == 5 && areaIs(c, AREA_LEFT, OPCODE_SET_COLOR, COLOR_RED, LEVEL_4, 0x00));
+	queueCommit(&q, MODE_NORMAL);
+	flushQueue(&q);
+	hid_mock_controller_state(0, &c);
+	CHECK(c.commits == 2 && c.reports == 6 && areaIs(c, AREA_LEFT, OPCODE_SET_COLOR, COLOR_PURPLE, LEVEL_4, 0x00));
+	CHECK(state.valid && state.areas[AREA_LEFT - 1][4] == COLOR_PURPLE);
+
+	// The register holds the uncommitted color, the one of the state must be sent again
+	current = "queue, back to the committed color";
+	queueArea(&q, OPCODE_SET_COLOR, AREA_LEFT, COLOR_YELLOW, LEVEL_4, 0x00);
+	flushQueue(&q);
+	queueArea(&q, OPCODE_SET_COLOR, AREA_LEFT, COLOR_PURPLE, LEVEL_4, 0x00);
+	queueCommit(&q, MODE_NORMAL);
+	flushQueue(&q);
+	hid_mock_controller_state(0, &c);
+	CHECK(c.commits == 3 && c.reports == 9 && areaIs(c, AREA_LEFT, OPCODE_SET_COLOR, COLOR_PURPLE, LEVEL_4, 0x00));
+
+	current = "queue, same state";
+	queueBatch(&q, &batch);
+	flushQueue(&q);
+	hid_mock_controller_state(0, &c);
+	CHECK(c.reports == 11 && areaIs(c, AREA_LEFT, OPCODE_SET_COLOR, COLOR_RED, LEVEL_4, 0x00));
+	queueBatch(&q, &batch);
+	flushQueue(&q);
+	CHECK(hid_mock_report_count() == 11);
+
+	// Producers only store into the slots: they go on while the writer is in a 200ms report
+	current = "queue, producers never wait";
+	hid_mock_set_latency(200000);
+	queueArea(&q, OPCODE_SET_COLOR, AREA_LEFT, COLOR_SKY, LEVEL_4, 0x00);
+	queueCommit(&q, MODE_NORMAL);
+	double start = nowMillis();
+	for (int i = 0; i < 1000; i++) {
+		queueBatch(&q, &batch);
+	}
+	CHECK(nowMillis() - start < 100);
+	flushQueue(&q);
+	hid_mock_set_latency(0);
+	hid_mock_controller_state(0, &c);
+	CHECK(areaIs(c, AREA_LEFT, OPCODE_SET_COLOR, COLOR_RED, LEVEL_4, 0x00));
+
+	// Whatever the interleaving, the keyboard and the state end on the last batch queued
+	current = "queue, producers and writer";
+	hid_mock_set_latency(50);
+	producer producers[4];
+	pthread_t threads[4];
+	for (int i = 0; i < 4; i++) {
+		producers[i] = { &q, (unsigned int) i + 1 };
+		pthread_create(&threads[i], NULL, produceColors, &producers[i]);
+	}
+	for (int i = 0; i < 4; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	queueBatch(&q, &batch);
+	flushQueue(&q);
+	hid_mock_set_latency(0);
+	hid_mock_controller_state(0, &c);
+	CHECK(c.mode == MODE_NORMAL && areaIs(c, AREA_LEFT, OPCODE_SET_COLOR, COLOR_RED, LEVEL_4, 0x00)
+		&& areaIs(c, AREA_MIDDLE, OPCODE_SET_COLOR, COLOR_GREEN, LEVEL_4, 0x00)
+		&& areaIs(c, AREA_RIGHT, OPCODE_SET_COLOR, COLOR_BLUE, LEVEL_4, 0x00));
+	// Every report stored counts, superseded or not: 667 batches and 1333 area and commit pairs
+	// per producer, after the 4023 reports of the cases above
+	CHECK(q.queued.load() == 4 * (667 * 4 + 1333 * 2) + 4023);
+	CHECK(q.failed == 0 && q.sent == c.reports);
+	CHECK(memcmp(state.areas[AREA_LEFT - 1], batch.data[0], REPORT_LENGTH) == 0);
+
+	closeQueue(&q);
+}
+
+static void
+testAnimation(hid_device* handle) {
+
+	animation anim = { EFFECT_CYCLE, { COLOR_RED, COLOR_GREEN, COLOR_BLUE }, LEVEL_4, 20, 3.0, 0.5 };
+	unsigned char colors[3], levels[3];
+	keyboardState state;
+	frameStats stats;
+	hid_mock_controller c;
+
+	current = "animation, cycle phase";
+	renderFrame(&anim, 0.1, colors, levels);
+	CHECK(colors[0] == COLOR_RED && colors[1] == COLOR_GREEN && colors[2] == COLOR_BLUE && levels[0] == LEVEL_4);
+	renderFrame(&anim, 1.5, colors, levels);
+	CHECK(colors[0] == COLOR_BLUE && colors[1] == COLOR_RED && colors[2] == COLOR_GREEN);
+	renderFrame(&anim, 3.0 + 2.5, colors, levels);
+	CHECK(colors[0] == COLOR_GREEN && colors[1] == COLOR_BLUE && colors[2] == COLOR_RED);
+
+	current = "animation, scan phase";
+	anim.effect = EFFECT_SCAN;
+	renderFrame(&anim, 0.75, colors, levels);
+	CHECK(levels[0] == LEVEL_1 && levels[1] == LEVEL_4 && levels[2] == LEVEL_1);
+
+	// 10 frames in the first sixth of a 3s period all show the first step of the cycle: the
+	// renderer must get seconds, nanoseconds since the start land anywhere in the period
+	current = "animation, elapsed seconds";
+	anim.effect = EFFECT_CYCLE;
+	hid_mock_reset();
+	resetState(&state);
+	CHECK(runAnimation(handle, &anim, &state, &stats) == 0);
+	CHECK(stats.frames + stats.dropped == 10 && stats.sent == 1);
+	hid_mock_controller_state(0, &c);
+	CHECK(c.commits == 1 && c.mode == MODE_NORMAL && areaIs(c, AREA_LEFT, OPCODE_SET_COLOR, COLOR_RED, LEVEL_4, 0x00)
+		&& areaIs(c, AREA_RIGHT, OPCODE_SET_COLOR, COLOR_BLUE, LEVEL_4, 0x00));
+}
+
+/**
+ * Fills the BGRX pixels [from, to) of each row of frame with r, g, b, only the rows of parity
+ * rows (0 even, 1 odd, -1 all).
+ */
+static void
+fillPixels(unsigned char* frame, int height, size_t stride, int from, int to, int rows,
+	unsigned char r, unsigned char g, unsigned char b) {
+
+	for (int y = 0; y < height; y++) {
+		for (int x = from; x < to && (rows < 0 || y % 2 == rows); x++) {
+			unsigned char* pixel = frame + y * stride + x * 4;
+			pixel[0] = b;
+			pixel[1] = g;
+			pixel[2] = r;
+			pixel[3] = 0xff;
+		}
+	}
+}
+
+/**
+ * reduceFrame one pixel at a time, what the SSE2 path must match.
+ */
+static void
+reduceFrameScalar(const unsigned char* frame, int width, int height, size_t stride, int rowStep, unsigned char rgb[9]) {
+
+	int bounds[4] = { 0, width / 3, width * 2 / 3, width };
+
+	for (int area = 0; area < 3; area++) {
+		unsigned long long sums[3] = {}, pixels = 0;
+		for (int y = 0; y < height; y += rowStep) {
+			for (int x = bounds[area]; x < bounds[area + 1]; x++, pixels++) {
+				for (int c = 0; c < 3; c++) {
+					sums[c] += frame[y * stride + x * 4 + 2 - c];
+				}
+			}
+		}
+		for (int c = 0; c < 3; c++) {
+			rgb[area * 3 + c] = pixels ? sums[c] / pixels : 0;
+		}
+	}
+}
+
+static void
+testAmbient() {
+
+	static unsigned char frame[64 * 4 * 16];
+	unsigned char rgb[9], expected[9];
+
+	current = "ambient, solid frame";
+	fillPixels(frame, 16, 64 * 4, 0, 64, -1, 10, 200, 30);
+	reduceFrame(frame, 64, 16, 64 * 4, 1, rgb);
+	CHECK(rgb[0] == 10 && rgb[1] == 200 && rgb[2] == 30 && memcmp(rgb, rgb + 3, 3) == 0 && memcmp(rgb, rgb + 6, 3) == 0);
+
+	current = "ambient, split frame";
+	fillPixels(frame, 16, 64 * 4, 0, 21, -1, 255, 0, 0);
+	fillPixels(frame, 16, 64 * 4, 21, 42, -1, 0, 255, 0);
+	fillPixels(frame, 16, 64 * 4, 42, 64, -1, 0, 0, 255);
+	reduceFrame(frame, 64, 16, 64 * 4, 1, rgb);
+	const unsigned char split[9] = { 255, 0, 0, 0, 255, 0, 0, 0, 255 };
+	CHECK(memcmp(rgb, split, 9) == 0);
+
+	// 7 and 13 pixels wide: thirds of 2 and 3 or 4 and 5 pixels, all or part in the scalar tail
+	current = "ambient, scalar tail";
+	fillPixels(frame, 16, 64 * 4, 0, 64, -1, 0, 0, 0);
+	fillPixels(frame, 4, 7 * 4, 0, 2, -1, 90, 60, 30);
+	fillPixels(frame, 4, 7 * 4, 5, 7, -1, 30, 60, 90);
+	reduceFrame(frame, 7, 4, 7 * 4, 1, rgb);
+	const unsigned char narrow[9] = { 90, 60, 30, 0, 0, 0, 20, 40, 60 };
+	CHECK(memcmp(rgb, narrow, 9) == 0);
+	fillPixels(frame, 4, 13 * 4, 0, 13, -1, 0, 0, 0);
+	fillPixels(frame, 4, 13 * 4, 3, 4, -1, 200, 100, 40);
+	fillPixels(frame, 4, 13 * 4, 12, 13, -1, 250, 150, 50);
+	reduceFrame(frame, 13, 4, 13 * 4, 1, rgb);
+	const unsigned char tail[9] = { 50, 25, 10, 0, 0, 0, 50, 30, 10 };
+	CHECK(memcmp(rgb, tail, 9) == 0);
+
+	current = "ambient, row step";
+	fillPixels(frame, 16, 64 * 4, 0, 64, 0, 240, 120, 60);
+	fillPixels(frame, 16, 64 * 4, 0, 64, 1, 0, 0, 0);
+	reduceFrame(frame, 64, 16, 64 * 4, 2, rgb);
+	CHECK(rgb[0] == 240 && rgb[1] == 120 && rgb[2] == 60 && memcmp(rgb, rgb + 6, 3) == 0);
+	reduceFrame(frame, 64, 16, 64 * 4, 1, rgb);
+	CHECK(rgb[0] == 120 && rgb[1] == 60 && rgb[2] == 30);
+
+	// Padded rows (stride wider than the frame) of random pixels, every width mod 4 and step
+	current = "ambient, SSE2 and scalar";
+	srand(1);
+	for (size_t i = 0; i < sizeof(frame); i++) {
+		frame[i] = rand();
+	}
+	for (int width = 3; width <= 60; width += 7) {
+		for (int step = 1; step <= 3; step++) {
+			reduceFrame(frame, width, 15, 64 * 4, step, rgb);
+			reduceFrameScalar(frame, width, 15, 64 * 4, step, expected);
+			CHECK(memcmp(rgb, expected, 9) == 0);
+		}
+	}
+}
+
+/**
+ * Writes a 16 bit PCM WAV of a sine of hz, the same in each channel, with a LIST chunk before
+ * the format when list is set. bits other than 16 only go in the header.
+ */
+static void
+writeWav(const char* path, unsigned int sampleRate, unsigned short channels, unsigned short bits,
+	double hz, int samples, bool list) {
+
+	FILE* f = fopen(path, "wb");
+	unsigned int dataBytes = samples * channels * 2;
+	unsigned int byteRate = sampleRate * channels * 2;
+	unsigned short blockAlign = channels * 2, pcm = 1;
+	unsigned int riffBytes = 4 + (list ? 8 + 4 : 0) + 8 + 16 + 8 + dataBytes, sixteen = 16, four = 4;
+
+	fwrite("RIFF", 1, 4, f);
+	fwrite(&riffBytes, 4, 1, f);
+	fwrite("WAVE", 1, 4, f);
+	if (list) {
+		fwrite("LIST", 1, 4, f);
+		fwrite(&four, 4, 1, f);
+		fwrite("INFO", 1, 4, f);
+	}
+	fwrite("fmt ", 1, 4, f);
+	fwrite(&sixteen, 4, 1, f);
+	fwrite(&pcm, 2, 1, f);
+	fwrite(&channels, 2, 1, f);
+	fwrite(&sampleRate, 4, 1, f);
+	fwrite(&byteRate, 4, 1, f);
+	fwrite(&blockAlign, 2, 1, f);
+	fwrite(&bits, 2, 1, f);
+	fwrite("data", 1, 4, f);
+	fwrite(&dataBytes, 4, 1, f);
+	for (int i = 0; i < samples; i++) {
+		short sample = (short) (16000 * sin(2 * M_PI * hz * i / sampleRate));
+		for (int c = 0; c < channels; c++) {
+			fwrite(&sample, 2, 1, f);
+		}
+	}
+	fclose(f);
+}
+
+/**
+ * Parses -audio path with the default colors.
+ */
+static const char*
+parseAudioFile(const char* path, audio* a) {
+
+	char program[] = "msiled", param[] = "-audio", source[256];
+	char* argv[] = { program, param, source, NULL };
+
+	snprintf(source, sizeof(source), "%s", path);
+	return parseAudio(3, argv, a);
+}
+
+static void
+testAudio(hid_device* handle, const char* runtimeDir) {
+
+	char path[256];
+	audio a;
+	audioStats stats;
+	keyboardState state;
+	hid_mock_controller c;
+
+	snprintf(path, sizeof(path), "%s/tone.wav", runtimeDir);
+
+	// 2000 samples at 8 kHz: windows end on samples 1024, 1280, 1536 and 1792
+	current = "audio, low tone";
+	writeWav(path, 8000, 1, 16, 100, 2000, false);
+	CHECK(parseAudioFile(path, &a) == NULL && a.sampleRate == 8000 && a.channels == 1 && a.paced);
+	hid_mock_reset();
+	resetState(&state);
+	CHECK(runAudio(handle, &a, &state, &stats) == 0);
+	closeAudio(&a);
+	CHECK(stats.analyses == 4 && stats.failed == 0 && stats.sent == 1);
+	hid_mock_controller_state(0, &c);
+	CHECK(c.commits == 1 && c.mode == MODE_NORMAL && areaIs(c, AREA_LEFT, OPCODE_SET_COLOR, COLOR_RED, LEVEL_4, 0x00)
+		&& areaIs(c, AREA_MIDDLE, OPCODE_SET_COLOR, COLOR_BLACK, LEVEL_1, 0x00)
+		&& areaIs(c, AREA_RIGHT, OPCODE_SET_COLOR, COLOR_BLACK, LEVEL_1, 0x00));
+
+	// Stereo, a chunk to read through before the format
+	current = "audio, high tone";
+	writeWav(path, 8000, 2, 16, 3000, 2000, true);
+	CHECK(parseAudioFile(path, &a) == NULL && a.channels == 2);
+	hid_mock_reset();
+	resetState(&state);
+	CHECK(runAudio(handle, &a, &state, &stats) == 0);
+	closeAudio(&a);
+	CHECK(stats.analyses == 4 && stats.sent == 1);
+	hid_mock_controller_state(0, &c);
+	CHECK(areaIs(c, AREA_LEFT, OPCODE_SET_COLOR, COLOR_BLACK, LEVEL_1, 0x00)
+		&& areaIs(c, AREA_MIDDLE, OPCODE_SET_COLOR, COLOR_BLACK, LEVEL_1, 0x00)
+		&& areaIs(c, AREA_RIGHT, OPCODE_SET_COLOR, COLOR_BLUE, LEVEL_4, 0x00));
+
+	current = "audio, invalid input";
+	writeWav(path, 8000, 1, 8, 100, 16, false);
+	CHECK(parseAudioFile(path, &a) != NULL);
+	closeAudio(&a);
+	writeWav(path, 2000, 1, 16, 100, 16, false);
+	CHECK(parseAudioFile(path, &a) != NULL);
+	closeAudio(&a);
+	CHECK(truncate(path, 30) == 0 && parseAudioFile(path, &a) != NULL);
+	closeAudio(&a);
+	CHECK(parseAudioFile(runtimeDir, &a) != NULL);
+	closeAudio(&a);
+	snprintf(path, sizeof(path), "%s/missing.wav", runtimeDir);
+	CHECK(parseAudioFile(path, &a) != NULL && a.fd < 0);
+}
+
+/**
+ * Writes text to path, replacing the file.
+ */
+static void
+writeText(const char* path, const char* text) {
+
+	FILE* f = fopen(path, "w");
+	fputs(text, f);
+	fclose(f);
+}
+
+/**
+ * Overwrites length bytes of the file at path from offset.
+ */
+static void
+patchFile(const char* path, long offset, const void* bytes, size_t length) {
+
+	FILE* f = fopen(path, "r+b");
+	fseek(f, offset, SEEK_SET);
+	fwrite(bytes, 1, length, f);
+	fclose(f);
+}
+
+/**
+ * Compiles source into library, the profiles of which are [alert] (steps 0 and 1) then [calm]
+ * (step 2): the header, 2 entries from 32, 3 steps from 64 and the names from 352.
+ */
+static bool
+compileFresh(const char* source, const char* library) {
+
+	int count;
+	profileLibrary lib;
+
+	memset(&lib, 0, sizeof(lib));
+	if (compileProfiles(source, library, &count) != NULL || count != 2 || openLibrary(&lib, library) != 0) {
+		return false;
+	}
+	bool laidOut = lib.length == 352 + 9;
+	closeLibrary(&lib);
+
+	return laidOut;
+}
+
+static void
+testProfiles(hid_device* handle, const char* runtimeDir) {
+
+	char source[256], library[256];
+	int count;
+	profileLibrary lib;
+	keyboardState state;
+	hid_mock_controller c;
+
+	snprintf(source, sizeof(source), "%s/profiles.txt", runtimeDir);
+	snprintf(library, sizeof(library), "%s/profiles.lib", runtimeDir);
+	memset(&lib, 0, sizeof(lib));
+
+	current = "profiles, compile and apply";
+	writeText(source, "# comment\n[alert]\n-preset red -hold 0.05\n\n  -preset blue\n[calm]\n-preset dim\n");
+	CHECK(compileFresh(source, library));
+	CHECK(openLibrary(&lib, library) == 0 && lib.header->profileCount == 2 && lib.header->stepCount == 3);
+	const profileEntry* alert = findProfile(&lib, "alert");
+	CHECK(alert && alert->stepCount == 2 && alert->firstStep == 0 && findProfile(&lib, "calm") && !findProfile(&lib, "cal"));
+	if (alert) {
+		hid_mock_reset();
+		resetState(&state);
+		double start = nowMillis();
+		CHECK(applyProfile(handle, &lib, alert, &state) == 0 && nowMillis() - start >= 50);
+		hid_mock_controller_state(0, &c);
+		CHECK(c.commits == 2 && areaIs(c, AREA_MIDDLE, OPCODE_SET_COLOR, COLOR_BLUE, LEVEL_4, 0x00));
+	}
+
+	// Kept while the file is the same, mapped again once it was compiled anew
+	const unsigned char* base = lib.base;
+	CHECK(openLibrary(&lib, library) == 0 && lib.base == base);
+	writeText(source, "[calm]\n-preset dim\n[alert]\n-preset off\n");
+	CHECK(compileProfiles(source, library, &count) == NULL && count == 2);
+	CHECK(openLibrary(&lib, library) == 0 && findProfile(&lib, "calm")->firstStep == 0);
+	closeLibrary(&lib);
+
+	current = "profiles, source errors";
+	const char* invalid[] = {
+		"-preset red\n", "[alert]\n", "[alert]\n-preset red\n[alert]\n-preset off\n", "[al ert]\n-preset red\n",
+		"[alert]\n-preset red -hold -1\n", "[alert]\n-preset red -hold 3601\n", "[alert]\n-preset nope\n",
+	};
+	for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		writeText(source, invalid[i]);
+		CHECK(compileProfiles(source, library, &count) != NULL && count == 0);
+	}
+	snprintf(source, sizeof(source), "%s/missing.txt", runtimeDir);
+	CHECK(compileProfiles(source, library, &count) != NULL);
+	snprintf(source, sizeof(source), "%s/profiles.txt", runtimeDir);
+
+	// A header that does not describe the file: nothing is mapped
+	current = "profiles, truncated or corrupt header";
+	writeText(source, "[alert]\n-preset red -hold 0.05\n-preset blue\n[calm]\n-preset dim\n");
+	unsigned int badMagic = 0x3250534d, badCount = 4, badLength = 352 + 10;
+	unsigned short badVersion = PROFILE_VERSION + 1, badStepSize = 95;
+	struct {
+		long offset;
+		const void* bytes;
+		size_t length;
+	} headers[] = {
+		{ 0, &badMagic, 4 }, { 4, &badVersion, 2 }, { 6, &badStepSize, 2 }, { 8, &badCount, 4 },
+		{ 12, &badCount, 4 }, { 28, &badLength, 4 },
+	};
+	for (size_t i = 0; i < sizeof(headers) / sizeof(headers[0]); i++) {
+		CHECK(compileFresh(source, library));
+		patchFile(library, headers[i].offset, headers[i].bytes, headers[i].length);
+		CHECK(openLibrary(&lib, library) == -1 && !lib.base);
+	}
+	CHECK(compileFresh(source, library));
+	CHECK(truncate(library, 352 + 4) == 0 && openLibrary(&lib, library) == -1);
+	CHECK(truncate(library, 16) == 0 && openLibrary(&lib, library) == -1);
+	CHECK(truncate(library, 0) == 0 && openLibrary(&lib, library) == -1);
+
+	// The index and the steps are only checked for the profile asked for, the others still apply
+	current = "profiles, corrupt index and steps";
+	unsigned int farStep = 0xfffe, farName = 0x10000;
+	unsigned char noReports = 0, tooManyReports = MAX_BATCH_REPORTS + 1;
+	struct {
+		long offset;
+		const void* bytes;
+		size_t length;
+	} steps[] = {
+		{ 64 + 4, &noReports, 1 }, { 64 + 96 + 4, &tooManyReports, 1 },
+	};
+	for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+		CHECK(compileFresh(source, library));
+		patchFile(library, steps[i].offset, steps[i].bytes, steps[i].length);
+		CHECK(openLibrary(&lib, library) == 0 && !findProfile(&lib, "alert") && findProfile(&lib, "calm"));
+		closeLibrary(&lib);
+	}
+	for (long entry = 32; entry < 64; entry += 16) {
+		CHECK(compileFresh(source, library));
+		patchFile(library, entry + 12, &farStep, 4);
+		CHECK(openLibrary(&lib, library) == 0 && (!findProfile(&lib, "alert") != !findProfile(&lib, "calm")));
+		closeLibrary(&lib);
+		CHECK(compileFresh(source, library));
+		patchFile(library, entry + 4, &farName, 4);
+		CHECK(openLibrary(&lib, library) == 0 && (!findProfile(&lib, "alert") != !findProfile(&lib, "calm")));
+		closeLibrary(&lib);
+	}
+}
+
+/**
+ * Parses -timeline path -fps fps.
+ */
+static const char*
+parseTimelineFile(const char* path, int fps, timeline* tl) {
+
+	char program[] = "msiled", param[] = "-timeline", source[256], fpsParam[] = "-fps", fpsValue[16];
+	char* argv[] = { program, param, source, fpsParam, fpsValue, NULL };
+
+	snprintf(source, sizeof(source), "%s", path);
+	snprintf(fpsValue, sizeof(fpsValue), "%d", fps);
+	return parseTimeline(5, argv, tl);
+}
+
+static void
+onTimelineSignal(int) {
+
+	stopTimeline();
+}
+
+/**
+ * Signals the thread running the timeline after 50ms, as Ctrl+C does to the command line.
+ */
+static void*
+stopTimelineLater(void* runner) {
+
+	struct timespec pause = { 0, 50000000 };
+	nanosleep(&pause, NULL);
+	pthread_kill(*(pthread_t*) runner, SIGUSR1);
+	return NULL;
+}
+
+static void
+testTimeline(hid_device* handle, const char* runtimeDir) {
+
+	char path[256];
+	timeline tl;
+	timelineStats stats;
+	keyboardState state;
+	hid_mock_controller c;
+
+	snprintf(path, sizeof(path), "%s/show.txt", runtimeDir);
+
+	current = "timeline, steps";
+	writeText(path, "# show\n0 -preset red\n\n0.05 -preset red\n0.1 -preset blue\n0.15 -preset off\n");
+	CHECK(parseTimelineFile(path, 20, &tl) == NULL && tl.count == 3 && tl.duration == 0.15);
+	CHECK(tl.count == 3 && tl.cues[0].at == 0 && tl.cues[1].at == 0.1 && tl.cues[2].at == 0.15);
+	hid_mock_reset();
+	resetState(&state);
+	CHECK(runTimeline(handle, &tl, &state, &stats) == 0);
+	CHECK(stats.cues == 3 && stats.sent + stats.skipped == 3 && stats.failed == 0 && stats.elapsed >= 0.15);
+	hid_mock_controller_state(0, &c);
+	CHECK(c.committed && c.mode == MODE_DISABLE && c.commits == stats.sent);
+	closeTimeline(&tl);
+
+	// 20 fps over 0.2s: the 3 frames between red and blue go through the colors between them
+	current = "timeline, fade";
+	writeText(path, "0 -mode normal -color1 red -color2 red -color3 red -level 0 -ease linear\n"
+		"0.2 -mode normal -color1 blue -color2 blue -color3 blue -level 0\n");
+	CHECK(parseTimelineFile(path, 20, &tl) == NULL && tl.count >= 3 && tl.count <= 5);
+	for (size_t i = 1; i < tl.count; i++) {
+		CHECK(tl.cues[i].at > tl.cues[i - 1].at && tl.cues[i].batch.count == 4);
+		CHECK(memcmp(tl.cues[i].batch.data, tl.cues[i - 1].batch.data, 4 * REPORT_LENGTH) != 0);
+	}
+	CHECK(tl.cues[0].batch.data[0][4] == COLOR_RED && tl.cues[tl.count - 1].batch.data[0][4] == COLOR_BLUE);
+	hid_mock_reset();
+	resetState(&state);
+	CHECK(runTimeline(handle, &tl, &state, &stats) == 0 && stats.sent + stats.skipped == tl.count);
+	hid_mock_controller_state(0, &c);
+	CHECK(c.mode == MODE_NORMAL && areaIs(c, AREA_RIGHT, OPCODE_SET_COLOR, COLOR_BLUE, LEVEL_4, 0x00));
+	closeTimeline(&tl);
+
+	current = "timeline, stop";
+	writeText(path, "0 -preset red\n30 -preset off\n");
+	CHECK(parseTimelineFile(path, 20, &tl) == NULL && tl.count == 2);
+	pthread_t runner = pthread_self(), stopper;
+	signal(SIGUSR1, onTimelineSignal);
+	pthread_create(&stopper, NULL, stopTimelineLater, &runner);
+	CHECK(runTimeline(handle, &tl, &state, &stats) == 0 && stats.sent == 1 && stats.elapsed < 5);
+	pthread_join(stopper, NULL);
+	signal(SIGUSR1, SIG_DFL);
+	closeTimeline(&tl);
+
+	current = "timeline, invalid";
+	const char* invalid[] = {
+		"", "# nothing\n", "1 -preset red\n0 -preset off\n", "soon -preset red\n", "-1 -preset red\n",
+		"0 -preset red -ease bounce\n", "0 -preset nope\n",
+	};
+	for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		writeText(path, invalid[i]);
+		CHECK(parseTimelineFile(path, 20, &tl) != NULL);
+		closeTimeline(&tl);
+	}
+	writeText(path, "0 -preset red\n");
+	CHECK(parseTimelineFile(path, 0, &tl) != NULL && parseTimelineFile(path, MAX_ANIMATION_FPS + 1, &tl) != NULL);
+	snprintf(path, sizeof(path), "%s/missing.txt", runtimeDir);
+	CHECK(parseTimelineFile(path, 20, &tl) != NULL);
+}
+
+static void*
+daemonThread(void* options) {
+
+	runDaemon((const daemonOptions*) options);
+	return NULL;
+}
+
+static int
+connectDaemon(const char* socketPath) {
+
+	struct sockaddr_un address;
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	snprintf(address.sun_path, sizeof(address.sun_path), "%s", socketPath);
+
+	// The daemon listens a little after its thread started
+	for (int i = 0; i < 200; i++) {
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd >= 0 && connect(fd, (struct sockaddr*) &address, sizeof(address)) == 0) {
+			return fd;
+		}
+		if (fd >= 0) {
+			close(fd);
+		}
+		usleep(10000);
+	}
+
+	return -1;
+}
+
+/**
+ * Reads the daemon replies into buffer until count of them ended with "ok" or an "error:" line,
+ * for up to 2s. Returns the number of replies read.
+ */
+static int
+readReplies(int fd, char* buffer, size_t length, int count) {
+
+	size_t used = 0;
+	int replies = 0;
+
+	buffer[0] = '\0';
+	while (replies < count && used < length - 1) {
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		if (poll(&pfd, 1, 2000) <= 0) {
+			break;
+		}
+		ssize_t received = read(fd, buffer + used, length - 1 - used);
+		if (received <= 0) {
+			break;
+		}
+		used += received;
+		buffer[used] = '\0';
+
+		replies = 0;
+		for (char* line = buffer; *line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : line + strlen(line)) {
+			if (strchr(line, '\n') && (strncmp(line, "ok\n", 3) == 0 || strncmp(line, "error: ", 7) == 0)) {
+				replies++;
+			}
+		}
+	}
+
+	return replies;
+}
+
+/**
+ * Sends data as is (none, one or several lines) and reads count replies into buffer.
+ */
+static bool
+exchange(int fd, const char* data, char* buffer, size_t length, int count) {
+
+	return write(fd, data, strlen(data)) == (ssize_t) strlen(data) && readReplies(fd, buffer, length, count) == count;
+}
+
+static void
+testDaemon(const char* runtimeDir) {
+
+	static char programName[] = "msiledenabler", daemonParam[] = "-daemon";
+	char* argv[] = { programName, daemonParam, NULL };
+	daemonOptions options;
+	pthread_t thread;
+	hid_mock_controller c;
+	char buffer[16384];
+
+	current = "daemon, options";
+	CHECK(parseDaemon(2, argv, &options) == NULL);
+	CHECK(strncmp(options.socketPath, runtimeDir, strlen(runtimeDir)) == 0 && options.group == NULL);
+
+	hid_mock_reset();
+	pthread_create(&thread, NULL, daemonThread, &options);
+	int fd = connectDaemon(options.socketPath);
+	CHECK(fd >= 0);
+	if (fd < 0) {
+		pthread_kill(thread, SIGTERM);
+		pthread_join(thread, NULL);
+		return;
+	}
+
+	current = "daemon, command";
+	CHECK(exchange(fd, "-mode normal -color1 red -color2 green -color3 blue -level 0\n", buffer, sizeof(buffer), 1));
+	CHECK(strcmp(buffer, "ok\n") == 0);
+	hid_mock_controller_state(0, &c);
+	CHECK(c.committed && c.mode == MODE_NORMAL && areaIs(c, AREA_LEFT, OPCODE_SET_COLOR, COLOR_RED, LEVEL_4, 0x00)
+		&& areaIs(c, AREA_RIGHT, OPCODE_SET_COLOR, COLOR_BLUE, LEVEL_4, 0x00));
+
+	current = "daemon, same state";
+	unsigned long long reports = hid_mock_report_count();
+	CHECK(exchange(fd, "-mode normal -color1 red -color2 green -color3 blue -level 0\n", buffer, sizeof(buffer), 1));
+	CHECK(strcmp(buffer, "ok\n") == 0 && hid_mock_report_count() == reports);
+
+	current = "daemon, line split across writes";
+	CHECK(write(fd, "-mode normal -color1 red -color2 gre", 36) == 36);
+	usleep(20000);
+	CHECK(exchange(fd, "en -color3 purple -level 0\r\n", buffer, sizeof(buffer), 1));
+	CHECK(strcmp(buffer, "ok\n") == 0 && hid_mock_report_count() == reports + 2);
+	hid_mock_controller_state(0, &c);
+	CHECK(areaIs(c, AREA_RIGHT, OPCODE_SET_COLOR, COLOR_PURPLE, LEVEL_4, 0x00));
+
+	current = "daemon, errors";
+	CHECK(exchange(fd, "-mode nope\n", buffer, sizeof(buffer), 1));
+	CHECK(strncmp(buffer, "error: ", 7) == 0);
+	CHECK(exchange(fd, "-animate breathe -color1 red\n", buffer, sizeof(buffer), 1));
+	CHECK(strstr(buffer, "error: -animate is only available on the command line") == buffer);
+	CHECK(exchange(fd, "-profile work -library /etc/shadow\n", buffer, sizeof(buffer), 1));
+	CHECK(strncmp(buffer, "error: ", 7) == 0 && strstr(buffer, "-daemon -library") != NULL);
+
+	current = "daemon, two lines in one write";
+	CHECK(exchange(fd, "-query\n--stats\n", buffer, sizeof(buffer), 2));
+	CHECK(strncmp(buffer, "mode normal (read back)\n", 24) == 0);
+	CHECK(strstr(buffer, "ok\n") != NULL && strcmp(buffer + strlen(buffer) - 3, "ok\n") == 0);
+	CHECK(hid_mock_report_count() == reports + 2);
+
+	close(fd);
+
+	// Wakes the poll in case the signal came before it, the daemon then sees the stop
+	pthread_kill(thread, SIGTERM);
+	close(connectDaemon(options.socketPath));
+	pthread_join(thread, NULL);
+
+	current = "daemon, stopped";
+	keyboardState saved;
+	char path[MAX_DEVICE_PATH];
+	hid_device* handle = tracedOpen(MSI_VENDOR_ID, MSI_PRODUCT_ID, path, sizeof(path));
+	CHECK(access(options.socketPath, F_OK) < 0);
+	CHECK(loadState(path, &saved) == 0 && saved.valid && saved.mode == MODE_NORMAL);
+	if (handle) {
+		tracedClose(handle);
+	}
+}
+
+/**
+ * Removes the runtime dir of the tests and the state files left in it.
+ */
+static void
+removeDir(const char* dir) {
+
+	char path[512];
+	DIR* d = opendir(dir);
+
+	for (struct dirent* entry = d ? readdir(d) : NULL; entry; entry = readdir(d)) {
+		if (entry->d_name[0] != '.') {
+			snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+			unlink(path);
+		}
+	}
+	if (d) {
+		closedir(d);
+	}
+	rmdir(dir);
+}
+
+int
+main() {
+
+	// The state files and the daemon socket of the tests never touch the real ones
+	char runtimeDir[] = "/tmp/msiled-test-XXXXXX";
+	if (!mkdtemp(runtimeDir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	setenv("XDG_RUNTIME_DIR", runtimeDir, 1);
+
+	hid_init();
+	hid_mock_set_devices(1);
+	hid_device* handle = hid_open_path("mock:0");
+	if (!handle) {
+		printf("Unable to open the loopback device.\n");
+		removeDir(runtimeDir);
+		return 1;
+	}
+
+	testModes(handle);
+	testPresets(handle);
+	testDiff(handle);
+	testRetries();
+	testSync(handle);
+	testTokens();
+	testColors();
+	testKeyboard();
+	testFanout();
+	testQueue(handle);
+	testAnimation(handle);
+	testAmbient();
+	testAudio(handle, runtimeDir);
+	testProfiles(handle, runtimeDir);
+	testTimeline(handle, runtimeDir);
+	testDaemon(runtimeDir);
+
+	hid_close(handle);
+	hid_exit();
+	removeDir(runtimeDir);
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,471 @@
+/**
+ * Tests of the hidraw backend (hid_linux.c) against a virtual 0x1770:0xff00 keyboard created
+ * through /dev/uhid, whose feature reports are answered by a thread of this program: enumerate,
+ * open by path and serial, feature reports both ways, input reports, write-only opens, the
+ * input reactor, and the enumeration cache, which must see the keyboard come and go and start
+ * over after hid_exit. The reactor is also run on a FIFO opened like a node, which needs no
+ * uhid: one report per read, devices left blocking, removal from a callback.
+ *
+ * Usage: make test (as root, with the uhid module loaded), or test/uhid_backend after a build
+ *
+ * Without /dev/uhid only the FIFO cases are checked: it says so.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
+#include <sys/stat.h>
+#include <linux/uhid.h>
+#include <algorithm>
+#include <atomic>
+#include "../hidapi.h"
+#include "../hid_reactor.h"
+#include "check.h"
+
+#define TEST_VENDOR_ID							0x1770
+#define TEST_PRODUCT_ID							0xff00
+/** Feature report 1 like the keyboard, input report 2, 8 bytes after the id */
+#define TEST_REPORT_LENGTH						9
+
+/** Vendor page, one feature and one input report of 8 bytes */
+static const unsigned char reportDescriptor[] = {
+	0x06, 0x00, 0xff, 0x09, 0x01, 0xa1, 0x01,
+	0x85, 0x01, 0x15, 0x00, 0x26, 0xff, 0x00, 0x75, 0x08, 0x95, 0x08, 0x09, 0x01, 0xb1, 0x02,
+	0x85, 0x02, 0x09, 0x02, 0x81, 0x02,
+	0xc0,
+};
+
+// struct for the virtual keyboard and the thread that answers for it
+struct virtualKeyboard {
+	int fd;
+	pthread_t thread;
+	std::atomic<bool> stop;
+	pthread_mutex_t mutex;
+	unsigned char feature[TEST_REPORT_LENGTH]; // the last feature report set, read back by get
+	unsigned int sets, gets;
+};
+
+static int
+sendEvent(int fd, struct uhid_event* event) {
+
+	return write(fd, event, sizeof(*event)) == (ssize_t) sizeof(*event) ? 0 : -1;
+}
+
+/**
+ * Answers the set and get feature report requests of the kernel until stopped.
+ */
+static void*
+answerRequests(void* context) {
+
+	virtualKeyboard* k = (virtualKeyboard*) context;
+
+	while (!k->stop.load()) {
+		struct pollfd pfd = { k->fd, POLLIN, 0 };
+		struct uhid_event event;
+
+		if (poll(&pfd, 1, 50) <= 0 || read(k->fd, &event, sizeof(event)) <= 0) {
+			continue;
+		}
+
+		struct uhid_event reply;
+		memset(&reply, 0, sizeof(reply));
+		if (event.type == UHID_SET_REPORT) {
+			pthread_mutex_lock(&k->mutex);
+			memset(k->feature, 0, sizeof(k->feature));
+			memcpy(k->feature, event.u.set_report.data, std::min((size_t) event.u.set_report.size, sizeof(k->feature)));
+			k->sets++;
+			pthread_mutex_unlock(&k->mutex);
+			reply.type = UHID_SET_REPORT_REPLY;
+			reply.u.set_report_reply.id = event.u.set_report.id;
+			sendEvent(k->fd, &reply);
+		} else if (event.type == UHID_GET_REPORT) {
+			pthread_mutex_lock(&k->mutex);
+			reply.u.get_report_reply.size = sizeof(k->feature);
+			memcpy(reply.u.get_report_reply.data, k->feature, sizeof(k->feature));
+			k->gets++;
+			pthread_mutex_unlock(&k->mutex);
+			reply.type = UHID_GET_REPORT_REPLY;
+			reply.u.get_report_reply.id = event.u.get_report.id;
+			sendEvent(k->fd, &reply);
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Creates the virtual keyboard with serial, returns -1 with errno if /dev/uhid can't be used.
+ */
+static int
+createKeyboard(virtualKeyboard* k, const char* serial) {
+
+	struct uhid_event event;
+
+	k->fd = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+	if (k->fd < 0) {
+		return -1;
+	}
+
+	memset(&event, 0, sizeof(event));
+	event.type = UHID_CREATE2;
+	snprintf((char*) event.u.create2.name, sizeof(event.u.create2.name), "msiledenabler test keyboard");
+	snprintf((char*) event.u.create2.uniq, sizeof(event.u.create2.uniq), "%s", serial);
+	memcpy(event.u.create2.rd_data, reportDescriptor, sizeof(reportDescriptor));
+	event.u.create2.rd_size = sizeof(reportDescriptor);
+	event.u.create2.bus = BUS_VIRTUAL;
+	event.u.create2.vendor = TEST_VENDOR_ID;
+	event.u.create2.product = TEST_PRODUCT_ID;
+	if (sendEvent(k->fd, &event) < 0) {
+		int err = errno;
+		close(k->fd);
+		errno = err;
+		return -1;
+	}
+
+	k->stop.store(false);
+	pthread_mutex_init(&k->mutex, NULL);
+	memset(k->feature, 0, sizeof(k->feature));
+	k->sets = k->gets = 0;
+	pthread_create(&k->thread, NULL, answerRequests, k);
+
+	return 0;
+}
+
+static void
+destroyKeyboard(virtualKeyboard* k) {
+
+	struct uhid_event event;
+
+	memset(&event, 0, sizeof(event));
+	event.type = UHID_DESTROY;
+	sendEvent(k->fd, &event);
+	k->stop.store(true);
+	pthread_join(k->thread, NULL);
+	close(k->fd);
+	pthread_mutex_destroy(&k->mutex);
+}
+
+/**
+ * Path of the test keyboard in a fresh enumeration into path, 0 if it is listed.
+ */
+static int
+findKeyboard(const wchar_t* serial, char* path, size_t length) {
+
+	struct hid_device_info* devs = hid_enumerate(TEST_VENDOR_ID, TEST_PRODUCT_ID);
+	int found = -1;
+
+	for (struct hid_device_info* d = devs; d; d = d->next) {
+		if (d->serial_number && wcscmp(d->serial_number, serial) == 0) {
+			snprintf(path, length, "%s", d->path);
+			found = 0;
+		}
+	}
+	hid_free_enumeration(devs);
+
+	return found;
+}
+
+/**
+ * Enumerates until the test keyboard is listed (listed) or gone, for up to 3s: hidraw nodes
+ * come and go a little after uhid is told.
+ */
+static bool
+waitForKeyboard(const wchar_t* serial, bool listed, char* path, size_t length) {
+
+	for (int i = 0; i < 300; i++) {
+		if ((findKeyboard(serial, path, length) == 0) == listed) {
+			return true;
+		}
+		struct timespec pause = { 0, 10000000 };
+		nanosleep(&pause, NULL);
+	}
+
+	return false;
+}
+
+// struct for what the reactor callbacks of a test received
+struct reactorLog {
+	struct hid_reactor* reactor;
+	bool removeOnReport; // the callback removes the device from the reactor
+	int reports, unplugs;
+	unsigned char firstBytes[32];
+	int lengths[32];
+};
+
+static void
+logInput(hid_device* dev, const unsigned char* data, int length, void* context) {
+
+	reactorLog* log = (reactorLog*) context;
+
+	if (length < 0) {
+		log->unplugs++;
+		return;
+	}
+	if (log->reports < 32) {
+		log->firstBytes[log->reports] = data[0];
+		log->lengths[log->reports] = length;
+	}
+	log->reports++;
+	if (log->removeOnReport) {
+		hid_reactor_remove(log->reactor, dev);
+	}
+}
+
+/**
+ * Descriptor this process holds on path, other than except, or -1.
+ */
+static int
+findDescriptor(const char* path, int except) {
+
+	for (int fd = 0; fd < 1024; fd++) {
+		char link[64], target[256];
+		snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+		ssize_t n = readlink(link, target, sizeof(target) - 1);
+		if (n > 0 && fd != except) {
+			target[n] = '\0';
+			if (strcmp(target, path) == 0) {
+				return fd;
+			}
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Writes count reports of HID_REACTOR_MAX_REPORT bytes, the first byte of each from first.
+ */
+static bool
+writeReports(int fd, int first, int count) {
+
+	unsigned char report[HID_REACTOR_MAX_REPORT];
+
+	for (int i = 0; i < count; i++) {
+		memset(report, 0, sizeof(report));
+		report[0] = first + i;
+		if (write(fd, report, sizeof(report)) != (ssize_t) sizeof(report)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * The reactor on a FIFO: reads of a FIFO stop at the buffer size like hidraw ones stop at a
+ * report, so reports of HID_REACTOR_MAX_REPORT bytes come one per read.
+ */
+static void
+testReactorFifo() {
+
+	char path[64];
+	unsigned char input[HID_REACTOR_MAX_REPORT];
+	reactorLog log;
+
+	snprintf(path, sizeof(path), "/tmp/msiled-reactor-%d", (int) getpid());
+	unlink(path);
+	current = "reactor on a FIFO";
+	if (mkfifo(path, 0600) < 0) {
+		CHECK(!"mkfifo");
+		return;
+	}
+	hid_device* device = hid_open_path(path);
+	int writer = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+	struct hid_reactor* reactor = hid_reactor_new();
+	CHECK(device && writer >= 0 && reactor && hid_reactor_fd(reactor) >= 0);
+	if (!device || writer < 0 || !reactor) {
+		unlink(path);
+		return;
+	}
+
+	memset(&log, 0, sizeof(log));
+	log.reactor = reactor;
+	int fd = findDescriptor(path, writer);
+	CHECK(hid_reactor_add(reactor, device, logInput, &log) == 0);
+	CHECK(fd >= 0 && !(fcntl(fd, F_GETFL) & O_NONBLOCK));
+	CHECK(hid_reactor_run(reactor, 0) == 0 && log.reports == 0);
+
+	// Every report queued is dispatched by one run, in order, and the device stays blocking
+	current = "reactor on a FIFO, dispatch";
+	CHECK(writeReports(writer, 1, 20));
+	struct pollfd pfd = { hid_reactor_fd(reactor), POLLIN, 0 };
+	CHECK(poll(&pfd, 1, 1000) == 1);
+	CHECK(hid_reactor_run(reactor, 1000) == 20 && log.reports == 20 && log.unplugs == 0);
+	bool ordered = true;
+	for (int i = 0; i < 20; i++) {
+		ordered = ordered && log.firstBytes[i] == i + 1 && log.lengths[i] == HID_REACTOR_MAX_REPORT;
+	}
+	CHECK(ordered);
+	CHECK(hid_reactor_run(reactor, 10) == 0);
+	CHECK(fd >= 0 && !(fcntl(fd, F_GETFL) & O_NONBLOCK));
+
+	// hid_read keeps working from the reactor thread, blocking or with a timeout
+	current = "reactor on a FIFO, hid_read";
+	CHECK(hid_read_timeout(device, input, sizeof(input), 0) == 0);
+	CHECK(writeReports(writer, 40, 1) && hid_read(device, input, sizeof(input)) == HID_REACTOR_MAX_REPORT && input[0] == 40);
+
+	// Removed by its callback after the first report: the others wait for hid_read
+	current = "reactor on a FIFO, removed from the callback";
+	log.reports = 0;
+	log.removeOnReport = true;
+	CHECK(writeReports(writer, 50, 3));
+	CHECK(hid_reactor_run(reactor, 1000) == 1 && log.reports == 1 && log.firstBytes[0] == 50);
+	CHECK(hid_reactor_run(reactor, 10) == 0);
+	CHECK(hid_read_timeout(device, input, sizeof(input), 0) == HID_REACTOR_MAX_REPORT && input[0] == 51);
+	CHECK(hid_read_timeout(device, input, sizeof(input), 0) == HID_REACTOR_MAX_REPORT && input[0] == 52);
+	CHECK(hid_reactor_remove(reactor, device) == -1);
+
+	current = "reactor on a FIFO, write-only";
+	hid_set_input_reports(0);
+	hid_device* writeOnly = hid_open_path(path);
+	hid_set_input_reports(1);
+	CHECK(writeOnly && hid_reactor_add(reactor, writeOnly, logInput, &log) == -1);
+	if (writeOnly) {
+		hid_close(writeOnly);
+	}
+
+	hid_reactor_free(reactor);
+	hid_close(device);
+	close(writer);
+	unlink(path);
+}
+
+int
+main() {
+
+	virtualKeyboard keyboard;
+	char serial[64], path[256];
+	wchar_t wideSerial[64];
+	unsigned long hits, scans, hitsBefore, scansBefore;
+
+	// A serial of its own, so a real keyboard or another run is never taken for it
+	snprintf(serial, sizeof(serial), "msiled-test-%d", (int) getpid());
+	mbstowcs(wideSerial, serial, 64);
+
+	// The uevent socket is opened by hid_init, before the keyboard comes
+	hid_init();
+	testReactorFifo();
+	if (createKeyboard(&keyboard, serial) < 0) {
+		printf("%s: /dev/uhid: %s, the virtual keyboard cases are skipped\n", __FILE__, strerror(errno));
+		return TEST_RESULT();
+	}
+
+	current = "enumerate";
+	CHECK(waitForKeyboard(wideSerial, true, path, sizeof(path)));
+	CHECK(strncmp(path, "/dev/hidraw", 11) == 0);
+
+	current = "enumeration cache";
+	hid_get_enumeration_stats(&hitsBefore, &scansBefore);
+	CHECK(findKeyboard(wideSerial, path, sizeof(path)) == 0);
+	hid_get_enumeration_stats(&hits, &scans);
+	CHECK(hits == hitsBefore + 1 && scans == scansBefore);
+
+	current = "open by serial";
+	hid_device* device = hid_open(TEST_VENDOR_ID, TEST_PRODUCT_ID, wideSerial);
+	CHECK(device != NULL);
+	if (device) {
+		wchar_t string[64];
+		CHECK(hid_get_serial_number_string(device, string, 64) == 0 && wcscmp(string, wideSerial) == 0);
+		hid_close(device);
+	}
+
+	current = "feature reports";
+	device = hid_open_path(path);
+	CHECK(device != NULL);
+	if (device) {
+		unsigned char report[TEST_REPORT_LENGTH] = { 0x01, 0x02, 0x41, 0x01, 0x00, 0x00, 0x00, 0xec, 0x00 };
+		unsigned char read[TEST_REPORT_LENGTH] = { 0x01 };
+		CHECK(hid_send_feature_report(device, report, sizeof(report)) == (int) sizeof(report));
+		CHECK(hid_get_feature_report(device, read, sizeof(read)) == (int) sizeof(read));
+		CHECK(memcmp(report, read, sizeof(report)) == 0);
+		CHECK(keyboard.sets == 1 && keyboard.gets == 1);
+
+		current = "input reports";
+		struct uhid_event event;
+		unsigned char input[TEST_REPORT_LENGTH];
+		memset(&event, 0, sizeof(event));
+		event.type = UHID_INPUT2;
+		event.u.input2.size = TEST_REPORT_LENGTH;
+		event.u.input2.data[0] = 0x02;
+		event.u.input2.data[1] = 0x5a;
+		CHECK(sendEvent(keyboard.fd, &event) == 0);
+		CHECK(hid_read_timeout(device, input, sizeof(input), 1000) == TEST_REPORT_LENGTH);
+		CHECK(input[0] == 0x02 && input[1] == 0x5a);
+		CHECK(hid_read_timeout(device, input, sizeof(input), 0) == 0);
+	}
+
+	current = "reactor";
+	struct hid_reactor* reactor = hid_reactor_new();
+	reactorLog log;
+	memset(&log, 0, sizeof(log));
+	log.reactor = reactor;
+	CHECK(reactor && device && hid_reactor_add(reactor, device, logInput, &log) == 0);
+	if (reactor && device) {
+		struct uhid_event event;
+		unsigned char input[TEST_REPORT_LENGTH];
+		memset(&event, 0, sizeof(event));
+		event.type = UHID_INPUT2;
+		event.u.input2.size = TEST_REPORT_LENGTH;
+		event.u.input2.data[0] = 0x02;
+		for (int i = 0; i < 3; i++) {
+			event.u.input2.data[1] = 0x10 + i;
+			CHECK(sendEvent(keyboard.fd, &event) == 0);
+		}
+		for (int i = 0; i < 100 && log.reports < 3; i++) {
+			hid_reactor_run(reactor, 10);
+		}
+		CHECK(log.reports == 3 && log.lengths[0] == TEST_REPORT_LENGTH && log.firstBytes[2] == 0x02);
+		CHECK(hid_reactor_run(reactor, 0) == 0 && hid_read_timeout(device, input, sizeof(input), 0) == 0);
+	}
+
+	current = "write-only";
+	hid_set_input_reports(0);
+	hid_device* writeOnly = hid_open_path(path);
+	hid_set_input_reports(1);
+	CHECK(writeOnly != NULL);
+	if (writeOnly) {
+		unsigned char report[TEST_REPORT_LENGTH] = { 0x01, 0x02, 0x41, 0x02, 0x00, 0x00, 0x00, 0xec, 0x00 };
+		unsigned char input[TEST_REPORT_LENGTH];
+		CHECK(hid_send_feature_report(writeOnly, report, sizeof(report)) == (int) sizeof(report));
+		CHECK(hid_read_timeout(writeOnly, input, sizeof(input), 0) == -1 && hid_error(writeOnly) != NULL);
+		hid_close(writeOnly);
+	}
+
+	current = "unplugged";
+	hid_get_enumeration_stats(&hitsBefore, &scansBefore);
+	destroyKeyboard(&keyboard);
+	CHECK(waitForKeyboard(wideSerial, false, path, sizeof(path)));
+	hid_get_enumeration_stats(&hits, &scans);
+	// The uevent of the node going dropped the cached enumeration that listed it
+	CHECK(scans > scansBefore);
+	if (reactor && device) {
+		for (int i = 0; i < 100 && log.unplugs == 0; i++) {
+			hid_reactor_run(reactor, 10);
+		}
+		CHECK(log.unplugs == 1 && hid_reactor_run(reactor, 10) == 0);
+	}
+	hid_reactor_free(reactor);
+	if (device) {
+		unsigned char report[TEST_REPORT_LENGTH] = { 0x01, 0x02, 0x41, 0x01, 0x00, 0x00, 0x00, 0xec, 0x00 };
+		CHECK(hid_send_feature_report(device, report, sizeof(report)) < 0 && hid_error(device) != NULL);
+		hid_close(device);
+	}
+
+	current = "hid_exit";
+	findKeyboard(wideSerial, path, sizeof(path));
+	hid_get_enumeration_stats(&hitsBefore, &scansBefore);
+	hid_exit();
+	findKeyboard(wideSerial, path, sizeof(path));
+	hid_get_enumeration_stats(&hits, &scans);
+	CHECK(scans == scansBefore + 1 && hits == hitsBefore);
+	hid_exit();
+
+	return TEST_RESULT();
+}